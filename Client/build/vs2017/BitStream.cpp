@@ -0,0 +1,39 @@
+#include "BitStream.h"
+
+void BitWriter::WriteBits(uint32_t value, int bits) {
+	uint64_t mask = ((uint64_t)1 << bits) - 1;
+	scratch_ |= (value & mask) << scratchBits_;
+	scratchBits_ += bits;
+	while (scratchBits_ >= 8) {
+		data_.push_back((uint8_t)scratch_);
+		scratch_ >>= 8;
+		scratchBits_ -= 8;
+	}
+}
+
+std::vector<uint8_t>& BitWriter::Finish() {
+	if (scratchBits_ > 0) {
+		data_.push_back((uint8_t)scratch_);
+		scratch_ = 0;
+		scratchBits_ = 0;
+	}
+	return data_;
+}
+
+BitReader::BitReader(const uint8_t* data, size_t size) {
+	data_ = data;
+	size_ = size;
+}
+
+bool BitReader::ReadBits(int bits, uint32_t& value) {
+	while (scratchBits_ < bits) {
+		if (pos_ >= size_) return false;
+		scratch_ |= (uint64_t)data_[pos_++] << scratchBits_;
+		scratchBits_ += 8;
+	}
+	uint64_t mask = ((uint64_t)1 << bits) - 1;
+	value = (uint32_t)(scratch_ & mask);
+	scratch_ >>= bits;
+	scratchBits_ -= bits;
+	return true;
+}
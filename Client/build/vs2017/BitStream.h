@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Shared by the client and server, keep both copies the same.
+
+// Writes values of any width from 1 to 32 bits back to back, lowest bit first.
+class BitWriter {
+public:
+	void WriteBits(uint32_t value, int bits);
+	// Write out the last partly filled byte, and hand over everything written
+	std::vector<uint8_t>& Finish();
+
+private:
+	std::vector<uint8_t> data_;
+	uint64_t scratch_ = 0;
+	int scratchBits_ = 0;
+};
+
+// Reads back what a BitWriter wrote. data must stay valid while reading.
+class BitReader {
+public:
+	BitReader(const uint8_t* data, size_t size);
+	// Returns false if there aren't that many bits left
+	bool ReadBits(int bits, uint32_t& value);
+	// Bits not read yet
+	size_t BitsLeft() const { return (size_ - pos_) * 8 + scratchBits_; }
+
+private:
+	const uint8_t* data_;
+	size_t size_;
+	size_t pos_ = 0;
+	uint64_t scratch_ = 0;
+	int scratchBits_ = 0;
+};
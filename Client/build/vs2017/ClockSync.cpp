@@ -0,0 +1,89 @@
+#include "ClockSync.h"
+#include <algorithm>
+#include <cmath>
+
+void ClockSync::AddSample(int64_t clientSend, int64_t serverReceive, int64_t serverSend, int64_t clientReceive) {
+	//Time on the wire, without however long the server held on to it
+	int64_t roundTrip = std::max<int64_t>((clientReceive - clientSend) - (serverSend - serverReceive), 0);
+	bool first = count_ == 0;
+
+	newest_ = (newest_ + 1) % CLOCK_SYNC_WINDOW;
+	Sample& sample = samples_[newest_];
+	sample.local = clientReceive;
+	sample.offset = ((double)(serverReceive - clientSend) + (double)(serverSend - clientReceive)) / 2;
+	sample.roundTrip = roundTrip;
+	if (count_ < CLOCK_SYNC_WINDOW) count_++;
+
+	if (first) {
+		//Nothing to ease from yet
+		applied_ = sample.offset;
+		lastLocal_ = clientReceive;
+		lastServer_ = clientReceive + (int64_t)llround(applied_);
+		return;
+	}
+	UpdateDrift();
+}
+
+const ClockSync::Sample& ClockSync::Best(size_t count) const {
+	const Sample* best = &At(0);
+	for (size_t i = 1; i < count; i++) {
+		if (At(i).roundTrip < best->roundTrip) best = &At(i);
+	}
+	return *best;
+}
+
+void ClockSync::UpdateDrift() {
+	//A point per window, from its best sample
+	if (++sinceDriftPoint_ < CLOCK_SYNC_WINDOW) return;
+	sinceDriftPoint_ = 0;
+	if (driftPointCount_ == CLOCK_SYNC_DRIFT_POINTS) {
+		std::copy(driftPoints_ + 1, driftPoints_ + CLOCK_SYNC_DRIFT_POINTS, driftPoints_);
+		driftPointCount_--;
+	}
+	driftPoints_[driftPointCount_++] = Best(CLOCK_SYNC_WINDOW);
+	if (driftPointCount_ < 3) return;
+
+	//Least squares slope of offset against time, relative to the first point so the sums stay small
+	double meanTime = 0, meanOffset = 0;
+	for (size_t i = 0; i < driftPointCount_; i++) {
+		meanTime += (double)(driftPoints_[i].local - driftPoints_[0].local);
+		meanOffset += driftPoints_[i].offset - driftPoints_[0].offset;
+	}
+	meanTime /= driftPointCount_;
+	meanOffset /= driftPointCount_;
+	double covariance = 0, variance = 0;
+	for (size_t i = 0; i < driftPointCount_; i++) {
+		double time = (double)(driftPoints_[i].local - driftPoints_[0].local) - meanTime;
+		covariance += time * (driftPoints_[i].offset - driftPoints_[0].offset - meanOffset);
+		variance += time * time;
+	}
+	if (variance <= 0) return;
+	drift_ = std::min(std::max(covariance / variance, -CLOCK_SYNC_MAX_DRIFT), CLOCK_SYNC_MAX_DRIFT);
+}
+
+int64_t ClockSync::RoundTrip() const {
+	return count_ ? Best(count_).roundTrip : 0;
+}
+
+int64_t ClockSync::ServerTime(int64_t local) {
+	if (count_ == 0) return local;
+
+	int64_t elapsed = std::max<int64_t>(local - lastLocal_, 0);
+	lastLocal_ = std::max(local, lastLocal_);
+
+	//Where the best sample says the offset is now, having drifted since it was taken
+	const Sample& best = Best(count_);
+	double target = best.offset + drift_ * (local - best.local);
+
+	applied_ += drift_ * elapsed;
+	double error = target - applied_;
+	double slew = CLOCK_SYNC_MAX_SLEW * elapsed;
+	bool step = fabs(error) > CLOCK_SYNC_STEP;
+	applied_ += step ? error : std::min(std::max(error, -slew), slew);
+
+	//The slew is well under our clock's own rate, so this only holds it still if local went backwards
+	int64_t server = local + (int64_t)llround(applied_);
+	if (!step) server = std::max(server, lastServer_);
+	lastServer_ = server;
+	return server;
+}
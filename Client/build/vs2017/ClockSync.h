@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Samples kept. The estimate comes from whichever of them had the shortest round trip, as its offset is the
+// least thrown off by queueing on the way there or back.
+#define CLOCK_SYNC_WINDOW 16
+
+// A few quick samples after connecting to get a good estimate early, then one a second to keep it
+#define CLOCK_SYNC_BURST 8
+#define CLOCK_SYNC_BURST_INTERVAL 100
+#define CLOCK_SYNC_INTERVAL 1000
+
+// Fastest the estimate is eased towards where it should be, beyond following the drift. 0.5%, so 5ms a second.
+#define CLOCK_SYNC_MAX_SLEW 0.005
+
+// An error bigger than this (us) isn't slewed out but jumped, as it means the server's clock has started again
+#define CLOCK_SYNC_STEP 500000
+
+// Drift is fitted to the best sample of each of the last CLOCK_SYNC_DRIFT_POINTS windows, a couple of minutes at one
+// a second, as a few ms of error over the few seconds of one window would swamp it. It's capped at CLOCK_SYNC_MAX_DRIFT,
+// well beyond any real clock, so a bad fit can't send it far off.
+#define CLOCK_SYNC_DRIFT_POINTS 8
+#define CLOCK_SYNC_MAX_DRIFT 0.001
+
+// Keeps an estimate of the server's clock from NTP style samples. Each sample is the four times of a request and
+// reply: sent and received by our clock, received and replied by the server's. The offset between the clocks is
+// taken from the sample with the shortest round trip in the last CLOCK_SYNC_WINDOW, carried forward by how fast the
+// clocks are drifting apart. The time handed out only ever eases towards that estimate, so it goes up smoothly
+// rather than jumping each time a better sample comes in.
+// All times are microseconds, ours from any fixed start. Not thread safe.
+class ClockSync {
+public:
+	void AddSample(int64_t clientSend, int64_t serverReceive, int64_t serverSend, int64_t clientReceive);
+
+	// The server's time at local. Our own clock until the first sample. local should only go up, and then so does this,
+	// unless the server's clock has started again and it's jumped back to it.
+	int64_t ServerTime(int64_t local);
+
+	bool Synced() const { return count_ > 0; }
+	size_t Samples() const { return count_; }
+
+	// For logging. The best sample's round trip, the offset being handed out, and how fast the server's clock runs against ours.
+	int64_t RoundTrip() const;
+	double Offset() const { return applied_; }
+	double Drift() const { return drift_; }
+
+private:
+	struct Sample {
+		int64_t local; // When the reply came back
+		double offset; // Server time minus ours
+		int64_t roundTrip;
+	};
+
+	// Sample i back from the newest
+	const Sample& At(size_t i) const { return samples_[(newest_ + CLOCK_SYNC_WINDOW - i) % CLOCK_SYNC_WINDOW]; }
+	// Shortest round trip of the last count samples, the newest of them if there's a tie
+	const Sample& Best(size_t count) const;
+	void UpdateDrift();
+
+	Sample samples_[CLOCK_SYNC_WINDOW];
+	size_t newest_ = CLOCK_SYNC_WINDOW - 1;
+	size_t count_ = 0;
+
+	Sample driftPoints_[CLOCK_SYNC_DRIFT_POINTS];
+	size_t driftPointCount_ = 0;
+	size_t sinceDriftPoint_ = 0;
+
+	double drift_ = 0;
+	double applied_ = 0; // Offset being handed out, eased towards the best sample's
+	int64_t lastLocal_ = 0;
+	int64_t lastServer_ = 0;
+};
@@ -0,0 +1,46 @@
+#include "FrameDecoder.h"
+
+// Size of the length and type fields at the start of every frame
+#define FRAME_HEADER_SIZE (sizeof(uint16_t) + sizeof(uint8_t))
+
+FrameDecoder::FrameDecoder() {
+	buffer_.resize(FRAME_READ_CHUNK);
+}
+
+char* FrameDecoder::GetWriteSpace(size_t& space) {
+	if (readPos_ == writePos_) {
+		// Nothing left over, start again from the front
+		readPos_ = writePos_ = 0;
+	}
+	else if (buffer_.size() - writePos_ < FRAME_READ_CHUNK && readPos_ > 0) {
+		// Move the partial frame back to the front to make room
+		memmove(buffer_.data(), buffer_.data() + readPos_, writePos_ - readPos_);
+		writePos_ -= readPos_;
+		readPos_ = 0;
+	}
+
+	if (buffer_.size() - writePos_ < FRAME_READ_CHUNK) {
+		// A big frame is on its way. Frames are at most FRAME_MAX_SIZE, so this stops growing by then.
+		buffer_.resize(writePos_ + FRAME_READ_CHUNK);
+	}
+
+	space = buffer_.size() - writePos_;
+	return buffer_.data() + writePos_;
+}
+
+void FrameDecoder::CommitWrite(size_t count) {
+	writePos_ += count;
+}
+
+int FrameDecoder::NextFrame(const char*& frame, uint16_t& length) {
+	size_t available = writePos_ - readPos_;
+	if (available < sizeof(uint16_t)) return 0;
+
+	length = ReadFrameLength(buffer_.data() + readPos_);
+	if (length < FRAME_HEADER_SIZE) return -1;
+	if (available < length) return 0;
+
+	frame = buffer_.data() + readPos_;
+	readPos_ += length;
+	return 1;
+}
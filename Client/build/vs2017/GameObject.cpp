@@ -22,6 +22,11 @@ void GameObject::InitPhysx(physx::PxVec3 halfExtent, physx::PxVec3 pos, physx::P
 	UpdatePhysx();
 }
 
+void GameObject::ReleasePhysx() {
+	if (pxbody_) pxbody_->release();
+	pxbody_ = NULL;
+}
+
 void GameObject::UpdatePhysx() {
 	if (pxbody_) {
 		gef::Matrix44 transform(physx::PxMat44(pxbody_->getGlobalPose()).front());
@@ -8,9 +8,11 @@ public:
 	~GameObject();
 	void InitPhysx(physx::PxVec3 halfExtent, physx::PxVec3 pos, physx::PxScene* scene, physx::PxPhysics* gPhysics, bool dynamic = false);
 	void UpdatePhysx();
+	// Take the body out of its scene and free it, which has to happen before the scene and physics go
+	void ReleasePhysx();
 	virtual physx::PxRigidActor* GetPxBody() { return pxbody_; }
 
 protected:
-	physx::PxRigidActor* pxbody_;
+	physx::PxRigidActor* pxbody_ = NULL;
 };
 
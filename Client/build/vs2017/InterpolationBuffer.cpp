@@ -0,0 +1,59 @@
+#include "InterpolationBuffer.h"
+#include <cmath>
+
+void InterpolationBuffer::Add(uint32_t time, const PlayerValues& values) {
+	//Snapshots are only used in order, so a sample that isn't newer is a repeat of one from the same snapshot
+	if (count_ > 0 && (int32_t)(time - At(0).time) <= 0) return;
+
+	newest_ = (newest_ + 1) % INTERPOLATION_SAMPLES;
+	InterpolationSample& sample = samples_[newest_];
+	sample.time = time;
+	sample.position = physx::PxVec3(values.position[0], values.position[1], values.position[2]);
+	sample.velocity = physx::PxVec3(values.velocity[0], values.velocity[1], values.velocity[2]);
+	sample.rotation = values.rotation;
+	if (count_ < INTERPOLATION_SAMPLES) count_++;
+}
+
+bool InterpolationBuffer::Sample(uint32_t time, physx::PxVec3& position, float& rotation) const {
+	if (count_ == 0) return false;
+
+	//Late, so carry on from the newest for a bit
+	const InterpolationSample& newest = At(0);
+	int32_t late = (int32_t)(time - newest.time);
+	if (late >= 0) {
+		if (late > INTERPOLATION_MAX_EXTRAPOLATION) late = INTERPOLATION_MAX_EXTRAPOLATION;
+		position = newest.position + newest.velocity * (late / 1000.0f);
+		rotation = newest.rotation;
+		return true;
+	}
+
+	//Find the samples either side, newest first as that's where time normally is
+	size_t i = 1;
+	while (i < count_ && (int32_t)(time - At(i).time) < 0) {
+		i++;
+	}
+	if (i == count_) {
+		position = At(count_ - 1).position;
+		rotation = At(count_ - 1).rotation;
+		return true;
+	}
+	const InterpolationSample& before = At(i);
+	const InterpolationSample& after = At(i - 1);
+
+	//Cubic Hermite, with the velocities scaled to the gap so they're tangents over 0-1
+	float gap = (after.time - before.time) / 1000.0f;
+	float t = (float)(time - before.time) / (float)(after.time - before.time);
+	float t2 = t * t;
+	float t3 = t2 * t;
+	position = before.position * (2 * t3 - 3 * t2 + 1) +
+		before.velocity * ((t3 - 2 * t2 + t) * gap) +
+		after.position * (-2 * t3 + 3 * t2) +
+		after.velocity * ((t3 - t2) * gap);
+
+	//The short way round
+	float turn = fmodf(after.rotation - before.rotation, 2 * physx::PxPi);
+	if (turn > physx::PxPi) turn -= 2 * physx::PxPi;
+	else if (turn < -physx::PxPi) turn += 2 * physx::PxPi;
+	rotation = before.rotation + turn * t;
+	return true;
+}
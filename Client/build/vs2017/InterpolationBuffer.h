@@ -0,0 +1,47 @@
+#pragma once
+#include "Messages.h"
+#include <PxPhysicsAPI.h>
+#include <cstdint>
+
+// Samples kept per player, a second's worth at the server's 8 snapshots a second
+#define INTERPOLATION_SAMPLES 8
+
+// How far (ms) behind server time other players are drawn. Two snapshot intervals, so there's normally a snapshot
+// either side even if one's late or lost.
+#define INTERPOLATION_DELAY 250
+
+// How far (ms) past the newest sample a player is carried on along its velocity when snapshots stop coming.
+// After that it's held where it got to, rather than wandering off further from where it probably is.
+#define INTERPOLATION_MAX_EXTRAPOLATION 125
+
+// A player's state at a server time (ms)
+struct InterpolationSample {
+	uint32_t time;
+	physx::PxVec3 position;
+	physx::PxVec3 velocity;
+	float rotation;
+};
+
+// The last few snapshots of another player, for drawing them a fixed delay behind server time. Between two samples
+// the position follows a Hermite curve through both positions and velocities, so it's smooth across samples and
+// follows a jump's arc rather than cutting the corner. Past the newest it's extrapolated, but only so far.
+class InterpolationBuffer {
+public:
+	// Server values for time. Anything not newer than the newest sample is ignored.
+	void Add(uint32_t time, const PlayerValues& values);
+
+	// Forget everything, so the next sample is jumped straight to
+	void Clear() { count_ = 0; }
+	bool Empty() const { return count_ == 0; }
+
+	// Where the player was at time. Before the oldest sample it's the oldest. False if there are no samples.
+	bool Sample(uint32_t time, physx::PxVec3& position, float& rotation) const;
+
+private:
+	// Sample i back from the newest
+	const InterpolationSample& At(size_t i) const { return samples_[(newest_ + INTERPOLATION_SAMPLES - i) % INTERPOLATION_SAMPLES]; }
+
+	InterpolationSample samples_[INTERPOLATION_SAMPLES];
+	size_t newest_ = INTERPOLATION_SAMPLES - 1;
+	size_t count_ = 0;
+};
@@ -1,18 +1,28 @@
 #include "NetworkClient.h"
 #include "scene_app.h"
+#include "Log.h"
 #include <iostream>
 #include <fstream>
 #include "msgpack.hpp"
+#include <algorithm>
 #include <chrono>
+#include <random>
 //#include <numeric>
 #pragma comment(lib, "ws2_32.lib")
 
 NetworkClient::~NetworkClient() {
 	running_ = false;
-	WSASetEvent(eventTCP_);
+	if (!udpOnly_) WSASetEvent(eventTCP_);
 	WSASetEvent(eventUDP_);
-	connectionThreadTCP_->join();
+	if (!udpOnly_) connectionThreadTCP_->join();
 	connectionThreadUDP_->join();
+
+	//There's no socket closing to tell the server we've gone, so say so. A few times, in case some don't get there.
+	if (udpOnly_ && connectStateUDP_ == ConnectStateUDP::CONNECTED) {
+		for (int i = 0; i < 3; i++) {
+			SendDisconnectMessage();
+		}
+	}
 }
 
 void NetworkClient::StartConnection(SceneApp* scene) {
@@ -25,10 +35,18 @@ void NetworkClient::StartConnection(SceneApp* scene) {
 	std::getline(serverIpFile, serverIP_);
 	serverIpFile.close();
 
-	ConnectTCP();
+	if (!udpOnly_) ConnectTCP();
 	ConnectUDP();
 
-	connectionThreadTCP_ = new std::thread(&NetworkClient::ConnectionLoopTCP, this);
+	if (udpOnly_) {
+		//Ties the cookie to this connection, so the server can tell a resent response from us connecting again from the same port
+		std::random_device random;
+		connectNonceUDP_ = (uint64_t)random() << 32 | random();
+		LOG_INFO(LOG_UDP, "Connecting over UDP\n");
+	}
+	else {
+		connectionThreadTCP_ = new std::thread(&NetworkClient::ConnectionLoopTCP, this);
+	}
 	connectionThreadUDP_ = new std::thread(&NetworkClient::ConnectionLoopUDP, this);
 }
 
@@ -53,8 +71,8 @@ void NetworkClient::ConnectTCP() {
 	addr.sin_port = htons(SERVERPORT_TCP); // htons converts the port number to network byte order (big-endian).
 	addr.sin_addr.s_addr = inet_addr(serverIP_.c_str());
 
-	printf("IP address to connect to: %s\n", inet_ntoa(addr.sin_addr)); // inet_ntoa formats an IP address as a string.
-	printf("Port number to connect to: %d\n\n", ntohs(addr.sin_port)); // ntohs does the opposite of htons.
+	LOG_INFO(LOG_TCP, "IP address to connect to: %s\n", inet_ntoa(addr.sin_addr)); // inet_ntoa formats an IP address as a string.
+	LOG_INFO(LOG_TCP, "Port number to connect to: %d\n", ntohs(addr.sin_port)); // ntohs does the opposite of htons.
 
 	// Connect the socket to the server.
 	if (connect(socketTCP_, (const sockaddr*)&addr, sizeof addr) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
@@ -66,11 +84,10 @@ void NetworkClient::ConnectTCP() {
 		die("Retrieving event information failed");
 	}
 	if (networkEventsTCP_.lNetworkEvents & FD_CONNECT) {
-		printf("TCP connected to server\n");
+		LOG_INFO(LOG_TCP, "TCP connected to server\n");
 	}
 	else if (networkEventsTCP_.iErrorCode[FD_CONNECT_BIT] != 0) {
-		printf("error code: %d", networkEventsTCP_.iErrorCode[FD_CONNECT_BIT]);
-		fprintf(stderr, "\nError: (WSAGetLastError() = %d)", WSAGetLastError());
+		LOG_ERROR(LOG_TCP, "Connect error code: %d (WSAGetLastError() = %d)\n", networkEventsTCP_.iErrorCode[FD_CONNECT_BIT], WSAGetLastError());
 		die("Failed to actually connect.");
 	}
 	if (networkEventsTCP_.lNetworkEvents & FD_WRITE) {
@@ -99,8 +116,8 @@ void NetworkClient::ConnectUDP() {
 	addr.sin_port = htons(SERVERPORT_UDP); // htons converts the port number to network byte order (big-endian).
 	addr.sin_addr.s_addr = inet_addr(serverIP_.c_str());
 
-	printf("IP address to connect to: %s\n", inet_ntoa(addr.sin_addr)); // inet_ntoa formats an IP address as a string.
-	printf("Port number to connect to: %d\n\n", ntohs(addr.sin_port)); // ntohs does the opposite of htons.
+	LOG_INFO(LOG_UDP, "IP address to connect to: %s\n", inet_ntoa(addr.sin_addr)); // inet_ntoa formats an IP address as a string.
+	LOG_INFO(LOG_UDP, "Port number to connect to: %d\n", ntohs(addr.sin_port)); // ntohs does the opposite of htons.
 
 	// Connect the socket to the server (this sets the default destination address)
 	if (connect(socketUDP_, (const sockaddr*)&addr, sizeof addr) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
@@ -114,7 +131,7 @@ void NetworkClient::ConnectUDP() {
 		writeableUDP_ = true;
 	}
 
-	printf("UDP socket ready\n");
+	LOG_INFO(LOG_UDP, "UDP socket ready\n");
 }
 
 void NetworkClient::ConnectionLoopTCP() {
@@ -136,10 +153,10 @@ void NetworkClient::ConnectionLoopTCP() {
 						//Ignore the error if the server just force quit
 						if (networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] != 0 && networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] != 10053)
 						{
-							printf("FD_CLOSE with error %d\n", networkEventsTCP_.iErrorCode[FD_CLOSE_BIT]);
+							LOG_WARNING(LOG_TCP, "FD_CLOSE with error %d\n", networkEventsTCP_.iErrorCode[FD_CLOSE_BIT]);
 						}
 						else if (networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] == 10053) {
-							printf("Server closed connection.\n");
+							LOG_INFO(LOG_TCP, "Server closed connection.\n");
 						}
 						CleanupSocket();
 					}
@@ -168,9 +185,10 @@ void NetworkClient::ConnectionLoopTCP() {
 }
 
 void NetworkClient::ConnectionLoopUDP() {
-
+	DWORD timeout = udpOnly_ ? UDP_WAIT_TIMEOUT : WSA_INFINITE;
 	while (running_) {
-		DWORD returnVal = WSAWaitForMultipleEvents(1, &eventUDP_, false, WSA_INFINITE, false);
+		DWORD returnVal = WSAWaitForMultipleEvents(1, &eventUDP_, false, timeout, false);
+		timeout = udpOnly_ ? UDP_WAIT_TIMEOUT : WSA_INFINITE;
 
 		if (returnVal != WSA_WAIT_FAILED) {
 
@@ -183,17 +201,12 @@ void NetworkClient::ConnectionLoopUDP() {
 			if (networkEventsUDP_.lNetworkEvents & FD_READ) {
 				ReadUDP();
 			}
+			if (writeableUDP_ && udpOnly_) {
+				UpdateConnectUDP();
+			}
 			if (writeableUDP_) {
-				//printf("sp: %d, t: %d, pt: %d\n", sendPlayerInputUDP_, time_, prevInputSendTime_);
-				if (sendPlayerInputUDP_){ 
-					if (time_ > prevInputSendTime_ + 1) { //Limit input sends to one every two milliseconds
-						prevInputSendTime_ = time_;
-						SendInputMessage();
-						mutexUDP_.lock();
-						sendPlayerInputUDP_ = false;
-						mutexUDP_.unlock();
-					}
-				}
+				SendInputMessages();
+				timeout = std::min(timeout, SyncTimeSend());
 			}
 
 		}
@@ -204,7 +217,10 @@ void NetworkClient::ConnectionLoopUDP() {
 }
 
 void NetworkClient::UpdateTime() {
-	time_ = std::chrono::duration_cast<std::chrono::milliseconds>(ClientClock::now() - timeStart_).count() + serverTimeDelta_;
+	clockMutex_.lock();
+	int64_t serverTime = clock_.ServerTime(LocalMicroseconds());
+	clockMutex_.unlock();
+	time_ = (uint32_t)(serverTime / 1000);
 	//printf("time: %d\n", time_);
 }
 
@@ -214,7 +230,7 @@ void NetworkClient::CreateClientInfoMessage() {
 	int addrLen = sizeof(addr);
 	getsockname(socketUDP_, (sockaddr*)&addr, &addrLen);
 
-	printf("UDP port: %d\n", addr.sin_port);
+	LOG_INFO(LOG_UDP, "UDP port: %d\n", addr.sin_port);
 
 	//Create message
 	ClientInfoMessage msg;
@@ -251,77 +267,58 @@ void NetworkClient::AddMessage(uint16_t &msgLen, MessageType &msgType, std::vect
 	clientMsgsTCP_.push(msgStr);
 	clientMsgsMutexTCP_.unlock();
 
-	WSASetEvent(eventTCP_); //Signal that there is a new message to be sent
+	WSASetEvent(udpOnly_ ? eventUDP_ : eventTCP_); //Signal that there is a new message to be sent
 }
 
 bool NetworkClient::ReadTCP() {
-	// Receive the length of the incoming message if we haven't already
-	if (readCountTCP_ < HeaderLenFieldSize) {
-		int count = recv(socketTCP_, readBufferTCP_ + readCountTCP_, HeaderLenFieldSize - readCountTCP_, 0); 
-		if (count == SOCKET_ERROR) {
-			printf("TCP Receive failed\n");
-			if (WSAGetLastError() == WSAEWOULDBLOCK) {
-				return false;
-			}
-			else die("TCP connection closed or broken");
-		}
-		printf("TCP Received %d bytes\n", count);
-		readCountTCP_ += count;
-		if (count < HeaderLenFieldSize) return false;
-	}
-
-	// Get length of message
-	uint16_t msgLength = (uint16_t)readBufferTCP_[0];
-
-	int count = recv(socketTCP_, readBufferTCP_ + readCountTCP_, msgLength - readCountTCP_, 0);
+	// Receive as much as there's room for in one go
+	size_t space;
+	char* dest = decoderTCP_.GetWriteSpace(space);
+	int count = recv(socketTCP_, dest, (int)space, 0);
 	if (count == SOCKET_ERROR) {
-		printf("TCP Receive failed\n");
 		if (WSAGetLastError() == WSAEWOULDBLOCK) {
 			return false;
 		}
-		else die("TCP Connection closed or broken");
+		else die("TCP connection closed or broken");
 	}
-	printf("TCP Received %d bytes\n", count);
-	readCountTCP_ += count;
+	LOG_DEBUG(LOG_TCP, "TCP Received %d bytes\n", count);
+	decoderTCP_.CommitWrite(count);
 
-	if (readCountTCP_ < msgLength) {
-		// ... but we've not received a complete message yet.
-		// So we can't do anything until we receive some more.
-		return false;
+	// Handle every complete message that's arrived, straight from the receive buffer
+	const char* msg;
+	uint16_t msgLength;
+	int result;
+	bool handled = false;
+	while ((result = decoderTCP_.NextFrame(msg, msgLength)) == 1) {
+		HandleMessage(msgLength, msg);
+		handled = true;
 	}
-
-	// We've got a complete message.
-	printf("TCP Received message from the server: '");
-	fwrite(readBufferTCP_, 1, msgLength, stdout);
-	printf("'\n\n");
-
-	HandleMessage(msgLength, readBufferTCP_);
-
-	// Clear the buffer, ready for the next message.
-	readCountTCP_ = 0;
-	return true;
+	if (result == -1) {
+		die("Malformed message stream from server");
+	}
+	return handled;
 }
 
 bool NetworkClient::ReadUDP() {
 	int count = recv(socketUDP_, readBufferUDP_, sizeof(readBufferUDP_), 0);
 	if (count == SOCKET_ERROR) {
-		printf("Receive failed\n");
+		LOG_DEBUG(LOG_UDP, "Receive failed\n");
 		if (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENETRESET || WSAGetLastError() == WSAEMSGSIZE) {
 			return true;
 		}
 		else {
-			printf("UDP socket closed or broken\n");
+			LOG_ERROR(LOG_UDP, "UDP socket closed or broken\n");
 			return false;
 		}
 	}
 
-	uint16_t msgLength = (uint16_t)readBufferUDP_[0];
+	uint16_t msgLength = ReadFrameLength(readBufferUDP_);
 	if (count == msgLength) {
 
 		HandleMessage(msgLength, readBufferUDP_);
 	}
 	else {
-		printf("UDP datagram wrong length - discarding.\n");
+		LOG_DEBUG(LOG_UDP, "UDP datagram wrong length - discarding.\n");
 	}
 }
 
@@ -341,7 +338,7 @@ bool NetworkClient::WriteTCP() {
 	int count = send(socketTCP_, msg.data() + writeCountTCP_, messageLeft, 0);
 	if (count == SOCKET_ERROR)
 	{
-		printf("Send failed\n");
+		LOG_DEBUG(LOG_TCP, "Send failed\n");
 		if (WSAGetLastError() == WSAEWOULDBLOCK) {
 			writeableTCP_ = false;
 			return false;
@@ -350,20 +347,18 @@ bool NetworkClient::WriteTCP() {
 	}
 
 	// We've written some data to the socket
-	printf("Sent %d bytes to the server.\n", count);
+	LOG_DEBUG(LOG_TCP, "Sent %d bytes to the server.\n", count);
 	writeCountTCP_ += count;
 
 	if (writeCountTCP_ < msgLength) {
-		printf("Not all sent\n");
+		LOG_DEBUG(LOG_TCP, "Not all sent\n");
 		// but not written the whole message. Stop writing for now.
 		writeableTCP_ = false;
 		return false;
 	}
 
 	// Written a complete message.
-	printf("Sent message to the server: '");
-	fwrite(msg.data(), 1, msgLength, stdout);
-	printf("'\n\n");
+	LOG_DEBUG(LOG_TCP, "Sent message of %d bytes to the server\n", msgLength);
 
 	// Remove message from queue
 	clientMsgsMutexTCP_.lock();
@@ -387,12 +382,33 @@ bool NetworkClient::WriteUDP(uint16_t& msgLen) {
 	return true;
 }
 
+void NetworkClient::WriteHeaderUDP(uint16_t msgLen, MessageType msgType) {
+	uint16_t handle = handleUDP_;
+	uint64_t token = tokenUDP_;
+	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
+	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	memcpy(writeBufferUDP_ + HeaderSize, &handle, HeaderHandleFieldSize);
+	memcpy(writeBufferUDP_ + HeaderSize + HeaderHandleFieldSize, &token, HeaderTokenFieldSize);
+}
+
 void NetworkClient::SendPingMessage() {
 	MessageType msgType = MessageType::PING;
-	uint16_t msgLen = HeaderSize;
+	uint16_t msgLen = HeaderSizeUDP;
 
-	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	WriteHeaderUDP(msgLen, msgType);
+
+	if (writeableUDP_) WriteUDP(msgLen);
+}
+
+void NetworkClient::SendSnapshotAckMessage(uint32_t sequence) {
+	SnapshotAckMessage msg;
+	MessageType msgType = MessageType::SNAPSHOTACK;
+	msg.sequence = sequence;
+	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
+
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
 
 	if (writeableUDP_) WriteUDP(msgLen);
 }
@@ -401,13 +417,14 @@ void NetworkClient::SendTimeReqMessage() {
 	//Create message
 	TimeRequestMessage msg;
 	MessageType msgType = MessageType::TIMEREQUEST;
-	msg.clientTime = time_;
+	msg.clientTime = LocalMicroseconds(); //Stamped here, on the thread that sends it, so it's as late as it can be
+	msg.serverReceiveTime = 0;
+	msg.serverTime = 0;
 	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
-	uint16_t msgLen = msgData.size() + HeaderSize;
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
 
-	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
-	memcpy(writeBufferUDP_ + HeaderSize, (const char*)msgData.data(), msgData.size());
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
 
 	if (writeableUDP_) {
 		WriteUDP(msgLen);
@@ -415,35 +432,157 @@ void NetworkClient::SendTimeReqMessage() {
 }
 
 void NetworkClient::SendInput(InputUpdateMessage& input) {
-
 	inputsMutex_.lock();
-	playerInputs_ = input;
+	if (playerInputs_.size() == INPUT_QUEUE_SIZE) {
+		LOG_WARNING(LOG_UDP, "Input queue full, input %u dropped\n", playerInputs_.front().sequence);
+		playerInputs_.pop_front();
+	}
+	playerInputs_.push_back(input);
 	inputsMutex_.unlock();
-	mutexUDP_.lock();
-	sendPlayerInputUDP_ = true;
-	mutexUDP_.unlock();
 
 	WSASetEvent(eventUDP_); //Signal that there is a new message to be sent
 }
 
-void NetworkClient::SendInputMessage() {
-	//Create message
-	InputUpdateMessage msg;
+void NetworkClient::SendInputMessages() {
+	while (writeableUDP_) {
+		inputsMutex_.lock();
+		if (playerInputs_.empty()) {
+			inputsMutex_.unlock();
+			return;
+		}
+		InputUpdateMessage msg = playerInputs_.front();
+		inputsMutex_.unlock();
+
+		if (!SendInputMessage(msg)) return;
+
+		inputsMutex_.lock();
+		//Unless the main thread had to drop it meanwhile to make room
+		if (!playerInputs_.empty() && playerInputs_.front().sequence == msg.sequence) playerInputs_.pop_front();
+		inputsMutex_.unlock();
+	}
+}
+
+bool NetworkClient::SendInputMessage(InputUpdateMessage& msg) {
+	//Already stamped with the time of the step it's for
 	MessageType msgType = MessageType::INPUTUPDATE;
-	inputsMutex_.lock();
-	msg = playerInputs_;
-	inputsMutex_.unlock();
-	msg.time = time_;
 	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
-	uint16_t msgLen = msgData.size() + HeaderSize;
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
 
-	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
-	memcpy(writeBufferUDP_ + HeaderSize, (const char*)msgData.data(), msgData.size());
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
+
+	return writeableUDP_ && WriteUDP(msgLen);
+}
+
+void NetworkClient::SendConnectRequestMessage() {
+	ConnectRequestMessage msg;
+	MessageType msgType = MessageType::CONNECTREQUEST;
+	msg.nonce = connectNonceUDP_;
+	//Padded out to the size the server wants, each byte of padding adds one to the packed size
+	size_t unpadded = msgpack::pack(msg).size() + HeaderSizeUDP;
+	if (unpadded < CONNECT_REQUEST_SIZE) msg.padding.resize(CONNECT_REQUEST_SIZE - unpadded);
+	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
+
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
 
 	if (writeableUDP_) WriteUDP(msgLen);
 }
 
+void NetworkClient::SendConnectResponseMessage() {
+	//The challenge goes straight back as it came
+	MessageType msgType = MessageType::CONNECTRESPONSE;
+	std::vector<uint8_t> msgData = msgpack::pack(challengeUDP_); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
+
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
+
+	if (writeableUDP_) WriteUDP(msgLen);
+}
+
+void NetworkClient::SendReliableAckMessage(uint32_t sequence) {
+	ReliableAckMessage msg;
+	MessageType msgType = MessageType::RELIABLEACK;
+	msg.sequence = sequence;
+	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSizeUDP;
+
+	WriteHeaderUDP(msgLen, msgType);
+	memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
+
+	if (writeableUDP_) WriteUDP(msgLen);
+}
+
+void NetworkClient::SendDisconnectMessage() {
+	MessageType msgType = MessageType::DISCONNECT;
+	uint16_t msgLen = HeaderSizeUDP;
+
+	WriteHeaderUDP(msgLen, msgType);
+
+	if (writeableUDP_) WriteUDP(msgLen);
+}
+
+void NetworkClient::UpdateConnectUDP() {
+	int64_t now = LocalMicroseconds() / 1000;
+	switch (connectStateUDP_)
+	{
+	case ConnectStateUDP::RESPONDING:
+		//The cookie's about to run out, so ask for another
+		if (now - respondingSinceUDP_ > CONNECT_RESPONSE_TIMEOUT) {
+			LOG_INFO(LOG_UDP, "No answer to connect response, asking again\n");
+			connectStateUDP_ = ConnectStateUDP::REQUESTING;
+			connectSentTimeUDP_ = now - CONNECT_RESEND_TIME;
+			UpdateConnectUDP();
+		}
+		else if (now - connectSentTimeUDP_ >= CONNECT_RESEND_TIME) {
+			connectSentTimeUDP_ = now;
+			SendConnectResponseMessage();
+		}
+		break;
+	case ConnectStateUDP::REQUESTING:
+		if (now - connectSentTimeUDP_ >= CONNECT_RESEND_TIME) {
+			connectSentTimeUDP_ = now;
+			SendConnectRequestMessage();
+		}
+		break;
+	case ConnectStateUDP::CONNECTED:
+		SendReliableMessages((uint32_t)now);
+		break;
+	default:
+		break;
+	}
+}
+
+void NetworkClient::SendReliableMessages(uint32_t now) {
+	//Messages queued by the main thread go into the stream whole
+	clientMsgsMutexTCP_.lock();
+	while (!clientMsgsTCP_.empty()) {
+		reliableUDP_.Write(clientMsgsTCP_.front().data(), clientMsgsTCP_.front().size());
+		clientMsgsTCP_.pop();
+	}
+	clientMsgsMutexTCP_.unlock();
+
+	bool alive = reliableUDP_.Send(now, [this](uint32_t sequence, const char* data, uint16_t dataLength) {
+		ReliableMessage msg;
+		MessageType msgType = MessageType::RELIABLE;
+		msg.sequence = sequence;
+		msg.data.assign(data, data + dataLength);
+		std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+		uint16_t msgLen = msgData.size() + HeaderSizeUDP;
+
+		WriteHeaderUDP(msgLen, msgType);
+		memcpy(writeBufferUDP_ + HeaderSizeUDP, (const char*)msgData.data(), msgData.size());
+
+		if (writeableUDP_) WriteUDP(msgLen);
+	});
+	if (!alive) {
+		LOG_ERROR(LOG_UDP, "Server stopped acknowledging, connection lost\n");
+		connectStateUDP_ = ConnectStateUDP::CLOSED;
+	}
+}
+
 void NetworkClient::SendMessages()
 {
 	// Keep sending messages from the queue until something stops us.
@@ -452,31 +591,31 @@ void NetworkClient::SendMessages()
 	}
 }
 
-void NetworkClient::SyncTimeSend() { //TODO: add a spawn feature - after joining game, wont be able to spawn till time is synced.
-	while (timeSynced_ < 10) {
-		for(int i = 0; i < 15; i++) {
-			SendTimeReqMessage();
-			std::this_thread::sleep_for(std::chrono::milliseconds(300));
-		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+DWORD NetworkClient::SyncTimeSend() { //TODO: add a spawn feature - after joining game, wont be able to spawn till time is synced.
+	if (!syncTimeUDP_) return WSA_INFINITE;
+
+	//A quick burst to get synced, then a sample now and then for as long as we're connected to keep up with drift.
+	//Lost requests don't matter, there's always another coming.
+	int64_t now = LocalMicroseconds() / 1000;
+	if (now >= nextTimeRequestUDP_) {
+		SendTimeReqMessage();
+		nextTimeRequestUDP_ = now + (timeRequestsUDP_++ < CLOCK_SYNC_BURST ? CLOCK_SYNC_BURST_INTERVAL : CLOCK_SYNC_INTERVAL);
 	}
+	return (DWORD)(nextTimeRequestUDP_ - now);
 }
 
 void NetworkClient::SyncTimeReceive(TimeRequestMessage& msg) {
-	printf("Syncing...\n");
-		int latency = (time_ - msg.clientTime) / 2;
-		//printf("latency: %d\n", latency);
-		if (latency < latency_) {
-			latency_ = latency;
-			// Sync the time
-			timeStart_ = ClientClock::now();
-			serverTimeDelta_ = msg.serverTime + latency_;
-		}
-
-		timeSynced_++;
-
-		printf("latency: %d\n", latency);
-		if (timeSynced_ == 10) printf("synced\n");
+	int64_t received = LocalMicroseconds();
+	clockMutex_.lock();
+	clock_.AddSample(msg.clientTime, msg.serverReceiveTime, msg.serverTime, received);
+	size_t samples = clock_.Samples();
+	int64_t roundTrip = clock_.RoundTrip();
+	double offset = clock_.Offset();
+	double drift = clock_.Drift();
+	clockMutex_.unlock();
+
+	LOG_DEBUG(LOG_GENERAL, "Clock sync: round trip %lldus, offset %.0fus, drift %.1fppm\n", (long long)roundTrip, offset, drift * 1e6);
+	if (samples == CLOCK_SYNC_BURST) LOG_INFO(LOG_GENERAL, "synced\n");
 }
 
 void NetworkClient::HandleMessage(uint16_t msgLength, const char* buffer) {
@@ -485,29 +624,113 @@ void NetworkClient::HandleMessage(uint16_t msgLength, const char* buffer) {
 	{
 	case MessageType::PLAYERSUPDATE :
 	{
-		PlayersUpdateMessage msg = msgpack::unpack<PlayersUpdateMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
-		//printf("vel: %f,%f,%f pos: %f,%f,%f rot: %f\n", msg.playerValues[0].velocity[0], msg.playerValues[0].velocity[1], msg.playerValues[0].velocity[2], msg.playerValues[0].position[0], msg.playerValues[0].position[1], msg.playerValues[0].position[2], msg.playerValues[0].rotation);
-		//As UDP packets can arrive out of order, only want most up to date values
-		if (msg.time > prevServerPlayerValTime) {
-			prevServerPlayerValTime = msg.time;
-			scene_->SetServerPlayerVals(msg.playerValues, prevServerPlayerValTime);
+		std::error_code ec;
+		PlayersUpdateMessage msg = msgpack::unpack<PlayersUpdateMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize, ec);
+		if (ec) {
+			LOG_DEBUG(LOG_UDP, "Malformed snapshot datagram - discarding\n");
+			break;
+		}
+
+		SnapshotFragmentResult result = assemblerUDP_.Add(msg, snapshotsUDP_);
+		if (result == SnapshotFragmentResult::BAD_FRAGMENT) {
+			LOG_DEBUG(LOG_UDP, "Snapshot %u with bad fragment %d/%d - discarding\n", msg.sequence, msg.fragment, msg.fragmentCount);
+		}
+		else if (result == SnapshotFragmentResult::UNKNOWN_BASELINE) {
+			LOG_DEBUG(LOG_UDP, "Snapshot %u against unknown baseline %u - discarding\n", msg.sequence, msg.baseline);
 		}
+		else if (result == SnapshotFragmentResult::MISFIT) {
+			LOG_DEBUG(LOG_UDP, "Snapshot %u doesn't fit its baseline - discarding\n", msg.sequence);
+		}
+		if (result != SnapshotFragmentResult::APPLIED && result != SnapshotFragmentResult::COMPLETE) break;
+
+		bool complete = result == SnapshotFragmentResult::COMPLETE;
+		if (complete) SendSnapshotAckMessage(msg.sequence);
+
+		//Each datagram's players are used straight away, rather than waiting for the rest.
+		//Players left out for bandwidth still have their baseline values, which the scene has already moved on from.
+		prevServerPlayerValTime = msg.time;
+		const SnapshotState& state = assemblerUDP_.State();
+		std::map<int, PlayerValues> updated;
+		for (int id : assemblerUDP_.Updated()) {
+			updated[id] = state.at(id);
+		}
+		scene_->SetServerPlayerVals(updated, msg.removed, prevServerPlayerValTime, complete ? &state : nullptr, msg.inputSequence);
 	}
 	break;
 	case MessageType::TIMEREQUEST:
 	{
 		//printf("syncing\n");
-		TimeRequestMessage msg = msgpack::unpack<TimeRequestMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
+		std::error_code ec;
+		TimeRequestMessage msg = msgpack::unpack<TimeRequestMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize, ec);
+		if (ec) break;
 		SyncTimeReceive(msg);
 	}
 		break;
 	case MessageType::SERVERACCEPT:
-		CreateClientInfoMessage();
-		std::thread(&NetworkClient::SyncTimeSend, this).detach();
+	{
+		//Over UDP the accept is sent again for each resent response that gets there
+		if (udpOnly_) {
+			if (connectStateUDP_ != ConnectStateUDP::RESPONDING) break;
+			connectStateUDP_ = ConnectStateUDP::CONNECTED;
+			LOG_INFO(LOG_UDP, "Connected over UDP\n");
+		}
+		ServerAcceptMessage msg = msgpack::unpack<ServerAcceptMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
+		handleUDP_ = msg.handleUDP;
+		tokenUDP_ = msg.tokenUDP;
+		if (!udpOnly_) CreateClientInfoMessage(); //The server already has our address from the handshake otherwise
+		//Time requests are sent from the UDP thread, which owns the write buffer
+		syncTimeUDP_ = true;
+		WSASetEvent(eventUDP_);
+	}
 		break;
 	case MessageType::SERVERFULL:
-		printf("Server full.\n");
+		LOG_INFO(LOG_TCP, "Server full.\n");
+		if (udpOnly_) connectStateUDP_ = ConnectStateUDP::CLOSED;
 		break;
+	case MessageType::CONNECTCHALLENGE:
+	{
+		if (!udpOnly_ || connectStateUDP_ != ConnectStateUDP::REQUESTING) break;
+		std::error_code ec;
+		ConnectChallengeMessage msg = msgpack::unpack<ConnectChallengeMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize, ec);
+		if (ec || msg.nonce != connectNonceUDP_) break;
+
+		challengeUDP_ = msg;
+		connectStateUDP_ = ConnectStateUDP::RESPONDING;
+		respondingSinceUDP_ = connectSentTimeUDP_ = LocalMicroseconds() / 1000;
+		SendConnectResponseMessage();
+	}
+	break;
+	case MessageType::RELIABLE:
+	{
+		if (!udpOnly_ || connectStateUDP_ != ConnectStateUDP::CONNECTED) break;
+		std::error_code ec;
+		ReliableMessage msg = msgpack::unpack<ReliableMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize, ec);
+		if (ec) break;
+		uint32_t next = reliableUDP_.Receive(msg.sequence, msg.data.data(), msg.data.size(), decoderTCP_);
+
+		//Acknowledged every time, even repeats, as it's the ack that was lost
+		SendReliableAckMessage(next);
+
+		//Every message the stream now has, just as if it had come over TCP
+		const char* frame;
+		uint16_t frameLength;
+		int result;
+		while ((result = decoderTCP_.NextFrame(frame, frameLength)) == 1) {
+			HandleMessage(frameLength, frame);
+		}
+		if (result == -1) {
+			die("Malformed message stream from server");
+		}
+	}
+	break;
+	case MessageType::RELIABLEACK:
+	{
+		if (!udpOnly_) break;
+		std::error_code ec;
+		ReliableAckMessage msg = msgpack::unpack<ReliableAckMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize, ec);
+		if (!ec) reliableUDP_.Acknowledge(msg.sequence);
+	}
+	break;
 	case MessageType::JOINGAME:
 	{
 		if (scene_->GetMyPlayer() == nullptr) {
@@ -559,6 +782,7 @@ void NetworkClient::StartWinSock() {
 }
 
 void NetworkClient::die(const char* message) {
+	Log::Flush(); //Get everything logged so far out before the error
 	fprintf(stderr, "\nError: %s (WSAGetLastError() = %d)", message, WSAGetLastError());
 	WSACleanup();
 #ifdef _DEBUG
@@ -570,7 +794,7 @@ void NetworkClient::die(const char* message) {
 }
 
 void NetworkClient::CleanupSocket() {
-	printf("Closing connection\n");
+	LOG_INFO(LOG_TCP, "Closing connection\n");
 	closesocket(socketTCP_);
 }
 
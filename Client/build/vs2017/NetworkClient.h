@@ -3,9 +3,15 @@
 #include <WinSock2.h>
 #include <iostream>
 #include "Messages.h"
+#include "FrameDecoder.h"
+#include "SnapshotDelta.h"
+#include "ClockSync.h"
+#include "ReliableStream.h"
 #include <thread>
+#include <deque>
 #include <queue>
 #include <mutex>
+#include <atomic>
 
 // The IP address of the server to connect to
 //#define SERVERIP serverIP_.c_str()
@@ -18,6 +24,20 @@
 
 #define TICKRATE 8
 
+// Join over UDP alone, with no TCP connection. The server answers with a signed cookie that has to be sent back before
+// it sets anything up for us, then sends what would have gone over TCP as a reliable stream of datagrams.
+#define CONNECT_OVER_UDP false
+// Connect requests are padded to the server's CONNECT_REQUEST_SIZE, it ignores anything smaller
+#define CONNECT_REQUEST_SIZE 64
+// ms between resending a connect request or response that hasn't been answered
+#define CONNECT_RESEND_TIME 250
+// ms to keep sending a response before starting again with a new request, a little under how long the server's cookies last
+#define CONNECT_RESPONSE_TIMEOUT 4000
+// Longest the UDP thread waits for something to happen when connected over UDP alone, as resends are up to it
+#define UDP_WAIT_TIMEOUT 50
+// Inputs waiting for the UDP thread to send them, the same as the server holds for one player. Past this the oldest go.
+#define INPUT_QUEUE_SIZE 64
+
 
 //Message header format: 
 // +--------+--------+--------+
@@ -31,12 +51,27 @@
 //Size of Type field in header
 #define HeaderTypeFieldSize sizeof(uint8_t)
 
+//Datagrams sent to the server carry the connection's handle and secret token after the type:
+// +--------+--------+--------+--------+--------+--------+-- .. --+--------+
+// |      Length     |  Type  |     Handle      |     Token (8 bytes)      |
+// +--------+--------+--------+--------+--------+--------+-- .. --+--------+
+
+//Size of Handle field in datagrams sent to the server
+#define HeaderHandleFieldSize sizeof(uint16_t)
+//Size of Token field in datagrams sent to the server
+#define HeaderTokenFieldSize sizeof(uint64_t)
+//Size of the header on datagrams sent to the server
+#define HeaderSizeUDP (HeaderSize + HeaderHandleFieldSize + HeaderTokenFieldSize)
+
 typedef std::chrono::high_resolution_clock ClientClock;
 
 class SceneApp;
 
 enum class ReadingWriting { READING, WRITING, NONE };
 
+// Where joining over UDP alone has got to
+enum class ConnectStateUDP { REQUESTING, RESPONDING, CONNECTED, CLOSED };
+
 class NetworkClient {
 public:
 	NetworkClient() {};
@@ -50,7 +85,7 @@ public:
 	void CreateClientInfoMessage();
 	void CreateChatMessage(const char* chatMsg, int playerID);
 	void SendInput(InputUpdateMessage& inputs);
-	int GetTime() { return time_; }
+	int GetTime() { return (int)time_.load(); }
 private:
 	void die(const char* message);
 	void ConnectTCP();
@@ -60,33 +95,48 @@ private:
 	bool ReadUDP();
 	bool WriteTCP();
 	bool WriteUDP(uint16_t& msgLen);
+	// Start writeBufferUDP_ with the header, for a body of msgLen - HeaderSizeUDP bytes
+	void WriteHeaderUDP(uint16_t msgLen, MessageType msgType);
 	void SendPingMessage();
+	void SendSnapshotAckMessage(uint32_t sequence);
 	void SendTimeReqMessage();
-	void SendInputMessage();
+	// Send every queued input in order, leaving any the socket won't take yet for when it's writeable again
+	void SendInputMessages();
+	bool SendInputMessage(InputUpdateMessage& msg);
+	void SendConnectRequestMessage();
+	void SendConnectResponseMessage();
+	void SendReliableAckMessage(uint32_t sequence);
+	void SendDisconnectMessage();
+	// Move the UDP only handshake along, or once connected, send whatever the reliable stream has due
+	void UpdateConnectUDP();
+	void SendReliableMessages(uint32_t now);
 	void AddMessage(uint16_t& msgLen, MessageType& msgType, std::vector<uint8_t>& msgData);
 	void SendMessages();
-	void SyncTimeSend();
+	// Send a time request if one's due, and return how long (ms) until the next is. The UDP thread's wait is no
+	// longer than that, so there's no thread of its own to outlive us.
+	DWORD SyncTimeSend();
 	void SyncTimeReceive(TimeRequestMessage& msg);
+	int64_t LocalMicroseconds() { return std::chrono::duration_cast<std::chrono::microseconds>(ClientClock::now() - timeStart_).count(); }
 	void HandleMessage(uint16_t length, const char* buffer);
 
 	std::string serverIP_;
 
 	ClientClock::time_point timeStart_ = ClientClock::now();
-	uint32_t time_ = 0;
-	int serverTimeDelta_ = 0;
-	int timeSynced_ = 0;
-	int latency_ = INT_MAX;
+	std::atomic<uint32_t> time_{ 0 }; //Server time (ms), as best we know it. Set by the main thread, read by any.
+	//Fed by the UDP thread, read by the main thread's UpdateTime
+	ClockSync clock_;
+	std::mutex clockMutex_;
 
 	SceneApp* scene_;
-	bool running_ = true;
+	std::atomic<bool> running_{ true };
+	bool udpOnly_ = CONNECT_OVER_UDP;
 
 	std::thread* connectionThreadTCP_;
 	std::thread* connectionThreadUDP_;
 
 	//Socket for TCP
 	SOCKET socketTCP_;
-	int readCountTCP_ = 0;
-	char readBufferTCP_[500]; //TODO: determine biggest buffer needed
+	FrameDecoder decoderTCP_;
 	int writeCountTCP_ = 0;
 	char writeBufferTCP_[65535];
 	bool writeableTCP_ = false;
@@ -94,16 +144,33 @@ private:
 	std::mutex clientMsgsMutexTCP_;
 
 	SOCKET socketUDP_;
-	std::mutex mutexUDP_;
-	char readBufferUDP_[500];
+	char readBufferUDP_[SNAPSHOT_MTU];
 	char writeBufferUDP_[500];
+	//From the server's accept message, they identify us in every datagram. Both 0 until then, which the server ignores
+	//on the connect messages sent before it.
+	std::atomic<uint16_t> handleUDP_{ 0 };
+	std::atomic<uint64_t> tokenUDP_{ 0 };
 	bool writeableUDP_ = false;
-	bool sendPlayerInputUDP_ = false;
-	bool sendTimeRequestUDP_ = false;
-	int prevInputSendTime_ = 0;
+	//Set once the server's accepted us, from whichever thread handled the accept
+	std::atomic<bool> syncTimeUDP_{ false };
+	int timeRequestsUDP_ = 0;
+	int64_t nextTimeRequestUDP_ = 0; //ms, by our clock
 	int prevServerPlayerValTime = 0;
-
-	InputUpdateMessage playerInputs_;
+	//Joining over UDP alone. Only used by the UDP thread.
+	ConnectStateUDP connectStateUDP_ = ConnectStateUDP::REQUESTING;
+	uint64_t connectNonceUDP_ = 0;
+	ConnectChallengeMessage challengeUDP_;
+	int64_t connectSentTimeUDP_ = -CONNECT_RESEND_TIME; //ms
+	int64_t respondingSinceUDP_ = 0;
+	//Stands in for the TCP socket, with decoderTCP_ putting the messages back together
+	ReliableStream reliableUDP_;
+	//Snapshots received, as baselines for the deltas the server sends. Only used by the UDP thread.
+	SnapshotHistory snapshotsUDP_;
+	//The snapshot being put together from its datagrams, starting from its baseline
+	SnapshotAssembler assemblerUDP_;
+
+	//An input a step from the main thread, each sent on its own by the UDP thread, so none are overwritten before they go
+	std::deque<InputUpdateMessage> playerInputs_;
 	std::mutex inputsMutex_;
  
 	//Structure to hold the result from WSAEnumNetworkEvents
@@ -1,12 +1,18 @@
 #include "Player.h"
+#include "SlotMap.h"
 
-void Player::Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, physx::PxSceneDesc* sceneDesc, int ID)
+Player::~Player()
+{
+	// Takes it out of the scene too, or it'd be left there for everyone else to bump into
+	ReleasePhysx();
+}
+
+void Player::Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int ID)
 {
 	playerID = ID;
 	globalScene = scene;
 	set_mesh(builder->CreateBoxMesh(gef::Vector4(0.5f, 0.75f, 0.5f)));
-	InitPhysx(physx::PxVec3(0.5f, 0.75f, 0.5f), physx::PxVec3(ID, 1.25f, 2), scene, physics, true);
-	localScene = physics->createScene(*sceneDesc);
+	InitPhysx(physx::PxVec3(0.5f, 0.75f, 0.5f), physx::PxVec3((float)(SlotMapIndex(ID) % 5), 1.25f, 2), scene, physics, true);
 	GetPxBody()->setRigidDynamicLockFlags(physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_X | physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_Z | physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_Y);
 }
 
@@ -49,6 +55,21 @@ void Player::setPosition(physx::PxVec3 pos)
 	GetPxBody()->setGlobalPose(t);
 }
 
+void Player::setPose(physx::PxVec3 pos, float angle)
+{
+	physx::PxTransform t(pos, physx::PxGetRotYQuat(angle));
+
+	forwardVec = -t.q.getBasisVector2();
+	rightVec = t.q.getBasisVector0();
+
+	GetPxBody()->setGlobalPose(t);
+}
+
+void Player::setKinematic(bool b)
+{
+	GetPxBody()->setRigidBodyFlag(physx::PxRigidBodyFlag::eKINEMATIC, b);
+}
+
 void Player::setVelocity(physx::PxVec3 newVelocity)
 {
 	GetPxBody()->setLinearVelocity(newVelocity);
@@ -69,8 +90,9 @@ physx::PxRigidDynamic* Player::GetPxBody()
 	return pxbody_->is<physx::PxRigidDynamic>();
 }
 
-void Player::SwitchToLocalScene() {
+void Player::SwitchToLocalScene(physx::PxScene* scene) {
 	if (globalScene == pxbody_->getScene()) {
+		localScene = scene;
 		globalScene->removeActor(*pxbody_);
 		localScene->addActor(*pxbody_);
 	}
@@ -82,6 +104,7 @@ void Player::SwitchToGlobalScene() {
 		localScene->removeActor(*pxbody_);
 		globalScene->addActor(*pxbody_);
 	}
+	localScene = NULL;
 }
 
 void Player::UpdateLocalScene(float dt) {
@@ -1,11 +1,13 @@
 #pragma once
 #include "GameObject.h"
 #include "primitive_builder.h"
+#include "InterpolationBuffer.h"
 #include <PxPhysicsAPI.h>
 
 class Player : public GameObject {
 public :
-	void Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, physx::PxSceneDesc* sceneDesc, int ID);
+	~Player();
+	void Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int ID);
 	void setID(int ID) { playerID = ID; }
 	int getID() { return playerID; }
 	void rotate(float angle);
@@ -13,21 +15,33 @@ public :
 	float getRotation();
 	void setVelocity(physx::PxVec3 newVelocity);
 	void setPosition(physx::PxVec3 pos);
+	// Position and rotation in one go
+	void setPose(physx::PxVec3 pos, float angle);
+	// Other players are moved straight to where the server had them, rather than simulated
+	void setKinematic(bool b);
 	physx::PxVec3 getVelocity() { return GetPxBody()->getLinearVelocity(); }
 	physx::PxVec3 getPosition() { return GetPxBody()->getGlobalPose().p; }
 	physx::PxVec3 getForwardVec();
 	physx::PxVec3 getRightVec();
 	physx::PxRigidDynamic* GetPxBody() override;
-	physx::PxScene* GetLocalScene() { return localScene; }
-	void SwitchToLocalScene();
+	// Move into scene (leased from the PredictionScenePool) to simulate on its own, and back again.
+	// The scene's free to return once the player's back in the global scene.
+	void SwitchToLocalScene(physx::PxScene* scene);
 	void SwitchToGlobalScene();
 	void UpdateLocalScene(float dt);
+	// Out of view players are too far away for the server to send, so they're frozen and not drawn
+	void setInView(bool b) { inView = b; }
+	bool isInView() { return inView; }
+	// Where the server has had this player recently, for drawing other players
+	InterpolationBuffer& getInterpolation() { return interpolation; }
 
 protected:
 	int playerID;
+	bool inView = true;
 	physx::PxVec3 velocity = physx::PxVec3(0, 0, 0);
 	physx::PxVec3 forwardVec = physx::PxVec3(0, 0, -1);
 	physx::PxVec3 rightVec = physx::PxVec3(1, 0, 0);
+	InterpolationBuffer interpolation;
 
 	physx::PxScene* localScene = NULL;
 	physx::PxScene* globalScene = NULL;
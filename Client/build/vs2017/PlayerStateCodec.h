@@ -0,0 +1,43 @@
+#pragma once
+#include "Messages.h"
+#include "BitStream.h"
+
+// Shared by the client and server, keep both copies the same.
+
+// A float sent as a fixed point number of bits between min and max. Values outside are clamped.
+struct QuantizedRange {
+	float min;
+	float max;
+	int bits;
+};
+
+// Precision of everything in a snapshot, all in one place.
+// The ground is 60x60 around the origin, so positions allow some room past the edges.
+namespace PlayerStateSchema {
+	const int idBits = 32;
+	const QuantizedRange positionXZ = { -64.0f, 64.0f, 20 }; // ~0.12mm steps
+	const QuantizedRange positionY = { -32.0f, 32.0f, 18 };  // ~0.24mm steps
+	const QuantizedRange velocity = { -32.0f, 32.0f, 16 };   // ~1mm/s steps
+	const int rotationBits = 16; // Yaw, wrapped into one turn
+}
+
+// What part of a player is written, in this order
+enum PlayerStateField : uint8_t {
+	STATE_POSITION = 1 << 0,
+	STATE_VELOCITY = 1 << 1,
+	STATE_ROTATION = 1 << 2,
+	STATE_ALL = STATE_POSITION | STATE_VELOCITY | STATE_ROTATION
+};
+#define PLAYER_STATE_FIELD_BITS 3
+
+uint32_t QuantizeFloat(float value, const QuantizedRange& range);
+float DequantizeFloat(uint32_t value, const QuantizedRange& range);
+uint32_t QuantizeAngle(float radians);
+float DequantizeAngle(uint32_t value);
+
+// Round every field to what the schema can send, so values compared on the server match what the client decodes
+void QuantizePlayerValues(PlayerValues& values);
+
+void WritePlayerFields(BitWriter& writer, const PlayerValues& values, uint8_t fields);
+// values must already have 3 entries for position and velocity. Returns false if the data ran out.
+bool ReadPlayerFields(BitReader& reader, PlayerValues& values, uint8_t fields);
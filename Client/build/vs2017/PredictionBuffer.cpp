@@ -0,0 +1,42 @@
+#include "PredictionBuffer.h"
+
+PredictionBuffer::PredictionBuffer() {
+	for (PredictedInput& predicted : inputs_) {
+		predicted.input.sequence = 0;
+		predicted.input.velocity.resize(2);
+	}
+}
+
+InputUpdateMessage& PredictionBuffer::Add() {
+	latest_++;
+	PredictedInput& predicted = inputs_[latest_ % PREDICTION_BUFFER_SIZE];
+	predicted.input.sequence = latest_;
+	predicted.position = physx::PxVec3(0, 0, 0);
+	//Fell out the back without the server ever getting to it, so there's nothing to replay from
+	if (latest_ - acknowledged_ > PREDICTION_BUFFER_SIZE) acknowledged_ = latest_ - PREDICTION_BUFFER_SIZE;
+	return predicted.input;
+}
+
+void PredictionBuffer::SetPosition(uint32_t sequence, const physx::PxVec3& position) {
+	PredictedInput* predicted = Get(sequence);
+	if (predicted) predicted->position = position;
+}
+
+bool PredictionBuffer::Acknowledge(uint32_t sequence, const physx::PxVec3& position) {
+	//Snapshots can arrive out of order, and can't be for inputs not sent yet
+	if (sequence <= acknowledged_ || sequence > latest_) return false;
+	acknowledged_ = sequence;
+
+	PredictedInput* predicted = Get(sequence);
+	if (!predicted) return true;
+	float error = (predicted->position - position).magnitude();
+	if (error > maxError_) maxError_ = error;
+	if (error <= PREDICTION_TOLERANCE) return false;
+	replays_++;
+	return true;
+}
+
+PredictedInput* PredictionBuffer::Get(uint32_t sequence) {
+	PredictedInput& predicted = inputs_[sequence % PREDICTION_BUFFER_SIZE];
+	return sequence != 0 && predicted.input.sequence == sequence ? &predicted : nullptr;
+}
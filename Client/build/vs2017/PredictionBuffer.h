@@ -0,0 +1,53 @@
+#pragma once
+#include "Messages.h"
+#include <PxPhysicsAPI.h>
+#include <cstdint>
+
+// Inputs kept for replaying, about 2 seconds' worth at 60Hz. Any older than that the server never used are forgotten.
+#define PREDICTION_BUFFER_SIZE 128
+
+// How far (m) the server's position can be from the predicted one before the client rewinds and replays.
+// Well above snapshot quantization, so only real disagreements cause a replay.
+#define PREDICTION_TOLERANCE 0.01f
+
+// An input the client has applied to its own player, and where that left it
+struct PredictedInput {
+	InputUpdateMessage input;
+	physx::PxVec3 position;
+};
+
+// The client's own inputs that the server hasn't been seen to use yet, in a ring indexed by sequence number.
+// Each simulation step the client adds an input, applies it straight away and records where it ended up. When a
+// snapshot says which input the server had got to, that prediction is checked against the server's position. If
+// they're too far apart the player is put back where the server had it and the inputs after that are replayed.
+class PredictionBuffer {
+public:
+	PredictionBuffer();
+
+	// Start the next input (numbered one on from the last) for the caller to fill in
+	InputUpdateMessage& Add();
+
+	// Where the player was after the step that applied sequence
+	void SetPosition(uint32_t sequence, const physx::PxVec3& position);
+
+	// The server had used every input up to sequence, and its player was at position. Returns true if that's too far
+	// from the prediction, and the pending inputs need replaying from there. Stale acknowledgements are ignored.
+	bool Acknowledge(uint32_t sequence, const physx::PxVec3& position);
+
+	// Inputs still waiting are Acknowledged() + 1 to Latest(). Get() is null for any pushed out of the ring.
+	uint32_t Acknowledged() const { return acknowledged_; }
+	uint32_t Latest() const { return latest_; }
+	PredictedInput* Get(uint32_t sequence);
+
+	// How many acknowledgements needed a replay, and the largest error seen (m)
+	uint32_t Replays() const { return replays_; }
+	float MaxError() const { return maxError_; }
+
+private:
+	PredictedInput inputs_[PREDICTION_BUFFER_SIZE];
+	uint32_t latest_ = 0;		// 0 is never used, so it can mean no input
+	uint32_t acknowledged_ = 0;
+
+	uint32_t replays_ = 0;
+	float maxError_ = 0;
+};
@@ -0,0 +1,50 @@
+#include "PredictionScenePool.h"
+#include "Log.h"
+
+void PredictionScenePool::Init(physx::PxPhysics* physics, const physx::PxSceneDesc& desc) {
+	physx::PxScene* scenes[PREDICTION_SCENE_POOL_SIZE];
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		scenes[i] = physics->createScene(desc);
+	}
+	Init(scenes);
+}
+
+void PredictionScenePool::Init(physx::PxScene* const scenes[PREDICTION_SCENE_POOL_SIZE]) {
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		scenes_[i] = scenes[i];
+		leased_[i] = false;
+	}
+	leasedCount_ = 0;
+}
+
+void PredictionScenePool::CleanUp() {
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		if (scenes_[i]) scenes_[i]->release();
+		scenes_[i] = NULL;
+		leased_[i] = false;
+	}
+	leasedCount_ = 0;
+}
+
+physx::PxScene* PredictionScenePool::Lease() {
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		if (scenes_[i] && !leased_[i]) {
+			leased_[i] = true;
+			leasedCount_++;
+			if (leasedCount_ > peakLeased_) peakLeased_ = leasedCount_;
+			return scenes_[i];
+		}
+	}
+	LOG_WARNING(LOG_GAME, "No prediction scene free, all %d are leased\n", PREDICTION_SCENE_POOL_SIZE);
+	return NULL;
+}
+
+void PredictionScenePool::Return(physx::PxScene* scene) {
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		if (scenes_[i] == scene && leased_[i]) {
+			leased_[i] = false;
+			leasedCount_--;
+			return;
+		}
+	}
+}
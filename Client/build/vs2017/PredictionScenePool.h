@@ -0,0 +1,35 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <cstddef>
+
+// Scenes kept for re-simulating in. Only our own player replays at the moment, the spare is for anything else that
+// wants to without needing another scene made.
+#define PREDICTION_SCENE_POOL_SIZE 2
+
+// A fixed set of PhysX scenes, made once at start up, that anything can borrow for a short re-simulation away from
+// the global scene and give back when it's done. Each scene has its own broadphase and memory pools, so making one
+// per player cost every join a scene that was never freed. Lease and Return on the main thread only.
+class PredictionScenePool {
+public:
+	// Make every scene from desc. They're empty, the caller adds whatever should always be there (the scenery).
+	void Init(physx::PxPhysics* physics, const physx::PxSceneDesc& desc);
+	// Or take over scenes made elsewhere. Any left null are never leased.
+	void Init(physx::PxScene* const scenes[PREDICTION_SCENE_POOL_SIZE]);
+	// Release every scene, leased or not
+	void CleanUp();
+
+	physx::PxScene* Scene(size_t i) { return scenes_[i]; }
+
+	// A scene nobody else is using, or null if they're all out. Whatever's added to it must be taken out before Return.
+	physx::PxScene* Lease();
+	void Return(physx::PxScene* scene);
+
+	// Most leased at once, to see whether the pool's big enough
+	size_t PeakLeased() const { return peakLeased_; }
+
+private:
+	physx::PxScene* scenes_[PREDICTION_SCENE_POOL_SIZE] = {};
+	bool leased_[PREDICTION_SCENE_POOL_SIZE] = {};
+	size_t leasedCount_ = 0;
+	size_t peakLeased_ = 0;
+};
@@ -0,0 +1,37 @@
+#include "ReliableStream.h"
+#include <cstring>
+
+void ReliableStream::Write(const char* data, size_t length) {
+	unsent_.insert(unsent_.end(), data, data + length);
+}
+
+void ReliableStream::Acknowledge(uint32_t next) {
+	//Acknowledgements can arrive out of order, an older one just covers less
+	while (!inFlight_.empty() && (int32_t)(next - inFlight_.front().sequence) > 0) {
+		inFlight_.pop_front();
+	}
+}
+
+uint32_t ReliableStream::Receive(uint32_t sequence, const uint8_t* data, size_t length, FrameDecoder& decoder) {
+	if (length == 0 || length > RELIABLE_CHUNK_SIZE) return expected_;
+	int32_t ahead = (int32_t)(sequence - expected_);
+	if (ahead < 0 || ahead >= RELIABLE_WINDOW) return expected_; //Already had it, or the sender's not allowed that far on
+
+	if (ahead > 0) {
+		ahead_.emplace(sequence, std::vector<uint8_t>(data, data + length));
+		return expected_;
+	}
+
+	//The one that was wanted, and any after it that were waiting on it
+	size_t space;
+	memcpy(decoder.GetWriteSpace(space), data, length);
+	decoder.CommitWrite(length);
+	expected_++;
+	for (auto next = ahead_.find(expected_); next != ahead_.end(); next = ahead_.find(expected_)) {
+		memcpy(decoder.GetWriteSpace(space), next->second.data(), next->second.size());
+		decoder.CommitWrite(next->second.size());
+		ahead_.erase(next);
+		expected_++;
+	}
+	return expected_;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "FrameDecoder.h"
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <vector>
+
+// Shared by the client and server, keep both copies the same.
+
+// Most stream bytes in one datagram. Small enough that a chunk and its header fit the server's receive buffers,
+// so a big message (a join listing every player) goes as several chunks.
+#define RELIABLE_CHUNK_SIZE 400
+// Chunks sent and not yet acknowledged, the rest wait their turn
+#define RELIABLE_WINDOW 32
+// ms before an unacknowledged chunk is sent again
+#define RELIABLE_RESEND_TIME 200
+// Times a chunk is sent without being acknowledged before the other end is taken to have gone, about 5 seconds
+#define RELIABLE_MAX_SENDS 25
+
+// A byte stream over datagrams, for the messages that would otherwise go over TCP. Each end has one of these.
+// The sending half cuts what's written into numbered chunks and sends them again until they're acknowledged.
+// The receiving half puts chunks back in order into a FrameDecoder, which splits the stream into messages just
+// as it does for TCP, and says which chunk it wants next, which acknowledges everything before it.
+// Not thread safe.
+class ReliableStream {
+public:
+	// Add bytes (whole frames) to the end of the stream
+	void Write(const char* data, size_t length);
+
+	// Send whatever's due as of now (ms): chunks unacknowledged for RELIABLE_RESEND_TIME, then new chunks while
+	// there's room in the window. send(sequence, data, length) is called for each. Returns false once a chunk has
+	// been sent RELIABLE_MAX_SENDS times without an acknowledgement.
+	template<class SendChunk>
+	bool Send(uint32_t now, SendChunk send);
+
+	// The other end wants next, so has everything before it
+	void Acknowledge(uint32_t next);
+
+	// Nothing waiting to be sent or acknowledged
+	bool Idle() const { return inFlight_.empty() && unsent_.empty(); }
+
+	// A chunk came in. Anything it completes is added to decoder in order, to be taken out with NextFrame().
+	// Returns the sequence to acknowledge, the next one wanted.
+	uint32_t Receive(uint32_t sequence, const uint8_t* data, size_t length, FrameDecoder& decoder);
+
+private:
+	struct Chunk {
+		uint32_t sequence;
+		std::vector<char> data;
+		uint32_t sentTime;
+		int sends;
+	};
+
+	// Sending
+	std::vector<char> unsent_;
+	std::deque<Chunk> inFlight_; // Oldest first
+	uint32_t nextSequence_ = 1;
+
+	// Receiving. Chunks that arrived ahead of one still missing wait here, at most a window's worth.
+	uint32_t expected_ = 1;
+	std::map<uint32_t, std::vector<uint8_t>> ahead_;
+};
+
+template<class SendChunk>
+bool ReliableStream::Send(uint32_t now, SendChunk send) {
+	for (Chunk& chunk : inFlight_) {
+		if ((int32_t)(now - chunk.sentTime) < RELIABLE_RESEND_TIME) continue;
+		if (chunk.sends >= RELIABLE_MAX_SENDS) return false;
+		chunk.sentTime = now;
+		chunk.sends++;
+		send(chunk.sequence, chunk.data.data(), (uint16_t)chunk.data.size());
+	}
+
+	size_t taken = 0;
+	while (inFlight_.size() < RELIABLE_WINDOW && taken < unsent_.size()) {
+		size_t length = unsent_.size() - taken;
+		if (length > RELIABLE_CHUNK_SIZE) length = RELIABLE_CHUNK_SIZE;
+		inFlight_.push_back({ nextSequence_++, std::vector<char>(unsent_.begin() + taken, unsent_.begin() + taken + length), now, 1 });
+		taken += length;
+		Chunk& chunk = inFlight_.back();
+		send(chunk.sequence, chunk.data.data(), (uint16_t)chunk.data.size());
+	}
+	unsent_.erase(unsent_.begin(), unsent_.begin() + taken);
+	return true;
+}
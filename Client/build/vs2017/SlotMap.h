@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// Shared by the client and server, keep both copies the same.
+
+// An ID is a slot index in the low 16 bits and the slot's generation in the bits above.
+// The generation changes every time a slot is reused, so an old ID never finds the new occupant.
+// IDs stay positive as ints, so they can travel in messages as a playerID.
+#define SLOTMAP_INDEX_BITS 16
+#define SLOTMAP_MAX_SLOTS (1u << SLOTMAP_INDEX_BITS)
+#define SLOTMAP_GENERATION_MASK 0x7fffu
+
+inline uint32_t SlotMapIndex(uint32_t id) { return id & (SLOTMAP_MAX_SLOTS - 1); }
+
+// Values stored densely for fast iteration, with O(1) insert, remove and lookup by ID.
+// Removal swaps the last value into the gap, so value order isn't stable but IDs are.
+template<class T>
+class SlotMap {
+public:
+	// Store value and return its ID, or -1 if every slot is taken.
+	int Insert(T value) {
+		uint32_t index;
+		if (!freeSlots_.empty()) {
+			index = freeSlots_.back();
+			freeSlots_.pop_back();
+		}
+		else {
+			if (slots_.size() >= SLOTMAP_MAX_SLOTS) return -1;
+			index = (uint32_t)slots_.size();
+			slots_.push_back(Slot());
+		}
+
+		Slot& slot = slots_[index];
+		slot.dense = (uint32_t)values_.size();
+		slot.occupied = true;
+		values_.push_back(std::move(value));
+		ids_.push_back(MakeID(index, slot.generation));
+		return (int)ids_.back();
+	}
+
+	// The value with this ID, or nullptr if it has been removed.
+	T* Get(int id) {
+		Slot* slot = Find(id);
+		return slot ? &values_[slot->dense] : nullptr;
+	}
+
+	// Returns false if there was nothing with this ID.
+	bool Remove(int id) {
+		Slot* slot = Find(id);
+		if (!slot) return false;
+
+		// Move the last value into the gap
+		uint32_t dense = slot->dense;
+		if (dense != values_.size() - 1) {
+			values_[dense] = std::move(values_.back());
+			ids_[dense] = ids_.back();
+			slots_[SlotMapIndex(ids_[dense])].dense = dense;
+		}
+		values_.pop_back();
+		ids_.pop_back();
+
+		slot->occupied = false;
+		slot->generation = (slot->generation + 1) & SLOTMAP_GENERATION_MASK;
+		freeSlots_.push_back(SlotMapIndex((uint32_t)id));
+		return true;
+	}
+
+	size_t Size() { return values_.size(); }
+
+	// Dense iteration: values and their IDs share positions.
+	typename std::vector<T>::iterator begin() { return values_.begin(); }
+	typename std::vector<T>::iterator end() { return values_.end(); }
+	T& ValueAt(size_t i) { return values_[i]; }
+	int IDAt(size_t i) { return (int)ids_[i]; }
+
+private:
+	struct Slot {
+		uint32_t dense = 0; // Position in values_ while occupied
+		uint32_t generation = 0;
+		bool occupied = false;
+	};
+
+	static uint32_t MakeID(uint32_t index, uint32_t generation) { return (generation << SLOTMAP_INDEX_BITS) | index; }
+
+	Slot* Find(int id) {
+		if (id < 0) return nullptr;
+		uint32_t index = SlotMapIndex((uint32_t)id);
+		if (index >= slots_.size()) return nullptr;
+		Slot& slot = slots_[index];
+		if (!slot.occupied || MakeID(index, slot.generation) != (uint32_t)id) return nullptr;
+		return &slot;
+	}
+
+	std::vector<Slot> slots_;
+	std::vector<uint32_t> freeSlots_;
+	std::vector<T> values_;
+	std::vector<uint32_t> ids_;
+};
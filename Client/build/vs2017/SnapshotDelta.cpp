@@ -0,0 +1,137 @@
+#include "SnapshotDelta.h"
+
+void SnapshotHistory::Store(uint32_t sequence, const SnapshotState& state) {
+	Entry& entry = entries_[sequence % SNAPSHOT_HISTORY];
+	if (entry.sequence > sequence) return; // A very late arrival, already replaced by something newer
+	entry.sequence = sequence;
+	entry.state = state;
+}
+
+const SnapshotState* SnapshotHistory::Find(uint32_t sequence) {
+	if (sequence == 0) return nullptr;
+	Entry& entry = entries_[sequence % SNAPSHOT_HISTORY];
+	return entry.sequence == sequence ? &entry.state : nullptr;
+}
+
+void DiffSnapshot(const SnapshotState* baseline, const SnapshotState& state, std::vector<SnapshotChange>& changes, std::vector<int>& removed) {
+	changes.clear();
+	removed.clear();
+
+	for (auto& player : state) {
+		const PlayerValues& values = player.second;
+		const PlayerValues* old = nullptr;
+		if (baseline) {
+			auto it = baseline->find(player.first);
+			if (it != baseline->end()) old = &it->second;
+		}
+
+		// Fields are compared exactly, so the client ends up with exactly what the server has
+		uint8_t fields = 0;
+		if (!old || old->position != values.position) fields |= STATE_POSITION;
+		if (!old || old->velocity != values.velocity) fields |= STATE_VELOCITY;
+		if (!old || old->rotation != values.rotation) fields |= STATE_ROTATION;
+		if (fields != 0) changes.push_back({ player.first, fields, &values });
+	}
+
+	if (baseline) {
+		for (auto& player : *baseline) {
+			if (!state.count(player.first)) removed.push_back(player.first);
+		}
+	}
+}
+
+size_t SnapshotChangeBits(uint8_t fields) {
+	using namespace PlayerStateSchema;
+	size_t bits = idBits + PLAYER_STATE_FIELD_BITS;
+	if (fields & STATE_POSITION) bits += 2 * positionXZ.bits + positionY.bits;
+	if (fields & STATE_VELOCITY) bits += 3 * velocity.bits;
+	if (fields & STATE_ROTATION) bits += rotationBits;
+	return bits;
+}
+
+void WriteSnapshotChanges(const SnapshotChange* changes, size_t count, PlayersUpdateMessage& msg) {
+	BitWriter writer;
+	writer.WriteBits((uint32_t)count, SNAPSHOT_COUNT_BITS);
+	for (size_t i = 0; i < count; i++) {
+		writer.WriteBits((uint32_t)changes[i].id, PlayerStateSchema::idBits);
+		writer.WriteBits(changes[i].fields, PLAYER_STATE_FIELD_BITS);
+		WritePlayerFields(writer, *changes[i].values, changes[i].fields);
+	}
+	msg.players = writer.Finish();
+}
+
+bool ApplySnapshotDelta(const PlayersUpdateMessage& msg, SnapshotState& state, std::vector<int>* updated) {
+	struct Decoded {
+		int id;
+		uint8_t fields;
+		PlayerValues values;
+	};
+
+	// Read everything first, so a bad datagram changes nothing
+	BitReader reader(msg.players.data(), msg.players.size());
+	uint32_t count;
+	if (!reader.ReadBits(SNAPSHOT_COUNT_BITS, count)) return false;
+	// Every player takes at least its ID and fields, so a count the data can't hold is turned away before allocating for it
+	if (count > reader.BitsLeft() / SnapshotChangeBits(0)) return false;
+	std::vector<Decoded> decoded(count);
+	for (Decoded& player : decoded) {
+		uint32_t id, fields;
+		if (!reader.ReadBits(PlayerStateSchema::idBits, id) || !reader.ReadBits(PLAYER_STATE_FIELD_BITS, fields)) return false;
+		player.id = (int)id;
+		player.fields = (uint8_t)fields;
+		player.values.position.resize(3);
+		player.values.velocity.resize(3);
+		if (!ReadPlayerFields(reader, player.values, player.fields)) return false;
+
+		// New to this client, so everything has to be there
+		if (player.fields != STATE_ALL && !state.count(player.id)) return false;
+	}
+
+	for (int id : msg.removed) {
+		state.erase(id);
+	}
+	if (updated) updated->clear();
+	for (Decoded& player : decoded) {
+		PlayerValues& values = state[player.id];
+		if (player.fields & STATE_POSITION) values.position = player.values.position;
+		if (player.fields & STATE_VELOCITY) values.velocity = player.values.velocity;
+		if (player.fields & STATE_ROTATION) values.rotation = player.values.rotation;
+		if (updated) updated->push_back(player.id);
+	}
+	return true;
+}
+
+SnapshotFragmentResult SnapshotAssembler::Add(const PlayersUpdateMessage& msg, SnapshotHistory& history) {
+	if (msg.fragmentCount == 0 || msg.fragmentCount > SNAPSHOT_MAX_FRAGMENTS || msg.fragment >= msg.fragmentCount) {
+		return SnapshotFragmentResult::BAD_FRAGMENT;
+	}
+	if (msg.sequence < sequence_) return SnapshotFragmentResult::DISCARDED;
+
+	if (msg.sequence > sequence_) {
+		// Rebuild the full snapshot from the baseline the server made it against.
+		// Without that baseline it can't be used, and isn't acked so the server keeps to one we have.
+		const SnapshotState* baseline = history.Find(msg.baseline);
+		sequence_ = msg.sequence;
+		fragmentCount_ = msg.fragmentCount;
+		received_ = 0;
+		valid_ = msg.baseline == 0 || baseline;
+		if (baseline) state_ = *baseline;
+		else state_.clear();
+		if (!valid_) return SnapshotFragmentResult::UNKNOWN_BASELINE;
+	}
+
+	if (msg.fragmentCount != fragmentCount_) return SnapshotFragmentResult::BAD_FRAGMENT;
+	uint64_t fragmentBit = (uint64_t)1 << msg.fragment;
+	if (!valid_ || (received_ & fragmentBit)) return SnapshotFragmentResult::DISCARDED;
+	if (!ApplySnapshotDelta(msg, state_, &updated_)) {
+		valid_ = false;
+		return SnapshotFragmentResult::MISFIT;
+	}
+	received_ |= fragmentBit;
+
+	// Once every datagram is in, it can be a baseline
+	uint64_t allFragments = fragmentCount_ == 64 ? ~(uint64_t)0 : ((uint64_t)1 << fragmentCount_) - 1;
+	if (received_ != allFragments) return SnapshotFragmentResult::APPLIED;
+	history.Store(sequence_, state_);
+	return SnapshotFragmentResult::COMPLETE;
+}
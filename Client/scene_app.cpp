@@ -1,5 +1,7 @@
 #pragma once
 #include "scene_app.h"
+#include "Log.h"
+#include "PlayerMovement.h"
 #include <system/platform.h>
 #include <platform/d3d11/system/platform_d3d11.h>
 #include <graphics/sprite_renderer.h>
@@ -12,6 +14,7 @@
 #include "ImGui/imgui_impl_win32.h"
 #include "ImGui/imgui_impl_dx11.h"
 #include <iostream>
+#include <algorithm>
 #include "NetworkClient.h"
 
 SceneApp::SceneApp(gef::Platform& platform) :
@@ -21,8 +24,6 @@ SceneApp::SceneApp(gef::Platform& platform) :
 	primitive_builder_(NULL),
 	font_(NULL)
 {
-	playerInput_.velocity.push_back(0);
-	playerInput_.velocity.push_back(0);
 }
 
 void SceneApp::Init()
@@ -44,10 +45,9 @@ void SceneApp::Init()
 
 	// Initialise the scene objects
 	ground_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(30.f, 0.5f, 30.f)));
-	ground_.InitPhysx(physx::PxVec3(30.f, 0.5f, 30.f), physx::PxVec3(0, 0, 0), gScene, gPhysics);
 
 	block_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(0.5, 0.5, 0.5)));
-	block_.InitPhysx(physx::PxVec3(0.5, 0.5, 0.5), physx::PxVec3(2, 1, 0), gScene, gPhysics);
+	initScenery(gScene, ground_, block_);
 
 
 	InitFont();
@@ -74,7 +74,18 @@ void SceneApp::initPhysics()
 	sceneDesc->cpuDispatcher = gDispatcher;
 	sceneDesc->filterShader = PxDefaultSimulationFilterShader;
 	gScene = gPhysics->createScene(*sceneDesc);
-	
+
+	// Each replay scene gets its own copy of the scenery
+	predictionScenes_.Init(gPhysics, *sceneDesc);
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		initScenery(predictionScenes_.Scene(i), predictionGround_[i], predictionBlock_[i]);
+	}
+}
+
+void SceneApp::initScenery(physx::PxScene* scene, GameObject& ground, GameObject& block)
+{
+	ground.InitPhysx(physx::PxVec3(30.f, 0.5f, 30.f), physx::PxVec3(0, 0, 0), scene, gPhysics);
+	block.InitPhysx(physx::PxVec3(0.5, 0.5, 0.5), physx::PxVec3(2, 1, 0), scene, gPhysics);
 }
 
 void SceneApp::updatePhysics(float dt)
@@ -85,17 +96,94 @@ void SceneApp::updatePhysics(float dt)
 
 	accumulator_ -= stepSize_;
 
+	predictMyPlayer();
 	gScene->simulate(stepSize_);
 	gScene->fetchResults(true);
+	if (myPlayer_) prediction_.SetPosition(prediction_.Latest(), myPlayer_->getPosition());
 	return;
 }
 
+void SceneApp::predictMyPlayer()
+{
+	if (!myPlayer_) return;
+	gef::Keyboard* keyInput = input_->keyboard();
+
+	// One input every step, even with nothing pressed, so the server steps through the same inputs in the same order
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_E)) {
+		myPlayer_->rotate(gef::DegToRad(-90) * stepSize_);
+	}
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_Q)) {
+		myPlayer_->rotate(gef::DegToRad(90) * stepSize_);
+	}
+	physx::PxVec3 direction(0, 0, 0);
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_W)) {
+		direction += myPlayer_->getForwardVec();
+	}
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_S)) {
+		direction -= myPlayer_->getForwardVec();
+	}
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_A)) {
+		direction -= myPlayer_->getRightVec();
+	}
+	if (keyInput->IsKeyDown(gef::Keyboard::KC_D)) {
+		direction += myPlayer_->getRightVec();
+	}
+
+	InputUpdateMessage& input = prediction_.Add();
+	input.time = network_.GetTime();
+	input.velocity[0] = direction.x;
+	input.velocity[1] = direction.z;
+	input.rotation = myPlayer_->getRotation();
+	input.jump = jumpPressed_; //TODO: stop infinite jumping
+	jumpPressed_ = false;
+
+	ApplyPlayerInput(*myPlayer_, input);
+	network_.SendInput(input); // Send input to server
+}
+
+void SceneApp::reconcileMyPlayer(uint32_t inputSequence, const PlayerValues& values)
+{
+	physx::PxVec3 position(values.position[0], values.position[1], values.position[2]);
+	if (!prediction_.Acknowledge(inputSequence, position)) return;
+
+	// Back to where the server had it, then every input since again. In a scene of its own, with just the
+	// scenery, so nothing else moves. Other players aren't there to bump into, the next snapshot sorts that out.
+	physx::PxScene* scene = predictionScenes_.Lease();
+	if (!scene) {
+		// Nowhere to replay, so take the server's position as it is. The inputs since are lost, but it's back in step.
+		myPlayer_->setPosition(position);
+		myPlayer_->setVelocity(physx::PxVec3(values.velocity[0], values.velocity[1], values.velocity[2]));
+		return;
+	}
+	LOG_DEBUG(LOG_GAME, "Replaying %u inputs from %u\n", prediction_.Latest() - prediction_.Acknowledged(), prediction_.Acknowledged());
+	myPlayer_->SwitchToLocalScene(scene);
+	myPlayer_->setPosition(position);
+	myPlayer_->setVelocity(physx::PxVec3(values.velocity[0], values.velocity[1], values.velocity[2]));
+	myPlayer_->setRotation(values.rotation);
+	for (uint32_t sequence = prediction_.Acknowledged() + 1; sequence <= prediction_.Latest(); sequence++) {
+		PredictedInput* predicted = prediction_.Get(sequence);
+		if (!predicted) continue;
+		ApplyPlayerInput(*myPlayer_, predicted->input);
+		myPlayer_->UpdateLocalScene(stepSize_);
+		predicted->position = myPlayer_->getPosition();
+	}
+	physx::PxVec3 velocity = myPlayer_->getVelocity();
+	myPlayer_->SwitchToGlobalScene();
+	myPlayer_->setVelocity(velocity);
+	predictionScenes_.Return(scene);
+}
+
 void SceneApp::AddMyPlayer(JoinGameMessage msg) {
 	playersMutex_.lock();
 	for(auto playerID : msg.activePlayers) {
 		addPlayer(primitive_builder_, gScene, gPhysics, playerID);
 	}
-	myPlayer_ = players_[msg.playerID].get();
+	auto it = players_.find(msg.playerID);
+	myPlayer_ = it != players_.end() ? it->second.get() : nullptr;
+	if (myPlayer_) {
+		myPlayer_->setKinematic(false);
+		myPlayerID_ = msg.playerID;
+	}
 	playersMutex_.unlock();
 }
 
@@ -107,14 +195,16 @@ void SceneApp::AddPlayer(int playerID) {
 
 void SceneApp::RemovePlayer(int playerID) {
 	playersMutex_.lock();
-	players_[playerID].reset();
+	players_.erase(playerID);
 	playersMutex_.unlock();
 }
 
 void SceneApp::addPlayer(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int playerID) {
-	players_[playerID] = std::make_unique<Player>();
-	players_[playerID]->Init(primitive_builder_, gScene, gPhysics, sceneDesc, playerID);
-	players_[playerID]->setID(playerID);
+	std::unique_ptr<Player>& player = players_[playerID];
+	player = std::make_unique<Player>();
+	player->Init(primitive_builder_, gScene, gPhysics, playerID);
+	player->setID(playerID);
+	player->setKinematic(true); // Only ours is simulated, see AddMyPlayer
 }
 
 void SceneApp::CleanUp()
@@ -130,8 +220,29 @@ void SceneApp::CleanUp()
 	delete sprite_renderer_;
 	sprite_renderer_ = NULL;
 
+	// PhysX objects go in the reverse of the order they were made, so nothing outlives what it came from:
+	// the players' bodies and the scenery, the scenes, the dispatcher they ran on, then the physics itself
+	playersMutex_.lock();
+	players_.clear();
+	myPlayer_ = nullptr;
+	playersMutex_.unlock();
+	block_.ReleasePhysx();
+	ground_.ReleasePhysx();
+	for (size_t i = PREDICTION_SCENE_POOL_SIZE; i-- > 0;) {
+		predictionBlock_[i].ReleasePhysx();
+		predictionGround_[i].ReleasePhysx();
+	}
+	predictionScenes_.CleanUp();
+	gScene->release();
+	gScene = NULL;
+	gDispatcher->release();
+	gDispatcher = NULL;
+	delete sceneDesc;
+	sceneDesc = NULL;
 	gPhysics->release();
+	gPhysics = NULL;
 	gFoundation->release();
+	gFoundation = NULL;
 
 	ImGui_ImplDX11_Shutdown();
 	ImGui_ImplWin32_Shutdown();
@@ -150,115 +261,83 @@ bool SceneApp::Update(float frame_time)
 
 	fps_ = 1.0f / frame_time;
 
-	playersMutex_.lock();
-	if (myPlayer_) {
-		if (keyInput->IsKeyPressed(gef::Keyboard::KC_SPACE) || keyInput->IsKeyDown(gef::Keyboard::KC_E) || keyInput->IsKeyDown(gef::Keyboard::KC_Q) || keyInput->IsKeyDown(gef::Keyboard::KC_W) || keyInput->IsKeyDown(gef::Keyboard::KC_S) || keyInput->IsKeyDown(gef::Keyboard::KC_A) || keyInput->IsKeyDown(gef::Keyboard::KC_D) || prevSentInputVel != physx::PxVec3(0,0,0)) {
-			physx::PxRigidDynamic* playerBody = myPlayer_->GetPxBody();
-			physx::PxVec3 oldVelocity = playerBody->getLinearVelocity();
-			physx::PxVec3 newVelocity(0, 0, 0);
-
-			playerInput_.jump = false;
-			if (keyInput->IsKeyPressed(gef::Keyboard::KC_SPACE)) {
-				playerBody->addForce(physx::PxVec3(0, 7, 0), physx::PxForceMode::eIMPULSE); //TODO: stop infinite jumping
-				playerInput_.jump = true;
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_E)) {
-				myPlayer_->rotate(gef::DegToRad(-90) * frame_time);
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_Q)) {
-				myPlayer_->rotate(gef::DegToRad(90) * frame_time);
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_W)) {
-				newVelocity += myPlayer_->getForwardVec();
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_S)) {
-				newVelocity -= myPlayer_->getForwardVec();
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_A)) {
-				newVelocity -= myPlayer_->getRightVec();
-			}
-			if (keyInput->IsKeyDown(gef::Keyboard::KC_D)) {
-				newVelocity += myPlayer_->getRightVec();
-			} //Send this to server
-
-			prevSentInputVel = newVelocity;
+	// Pressed this frame, jumps on the next step
+	if (keyInput->IsKeyPressed(gef::Keyboard::KC_SPACE)) {
+		jumpPressed_ = true;
+	}
 
-			playerInput_.velocity[0] = newVelocity.x;
-			playerInput_.velocity[1] = newVelocity.z;
-			playerInput_.rotation = myPlayer_->getRotation();
-		
-			network_.SendInput(playerInput_); // Send input to server
-			
-			newVelocity.normalize();
-			newVelocity = newVelocity * 3;
-			newVelocity.y = oldVelocity.y;
+	playersMutex_.lock();
+	updatePhysics(frame_time);
 
-			myPlayer_->setVelocity(newVelocity);
+	//================= Interpolation stuff here =======================
 
-		}
+	// Take whatever the server sent since last frame
+	std::vector<ServerPlayerSample> serverSamples;
+	std::vector<int> serverRemoved;
+	std::vector<int> serverInView;
+	bool serverValuesComplete;
+	PlayerValues serverMyValues;
+	uint32_t serverInputSequence = 0;
+	serverValuesMutex_.lock();
+	serverSamples.swap(serverSamples_);
+	serverRemoved.swap(serverRemoved_);
+	serverValuesComplete = serverValuesComplete_;
+	if (serverValuesComplete) {
+		serverInView.swap(serverInView_);
+		serverMyValues = serverMyValues_;
+		serverInputSequence = serverInputSequence_;
 	}
+	serverValuesComplete_ = false;
+	serverValuesMutex_.unlock();
 
-	updatePhysics(frame_time);
+	if (myPlayer_ && serverInputSequence != 0) {
+		reconcileMyPlayer(serverInputSequence, serverMyValues);
+	}
 
-	//================= Interpolation stuff here =======================
+	// Everyone else is drawn from their samples, a bit behind the server so there's normally one either side
+	std::vector<int> serverUpdated;
+	for (ServerPlayerSample& sample : serverSamples) {
+		auto it = players_.find(sample.ID);
+		if (it == players_.end() || !it->second || it->second.get() == myPlayer_) continue;
+		it->second->getInterpolation().Add(sample.time, sample.values);
+		serverUpdated.push_back(sample.ID);
+	}
+	std::sort(serverUpdated.begin(), serverUpdated.end());
+	uint32_t renderTime = (uint32_t)(network_.GetTime() - interpolationDelay_);
 
-	for (auto& player : players_) {
-		if (player) {
+	for (auto& entry : players_) {
+		std::unique_ptr<Player>& player = entry.second;
+		if (player.get() == myPlayer_) {
+			// Predicted, and corrected above
+			player->UpdatePhysx();
+		}
+		else if (player) {
 			int ID = player->getID();
-			if (serverPlayerValues_.count(ID)) {
-				//Get the position sent by the server and players current position
-				physx::PxVec3 pos(0, 0, 0);
-				pos.x = serverPlayerValues_[ID].position[0];
-				pos.y = serverPlayerValues_[ID].position[1];
-				pos.z = serverPlayerValues_[ID].position[2];
-
-				physx::PxVec3 vel(0, 0, 0);
-				vel.x = serverPlayerValues_[ID].velocity[0];
-				vel.y = serverPlayerValues_[ID].velocity[1];
-				vel.z = serverPlayerValues_[ID].velocity[2];
-
-				physx::PxVec3 currentPos = player->getPosition();
-				printf("time: %d, x: %f, y: %f\n", network_.GetTime(), currentPos.x, currentPos.y);
-
-				// Do interpolation if player isn't close enough (but also skip if too far, just teleport the player)
-				float diff = (pos - currentPos).magnitude();
-				if (diff > 0.01 && diff < 0.8) {
-					// Run physics simulation on player using the latest server values
-					player->SwitchToLocalScene();
-					player->setPosition(pos);
-					player->setVelocity(vel);
-					player->GetPxBody()->setActorFlag(physx::PxActorFlag::eDISABLE_GRAVITY, false);
-					float delay = (network_.GetTime() - serverValuesTime_) / 1000;
-					player->UpdateLocalScene(serverTick_ + delay); // Simulate from when it was sent till the next tick time (in the future)
-		
-					// get players future position and work out velocity needed to make it there quick enough
-					physx::PxVec3 futurePos = player->getPosition();
-					physx::PxVec3 lerpVelocity = (futurePos - currentPos) * TICKRATE;
-					
-					// go back to incorrect position but with the new interpolation velocity
-					player->GetPxBody()->setActorFlag(physx::PxActorFlag::eDISABLE_GRAVITY, true);
-					player->SwitchToGlobalScene();
-					player->setPosition(currentPos);
-					player->setVelocity(lerpVelocity);
-				}
-				else {
-					player->SwitchToGlobalScene();
-					player->setPosition(pos);
-					player->setVelocity(vel);
-					player->GetPxBody()->setActorFlag(physx::PxActorFlag::eDISABLE_GRAVITY, false);
-				}
-
-				player->setRotation(serverPlayerValues_[ID].rotation);
+			bool updated = std::binary_search(serverUpdated.begin(), serverUpdated.end(), ID);
+			// A snapshot only holds the players near ours, so anyone it removed, or missing from a whole one, has gone out of view
+			bool outOfView = !updated &&
+				((serverValuesComplete && !std::binary_search(serverInView.begin(), serverInView.end(), ID)) ||
+				std::find(serverRemoved.begin(), serverRemoved.end(), ID) != serverRemoved.end());
+			if (outOfView && player->isInView()) {
+				// It'll have moved a long way by the time it's back, so it goes straight to its first sample then
+				player->setInView(false);
+				player->getInterpolation().Clear();
+			}
+			if (updated) {
+				player->setInView(true);
 			}
-			player->UpdatePhysx();
 
+			physx::PxVec3 pos;
+			float rotation;
+			if (player->isInView() && player->getInterpolation().Sample(renderTime, pos, rotation)) {
+				player->setPose(pos, rotation);
+			}
+			player->UpdatePhysx();
 		}
 	}
 
 	playersMutex_.unlock();
 
-	serverPlayerValues_.clear();
-
 	gui();
 
 	return true;
@@ -298,6 +377,32 @@ void SceneApp::TextToChat(int playerID, const char* chatMsg) {
 	chatString_ += "\n";
 }
 
+void SceneApp::SetServerPlayerVals(std::map<int, PlayerValues>& vals, std::vector<int>& removed, int time, const std::map<int, PlayerValues>* snapshot, uint32_t inputSequence) {
+	serverValuesMutex_.lock();
+	for (int ID : removed) {
+		serverSamples_.erase(std::remove_if(serverSamples_.begin(), serverSamples_.end(),
+			[ID](const ServerPlayerSample& sample) { return sample.ID == ID; }), serverSamples_.end());
+	}
+	for (auto& player : vals) {
+		serverSamples_.push_back({ player.first, time, player.second });
+	}
+	serverRemoved_.insert(serverRemoved_.end(), removed.begin(), removed.end());
+	if (snapshot) {
+		serverInView_.clear();
+		for (auto& player : *snapshot) {
+			serverInView_.push_back(player.first);
+		}
+		serverValuesComplete_ = true;
+		// Only worth checking against with an input to go with it
+		auto mine = snapshot->find(myPlayerID_);
+		if (mine != snapshot->end() && inputSequence != 0) {
+			serverMyValues_ = mine->second;
+			serverInputSequence_ = inputSequence;
+		}
+	}
+	serverValuesMutex_.unlock();
+}
+
 void SceneApp::Render()
 {
 
@@ -341,9 +446,9 @@ void SceneApp::Render()
 }
 
 void SceneApp::renderPlayers() {
-	for (int i = 0; i < 5 ; i++) {
-		if (players_[i]) {
-			switch (i)
+	for (auto& entry : players_) {
+		if (entry.second && entry.second->isInView()) {
+			switch (SlotMapIndex(entry.first) % 5)
 			{
 			case 0:
 				renderer_3d_->set_override_material(&primitive_builder_->red_material());
@@ -363,7 +468,7 @@ void SceneApp::renderPlayers() {
 			default:
 				break;
 			}
-			renderer_3d_->DrawMesh(*players_[i].get());
+			renderer_3d_->DrawMesh(*entry.second.get());
 		}
 	}
 }
@@ -13,11 +13,17 @@
 #include "GameObject.h"
 #include "Player.h"
 #include "Messages.h"
+#include "SlotMap.h"
+#include "PredictionBuffer.h"
+#include "PredictionScenePool.h"
 #include <input/keyboard.h>
 #include <PxPhysicsAPI.h>
 #include <string>
 #include <mutex>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
 
 
 
@@ -44,14 +50,23 @@ public:
 	void RemovePlayer(int playerID);
 	Player* GetMyPlayer() { return myPlayer_; }
 	void TextToChat(int playerID, const char* chatMsg);
-	void SetServerPlayerVals(std::map<int, PlayerValues>& vals, int time) { serverPlayerValues_ = vals; serverValuesTime_ = time; }
+	// Server values arrive a datagram at a time and build up until the next Update. time is the server time they're
+	// from, and removed have gone out of view.
+	// snapshot is given once a whole snapshot is in, then anyone not in it is out of view too, and inputSequence is
+	// the last of our inputs the server had used for it.
+	void SetServerPlayerVals(std::map<int, PlayerValues>& vals, std::vector<int>& removed, int time, const std::map<int, PlayerValues>* snapshot, uint32_t inputSequence);
 private:
 	void InitFont();
 	void CleanUpFont();
 	void DrawHUD();
 	void SetupLights();
 	void initPhysics();
+	void initScenery(physx::PxScene* scene, GameObject& ground, GameObject& block);
 	void updatePhysics(float dt);
+	// Apply this step's input to our player and send it, before the step
+	void predictMyPlayer();
+	// Check our player against where the server had it after inputSequence, and replay the inputs since if it's out
+	void reconcileMyPlayer(uint32_t inputSequence, const PlayerValues& values);
 	void gui();
 	void renderPlayers();
 	void addPlayer(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int playerID);
@@ -66,14 +81,33 @@ private:
 
 	PrimitiveBuilder* primitive_builder_;
 
-	std::unique_ptr<Player> players_[5];
+	// Keyed by the IDs the server hands out, which are slot map IDs
+	std::unordered_map<int, std::unique_ptr<Player>> players_;
 	Player* myPlayer_ = nullptr;
 	std::mutex playersMutex_;
 
-	InputUpdateMessage playerInput_;
-	physx::PxVec3 prevSentInputVel = physx::PxVec3(0, 0, 0);
-	std::map<int, PlayerValues> serverPlayerValues_;
-	int serverValuesTime_;
+	// Our player moves as soon as a key's pressed, and is corrected once the server's caught up
+	PredictionBuffer prediction_;
+	bool jumpPressed_ = false; // Held until the next step, which might not be this frame
+	std::atomic<int> myPlayerID_{ -1 }; // For picking our player out of snapshots on the network thread
+	// Scenes to replay inputs in, each with the scenery again
+	PredictionScenePool predictionScenes_;
+	GameObject predictionGround_[PREDICTION_SCENE_POOL_SIZE];
+	GameObject predictionBlock_[PREDICTION_SCENE_POOL_SIZE];
+
+	// One player's values from a snapshot, and the server time it was taken
+	struct ServerPlayerSample {
+		int ID;
+		int time;
+		PlayerValues values;
+	};
+	std::vector<ServerPlayerSample> serverSamples_;
+	std::vector<int> serverRemoved_;
+	std::vector<int> serverInView_; // Sorted, from the last whole snapshot
+	bool serverValuesComplete_ = false;
+	PlayerValues serverMyValues_; // Our player from the last whole snapshot
+	uint32_t serverInputSequence_ = 0;
+	std::mutex serverValuesMutex_;
 	//std::map<int, std::map<int, float>> prevServerPlayerValues_;
 
 	GameObject ground_;
@@ -88,7 +122,7 @@ private:
 	physx::PxScene* gScene = NULL;
 	float accumulator_ = 0.0f;
 	float stepSize_ = 1.0f / 60.0f;
-	float serverTick_ = 1.f / TICKRATE;
+	int interpolationDelay_ = INTERPOLATION_DELAY; // Other players are drawn this far (ms) behind server time
 
 	char ChatBuff_[100] = "";
 	std::string chatString_ = "";
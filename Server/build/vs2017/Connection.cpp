@@ -1,136 +1,149 @@
 #include "Connection.h"
 #include <iostream>
 #include "NetworkServer.h"
+#include "Log.h"
 #include "msgpack.hpp"
-#include "Player.h"
+#include <cerrno>
 
-Connection::Connection(SOCKET sock, WSAEVENT eventTCP, int playerID, NetworkServer* server) {
+Connection::Connection(SOCKET sock, uint32_t handle, int playerID, NetworkServer* server) {
 	socketTCP_ = sock;
+	handle_ = handle;
 	playerID_ = playerID;
-	eventTCP_ = eventTCP;
 	server_ = server;
 }
 
 // Destructor.
 Connection::~Connection() {
-	printf("Closing connection\n");
-	closesocket(socketTCP_);
-}
-
-bool Connection::Read() {
-	// Receive the length of the incoming message if we haven't already
-	if (readCountTCP_ < HeaderLenFieldSize) {
-		int count = recv(socketTCP_, readBufferTCP_ + readCountTCP_, HeaderLenFieldSize - readCountTCP_, 0);
-		if (count == SOCKET_ERROR) {
-			printf("Receive failed\n");
-			if (WSAGetLastError() == WSAEWOULDBLOCK) {
-				return true;
-			}
-			else {
-				printf("Connection closed or broken\n");
-				return false;
-			}
-		}
-		printf("TCP Received %d bytes\n", count);
-		readCountTCP_ += count;
-		if (count < HeaderLenFieldSize) return false;
-	}
-
-	// Get length of message
-	uint16_t msgLength = (uint16_t)readBufferTCP_[0];
+	LOG_INFO(LOG_TCP, "Closing connection\n");
+	if (socketTCP_ != INVALID_SOCKET) closesocket(socketTCP_);
+}
 
-	int count = recv(socketTCP_, readBufferTCP_ + readCountTCP_, msgLength - readCountTCP_, 0);
+int Connection::Read() {
+	// Receive as much as there's room for in one go
+	size_t space;
+	char* dest = decoderTCP_.GetWriteSpace(space);
+	int count = recv(socketTCP_, dest, (int)space, 0);
 	if (count == SOCKET_ERROR) {
-		printf("Receive failed\n");
 		if (WSAGetLastError() == WSAEWOULDBLOCK) {
-			return true;
+			return 0;
 		}
 		else {
-			printf("Connection closed or broken\n");
-			return false;
+			LOG_INFO(LOG_TCP, "Connection closed or broken\n");
+			return -1;
 		}
 	}
-	printf("TCP Received %d bytes\n", count);
-	readCountTCP_ += count;
-
-	if (readCountTCP_ < msgLength) {
-		// ... but we've not received a complete message yet.
-		// So we can't do anything until we receive some more.
-		return true;
+	if (count == 0) {
+		LOG_INFO(LOG_TCP, "Connection closed by client\n");
+		return -1;
 	}
-
-	// We've got a complete message.
-	printf("TCP Received message from client: '");
-	fwrite(readBufferTCP_, 1, msgLength, stdout);
-	printf("'\n\n");
-
-	server_->HandleMessage(playerID_, msgLength, readBufferTCP_);
-
-	// Clear the buffer, ready for the next message.
-	readCountTCP_ = 0;
-	return true;
+	decoderTCP_.CommitWrite(count);
+
+	// Handle every complete message that's arrived, straight from the receive buffer
+	const char* msg;
+	uint16_t msgLength;
+	int result;
+	while ((result = decoderTCP_.NextFrame(msg, msgLength)) == 1) {
+		server_->HandleMessage(playerID_, msgLength, msg);
+	}
+	if (result == -1) {
+		LOG_WARNING(LOG_TCP, "Malformed message stream from client\n");
+		return -1;
+	}
+	return 1;
 }
 
-int Connection::Write(std::string msg) {
-	// Try to send as much as is left to send
-	int msgLength = msg.length();
-	int messageLeft = (msgLength)-writeCountTCP_;
-	int count = send(socketTCP_, msg.data() + writeCountTCP_, messageLeft, 0);
-	if (count == SOCKET_ERROR)
+int Connection::Write() {
+	// Gather every queued message into one send, starting partway through the first if it was cut short last time
+	const char* msgs[OUTBOUND_RING_SLOTS];
+	uint16_t lengths[OUTBOUND_RING_SLOTS];
+	int count = 0;
+	while (count < OUTBOUND_RING_SLOTS && (msgs[count] = msgsTCP_.Peek(count, lengths[count]))) {
+		count++;
+	}
+	if (count == 0) return 1;
+
+#ifdef _WIN32
+	WSABUF buffers[OUTBOUND_RING_SLOTS];
+	for (int i = 0; i < count; i++) {
+		int offset = i == 0 ? writeCountTCP_ : 0;
+		buffers[i].buf = (CHAR*)msgs[i] + offset;
+		buffers[i].len = lengths[i] - offset;
+	}
+	DWORD sent = 0;
+	int sentBytes = WSASend(socketTCP_, buffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR ? SOCKET_ERROR : (int)sent;
+#else
+	iovec buffers[OUTBOUND_RING_SLOTS];
+	for (int i = 0; i < count; i++) {
+		int offset = i == 0 ? writeCountTCP_ : 0;
+		buffers[i].iov_base = (void*)(msgs[i] + offset);
+		buffers[i].iov_len = lengths[i] - offset;
+	}
+	msghdr header = {};
+	header.msg_iov = buffers;
+	header.msg_iovlen = count;
+	int sentBytes = sendmsg(socketTCP_, &header, MSG_NOSIGNAL);
+#endif
+	stats_.sendCalls++;
+
+	if (sentBytes == SOCKET_ERROR)
 	{
-		printf("Send failed\n");
 		if (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENOBUFS) {
 			writeableTCP_ = false;
-			return false;
+			return 0;
 		}
 		else {
-			printf("Connection closed or broken\n");
-			fprintf(stderr, "\nError: (WSAGetLastError() = %d)", WSAGetLastError());
+			LOG_INFO(LOG_TCP, "Connection closed or broken (WSAGetLastError() = %d)\n", WSAGetLastError());
 			return -1;
 		}
 	}
-
-	// We've written some data to the socket
-	printf("Sent %d bytes to the client.\n", count);
-	writeCountTCP_ += count;
-
-	if (writeCountTCP_ < msgLength) {
-		printf("Not all sent\n");
-		// but not written the whole message. Stop writing for now.
-		writeableTCP_ = false;
-		//WSAResetEvent(eventsTCP_[1]);
-		return false;
+	stats_.bytesSent += sentBytes;
+
+	// Pop every message that went out whole. Whatever's left of a cut short one is picked up next time.
+	int remaining = sentBytes;
+	for (int i = 0; i < count; i++) {
+		int left = lengths[i] - writeCountTCP_;
+		if (remaining < left) {
+			writeCountTCP_ += remaining;
+			stats_.partialWrites++;
+			// Not written everything. Stop writing for now.
+			writeableTCP_ = false;
+			return 0;
+		}
+		remaining -= left;
+		writeCountTCP_ = 0;
+		msgsTCP_.Pop();
+		stats_.messagesSent++;
 	}
-
-	// Written a complete message.
-	printf("Sent message to the client: '");
-	fwrite(msg.data(), 1, msgLength, stdout);
-	printf("'\n\n");
-
-	writeCountTCP_ = 0;
-	return true;
+	return 1;
 }
 
 void Connection::CreateServerAcceptMessage() {
+	//Create message
+	ServerAcceptMessage msg;
 	MessageType msgType = MessageType::SERVERACCEPT;
-	uint16_t msgLen = HeaderSize;
-
-	memcpy(writeBufferTCP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferTCP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	msg.handleUDP = (uint16_t)handle_;
+	msg.tokenUDP = tokenUDP_;
+	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSize;
 
-	AddMessage(msgLen, writeBufferTCP_);
+	//Add the message to the queue of outgoing messages
+	AddMessage(msgLen, msgType, msgData);
 }
 
 void Connection::CreateServerFullMessage() {
 	MessageType msgType = MessageType::SERVERFULL;
 	uint16_t msgLen = HeaderSize;
 
-	memcpy(writeBufferTCP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferTCP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	char header[HeaderSize];
+	memcpy(header, &msgLen, HeaderLenFieldSize);
+	memcpy(header + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
 
-	AddMessage(msgLen, writeBufferTCP_);
+	AddMessage(msgLen, header);
 }
 
+// Every player's ID (at most 5 bytes packed), and a little for the rest, has to fit in one frame
+static_assert(MAX_PLAYERS * 5 + 16 <= FRAME_MAX_SIZE, "JOINGAME can't list MAX_PLAYERS players");
+
 void Connection::CreateJoinMessage(std::vector<Connection*>& clients) {
 	JoinGameMessage msg;
 	MessageType msgType = MessageType::JOINGAME;
@@ -182,47 +195,274 @@ void Connection::CreatePlayerQuitMessage(int id) {
 	AddMessage(msgLen, msgType, msgData);
 }
 
-void Connection::AddMessage(uint16_t& msgLen, MessageType& msgType, std::vector<uint8_t>& msgData) {
-	memcpy(writeBufferTCP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferTCP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
-	memcpy(writeBufferTCP_ + HeaderSize, (const char*)msgData.data(), msgData.size());
+bool Connection::AddMessage(uint16_t& msgLen, MessageType& msgType, std::vector<uint8_t>& msgData) {
+	// The length field can't say how big it is, and msgLen will have wrapped round
+	if (msgData.size() + HeaderSize > FRAME_MAX_SIZE) {
+		LOG_ERROR(LOG_TCP, "Message type %d of %u bytes is too big to send to player %d - message dropped\n", (int)msgType, (unsigned)(msgData.size() + HeaderSize), playerID_);
+		return false;
+	}
 
-	std::string msgStr(writeBufferTCP_, msgLen);
+	// Built on the stack, as several threads may be adding messages at once
+	char header[HeaderSize];
+	memcpy(header, &msgLen, HeaderLenFieldSize);
+	memcpy(header + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
 
-	msgsMutexTCP_.lock();
-	msgsTCP_.push(msgStr);
-	msgsMutexTCP_.unlock();
+	if (!msgsTCP_.Push(header, HeaderSize, (const char*)msgData.data(), (uint16_t)msgData.size())) {
+		QueueFull();
+		return false;
+	}
 
-	WSASetEvent(eventTCP_); //Signal that there is a new message to be sent
+	server_->QueueSend(handle_); //Signal that there is a new message to be sent
+	return true;
 }
 
-void Connection::AddMessage(uint16_t& msgLen, const char* buffer) {
-	std::string msgStr(buffer, msgLen);
+bool Connection::AddMessage(uint16_t& msgLen, const char* buffer) {
+	if (!msgsTCP_.Push(buffer, msgLen)) {
+		QueueFull();
+		return false;
+	}
 
-	msgsMutexTCP_.lock();
-	msgsTCP_.push(msgStr);
-	msgsMutexTCP_.unlock();
+	server_->QueueSend(handle_); //Signal that there is a new message to be sent
+	return true;
+}
 
-	WSASetEvent(eventTCP_); //Signal that there is a new message to be sent
+void Connection::QueueFull() {
+	//Reliable messages can't just be dropped, the client would be out of step with everyone else from then on.
+	//A client that isn't taking what it's sent fast enough is closed instead, by the network thread.
+	if (droppedMessages_++ == 0) {
+		LOG_WARNING(LOG_TCP, "Outgoing queue full for player %d - disconnecting\n", playerID_);
+	}
+	setClosing();
+	server_->QueueSend(handle_);
 }
 
 int Connection::SendMessages() { //1 - all good, 0 - unwritable, -1 - broken
-	while (true) {
-		msgsMutexTCP_.lock();
-		if (msgsTCP_.empty()) {
-			msgsMutexTCP_.unlock();
-			return true;
+	uint64_t callsBefore = stats_.sendCalls;
+	int result;
+	// Messages can be added while we're writing, so keep going until the queue is empty
+	while ((result = Write()) == 1 && !msgsTCP_.Empty()) {}
+
+	if (stats_.sendCalls != callsBefore) {
+		stats_.batchesFlushed++;
+		stats_.lastBatchSendCalls = (uint32_t)(stats_.sendCalls - callsBefore);
+	}
+	return result;
+}
+
+int Connection::SendReliable(uint32_t now, sockaddr_in* address) { //1 - all good, -1 - broken
+	reliableMutex_.lock();
+	// Queued messages are written into the stream whole, it cuts them up to fit datagrams
+	const char* queued;
+	uint16_t length;
+	while ((queued = msgsTCP_.Peek(0, length))) {
+		reliable_.Write(queued, length);
+		msgsTCP_.Pop();
+		stats_.messagesSent++;
+	}
+
+	bool alive = reliable_.Send(now, [&](uint32_t sequence, const char* data, uint16_t dataLength) {
+		ReliableMessage msg;
+		MessageType msgType = MessageType::RELIABLE;
+		msg.sequence = sequence;
+		msg.data.assign(data, data + dataLength);
+		std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+		uint16_t msgLen = msgData.size() + HeaderSize;
+
+		char buffer[DATAGRAM_BUFFER_SIZE];
+		memcpy(buffer, &msgLen, HeaderLenFieldSize);
+		memcpy(buffer + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+		memcpy(buffer + HeaderSize, (const char*)msgData.data(), msgData.size());
+		server_->SendDatagram(address, buffer, msgLen);
+		stats_.sendCalls++;
+		stats_.bytesSent += msgLen;
+	});
+	reliableMutex_.unlock();
+
+	if (!alive) {
+		LOG_INFO(LOG_UDP, "Player %d stopped acknowledging reliable messages\n", playerID_);
+		return -1;
+	}
+	return 1;
+}
+
+uint32_t Connection::ReceiveReliable(const ReliableMessage& msg) {
+	reliableMutex_.lock();
+	uint32_t next = reliable_.Receive(msg.sequence, msg.data.data(), msg.data.size(), decoderTCP_);
+
+	// Handle every complete message the stream now has, just as if it had come over TCP
+	const char* frame;
+	uint16_t frameLength;
+	int result;
+	while ((result = decoderTCP_.NextFrame(frame, frameLength)) == 1) {
+		server_->HandleMessage(playerID_, frameLength, frame);
+	}
+	reliableMutex_.unlock();
+
+	if (result == -1) {
+		LOG_WARNING(LOG_UDP, "Malformed reliable stream from player %d\n", playerID_);
+		setClosing();
+		server_->QueueSend(handle_);
+	}
+	return next;
+}
+
+void Connection::AcknowledgeReliable(uint32_t sequence) {
+	reliableMutex_.lock();
+	reliable_.Acknowledge(sequence);
+	reliableMutex_.unlock();
+}
+
+bool Connection::ReliablePending() {
+	reliableMutex_.lock();
+	bool pending = !reliable_.Idle();
+	reliableMutex_.unlock();
+	return pending;
+}
+
+bool Connection::getAddressUDP(sockaddr_in& address) {
+	addressMutexUDP_.lock();
+	bool known = hasAddressUDP_;
+	if (known) address = addressUDP_;
+	addressMutexUDP_.unlock();
+	return known;
+}
+
+bool Connection::setAddressUDP(const sockaddr_in& address) {
+	addressMutexUDP_.lock();
+	bool changed = !hasAddressUDP_ || addressUDP_.sin_port != address.sin_port || addressUDP_.sin_addr.s_addr != address.sin_addr.s_addr;
+	if (changed) {
+		addressUDP_ = address;
+		hasAddressUDP_ = true;
+	}
+	addressMutexUDP_.unlock();
+	return changed;
+}
+
+bool Connection::isAddressUDP(const sockaddr_in& address) {
+	addressMutexUDP_.lock();
+	if (!hasAddressUDP_) {
+		addressUDP_ = address;
+		hasAddressUDP_ = true;
+	}
+	bool same = addressUDP_.sin_port == address.sin_port && addressUDP_.sin_addr.s_addr == address.sin_addr.s_addr;
+	addressMutexUDP_.unlock();
+	return same;
+}
+
+int Connection::InputAddressUDP(const sockaddr_in& address, uint32_t sequence) {
+	addressMutexUDP_.lock();
+	//Sequences count up from wherever, so newer is just ahead of the last, even once they wrap
+	bool newer = !hasInputUDP_ || (int32_t)(sequence - inputSequenceUDP_) > 0;
+	if (newer) {
+		inputSequenceUDP_ = sequence;
+		hasInputUDP_ = true;
+	}
+	int result = 0;
+	if (!hasAddressUDP_ || addressUDP_.sin_port != address.sin_port || addressUDP_.sin_addr.s_addr != address.sin_addr.s_addr) {
+		result = newer ? 1 : -1;
+		if (newer) {
+			addressUDP_ = address;
+			hasAddressUDP_ = true;
+		}
+	}
+	addressMutexUDP_.unlock();
+	return result;
+}
+
+#ifdef __linux__
+int Connection::SendMessages(IoUring* ring) { //1 - all good, 0 - unwritable, -1 - broken
+	uint64_t callsBefore = stats_.sendCalls;
+	int result;
+	while ((result = WriteLinked(ring)) == 1 && !msgsTCP_.Empty()) {}
+
+	if (stats_.sendCalls != callsBefore) {
+		stats_.batchesFlushed++;
+		stats_.lastBatchSendCalls = (uint32_t)(stats_.sendCalls - callsBefore);
+	}
+	return result;
+}
+
+int Connection::WriteLinked(IoUring* ring) {
+	const char* chain[MAX_LINKED_SENDS];
+	uint16_t lengths[MAX_LINKED_SENDS];
+	int results[MAX_LINKED_SENDS];
+
+	// Messages are only ever removed by this thread, so they stay put while others are added
+	int count = 0;
+	while (count < MAX_LINKED_SENDS && (chain[count] = msgsTCP_.Peek(count, lengths[count]))) {
+		count++;
+	}
+	if (count == 0) return 1;
+
+	// Link the sends so they go out in order, and a short send cancels the rest of the chain.
+	// MSG_WAITALL is what makes a short send count as a failure that breaks the link.
+	io_uring_sqe* previous = nullptr;
+	for (int i = 0; i < count; i++) {
+		io_uring_sqe* sqe = ring->GetSqe();
+		if (!sqe) {
+			// No room even after submitting. Send the chain so far and leave the rest for next time, but with
+			// every send reaped before returning, nothing at all fitting means the ring is broken.
+			if (i == 0) return -1;
+			previous->flags &= ~IOSQE_IO_LINK;
+			count = i;
+			break;
 		}
-		std::string msg = msgsTCP_.front();
-		msgsMutexTCP_.unlock();
-
-		int result = Write(msg);
-		if (result == 1) {
-			// Remove message from queue
-			msgsMutexTCP_.lock();
-			msgsTCP_.pop();
-			msgsMutexTCP_.unlock();
+		previous = sqe;
+		int offset = i == 0 ? writeCountTCP_ : 0;
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = socketTCP_;
+		sqe->addr = (uint64_t)(uintptr_t)(chain[i] + offset);
+		sqe->len = lengths[i] - offset;
+		sqe->msg_flags = MSG_DONTWAIT | MSG_WAITALL | MSG_NOSIGNAL;
+		sqe->user_data = i;
+		if (i < count - 1) sqe->flags = IOSQE_IO_LINK;
+	}
+
+	int submitted = ring->Submit(count);
+	stats_.sendCalls++;
+	if (submitted < 0) {
+		LOG_ERROR(LOG_TCP, "io_uring submit failed with error %d\n", -submitted);
+		return -1;
+	}
+
+	// Every send in the chain completes (or is cancelled) before the ring is handed back
+	for (int reaped = 0; reaped < count;) {
+		io_uring_cqe* cqe = ring->PeekCqe();
+		if (!cqe) {
+			ring->Submit(count - reaped);
+			continue;
+		}
+		results[cqe->user_data] = cqe->res;
+		ring->SeenCqe();
+		reaped++;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int result = results[i];
+		if (result == -EAGAIN || result == -ENOBUFS) {
+			writeableTCP_ = false;
+			return 0;
 		}
-		else return result;
+		if (result < 0) {
+			LOG_INFO(LOG_TCP, "Connection closed or broken (io_uring send = %d)\n", -result);
+			return -1;
+		}
+
+		stats_.bytesSent += result;
+		writeCountTCP_ += result;
+		if (writeCountTCP_ < lengths[i]) {
+			LOG_DEBUG(LOG_TCP, "Not all sent\n");
+			stats_.partialWrites++;
+			// The rest of the chain was cancelled. Stop writing for now.
+			writeableTCP_ = false;
+			return 0;
+		}
+
+		// Written a complete message.
+		writeCountTCP_ = 0;
+		msgsTCP_.Pop();
+		stats_.messagesSent++;
 	}
+	return 1;
 }
+#endif
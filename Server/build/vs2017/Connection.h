@@ -1,11 +1,21 @@
 #pragma once
-#define NOMINMAX
-#include <WinSock2.h>
+#include "Sockets.h"
 #include "Messages.h"
 #include <string>
 #include <vector>
-#include <queue>
+#include <map>
+#include <unordered_map>
+#include <memory>
 #include <mutex>
+#include <atomic>
+#include "OutboundRing.h"
+#include "FrameDecoder.h"
+#include "ReliableStream.h"
+#include "SnapshotDelta.h"
+#include "RateLimiter.h"
+#ifdef __linux__
+#include "IoUring.h"
+#endif
 
     //Message header format: 
     // +--------+--------+--------+
@@ -19,25 +29,93 @@
 //Size of Type field in header
 #define HeaderTypeFieldSize sizeof(uint8_t)
 
+    //Datagrams from the client carry its connection's handle and secret token after the type:
+    // +--------+--------+--------+--------+--------+--------+-- .. --+--------+
+    // |      Length     |  Type  |     Handle      |     Token (8 bytes)      |
+    // +--------+--------+--------+--------+--------+--------+-- .. --+--------+
+
+//Size of Handle field in client datagrams
+#define HeaderHandleFieldSize sizeof(uint16_t)
+//Size of Token field in client datagrams
+#define HeaderTokenFieldSize sizeof(uint64_t)
+//Size of the header on client datagrams
+#define HeaderSizeUDP (HeaderSize + HeaderHandleFieldSize + HeaderTokenFieldSize)
+
+//Most queued messages handed to io_uring as one chain of linked sends
+#define MAX_LINKED_SENDS 32
+
 class NetworkServer;
 
+// Counters for judging how well a connection's outgoing messages are being batched.
+struct ConnectionStats {
+	uint64_t sendCalls = 0;      // System calls made to send
+	uint64_t batchesFlushed = 0; // Calls to SendMessages() that sent anything
+	uint64_t messagesSent = 0;
+	uint64_t bytesSent = 0;
+	uint64_t partialWrites = 0;  // Sends cut short by a full socket buffer, resumed partway through a message later
+	uint32_t lastBatchSendCalls = 0; // System calls the most recent batch took
+
+	void Add(const ConnectionStats& other) {
+		sendCalls += other.sendCalls;
+		batchesFlushed += other.batchesFlushed;
+		messagesSent += other.messagesSent;
+		bytesSent += other.bytesSent;
+		partialWrites += other.partialWrites;
+	}
+};
+
+// Snapshot bandwidth for one client. The results are for the last full stats interval.
+struct SnapshotStats {
+	uint32_t bitrate = 0;     // Snapshot bits per second sent
+	float meanStaleness = 0;  // Mean ms since each player in the client's snapshots was last brought up to date
+	uint32_t deferred = 0;    // Changed players left for a later tick, in the most recent snapshot
+
+	// Totals so far this interval
+	uint32_t intervalStart = 0;
+	uint64_t intervalBytes = 0;
+	double intervalStaleness = 0;
+	uint32_t intervalPlayers = 0;
+};
+
+// Rate limits on what one client sends, checked before its datagrams are decoded.
+// Used by an ingress thread taking tokens and the tick thread logging drops, with mutex held.
+struct IngressLimits {
+	std::mutex mutex;
+	TokenBucket datagrams;
+	TokenBucket timeRequests; // Each of these gets a reply, so they have a tighter limit of their own
+	uint64_t dropped = 0;     // Datagrams over either limit
+	uint64_t droppedLogged = 0; // What dropped was when it was last logged
+};
+
+// How much a player in a client's snapshot is owed an update
+struct EntityPriority {
+	float priority = 0;          // Builds up each tick it changed but wasn't sent
+	float sentVelocity[3] = {};  // Velocity the client was last sent
+	uint32_t sentTime = 0;       // When the client was last brought up to date
+};
+
 class Connection {
 public:
 	// Constructor.
-	// sock: the socket that we've accepted the client connection on.
-	Connection(SOCKET sock, WSAEVENT eventTCP, int playerID, NetworkServer* server);
+	// sock: the socket that we've accepted the client connection on, or INVALID_SOCKET for a client that joined over UDP alone.
+	// handle: the server's connection handle, used to route reactor events back to this connection.
+	Connection(SOCKET sock, uint32_t handle, int playerID, NetworkServer* server);
 
 	// Destructor.
 	~Connection();
 
 	// Return the client's socket.
 	SOCKET getSocketTCP() { return socketTCP_; };
+	// Joined over UDP, so messages go through the reliable stream rather than a socket
+	bool isUDPOnly() { return socketTCP_ == INVALID_SOCKET; }
 
-	// Call this when the socket is ready to read.
-	bool Read();
+	// Call this when the socket is ready to read, until it returns 0.
+	// 1 - made progress, 0 - nothing left to read, -1 - closed or broken
+	int Read();
 
-	// Call this when the socket is ready to write.
-	int Write(std::string msg);
+	// Call this when the socket is ready to write. Sends every queued message with a single gathered write.
+	// 1 - everything queued was sent, 0 - unwritable, -1 - broken
+	int Write();
 
 	void CreateServerAcceptMessage();
 	void CreateServerFullMessage();
@@ -45,46 +123,141 @@ public:
 	void CreateChatMessage(const char* chatMsg, int id);
 	void CreateNewPlayerMessage(int id);
 	void CreatePlayerQuitMessage(int id);
-	void AddMessage(uint16_t& msgLen, MessageType& msgType, std::vector<uint8_t>& msgData);
-	void AddMessage(uint16_t& msgLen, const char* buffer);
+	// Queue a message to be sent, from any thread. Returns false if the outgoing queue is full, in which case the
+	// connection is closed, as the client's missed a message it can't get back.
+	bool AddMessage(uint16_t& msgLen, MessageType& msgType, std::vector<uint8_t>& msgData);
+	bool AddMessage(uint16_t& msgLen, const char* buffer);
 	int SendMessages();
+	// For UDP only connections, move queued messages into the reliable stream and send whatever's due to address.
+	// Only called from the network thread. 1 - all good, -1 - the client stopped acknowledging
+	int SendReliable(uint32_t now, sockaddr_in* address);
+	// A RELIABLE datagram from the client. Handles every message it completes and returns the sequence to acknowledge.
+	uint32_t ReceiveReliable(const ReliableMessage& msg);
+	void AcknowledgeReliable(uint32_t sequence);
+	// Anything sent and not yet acknowledged
+	bool ReliablePending();
+#ifdef __linux__
+	// Send queued messages through ring as chains of linked sends, so a whole queue costs one system call.
+	// Same results as SendMessages().
+	int SendMessages(IoUring* ring);
+#endif
+	const ConnectionStats& getStats() { return stats_; }
 	void setWriteable(bool b) { writeableTCP_ = b; }
 	bool isWriteable() { return writeableTCP_; }
 
+	uint32_t getHandle() { return handle_; }
 	int getPlayerID() { return playerID_; }
-	sockaddr_in* getAddressUDP() { return addressUDP_.get(); }
-	void setAddressUDP(sockaddr_in addr) { addressUDP_ = std::make_unique<sockaddr_in>(addr); }
+	// Secret the client puts in every datagram next to the connection's handle, to show it's them
+	uint64_t getTokenUDP() { return tokenUDP_; }
+	void setTokenUDP(uint64_t token) { tokenUDP_ = token; }
+	// Copy where the client's datagrams are sent into address, false if that isn't known yet.
+	// Copied out under the connection's own lock, as an ingress thread can move the client at any time.
+	bool getAddressUDP(sockaddr_in& address);
+	// Returns true if the address changed
+	bool setAddressUDP(const sockaddr_in& address);
+	// True if address is where the client is, taking it to be if nowhere is known yet
+	bool isAddressUDP(const sockaddr_in& address);
+	// Note an input's sequence, moving the client to address if it's from somewhere new. Anyone who's seen a datagram
+	// can send it again from anywhere, so only an input newer than any before moves the client.
+	// 1 - moved, 0 - already there, -1 - from somewhere new but not a new input, so the client stays put
+	int InputAddressUDP(const sockaddr_in& address, uint32_t sequence);
 	void setInput(std::map<int, float>& input) { playerInputs_ = input; }
 
-	int* LastUpdateTime() { return &lastUpdateTime_; }
+
+	// IDs of the players in this client's last snapshot, sorted. Only used by the snapshot thread.
+	std::vector<int>& Interest() { return interest_; }
+
+	// Snapshots sent to this client, kept as baselines for delta encoding. Only used by the snapshot thread.
+	SnapshotHistory& Snapshots() { return snapshots_; }
+	uint32_t NextSnapshotSequence() { return ++snapshotSequence_; }
+	uint32_t getSnapshotSequence() { return snapshotSequence_; }
+	// Newest snapshot the client has said it received, 0 if none yet
+	uint32_t getAckedSnapshot() { return ackedSnapshot_; }
+	void setAckedSnapshot(uint32_t sequence) { ackedSnapshot_ = sequence; }
+	// Players waiting to be sent to this client, by player ID. Only used by the snapshot thread.
+	std::unordered_map<int, EntityPriority>& Priorities() { return priorities_; }
+	// Bits per second of snapshots this client can be sent
+	uint32_t getBandwidthUDP() { return bandwidthUDP_; }
+	void setBandwidthUDP(uint32_t bitsPerSecond) { bandwidthUDP_ = bitsPerSecond; }
+	SnapshotStats& getSnapshotStats() { return snapshotStats_; }
+	IngressLimits& getIngressLimits() { return ingressLimits_; }
+
+	// Nonce from a UDP only client's connect request, to tell its resent responses from a new connection
+	uint64_t getConnectNonce() { return connectNonce_; }
+	void setConnectNonce(uint64_t nonce) { connectNonce_ = nonce; }
+	// Address a UDP only client connected from, as ip << 16 | port. It keeps this even if its address changes later.
+	uint64_t getConnectKey() { return connectKey_; }
+	void setConnectKey(uint64_t key) { connectKey_ = key; }
+	// Server time a datagram was last heard from the client
+	uint32_t getLastReceive() { return lastReceive_; }
+	void setLastReceive(uint32_t time) { lastReceive_ = time; }
+	// Set from any thread to have the network thread close the connection
+	bool isClosing() { return closing_; }
+	void setClosing() { closing_ = true; }
+	// Messages that didn't fit the outgoing queue
+	uint32_t getDroppedMessages() { return droppedMessages_; }
+
+	// Position in NetworkServer's list of connections, kept up to date so removal is a swap and pop.
+	size_t getIndex() { return index_; }
+	void setIndex(size_t index) { index_ = index; }
 
 private:
+#ifdef __linux__
+	// Send up to MAX_LINKED_SENDS queued messages as one chain. Same results as Write().
+	int WriteLinked(IoUring* ring);
+#endif
+	// The outgoing queue's full, so give up on the client
+	void QueueFull();
+
 	NetworkServer* server_;
 
+	uint32_t handle_;
+	size_t index_ = 0;
+
 	int playerID_;
 
 	std::map<int, float> playerInputs_;
 
-	std::unique_ptr<sockaddr_in> addressUDP_;
-	int lastUpdateTime_ = 0;
+	uint64_t tokenUDP_ = 0;
+	sockaddr_in addressUDP_ = {};
+	bool hasAddressUDP_ = false;
+	uint32_t inputSequenceUDP_ = 0; // Newest input's, with addressMutexUDP_ held
+	bool hasInputUDP_ = false;
+	std::mutex addressMutexUDP_;
+	std::vector<int> interest_;
+	SnapshotHistory snapshots_;
+	//Written by the snapshot thread and an ingress thread respectively, read by both
+	std::atomic<uint32_t> snapshotSequence_{ 0 };
+	std::atomic<uint32_t> ackedSnapshot_{ 0 };
+	std::unordered_map<int, EntityPriority> priorities_;
+	uint32_t bandwidthUDP_ = 0;
+	SnapshotStats snapshotStats_;
+	IngressLimits ingressLimits_;
 
 	// This client's TCP socket.
 	SOCKET socketTCP_;
 	
-	std::queue<std::string> msgsTCP_;
-	std::mutex msgsMutexTCP_;
+	// Messages waiting to be sent, filled by any thread and drained by the network thread.
+	OutboundRing msgsTCP_;
+
+	// The data we've read from the client, split back into messages.
+	FrameDecoder decoderTCP_;
 
-	// The data we've read from the client.
-	int readCountTCP_ = 0;
-	char readBufferTCP_[500];
+	// Stands in for the socket on UDP only connections. Sent from by the network thread, received into by the ingress threads.
+	ReliableStream reliable_;
+	std::mutex reliableMutex_;
+	uint64_t connectNonce_ = 0;
+	uint64_t connectKey_ = 0;
+	std::atomic<uint32_t> lastReceive_{ 0 };
+	std::atomic<bool> closing_{ false };
+	std::atomic<uint32_t> droppedMessages_{ 0 };
 
-	// The data for writing to the client.
+	// How much of the oldest queued message has been written.
 	int writeCountTCP_ = 0;
-	char writeBufferTCP_[500];
+
+	ConnectionStats stats_;
 
 	// Socket can currently be written to?
 	bool writeableTCP_ = false;
-
-	WSAEVENT eventTCP_;
 };
 
@@ -0,0 +1,192 @@
+#include "DatagramBatch.h"
+#include <cstring>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/uio.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// Kernel limits on a single GSO send
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+// Kernel limit on messages per sendmmsg/recvmmsg call
+#define MMSG_MAX 1024
+#endif
+
+// Datagrams a Flush() has room for without growing, a tick's worth for a full server
+#define DATAGRAM_BATCH_RESERVE 1024
+
+DatagramBatch::DatagramBatch(SOCKET sock) {
+	socket_ = sock;
+	queue_.reserve(DATAGRAM_BATCH_RESERVE);
+#ifdef __linux__
+	iovecs_.resize(DATAGRAM_BATCH_RESERVE);
+	msgs_.reserve(DATAGRAM_BATCH_RESERVE);
+	controls_.resize(DATAGRAM_BATCH_RESERVE);
+#endif
+}
+
+void DatagramBatch::Queue(const sockaddr_in& address, const char* data, uint16_t length) {
+	queue_.push_back({ address, data, length });
+}
+
+#ifdef __linux__
+
+int DatagramBatch::Flush() {
+	if (queue_.empty()) return 1;
+
+	//Only grows for a bigger tick than any before
+	if (iovecs_.size() < queue_.size()) {
+		iovecs_.resize(queue_.size());
+		controls_.resize(queue_.size());
+	}
+	msgs_.clear();
+
+	size_t i = 0;
+	while (i < queue_.size()) {
+		// Gather a run of same sized datagrams going to the same address, these can go out as one GSO send
+		size_t end = i + 1;
+		if (gsoEnabled_) {
+			size_t bytes = queue_[i].length;
+			while (end < queue_.size() && end - i < GSO_MAX_SEGMENTS
+				&& queue_[end].length == queue_[i].length
+				&& bytes + queue_[end].length <= GSO_MAX_BYTES
+				&& memcmp(&queue_[end].address, &queue_[i].address, sizeof(sockaddr_in)) == 0) {
+				bytes += queue_[end].length;
+				end++;
+			}
+		}
+
+		for (size_t j = i; j < end; j++) {
+			iovecs_[j].iov_base = (void*)queue_[j].data;
+			iovecs_[j].iov_len = queue_[j].length;
+		}
+
+		mmsghdr msg = {};
+		msg.msg_hdr.msg_name = &queue_[i].address;
+		msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		msg.msg_hdr.msg_iov = &iovecs_[i];
+		msg.msg_hdr.msg_iovlen = end - i;
+		if (end - i > 1) {
+			GsoControl& control = controls_[msgs_.size()];
+			msg.msg_hdr.msg_control = control.buffer;
+			msg.msg_hdr.msg_controllen = sizeof(control.buffer);
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segmentSize = queue_[i].length;
+			memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+		}
+		msgs_.push_back(msg);
+		i = end;
+	}
+
+	int result = 1;
+	size_t sent = 0;
+	while (sent < msgs_.size()) {
+		unsigned int count = (unsigned int)std::min(msgs_.size() - sent, (size_t)MMSG_MAX);
+		int done = sendmmsg(socket_, &msgs_[sent], count, 0);
+		stats_.sendCalls++;
+		if (done == -1) {
+			if (errno == EINTR) continue;
+			if ((errno == EIO || errno == EINVAL) && gsoEnabled_ && msgs_[sent].msg_hdr.msg_iovlen > 1) {
+				// No GSO on this kernel or device, send the rest one datagram at a time
+				gsoEnabled_ = false;
+				queue_.erase(queue_.begin(), queue_.begin() + (msgs_[sent].msg_hdr.msg_iov - iovecs_.data()));
+				return Flush();
+			}
+			result = (errno == EWOULDBLOCK || errno == ENOBUFS) ? 0 : -1;
+			break;
+		}
+		for (int j = 0; j < done; j++) {
+			stats_.packetsSent += msgs_[sent + j].msg_hdr.msg_iovlen;
+		}
+		sent += done;
+	}
+
+	queue_.clear();
+	return result;
+}
+
+int DatagramBatch::Receive() {
+	mmsghdr msgs[DATAGRAM_RING_SIZE];
+	iovec iovecs[DATAGRAM_RING_SIZE];
+	for (int i = 0; i < DATAGRAM_RING_SIZE; i++) {
+		iovecs[i].iov_base = ring_[i].data;
+		iovecs[i].iov_len = DATAGRAM_BUFFER_SIZE;
+		msgs[i] = {};
+		msgs[i].msg_hdr.msg_name = &ring_[i].address;
+		msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int count;
+	do {
+		count = recvmmsg(socket_, msgs, DATAGRAM_RING_SIZE, MSG_DONTWAIT, nullptr);
+		stats_.receiveCalls++;
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1) {
+		return (errno == EWOULDBLOCK || errno == ECONNREFUSED) ? 0 : -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		// Truncated datagrams were too big for the slot, so can't be valid messages
+		ring_[i].length = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+	}
+	stats_.packetsReceived += count;
+	return count;
+}
+
+#else
+
+int DatagramBatch::Flush() {
+	int result = 1;
+	for (OutgoingDatagram& datagram : queue_) {
+		int count = sendto(socket_, datagram.data, datagram.length, 0, (const sockaddr*)&datagram.address, sizeof(sockaddr_in));
+		stats_.sendCalls++;
+		if (count == SOCKET_ERROR) {
+			result = (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENOBUFS) ? 0 : -1;
+			break;
+		}
+		stats_.packetsSent++;
+	}
+
+	queue_.clear();
+	return result;
+}
+
+int DatagramBatch::Receive() {
+	int count = 0;
+	while (count < DATAGRAM_RING_SIZE) {
+		RingSlot& slot = ring_[count];
+		socklen_t addressLen = sizeof(slot.address);
+		slot.length = recvfrom(socket_, slot.data, DATAGRAM_BUFFER_SIZE, 0, (sockaddr*)&slot.address, &addressLen);
+		stats_.receiveCalls++;
+		if (slot.length == SOCKET_ERROR) {
+			int error = WSAGetLastError();
+			if (error == WSAEMSGSIZE) {
+				slot.length = 0; // Too big for the slot, so can't be a valid message
+			}
+			else if (error == WSAENETRESET || error == WSAECONNRESET) {
+				continue; // Just this datagram was bad, there may be more behind it
+			}
+			else if (error == WSAEWOULDBLOCK) {
+				break;
+			}
+			else {
+				return count > 0 ? count : -1;
+			}
+		}
+		count++;
+	}
+	stats_.packetsReceived += count;
+	return count;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+#include "Sockets.h"
+#include <cstdint>
+#include <vector>
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+// Number of datagrams that can be received with one call to Receive()
+#define DATAGRAM_RING_SIZE 64
+
+// Largest datagram the receive ring will hold. Anything bigger is discarded.
+#define DATAGRAM_BUFFER_SIZE 500
+
+// Counters for judging how well sends and receives are being batched.
+struct DatagramStats {
+	uint64_t packetsSent = 0;
+	uint64_t packetsReceived = 0;
+	uint64_t sendCalls = 0;
+	uint64_t receiveCalls = 0;
+};
+
+// Batched datagram I/O on a single UDP socket.
+// On Linux a whole tick of outgoing datagrams goes out in one sendmmsg call, with runs of equal sized
+// datagrams to the same address merged into a single UDP GSO send, and incoming datagrams are pulled
+// in bursts with recvmmsg. Elsewhere it falls back to one sendto/recvfrom per datagram.
+class DatagramBatch {
+public:
+	DatagramBatch(SOCKET sock);
+
+	// Queue a datagram for the next Flush(). data is not copied and must stay valid until then.
+	void Queue(const sockaddr_in& address, const char* data, uint16_t length);
+
+	// Send everything queued and empty the queue.
+	// 1 - all sent, 0 - socket would block (the rest are dropped), -1 - broken
+	int Flush();
+
+	// Receive up to DATAGRAM_RING_SIZE datagrams into the ring. Returns how many, or -1 if the socket is broken.
+	// The received datagrams stay valid until the next call.
+	int Receive();
+	const char* GetData(int i) { return ring_[i].data; }
+	int GetLength(int i) { return ring_[i].length; }
+	const sockaddr_in& GetAddress(int i) { return ring_[i].address; }
+
+	const DatagramStats& GetStats() { return stats_; }
+
+private:
+	struct OutgoingDatagram {
+		sockaddr_in address;
+		const char* data;
+		uint16_t length;
+	};
+
+	struct RingSlot {
+		sockaddr_in address;
+		int length; // 0 if the datagram was too big for the slot
+		char data[DATAGRAM_BUFFER_SIZE];
+	};
+
+	SOCKET socket_;
+	std::vector<OutgoingDatagram> queue_;
+#ifdef __linux__
+	// One control message buffer per merged GSO send
+	struct GsoControl { char buffer[CMSG_SPACE(sizeof(uint16_t))]; };
+	// Flush's scratch space, kept between calls so sending allocates nothing once it's as big as a tick needs
+	std::vector<iovec> iovecs_;
+	std::vector<mmsghdr> msgs_;
+	std::vector<GsoControl> controls_;
+#endif
+	RingSlot ring_[DATAGRAM_RING_SIZE];
+	DatagramStats stats_;
+	bool gsoEnabled_ = true;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Shared by the client and server, keep both copies the same.
+
+// Biggest frame the length field can describe
+#define FRAME_MAX_SIZE 65535
+
+// Smallest amount of free space handed out for each recv
+#define FRAME_READ_CHUNK 4096
+
+// Read the length field from the start of a message. It's sent as a little-endian uint16_t.
+inline uint16_t ReadFrameLength(const char* buffer) {
+	uint16_t length;
+	memcpy(&length, buffer, sizeof(length));
+	return length;
+}
+
+// Splits a TCP byte stream back into the length prefixed frames it was sent as.
+// Bytes are received straight into the decoder's buffer with as big a recv as there's room for,
+// then every complete frame is handed out in place, without copying.
+// The buffer grows to fit frames up to FRAME_MAX_SIZE, and leftover partial frames are moved back
+// to the front when space runs out, so each frame is always contiguous.
+class FrameDecoder {
+public:
+	FrameDecoder();
+
+	// Somewhere to recv into. space is set to how many bytes it has room for, at least FRAME_READ_CHUNK.
+	// Calling this invalidates frames handed out by NextFrame().
+	char* GetWriteSpace(size_t& space);
+
+	// Tell the decoder count bytes were received into the space from GetWriteSpace().
+	void CommitWrite(size_t count);
+
+	// Take the next complete frame, header included. It stays valid until the next GetWriteSpace().
+	// 1 - got a frame, 0 - need more data, -1 - the stream is malformed and can't be recovered
+	int NextFrame(const char*& frame, uint16_t& length);
+
+	// Drop everything buffered, ready for a new stream.
+	void Reset() { readPos_ = writePos_ = 0; }
+
+private:
+	std::vector<char> buffer_;
+	size_t readPos_ = 0;
+	size_t writePos_ = 0;
+};
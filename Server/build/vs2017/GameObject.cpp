@@ -3,7 +3,14 @@
 
 GameObject::~GameObject()
 {
-	pxbody_->release();
+	ReleasePhysx();
+}
+
+void GameObject::ReleasePhysx() {
+	if (pxbody_) {
+		pxbody_->release();
+		pxbody_ = nullptr;
+	}
 }
 
 void GameObject::InitPhysx(physx::PxVec3 halfExtent, physx::PxVec3 pos, physx::PxScene* scene, physx::PxPhysics* gPhysics, bool dynamic) {
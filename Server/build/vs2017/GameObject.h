@@ -8,9 +8,11 @@ public:
 	~GameObject();
 	void InitPhysx(physx::PxVec3 halfExtent, physx::PxVec3 pos, physx::PxScene* scene, physx::PxPhysics* gPhysics, bool dynamic = false);
 	void UpdatePhysx();
+	// Release the body now rather than on destruction, which has to happen before PhysX itself is released
+	void ReleasePhysx();
 	virtual physx::PxRigidActor* GetPxBody() { return pxbody_; }
 
 protected:
-	physx::PxRigidActor* pxbody_;
+	physx::PxRigidActor* pxbody_ = NULL;
 };
 
@@ -0,0 +1,122 @@
+#include "Hmac.h"
+#include <cstring>
+
+#define SHA256_BLOCK_SIZE 64
+
+namespace {
+	const uint32_t K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	inline uint32_t Rotate(uint32_t x, int n) {
+		return (x >> n) | (x << (32 - n));
+	}
+
+	struct Sha256State {
+		uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		uint8_t block[SHA256_BLOCK_SIZE];
+		size_t blockLength = 0;
+		uint64_t totalLength = 0;
+
+		void Compress() {
+			uint32_t w[64];
+			for (int i = 0; i < 16; i++) {
+				w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+			}
+			for (int i = 16; i < 64; i++) {
+				uint32_t s0 = Rotate(w[i - 15], 7) ^ Rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = Rotate(w[i - 2], 17) ^ Rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+			for (int i = 0; i < 64; i++) {
+				uint32_t t1 = hh + (Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+				uint32_t t2 = (Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				hh = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+			h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+		}
+
+		void Update(const uint8_t* data, size_t length) {
+			totalLength += length;
+			while (length > 0) {
+				size_t take = SHA256_BLOCK_SIZE - blockLength;
+				if (take > length) take = length;
+				memcpy(block + blockLength, data, take);
+				blockLength += take;
+				data += take;
+				length -= take;
+				if (blockLength == SHA256_BLOCK_SIZE) {
+					Compress();
+					blockLength = 0;
+				}
+			}
+		}
+
+		void Finish(uint8_t out[SHA256_SIZE]) {
+			uint64_t bits = totalLength * 8;
+			uint8_t pad = 0x80;
+			Update(&pad, 1);
+			pad = 0;
+			while (blockLength != SHA256_BLOCK_SIZE - 8) {
+				Update(&pad, 1);
+			}
+			uint8_t length[8];
+			for (int i = 0; i < 8; i++) {
+				length[i] = (uint8_t)(bits >> (56 - i * 8));
+			}
+			Update(length, 8);
+			for (int i = 0; i < 8; i++) {
+				out[i * 4] = (uint8_t)(h[i] >> 24);
+				out[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+				out[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+				out[i * 4 + 3] = (uint8_t)h[i];
+			}
+		}
+	};
+}
+
+void Sha256(const uint8_t* data, size_t length, uint8_t out[SHA256_SIZE]) {
+	Sha256State state;
+	state.Update(data, length);
+	state.Finish(out);
+}
+
+void HmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length, uint8_t out[SHA256_SIZE]) {
+	//Keys longer than a block are hashed down first, shorter ones padded with zeros
+	uint8_t block[SHA256_BLOCK_SIZE] = {};
+	if (keyLength > SHA256_BLOCK_SIZE) Sha256(key, keyLength, block);
+	else memcpy(block, key, keyLength);
+
+	uint8_t pad[SHA256_BLOCK_SIZE];
+	for (int i = 0; i < SHA256_BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x36;
+	uint8_t inner[SHA256_SIZE];
+	Sha256State innerState;
+	innerState.Update(pad, SHA256_BLOCK_SIZE);
+	innerState.Update(data, length);
+	innerState.Finish(inner);
+
+	for (int i = 0; i < SHA256_BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x5c;
+	Sha256State outerState;
+	outerState.Update(pad, SHA256_BLOCK_SIZE);
+	outerState.Update(inner, SHA256_SIZE);
+	outerState.Finish(out);
+}
+
+bool ConstantTimeEqual(const uint8_t* a, const uint8_t* b, size_t length) {
+	uint8_t difference = 0;
+	for (size_t i = 0; i < length; i++) {
+		difference |= a[i] ^ b[i];
+	}
+	return difference == 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define SHA256_SIZE 32
+
+// SHA-256 and HMAC-SHA-256 (FIPS 180-4, RFC 2104), for signing connect cookies. Only ever given a few dozen bytes,
+// so it's written to be plain rather than fast.
+void Sha256(const uint8_t* data, size_t length, uint8_t out[SHA256_SIZE]);
+void HmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length, uint8_t out[SHA256_SIZE]);
+
+// Compare without stopping at the first difference, so how long it takes says nothing about how much of a guess was right
+bool ConstantTimeEqual(const uint8_t* a, const uint8_t* b, size_t length);
@@ -0,0 +1,147 @@
+#include "InputJitterBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+void InputJitterBuffer::Push(const InputUpdateMessage& input, uint32_t arrival) {
+	int32_t time = (int32_t)input.time;
+
+	if (started_ && input.sequence == current_.sequence) return; //Duplicate
+
+	//Far behind the input in use means the client's clock was reset
+	bool overtaken = started_ && time < (int32_t)current_.time;
+	if (overtaken && (int32_t)current_.time - time > INPUT_RESYNC_GAP) {
+		Reset();
+		overtaken = false;
+	}
+
+	//Jitter goes up quickly and comes down slowly, so a burst of late inputs lengthens the delay straight away.
+	//Late ones count too, or a delay too short to wait for them would never grow.
+	float transit = (float)(int32_t)(arrival - input.time);
+	if (!measured_) {
+		meanTransit_ = transit;
+		jitter_ = 0;
+		measured_ = true;
+	}
+	else {
+		float deviation = fabsf(transit - meanTransit_);
+		jitter_ += (deviation - jitter_) * (deviation > jitter_ ? 0.25f : 0.0625f);
+		meanTransit_ += (transit - meanTransit_) * 0.0625f;
+	}
+
+	//Anything before the input in use has been overtaken by it. A jump is still wanted late.
+	if (overtaken) {
+		lateJump_ = lateJump_ || input.jump;
+		stats_.intervalLate++;
+		return;
+	}
+
+	//Still used next step, but the step it was meant for has been and gone holding the input before
+	if (started_ && count_ == 0 && time <= lastPlayout_ && underrunPlayout_ != lastPlayout_) {
+		underrunPlayout_ = lastPlayout_;
+		stats_.intervalUnderruns++;
+	}
+
+	//Kept in time order. Out of order arrivals are rare, so search from the newest end.
+	size_t position = count_;
+	while (position > 0 && (int32_t)At(position - 1).time > time) {
+		position--;
+	}
+	for (size_t i = position; i > 0 && (int32_t)At(i - 1).time == time; i--) {
+		if (At(i - 1).sequence == input.sequence) return; //Duplicate
+	}
+
+	if (count_ == INPUT_BUFFER_CAPACITY) {
+		//Full, so the oldest goes. Its jump is carried to the next so it's not lost.
+		if (position == 0) {
+			stats_.intervalOverflowed++;
+			return;
+		}
+		if (At(0).jump) At(1).jump = true;
+		head_ = (head_ + 1) % INPUT_BUFFER_CAPACITY;
+		count_--;
+		position--;
+		stats_.intervalOverflowed++;
+	}
+
+	for (size_t i = count_; i > position; i--) {
+		At(i) = At(i - 1);
+	}
+	At(position) = input;
+	count_++;
+}
+
+const InputUpdateMessage* InputJitterBuffer::Consume(uint32_t now) {
+	int32_t playout = (int32_t)now - (int32_t)lroundf(meanTransit_) - (int32_t)ExtraDelay();
+
+	//Changes in the delay are eased in by playing out a bit faster or slower, rather than jumping,
+	//so a step doesn't find nothing due because the delay just went up or skip inputs because it went down
+	if (started_) {
+		int32_t elapsed = (int32_t)(now - lastConsume_);
+		playout = std::max(playout, lastPlayout_ + elapsed * 3 / 4);
+		playout = std::min(playout, lastPlayout_ + elapsed * 5 / 4);
+	}
+	lastConsume_ = now;
+
+	stats_.intervalTicks++;
+	stats_.intervalDepth += (uint32_t)count_;
+
+	bool jump = lateJump_;
+	lateJump_ = false;
+
+	//A backlog is worked through one a step, catching up on the steps with nothing new due, such as when the playout
+	//eases to 0.75x after the delay goes up. Only what's fallen too far behind for that is skipped, its jump kept.
+	while (count_ > 1 && (int32_t)At(0).time < playout - INPUT_MAX_BACKLOG) {
+		jump = jump || At(0).jump;
+		head_ = (head_ + 1) % INPUT_BUFFER_CAPACITY;
+		count_--;
+		stats_.intervalSkipped++;
+	}
+
+	if (count_ > 0 && (int32_t)At(0).time <= playout) {
+		current_ = At(0);
+		current_.jump = current_.jump || jump;
+		head_ = (head_ + 1) % INPUT_BUFFER_CAPACITY;
+		count_--;
+		started_ = true;
+	}
+	else {
+		current_.jump = jump; //Held, so it's already jumped
+	}
+	lastPlayout_ = playout;
+
+	return started_ ? &current_ : nullptr;
+}
+
+bool InputJitterBuffer::UpdateStats(uint32_t now) {
+	if (stats_.intervalStart == 0) stats_.intervalStart = now;
+	uint32_t elapsed = now - stats_.intervalStart;
+	if (elapsed < INPUT_STATS_INTERVAL) return false;
+
+	stats_.meanDepth = stats_.intervalTicks ? (float)stats_.intervalDepth / stats_.intervalTicks : 0.0f;
+	stats_.targetDelay = ExtraDelay();
+	stats_.underruns = stats_.intervalUnderruns;
+	stats_.late = stats_.intervalLate;
+	stats_.overflowed = stats_.intervalOverflowed;
+	stats_.skipped = stats_.intervalSkipped;
+
+	stats_.intervalStart = now;
+	stats_.intervalTicks = 0;
+	stats_.intervalDepth = 0;
+	stats_.intervalUnderruns = 0;
+	stats_.intervalLate = 0;
+	stats_.intervalOverflowed = 0;
+	stats_.intervalSkipped = 0;
+	return true;
+}
+
+uint32_t InputJitterBuffer::ExtraDelay() const {
+	return (uint32_t)lroundf(std::min(jitter_ * INPUT_JITTER_MULTIPLE, (float)INPUT_MAX_EXTRA_DELAY));
+}
+
+void InputJitterBuffer::Reset() {
+	head_ = 0;
+	count_ = 0;
+	started_ = false;
+	measured_ = false;
+	lateJump_ = false;
+}
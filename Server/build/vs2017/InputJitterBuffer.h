@@ -0,0 +1,84 @@
+#pragma once
+#include "Messages.h"
+#include <cstdint>
+
+// Most inputs held for one player. A client sends one a frame, so this covers the longest delay at 240fps.
+#define INPUT_BUFFER_CAPACITY 64
+
+// Playout delay is the mean transit time plus this many times the transit jitter
+#define INPUT_JITTER_MULTIPLE 4
+
+// Longest the playout delay is allowed to get past the mean transit, in ms
+#define INPUT_MAX_EXTRA_DELAY 200
+
+// Longest an input is kept waiting behind the playout for its turn, in ms. Past this the oldest are skipped.
+#define INPUT_MAX_BACKLOG 100
+
+// An input this far behind the last one used (in ms) means the client's clock was reset, so start afresh
+#define INPUT_RESYNC_GAP 1000
+
+// How often a player's input stats are logged, in ms
+#define INPUT_STATS_INTERVAL 5000
+
+// Counts over the current stats interval, and the figures from the last one
+struct InputBufferStats {
+	float meanDepth = 0;			// Inputs waiting when each tick took one
+	uint32_t targetDelay = 0;		// Delay past the mean transit time, in ms
+	uint32_t underruns = 0;			// Ticks whose input hadn't arrived in time, so the one before was held
+	uint32_t late = 0;				// Arrived after a newer input had been used, so thrown away
+	uint32_t overflowed = 0;		// Pushed out of a full buffer before their tick
+	uint32_t skipped = 0;			// Left more than INPUT_MAX_BACKLOG behind the playout, so thrown away
+
+	uint32_t intervalStart = 0;
+	uint32_t intervalTicks = 0;
+	uint32_t intervalDepth = 0;
+	uint32_t intervalUnderruns = 0;
+	uint32_t intervalLate = 0;
+	uint32_t intervalOverflowed = 0;
+	uint32_t intervalSkipped = 0;
+};
+
+// One player's inputs, in the order the client sent them, played out one per simulation step.
+// Inputs are time stamped with the client's (server synced) clock. Each is held until the server clock passes its
+// time plus the playout delay, which follows the measured transit time and jitter, so inputs that arrive unevenly are
+// still used evenly. Only touched by the simulation thread, under SceneApp's input lock.
+class InputJitterBuffer {
+public:
+	// arrival is the server time the datagram was read
+	void Push(const InputUpdateMessage& input, uint32_t arrival);
+
+	// Input for the step at server time now: the oldest one due, so each is used for a step of its own even when
+	// several are due at once. If none is due the last one is held, without its jump. Null until the first input has arrived.
+	const InputUpdateMessage* Consume(uint32_t now);
+
+	// Roll the stats over if the interval is up. True if it was, and the figures in Stats() are new.
+	bool UpdateStats(uint32_t now);
+	const InputBufferStats& Stats() const { return stats_; }
+
+	// Inputs waiting
+	size_t Depth() const { return count_; }
+	// Current delay past the mean transit time, in ms
+	uint32_t ExtraDelay() const;
+
+private:
+	InputUpdateMessage& At(size_t i) { return ring_[(head_ + i) % INPUT_BUFFER_CAPACITY]; }
+	void Reset();
+
+	InputUpdateMessage ring_[INPUT_BUFFER_CAPACITY];
+	size_t head_ = 0;
+	size_t count_ = 0;
+
+	InputUpdateMessage current_;
+	bool started_ = false;		// current_ holds an input
+	bool lateJump_ = false;		// A late input jumped, so the next step does
+	int32_t lastPlayout_ = 0;	// Client time the last step played out up to
+	uint32_t lastConsume_ = 0;	// Server time of the last step
+	int32_t underrunPlayout_ = 0;	// So a step is only counted as an underrun once
+
+	// Smoothed transit time (server arrival minus client stamp, so it includes any clock offset) and its mean deviation, in ms
+	float meanTransit_ = 0;
+	float jitter_ = 0;
+	bool measured_ = false;
+
+	InputBufferStats stats_;
+};
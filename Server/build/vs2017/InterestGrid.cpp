@@ -0,0 +1,50 @@
+#include "InterestGrid.h"
+#include <cmath>
+
+InterestGrid::InterestGrid(float cellSize) {
+	cellSize_ = cellSize;
+}
+
+void InterestGrid::Clear() {
+	for (auto cell = cells_.begin(); cell != cells_.end();) {
+		if (cell->second.empty()) {
+			cell = cells_.erase(cell);
+		}
+		else {
+			cell->second.clear();
+			++cell;
+		}
+	}
+}
+
+void InterestGrid::Insert(int id, float x, float z) {
+	cells_[CellKey(CellCoord(x), CellCoord(z))].push_back({ id, x, z });
+}
+
+void InterestGrid::Query(float x, float z, float radius, std::vector<InterestEntry>& found) {
+	float radiusSq = radius * radius;
+	int minX = CellCoord(x - radius), maxX = CellCoord(x + radius);
+	int minZ = CellCoord(z - radius), maxZ = CellCoord(z + radius);
+
+	for (int cellX = minX; cellX <= maxX; cellX++) {
+		for (int cellZ = minZ; cellZ <= maxZ; cellZ++) {
+			auto cell = cells_.find(CellKey(cellX, cellZ));
+			if (cell == cells_.end()) continue;
+
+			for (Point& point : cell->second) {
+				float dx = point.x - x;
+				float dz = point.z - z;
+				float distanceSq = dx * dx + dz * dz;
+				if (distanceSq <= radiusSq) found.push_back({ point.id, distanceSq });
+			}
+		}
+	}
+}
+
+int InterestGrid::CellCoord(float v) {
+	float cell = std::floor(v / cellSize_);
+	//Casting a float outside int's range is undefined, and NaN fails both tests so lands on the low edge
+	if (!(cell > -INTEREST_GRID_MAX_CELL)) return -INTEREST_GRID_MAX_CELL;
+	if (cell > INTEREST_GRID_MAX_CELL) return INTEREST_GRID_MAX_CELL;
+	return (int)cell;
+}
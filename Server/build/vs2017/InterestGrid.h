@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+
+// Cell coordinates are clamped to this either way, so a position too far out for an int (or NaN) still has a cell
+#define INTEREST_GRID_MAX_CELL (1 << 24)
+
+// A player found by a query, with its squared distance from the query point
+struct InterestEntry {
+	int id;
+	float distanceSq;
+};
+
+// Uniform spatial hash over player positions on the ground plane (x, z), rebuilt every snapshot tick.
+// Only cells that have players in them take up space, so the world needs no fixed bounds.
+class InterestGrid {
+public:
+	InterestGrid(float cellSize);
+
+	// Empty every cell, keeping the storage of those used by the last build for the next one.
+	// Cells left empty by the last build are dropped, so players wandering about don't grow the grid forever.
+	void Clear();
+	void Insert(int id, float x, float z);
+	// Append every player within radius of (x, z) to found
+	void Query(float x, float z, float radius, std::vector<InterestEntry>& found);
+	// Cells held, empty or not
+	size_t CellCount() { return cells_.size(); }
+
+private:
+	struct Point {
+		int id;
+		float x;
+		float z;
+	};
+
+	int CellCoord(float v);
+	uint64_t CellKey(int cellX, int cellZ) { return ((uint64_t)(uint32_t)cellX << 32) | (uint32_t)cellZ; }
+
+	float cellSize_;
+	std::unordered_map<uint64_t, std::vector<Point>> cells_;
+};
@@ -0,0 +1,214 @@
+#ifdef __linux__
+#include "IoUring.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+static int io_uring_setup(unsigned int entries, io_uring_params* params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nrArgs) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// The kernel reads and writes the ring indices concurrently, so they need acquire/release ordering
+static unsigned int LoadAcquire(unsigned int* p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void StoreRelease(unsigned int* p, unsigned int v) {
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoUring::~IoUring() {
+	if (bufRing_) munmap(bufRing_, bufRingSize_);
+	if (sqes_) munmap(sqes_, sqesSize_);
+	if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+	if (sqRing_) munmap(sqRing_, sqRingSize_);
+	if (ringFD_ != -1) close(ringFD_);
+}
+
+bool IoUring::Init(unsigned int entries) {
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ringFD_ = io_uring_setup(entries, &params);
+	if (ringFD_ < 0) {
+		ringFD_ = -1;
+		return false;
+	}
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cqRingSize_ > sqRingSize_) sqRingSize_ = cqRingSize_;
+		cqRingSize_ = sqRingSize_;
+	}
+
+	sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_SQ_RING);
+	if (sqRing_ == MAP_FAILED) {
+		sqRing_ = nullptr;
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cqRing_ = sqRing_;
+	}
+	else {
+		cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_CQ_RING);
+		if (cqRing_ == MAP_FAILED) {
+			cqRing_ = nullptr;
+			return false;
+		}
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+	sqes_ = (io_uring_sqe*)mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_SQES);
+	if (sqes_ == MAP_FAILED) {
+		sqes_ = nullptr;
+		return false;
+	}
+
+	char* sq = (char*)sqRing_;
+	sqHead_ = (unsigned int*)(sq + params.sq_off.head);
+	sqTail_ = (unsigned int*)(sq + params.sq_off.tail);
+	sqArray_ = (unsigned int*)(sq + params.sq_off.array);
+	sqMask_ = *(unsigned int*)(sq + params.sq_off.ring_mask);
+	sqEntries_ = params.sq_entries;
+	sqLocalTail_ = *sqTail_;
+	sqSubmitted_ = sqLocalTail_;
+
+	char* cq = (char*)cqRing_;
+	cqHead_ = (unsigned int*)(cq + params.cq_off.head);
+	cqTail_ = (unsigned int*)(cq + params.cq_off.tail);
+	cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+	cqMask_ = *(unsigned int*)(cq + params.cq_off.ring_mask);
+	return true;
+}
+
+bool IoUring::SupportsMultishotReceive() {
+	IoUring ring;
+	if (!ring.Init(4)) return false;
+	//Static, as the kernel only lets go of it once the ring's teardown has cancelled the receive
+	static char buffers[2 * 256];
+	if (!ring.RegisterBufferRing(0, buffers, 2, 256)) return false;
+
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock == -1) return false;
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	char probe = 0;
+	bool supported = false;
+	//A datagram already waiting, so the receive completes straight away whether it's supported or not
+	if (bind(sock, (sockaddr*)&address, sizeof(address)) == 0 && getsockname(sock, (sockaddr*)&address, &length) == 0 &&
+		sendto(sock, &probe, 1, 0, (sockaddr*)&address, sizeof(address)) == 1) {
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_namelen = sizeof(sockaddr_in);
+		io_uring_sqe* sqe = ring.GetSqe();
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = sock;
+		sqe->addr = (uint64_t)(uintptr_t)&msg;
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		if (ring.Submit(1) >= 0) {
+			io_uring_cqe* cqe = ring.PeekCqe();
+			//Kernels without multishot either reject it or quietly do a single receive, which doesn't set MORE
+			supported = cqe && cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER) && (cqe->flags & IORING_CQE_F_MORE);
+		}
+	}
+	//Closing the ring cancels the receive still armed on the socket
+	close(sock);
+	return supported;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+	if (sqLocalTail_ - LoadAcquire(sqHead_) >= sqEntries_) {
+		Submit();
+		if (sqLocalTail_ - LoadAcquire(sqHead_) >= sqEntries_) return nullptr;
+	}
+
+	unsigned int index = sqLocalTail_ & sqMask_;
+	io_uring_sqe* sqe = &sqes_[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqArray_[index] = index;
+	sqLocalTail_++;
+	return sqe;
+}
+
+int IoUring::Submit(unsigned int waitNr) {
+	unsigned int toSubmit = sqLocalTail_ - sqSubmitted_;
+	StoreRelease(sqTail_, sqLocalTail_);
+	sqSubmitted_ = sqLocalTail_;
+
+	if (toSubmit == 0 && waitNr == 0) return 0;
+
+	int result;
+	do {
+		result = io_uring_enter(ringFD_, toSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+	} while (result < 0 && errno == EINTR);
+	return result < 0 ? -errno : result;
+}
+
+io_uring_cqe* IoUring::PeekCqe() {
+	unsigned int head = *cqHead_;
+	if (head == LoadAcquire(cqTail_)) return nullptr;
+	return &cqes_[head & cqMask_];
+}
+
+void IoUring::SeenCqe() {
+	StoreRelease(cqHead_, *cqHead_ + 1);
+}
+
+bool IoUring::RegisterBufferRing(uint16_t groupID, char* buffers, unsigned int count, unsigned int size) {
+	// The ring needs a power of two number of entries
+	if (count == 0 || (count & (count - 1)) != 0) return false;
+
+	bufRingSize_ = count * sizeof(io_uring_buf);
+	void* mem = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (mem == MAP_FAILED) return false;
+	bufRing_ = (io_uring_buf_ring*)mem;
+	buffers_ = buffers;
+	bufferSize_ = size;
+	bufCount_ = count;
+
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)bufRing_;
+	reg.ring_entries = count;
+	reg.bgid = groupID;
+	if (io_uring_register(ringFD_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		munmap(bufRing_, bufRingSize_);
+		bufRing_ = nullptr;
+		return false;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		RecycleBuffer((uint16_t)i);
+	}
+	return true;
+}
+
+void IoUring::RecycleBuffer(uint16_t bufferID) {
+	uint16_t tail = bufRing_->tail;
+	// The header declares bufs as a flexible array behind an empty struct, which C++ gives a size,
+	// so index from the start of the ring rather than trusting the member's offset
+	io_uring_buf& buf = ((io_uring_buf*)bufRing_)[tail & (bufCount_ - 1)];
+	buf.addr = (uint64_t)(uintptr_t)GetBuffer(bufferID);
+	buf.len = bufferSize_;
+	buf.bid = bufferID;
+	__atomic_store_n(&bufRing_->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+#endif
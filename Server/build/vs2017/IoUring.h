@@ -0,0 +1,75 @@
+#pragma once
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <cstdint>
+#include <cstddef>
+
+// Minimal io_uring wrapper talking to the kernel directly, so no liburing is needed.
+// A ring must only be used from one thread.
+class IoUring {
+public:
+	IoUring() {}
+	~IoUring();
+
+	// Set up a ring with room for entries submissions. Returns false if io_uring isn't available.
+	bool Init(unsigned int entries);
+
+	// Whether the kernel can do multishot RECVMSG into a provided buffer ring (Linux 6.0 on). Older kernels that
+	// have io_uring but not these fail every such receive, so this tries one out on a throwaway ring and socket.
+	static bool SupportsMultishotReceive();
+
+	// The ring's file descriptor, which polls readable when completions are waiting.
+	int GetFD() { return ringFD_; }
+
+	// Get a zeroed submission entry to fill in, submitting what's queued first if the queue is full.
+	// Returns nullptr if it's still full after that, e.g. because the completion queue needs emptying first.
+	io_uring_sqe* GetSqe();
+
+	// Submit queued entries and wait until at least waitNr completions are available.
+	// Returns the number submitted, or -errno.
+	int Submit(unsigned int waitNr = 0);
+
+	// Take the oldest completion, or nullptr if there are none. Call SeenCqe() once it has been handled.
+	io_uring_cqe* PeekCqe();
+	void SeenCqe();
+
+	// Register count buffers of size bytes each, starting at buffers, as provided buffer group groupID.
+	// Receives using IOSQE_BUFFER_SELECT pick a buffer from the group, and report its ID in the completion flags.
+	bool RegisterBufferRing(uint16_t groupID, char* buffers, unsigned int count, unsigned int size);
+
+	// Hand a provided buffer back to the kernel once its contents have been used.
+	void RecycleBuffer(uint16_t bufferID);
+	char* GetBuffer(uint16_t bufferID) { return buffers_ + (size_t)bufferID * bufferSize_; }
+
+private:
+	int ringFD_ = -1;
+
+	// Submission queue
+	void* sqRing_ = nullptr;
+	size_t sqRingSize_ = 0;
+	io_uring_sqe* sqes_ = nullptr;
+	size_t sqesSize_ = 0;
+	unsigned int* sqHead_;
+	unsigned int* sqTail_;
+	unsigned int* sqArray_;
+	unsigned int sqMask_;
+	unsigned int sqEntries_;
+	unsigned int sqLocalTail_ = 0;
+	unsigned int sqSubmitted_ = 0;
+
+	// Completion queue
+	void* cqRing_ = nullptr;
+	size_t cqRingSize_ = 0;
+	unsigned int* cqHead_;
+	unsigned int* cqTail_;
+	io_uring_cqe* cqes_;
+	unsigned int cqMask_;
+
+	// Provided buffer ring
+	io_uring_buf_ring* bufRing_ = nullptr;
+	size_t bufRingSize_ = 0;
+	char* buffers_ = nullptr;
+	unsigned int bufferSize_ = 0;
+	unsigned int bufCount_ = 0;
+};
+#endif
@@ -0,0 +1,116 @@
+#include "Log.h"
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Log {
+	std::atomic<uint32_t> enabledCategories{ LOG_ALL };
+
+	static const char* levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+	static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	// Every thread's ring, only added to. Rings outlive their threads so nothing is lost when one exits.
+	static std::vector<ThreadRing*> rings;
+	static std::mutex ringsMutex;
+	static std::mutex printMutex;
+	static FILE* output = stdout; // With printMutex held
+
+	static const char* CategoryName(uint32_t category) {
+		switch (category) {
+		case LOG_TCP: return "TCP";
+		case LOG_UDP: return "UDP";
+		case LOG_GAME: return "GAME";
+		default: return "GEN";
+		}
+	}
+
+	// Print everything waiting in every ring. Returns true if anything was printed.
+	static bool Drain() {
+		ringsMutex.lock();
+		std::vector<ThreadRing*> current = rings;
+		ringsMutex.unlock();
+
+		bool printed = false;
+		printMutex.lock();
+		for (ThreadRing* ring : current) {
+			while (Record* record = ring->Peek()) {
+				fprintf(output, "%u.%03u %-5s %-4s ", record->time / 1000, record->time % 1000, levelNames[record->level], CategoryName(record->category));
+				record->print(output, record->format, record->args);
+				ring->Pop();
+				printed = true;
+			}
+			// After what did get through, as the drops came later than that
+			if (uint64_t dropped = ring->TakeDropped()) {
+				uint32_t time = GetTime();
+				fprintf(output, "%u.%03u %-5s %-4s %llu log records dropped, a thread's ring was full\n", time / 1000, time % 1000,
+					levelNames[LOG_LEVEL_WARNING], CategoryName(LOG_GENERAL), (unsigned long long)dropped);
+				printed = true;
+			}
+		}
+		if (printed) fflush(output);
+		printMutex.unlock();
+		return printed;
+	}
+
+	static void PrintLoop() {
+		while (true) {
+			// Sleep a little between passes when there's nothing to do, so an idle logger costs nothing
+			if (!Drain()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+
+	Record* ThreadRing::Reserve() {
+		uint64_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) >= LOG_RING_RECORDS) {
+			dropped_++;
+			return nullptr;
+		}
+		return &records_[head & (LOG_RING_RECORDS - 1)];
+	}
+
+	Record* ThreadRing::Peek() {
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+		return &records_[tail & (LOG_RING_RECORDS - 1)];
+	}
+
+	ThreadRing* GetThreadRing() {
+		thread_local ThreadRing* ring = nullptr;
+		if (!ring) {
+			static std::once_flag started;
+			std::call_once(started, [] {
+				std::thread(PrintLoop).detach();
+				// The printing thread is just stopped at exit, so print what it hadn't got to
+				std::atexit(Flush);
+			});
+
+			ring = new ThreadRing();
+			ringsMutex.lock();
+			rings.push_back(ring);
+			ringsMutex.unlock();
+		}
+		return ring;
+	}
+
+	uint32_t GetTime() {
+		return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	void SetCategories(uint32_t categories) {
+		enabledCategories.store(categories, std::memory_order_relaxed);
+	}
+
+	void Flush() {
+		Drain();
+	}
+
+	void SetOutput(FILE* out) {
+		printMutex.lock();
+		fflush(output);
+		output = out;
+		printMutex.unlock();
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Shared by the client and server, keep both copies the same.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+// Records below this level are compiled out completely. Define it in the project settings to override.
+#ifndef LOG_LEVEL
+#ifdef _DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// Categories can be switched on and off while running with Log::SetCategories()
+enum LogCategory : uint32_t {
+	LOG_GENERAL = 1 << 0,
+	LOG_TCP = 1 << 1,
+	LOG_UDP = 1 << 2,
+	LOG_GAME = 1 << 3,
+	LOG_ALL = 0xffffffff
+};
+
+// Records each thread can have waiting to be printed before new ones are dropped, must be a power of two
+#define LOG_RING_RECORDS 1024
+
+// Space for a record's arguments
+#define LOG_ARGS_SIZE 96
+
+// Longest string argument kept, anything longer is cut short
+#define LOG_STRING_SIZE 64
+
+// Usage is just like printf: LOG_INFO(LOG_TCP, "Sent %d bytes\n", count);
+// Only the format pointer and a binary copy of the arguments are stored on the calling thread.
+// The text is formatted and written out later by a background thread.
+#define LOG_AT(level, category, ...) \
+	do { if ((level) >= LOG_LEVEL && Log::Enabled(category)) Log::Write((level), (category), __VA_ARGS__); } while (0)
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#define LOG_WARNING(category, ...) LOG_AT(LOG_LEVEL_WARNING, category, __VA_ARGS__)
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+
+namespace Log {
+	// Strings are copied into the record, as the pointer may not be valid by the time it's printed
+	struct LogString {
+		char str[LOG_STRING_SIZE];
+	};
+
+	// How each argument type is kept in a record
+	template<class T> struct Stored {
+		static_assert(std::is_trivially_copyable<T>::value, "Log arguments must be plain values");
+		typedef T Type;
+		static Type Store(T value) { return value; }
+		static T Load(const Type& value) { return value; }
+	};
+	template<> struct Stored<const char*> {
+		typedef LogString Type;
+		static Type Store(const char* value) {
+			Type stored;
+			strncpy(stored.str, value ? value : "(null)", LOG_STRING_SIZE - 1);
+			stored.str[LOG_STRING_SIZE - 1] = '\0';
+			return stored;
+		}
+		static const char* Load(const Type& value) { return value.str; }
+	};
+	template<> struct Stored<char*> : Stored<const char*> {};
+
+	typedef void (*PrintFunction)(FILE* out, const char* format, const char* args);
+
+	struct Record {
+		uint32_t time; // Milliseconds since logging started
+		uint8_t level;
+		uint32_t category;
+		const char* format;
+		PrintFunction print;
+		alignas(8) char args[LOG_ARGS_SIZE];
+	};
+
+	// Single producer, single consumer queue of records belonging to one thread
+	class ThreadRing {
+	public:
+		Record* Reserve();
+		void Commit() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+		Record* Peek();
+		void Pop() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+		uint64_t GetDropped() { return dropped_.load(std::memory_order_relaxed); }
+		// Records dropped since the last call, only called by the printing thread
+		uint64_t TakeDropped() { uint64_t dropped = GetDropped(), taken = dropped - droppedTaken_; droppedTaken_ = dropped; return taken; }
+
+	private:
+		Record records_[LOG_RING_RECORDS];
+		// Padded apart so the producer and the printing thread don't share a cache line
+		std::atomic<uint64_t> head_{ 0 };
+		char padding_[64];
+		std::atomic<uint64_t> tail_{ 0 };
+		std::atomic<uint64_t> dropped_{ 0 };
+		uint64_t droppedTaken_ = 0;
+	};
+
+	extern std::atomic<uint32_t> enabledCategories;
+
+	inline bool Enabled(uint32_t category) { return (enabledCategories.load(std::memory_order_relaxed) & category) != 0; }
+	void SetCategories(uint32_t categories);
+
+	// The calling thread's ring, created (and the printing thread started) on first use
+	ThreadRing* GetThreadRing();
+	uint32_t GetTime();
+
+	// Print everything waiting right now, e.g. before exiting. Also done when the program exits normally.
+	void Flush();
+
+	// Where records are printed, stdout unless changed
+	void SetOutput(FILE* out);
+
+	template<class... T, size_t... I>
+	void PrintStored(FILE* out, const char* format, const std::tuple<typename Stored<T>::Type...>& values, std::index_sequence<I...>) {
+		fprintf(out, format, Stored<T>::Load(std::get<I>(values))...);
+	}
+
+	template<class... T>
+	void PrintRecord(FILE* out, const char* format, const char* args) {
+		const std::tuple<typename Stored<T>::Type...>& values = *reinterpret_cast<const std::tuple<typename Stored<T>::Type...>*>(args);
+		PrintStored<T...>(out, format, values, std::index_sequence_for<T...>());
+	}
+
+	template<class... Args>
+	void Write(int level, uint32_t category, const char* format, Args... args) {
+		typedef std::tuple<typename Stored<typename std::decay<Args>::type>::Type...> Values;
+		static_assert(sizeof(Values) <= LOG_ARGS_SIZE && alignof(Values) <= 8, "Too many log arguments");
+
+		ThreadRing* ring = GetThreadRing();
+		Record* record = ring->Reserve();
+		if (!record) return; // Full, the record is dropped and counted
+
+		record->time = GetTime();
+		record->level = (uint8_t)level;
+		record->category = category;
+		record->format = format;
+		record->print = &PrintRecord<typename std::decay<Args>::type...>;
+		// Every stored type is trivially copyable, so the values need no destructing once printed
+		new (record->args) Values(Stored<typename std::decay<Args>::type>::Store(args)...);
+		ring->Commit();
+	}
+}
@@ -3,29 +3,33 @@
 #include <vector>
 #include <map>
 
-enum class MessageType { INPUTUPDATE, TIMEREQUEST, PLAYERSUPDATE, PING, SERVERACCEPT, SERVERFULL, CLIENTINFO, JOINGAME, NEWPLAYER, PLAYERQUIT, CHAT };
+enum class MessageType { INPUTUPDATE, TIMEREQUEST, PLAYERSUPDATE, PING, SERVERACCEPT, SERVERFULL, CLIENTINFO, JOINGAME, NEWPLAYER, PLAYERQUIT, CHAT, SNAPSHOTACK, CONNECTREQUEST, CONNECTCHALLENGE, CONNECTRESPONSE, RELIABLE, RELIABLEACK, DISCONNECT };
 //enum class PlayerInputs { VELOCITY_X, VELOCITY_Z, ROTATION, JUMP };
 //enum class PlayerInfo { VELOCITY_X, VELOCITY_Y, VELOCITY_Z, POSITION_X, POSITION_Y, POSITION_Z, ROTATION  };
 
+// A clock sync sample, all in microseconds. The client stamps when it sent the request by its own clock, and the
+// server fills in its own time when the request arrived and when the reply went.
 struct TimeRequestMessage {
-	uint32_t clientTime;
-	uint32_t serverTime;
+	uint64_t clientTime;
+	uint64_t serverReceiveTime;
+	uint64_t serverTime;
 
 	template<class T>
 	void pack(T& pack) {
-		pack(clientTime, serverTime);
+		pack(clientTime, serverReceiveTime, serverTime);
 	}
 };
 
 struct InputUpdateMessage {
 	uint32_t time;
+	uint32_t sequence; // Counts up per client, one input every simulation step
 	std::vector<float> velocity;
 	float rotation;
 	bool jump;
 
 	template<class T>
 	void pack(T& pack) {
-		pack(time, velocity, rotation, jump);
+		pack(time, sequence, velocity, rotation, jump);
 	}
 };
 
@@ -42,11 +46,37 @@ struct PlayerValues {
 
 struct PlayersUpdateMessage {
 	uint32_t time;
-	std::map<int, PlayerValues> playerValues;
+	uint32_t sequence; // Counts up per client
+	uint32_t baseline; // Sequence of the snapshot this is a delta against, 0 if it's complete
+	uint32_t inputSequence; // Newest of this client's inputs the server had used when it took the snapshot
+	uint8_t fragment; // Which of the snapshot's datagrams this is
+	uint8_t fragmentCount; // How many datagrams the snapshot is split over
+	std::vector<uint8_t> players; // Bit packed, only players that changed since the baseline. See SnapshotDelta.h.
+	std::vector<int> removed; // Players in the baseline that aren't in this snapshot
 
 	template<class T>
 	void pack(T& pack) {
-		pack(time, playerValues);
+		pack(time, sequence, baseline, inputSequence, fragment, fragmentCount, players, removed);
+	}
+};
+
+struct SnapshotAckMessage {
+	uint32_t sequence;
+
+	template<class T>
+	void pack(T& pack) {
+		pack(sequence);
+	}
+};
+
+struct ServerAcceptMessage {
+	// Both go in the header of every datagram the client sends
+	uint16_t handleUDP;
+	uint64_t tokenUDP;
+
+	template<class T>
+	void pack(T& pack) {
+		pack(handleUDP, tokenUDP);
 	}
 };
 
@@ -95,4 +125,49 @@ struct ChatMessage {
 	void pack(T& pack) {
 		pack(playerID, chatStr);
 	}
-};
\ No newline at end of file
+};
+
+// Joining over UDP alone. The client asks to connect, the server answers with a cookie signed with a key only it knows,
+// and the client sends the cookie back from the same address to show it's really there. Nothing is kept for a client
+// until its cookie comes back valid.
+struct ConnectRequestMessage {
+	uint64_t nonce; // Picked by the client, so its cookie is its own
+	std::vector<uint8_t> padding; // Makes the request at least as big as the challenge, so the server can't be used to amplify
+
+	template<class T>
+	void pack(T& pack) {
+		pack(nonce, padding);
+	}
+};
+
+// The challenge, and the client's response which sends it straight back
+struct ConnectChallengeMessage {
+	uint64_t nonce;
+	uint32_t time; // Server time the cookie was made, it's only good for a few seconds
+	std::vector<uint8_t> cookie;
+
+	template<class T>
+	void pack(T& pack) {
+		pack(nonce, time, cookie);
+	}
+};
+
+// Part of the ordered stream of messages that would otherwise go over TCP, resent until acknowledged
+struct ReliableMessage {
+	uint32_t sequence;
+	std::vector<uint8_t> data;
+
+	template<class T>
+	void pack(T& pack) {
+		pack(sequence, data);
+	}
+};
+
+struct ReliableAckMessage {
+	uint32_t sequence; // The next one wanted, everything before it has arrived
+
+	template<class T>
+	void pack(T& pack) {
+		pack(sequence);
+	}
+};
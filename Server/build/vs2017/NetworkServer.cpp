@@ -3,8 +3,25 @@
 #include <iostream>
 #include "msgpack.hpp"
 #include "Connection.h"
+#include "Log.h"
+#include "Hmac.h"
 #include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+//Completion tags for the io_uring UDP loop
+enum UringTagUDP : uint64_t { URING_TAG_RECEIVE = 1, URING_TAG_TICK, URING_TAG_SNAPSHOT, URING_TAG_STOP, URING_TAG_CANCEL };
+#endif
 
 ////Message header format: 
 //// +--------+--------+--------+
@@ -18,13 +35,70 @@
 ////Size of Type field in header
 //#define HeaderTypeFieldSize sizeof(uint8_t)
 
+//Bump one of an ingress thread's counters. Only that thread writes them, so there's no need for a locked add.
+static void Count(std::atomic<uint64_t>& counter) {
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
 NetworkServer::~NetworkServer() {
-	connectionThreadTCP_->join();
-	connectionThreadUDP_->join();
+	Stop();
+
+	//Nothing is running any more, so the sockets can close, freeing the ports for another server
+	for (Connection* conn : connections_) {
+		delete conn;
+	}
+	if (ListenSocket_ != INVALID_SOCKET) closesocket(ListenSocket_);
+	for (UDPWorker* worker : workersUDP_) {
+		closesocket(worker->socket);
+		delete worker->batch;
+		delete worker->reactor;
+		delete worker;
+	}
+	delete batchUDP_;
+	delete reactorTCP_;
+	delete reactorUDP_;
+#ifdef __linux__
+	delete ringTCP_;
+	delete ringUDP_;
+	delete[] receiveBuffersUDP_;
+	if (stopEventUDP_ != -1) close(stopEventUDP_);
+#endif
+}
+
+void NetworkServer::Stop() {
+	if (stopping_.exchange(true)) return;
+
+	//Every loop checks stopping_ when it wakes, so wake any that are waiting
+	if (reactorTCP_) reactorTCP_->Wake();
+	if (reactorUDP_) reactorUDP_->Wake();
+	for (UDPWorker* worker : workersUDP_) {
+		if (worker->reactor) worker->reactor->Wake();
+	}
+#ifdef __linux__
+	if (stopEventUDP_ != -1) {
+		uint64_t one = 1;
+		if (write(stopEventUDP_, &one, sizeof(one)) != sizeof(one)) {
+			LOG_WARNING(LOG_UDP, "Failed to wake the UDP ring\n");
+		}
+	}
+#endif
+
+	std::vector<std::thread*> threads = { connectionThreadTCP_, connectionThreadUDP_ };
+	for (UDPWorker* worker : workersUDP_) {
+		threads.push_back(worker->thread);
+		worker->thread = nullptr;
+	}
+	for (std::thread* thread : threads) {
+		if (!thread) continue;
+		thread->join();
+		delete thread;
+	}
+	connectionThreadTCP_ = connectionThreadUDP_ = nullptr;
+	LOG_INFO(LOG_GENERAL, "Network stopped\n");
 }
 
 void NetworkServer::DisplayLocalIP() {
-	sockaddr_in addr;
+	sockaddr_in addr = {};
 	addr.sin_family = AF_INET;
 	
 	SOCKET testsock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -36,14 +110,12 @@ void NetworkServer::DisplayLocalIP() {
 	}
 
 	sockaddr_in testaddr;
-	int testaddrLen = sizeof(testaddr);
+	socklen_t testaddrLen = sizeof(testaddr);
 	getsockname(testsock, (sockaddr*)&testaddr, &testaddrLen);
 
 	closesocket(testsock);
 
-	printf("LAN IPv4 address: ");
-	printf(inet_ntoa(testaddr.sin_addr));
-	printf("\n");
+	LOG_INFO(LOG_GENERAL, "LAN IPv4 address: %s\n", inet_ntoa(testaddr.sin_addr));
 }
 
 void NetworkServer::StartListeningTCP() {
@@ -64,24 +136,24 @@ void NetworkServer::StartListeningTCP() {
 		die("bind failed");
 	}
 
-	// Create a new event for checking listen socket activity
-	eventsTCP_[0] = WSACreateEvent();
-	if (eventsTCP_.front() == WSA_INVALID_EVENT) {
-		die("tcp listen event creation failed");
+	if (!SetNonBlocking(ListenSocket_)) {
+		die("tcp listen socket non-blocking failed");
 	}
-	//Assosciate this event with the socket types we're interested in
-	//In this case, on the server, we're interested in Accepts and Closes
-	WSAEventSelect(ListenSocket_, eventsTCP_.front(), FD_ACCEPT | FD_CLOSE);
 
 	//Start listening for connection requests on the socket
-	if (listen(ListenSocket_, 1) == SOCKET_ERROR) {
+	if (listen(ListenSocket_, SOMAXCONN) == SOCKET_ERROR) {
 		die("listen failed");
 	}
 
-	printf("Listening for TCP on socket %d...\n", ListenSocket_);
+	//Watch for incoming connections (and errors, which show up as closes)
+	if (!reactorTCP_->Add(ListenSocket_, LISTEN_HANDLE, REACTOR_READ)) {
+		die("tcp listen socket registration failed");
+	}
+
+	LOG_INFO(LOG_TCP, "Listening for TCP on socket %d...\n", ListenSocket_);
 }
 
-void NetworkServer::StartListeningUDP() {
+SOCKET NetworkServer::CreateSocketUDP(bool reusePort) {
 	//Build socket address structure for binding the socket
 	sockaddr_in addr;
 	addr.sin_family = AF_INET;
@@ -89,33 +161,74 @@ void NetworkServer::StartListeningUDP() {
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
 	//Create UDP server/listen socket
-	socketUDP_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if (socketUDP_ == INVALID_SOCKET) {
+	SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock == INVALID_SOCKET) {
 		die("socket failed");
 	}
 
+#ifdef SO_REUSEPORT
+	//Every socket in the group must opt in before binding
+	int enable = 1;
+	if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) != 0) {
+		die("udp SO_REUSEPORT failed");
+	}
+#endif
+
 	// Bind the server socket to its address.
-	if (bind(socketUDP_, (SOCKADDR*)&addr, sizeof(addr)) != 0) {
+	if (bind(sock, (SOCKADDR*)&addr, sizeof(addr)) != 0) {
 		die("bind failed");
 	}
 
-	// Create a new event for checking socket activity
-	eventUDP_ = WSACreateEvent();
-	if (eventUDP_ == WSA_INVALID_EVENT) {
-		die("udp event creation failed");
+	if (!SetNonBlocking(sock)) {
+		die("udp socket non-blocking failed");
+	}
+
+	return sock;
+}
+
+void NetworkServer::StartListeningUDP() {
+	int workerCount = 1;
+#ifdef SO_REUSEPORT
+	//The io_uring backend reads everything through its one ring
+	if (backend_ == NetworkBackend::READINESS) workerCount = UDP_INGRESS_WORKERS;
+#endif
+
+	for (int i = 0; i < workerCount; i++) {
+		UDPWorker* worker = new UDPWorker();
+		worker->socket = CreateSocketUDP(workerCount > 1);
+		workersUDP_.push_back(worker);
+
+		if (backend_ == NetworkBackend::READINESS) {
+			worker->reactor = Reactor::Create();
+			if (!worker->reactor || !worker->reactor->Add(worker->socket, 0, REACTOR_READ)) {
+				die("udp socket registration failed");
+			}
+			worker->batch = new DatagramBatch(worker->socket);
+		}
+	}
+	socketUDP_ = workersUDP_[0]->socket;
+
+	if (backend_ == NetworkBackend::READINESS) {
+		//The tick thread only sends, so it just needs to know when the socket is writeable
+		if (!reactorUDP_->Add(socketUDP_, 0, REACTOR_WRITE)) {
+			die("udp socket registration failed");
+		}
+
+		batchUDP_ = new DatagramBatch(socketUDP_);
+	}
+	else {
+		//The ring does the waiting, and sends that would block are just dropped
+		writeableUDP_ = true;
 	}
-	//Assosciate this event with the socket types we're interested in
-	//In this case, on the server, we're interested in Reads and Writes
-	WSAEventSelect(socketUDP_, eventUDP_, FD_READ | FD_WRITE);
 
-	printf("UDP ready on socket %d...\n", socketUDP_);
+	LOG_INFO(LOG_UDP, "UDP ready on %d socket(s)...\n", workerCount);
 }
 
 
 void NetworkServer::RestartListeningTCP() {
-	printf("Restarting listening\n");
+	LOG_INFO(LOG_TCP, "Restarting listening\n");
+	reactorTCP_->Remove(ListenSocket_, LISTEN_HANDLE);
 	closesocket(ListenSocket_);
-	WSACloseEvent(eventsTCP_.front());
 
 	StartListeningTCP();
 }
@@ -123,158 +236,339 @@ void NetworkServer::RestartListeningTCP() {
 void NetworkServer::StartConnection(SceneApp* scene) {
 	scene_ = scene;
 
+	//Cookies from before a restart are no good, which is fine as they only last a few seconds anyway
+	std::random_device random;
+	for (size_t i = 0; i < sizeof(cookieKey_); i += sizeof(uint32_t)) {
+		uint32_t bits = random();
+		memcpy(cookieKey_ + i, &bits, sizeof(bits));
+	}
+
 	StartWinSock();
-	printf("Server starting\n");
+	LOG_INFO(LOG_GENERAL, "Server starting\n");
+
+	reactorTCP_ = Reactor::Create();
+	reactorUDP_ = Reactor::Create();
+	if (!reactorTCP_ || !reactorUDP_) {
+		die("reactor creation failed");
+	}
+
+	const char* backend = getenv(BACKEND_ENV_VAR);
+	if (backend && strcmp(backend, "io_uring") == 0) {
+#ifdef __linux__
+		if (StartIoUring()) {
+			backend_ = NetworkBackend::IO_URING;
+		}
+		else {
+			LOG_INFO(LOG_GENERAL, "io_uring unavailable, falling back to the readiness backend\n");
+		}
+#else
+		LOG_INFO(LOG_GENERAL, "io_uring is only available on Linux, using the readiness backend\n");
+#endif
+	}
+	LOG_INFO(LOG_GENERAL, "Using the %s network backend\n", backend_ == NetworkBackend::IO_URING ? "io_uring" : "readiness");
+
+	const char* bandwidth = getenv(BANDWIDTH_ENV_VAR);
+	if (bandwidth && atoi(bandwidth) > 0) {
+		clientBandwidthUDP_ = atoi(bandwidth);
+	}
+	LOG_INFO(LOG_GENERAL, "Snapshot bandwidth per client: %u bits/s\n", clientBandwidthUDP_);
 
 	DisplayLocalIP();
 	StartListeningTCP();
 	StartListeningUDP();
 
 	connectionThreadTCP_ = new std::thread(&NetworkServer::ConnectionLoopTCP, this);
+#ifdef __linux__
+	if (backend_ == NetworkBackend::IO_URING) {
+		connectionThreadUDP_ = new std::thread(&NetworkServer::ConnectionLoopUDPUring, this);
+		return;
+	}
+#endif
 	connectionThreadUDP_ = new std::thread(&NetworkServer::ConnectionLoopUDP, this);
+	for (UDPWorker* worker : workersUDP_) {
+		worker->thread = new std::thread(&NetworkServer::IngressLoopUDP, this, worker);
+	}
 }
 
 void NetworkServer::ConnectionLoopTCP() {
-	while (true) {
-
-		DWORD returnVal = WSAWaitForMultipleEvents(eventsTCP_.size(), eventsTCP_.data(), false, WSA_INFINITE, false);
-
-		if ((returnVal != WSA_WAIT_TIMEOUT) && (returnVal != WSA_WAIT_FAILED)) {
-			int eventIndex = returnVal - WSA_WAIT_EVENT_0; //In practice, eventIndex will equal returnVal, but this is here for compatability
-			if (eventIndex == 0) { //Listen event
+	while (!stopping_) {
+		int count = reactorTCP_->Wait(eventsTCP_, MAX_REACTOR_EVENTS, -1);
+		if (count == -1) {
+			die("TCP reactor wait failed!");
+		}
 
-				if (WSAEnumNetworkEvents(ListenSocket_, eventsTCP_.front(), &networkEventsTCP_) == SOCKET_ERROR) {
-					printf("Retrieving listen event information failed\n");
+		for (int i = 0; i < count; i++) {
+			ReactorEvent& ev = eventsTCP_[i];
+			if (ev.events & REACTOR_WAKE) { //Messages or UDP joins were queued from another thread
+				AcceptConnectionsUDP();
+				FlushQueuedSends();
+			}
+			else if (ev.handle == LISTEN_HANDLE) { //Listen event
+				if (ev.events & REACTOR_CLOSE) {
+					LOG_WARNING(LOG_TCP, "Listen socket error\n");
 					RestartListeningTCP();
 					continue;
 				}
-				if (networkEventsTCP_.lNetworkEvents & FD_ACCEPT)
-				{
-					if (networkEventsTCP_.iErrorCode[FD_ACCEPT_BIT] != 0) {
-						printf("FD_ACCEPT failed with error %d\n", networkEventsTCP_.iErrorCode[FD_ACCEPT_BIT]);
-						RestartListeningTCP();
-						continue;
-					}
-					// Accept a new connection, and add it to the socket and event lists
-					eventsTCP_.push_back(WSACreateEvent());
-					Connection* conn = new Connection(accept(ListenSocket_, NULL, NULL), eventsTCP_.back(), scene_->GetAvailableID(), this);
-					connections_.push_back(conn);
-					playerIDtoConnection_[conn->getPlayerID()] = conn;
-					//eventIndexMap_.push_back(connections_.size() - 1);
-
-					WSAEventSelect(connections_.back()->getSocketTCP(), eventsTCP_.back(), FD_CLOSE | FD_READ | FD_WRITE);
-
-					//Check socket for errors
-					if (WSAEnumNetworkEvents(connections_.back()->getSocketTCP(), eventsTCP_.back(), &networkEventsTCP_) == SOCKET_ERROR) {
-						printf("Retrieving event information failed\n");
-						CleanupSocket(connections_.size() - 1);
-						continue;
-					}
-					if (networkEventsTCP_.lNetworkEvents & FD_WRITE) {
-						if (networkEventsTCP_.iErrorCode[FD_WRITE_BIT] != 0) {
-							printf("FD_WRITE failed with error %d\n", networkEventsTCP_.iErrorCode[FD_WRITE_BIT]);
-							CleanupSocket(connections_.size() - 1);
-						}
-						conn->setWriteable(true);
-					}
-					if (connections_.size() <= 5) {
-						conn->CreateServerAcceptMessage();
-
-						printf("Socket %d connected\n", connections_.back()->getSocketTCP());
-						sockaddr_in addr;
-						int addrLen = sizeof(addr);
-						getpeername(connections_.back()->getSocketTCP(), (sockaddr*)&addr, &addrLen);
-
-						printf("Client IPv4 address: ");
-						printf(inet_ntoa(addr.sin_addr));
-						printf("\n");
-						printf("Client TCP port: %d\n\n", addr.sin_port);
-					}
-					else {
-						conn->CreateServerFullMessage();
-						conn->SendMessages();
-						CleanupSocket(connections_.size());
-						printf("Server full - client rejected\n");
-					}
-				}
+				AcceptConnections();
 			}
-			else {
-				Connection* conn = connections_[eventIndex - 1];
+			else if (ev.handle < connectionTable_.size() && connectionTable_[ev.handle]) {
+				HandleConnectionEvent(connectionTable_[ev.handle], ev.events);
+			}
+		}
 
-				if (WSAEnumNetworkEvents(conn->getSocketTCP(), eventsTCP_[eventIndex], &networkEventsTCP_) == SOCKET_ERROR) {
-					printf("Retrieving event information failed\n");
-					CleanupSocket(eventIndex);
-					continue;
-				}
-				if (networkEventsTCP_.lNetworkEvents & FD_CLOSE)
-				{
-					//Ignore the error if the client just force quit
-					if (networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] != 0 && networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] != 10053)
-					{
-						printf("FD_CLOSE with error %d\n", networkEventsTCP_.iErrorCode[FD_CLOSE_BIT]);
-					}
-					else if (networkEventsTCP_.iErrorCode[FD_CLOSE_BIT] == 10053) {
-						printf("Client closed connection.\n");
-					}
-					for (auto client : connections_) {
-						if (client != conn) client->CreatePlayerQuitMessage(conn->getPlayerID());
-					}
-					scene_->RemovePlayer(conn->getPlayerID());
-					CleanupSocket(eventIndex);
-				}
-				if (networkEventsTCP_.lNetworkEvents & FD_READ) {
-					//Reading message from client
-					conn->Read();
-				}
-				if (networkEventsTCP_.lNetworkEvents & FD_WRITE) {
-					conn->setWriteable(true);
-				}
-				if (conn->isWriteable()) {
-					int result = conn->SendMessages();
-					if (result == -1) {
-						printf("Sending to client failed.\n");
-						CleanupSocket(eventIndex);
-					}
-				}
+		//Handles closed in this batch can't have any more events pending, so are safe to reuse now
+		freeHandles_.insert(freeHandles_.end(), closedHandles_.begin(), closedHandles_.end());
+		closedHandles_.clear();
+		UpdateSendStats();
+	}
+}
+
+void NetworkServer::AcceptConnections() {
+	//Edge-triggered, so keep accepting until there are no more pending connections
+	while (true) {
+		SOCKET sock = accept(ListenSocket_, NULL, NULL);
+		if (sock == INVALID_SOCKET) {
+			if (WSAGetLastError() != WSAEWOULDBLOCK) {
+				LOG_WARNING(LOG_TCP, "Accept failed with error %d\n", WSAGetLastError());
 			}
+			return;
+		}
+		if (!SetNonBlocking(sock)) {
+			LOG_WARNING(LOG_TCP, "Failed to make client socket non-blocking\n");
+			closesocket(sock);
+			continue;
+		}
+
+		uint32_t handle = AllocateHandle();
+
+		// No ID left, or a handle too big for a token, also means full
+		int playerID = connections_.size() >= MAX_PLAYERS || handle > MAX_HANDLE_UDP ? -1 : scene_->GetAvailableID();
+		bool full = playerID < 0;
+		Connection* conn = new Connection(sock, handle, playerID, this);
+		conn->setTokenUDP(CreateTokenUDP());
+		conn->setBandwidthUDP(clientBandwidthUDP_);
+		conn->setWriteable(true); //A freshly accepted socket has an empty send buffer
+
+		connectionsMutex_.lock();
+		connectionTable_[handle] = conn;
+		conn->setIndex(connections_.size());
+		connections_.push_back(conn);
+		if (!full) playerIDtoConnection_[conn->getPlayerID()] = conn;
+		connectionsMutex_.unlock();
+
+		if (!reactorTCP_->Add(sock, handle, REACTOR_READ | REACTOR_WRITE)) {
+			LOG_WARNING(LOG_TCP, "Registering client socket failed\n");
+			//Give the ID back, as CloseConnection does
+			if (!full) scene_->RemovePlayer(conn->getPlayerID());
+			CleanupSocket(conn);
+			continue;
+		}
+
+		if (!full) {
+			conn->CreateServerAcceptMessage();
+
+			LOG_INFO(LOG_TCP, "Socket %d connected\n", (int)sock);
+			sockaddr_in addr;
+			socklen_t addrLen = sizeof(addr);
+			getpeername(sock, (sockaddr*)&addr, &addrLen);
+
+			LOG_INFO(LOG_TCP, "Client IPv4 address: %s\n", inet_ntoa(addr.sin_addr));
+			LOG_INFO(LOG_TCP, "Client TCP port: %d\n", addr.sin_port);
+		}
+		else {
+			conn->CreateServerFullMessage();
+			conn->SendMessages();
+			CleanupSocket(conn);
+			LOG_INFO(LOG_TCP, "Server full - client rejected\n");
 		}
-		else if (returnVal == WSA_WAIT_TIMEOUT) {
-			//All good, we just have no activity
+	}
+}
+
+void NetworkServer::AcceptConnectionsUDP() {
+	pendingJoinsMutex_.lock();
+	pendingJoinsUDP_.swap(pendingJoinsSwapUDP_);
+	pendingJoinsMutex_.unlock();
+
+	for (PendingJoinUDP& join : pendingJoinsSwapUDP_) {
+		uint64_t key = (uint64_t)join.address.sin_addr.s_addr << 16 | join.address.sin_port;
+		auto existing = connectedUDP_.find(key);
+		if (existing != connectedUDP_.end()) {
+			Connection* old = connectionTable_[existing->second];
+			//The same response again, already being answered from the ingress thread
+			if (old->getConnectNonce() == join.nonce) continue;
+			//A new nonce from the same address is the client starting again, so the old connection is dead
+			LOG_INFO(LOG_UDP, "Player %d reconnected over UDP\n", old->getPlayerID());
+			CloseConnection(old);
 		}
-		else if (returnVal == WSA_WAIT_FAILED) {
-			die("TCP WSAWaitForMultipleEvents failed!");
+
+		// No ID left, or a handle too big for a token, also means full. Turned away without a connection being made.
+		uint32_t handle = AllocateHandle();
+		int playerID = connections_.size() >= MAX_PLAYERS || handle > MAX_HANDLE_UDP ? -1 : scene_->GetAvailableID();
+		if (playerID < 0) {
+			closedHandles_.push_back(handle);
+			char full[HeaderSize];
+			MessageType msgType = MessageType::SERVERFULL;
+			uint16_t msgLen = HeaderSize;
+			memcpy(full, &msgLen, HeaderLenFieldSize);
+			memcpy(full + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+			WriteUDP(socketUDP_, full, &join.address, msgLen);
+			LOG_INFO(LOG_UDP, "Server full - UDP client rejected\n");
+			continue;
 		}
+
+		Connection* conn = new Connection(INVALID_SOCKET, handle, playerID, this);
+		conn->setTokenUDP(CreateTokenUDP());
+		conn->setBandwidthUDP(clientBandwidthUDP_);
+		conn->setAddressUDP(join.address);
+		conn->setConnectNonce(join.nonce);
+		conn->setConnectKey(key);
+		conn->setLastReceive(time_);
+
+		//Straight out as a datagram, the client keeps responding until it gets one.
+		//Sent before the ingress threads can see the connection and move its address.
+		SendServerAcceptUDP(socketUDP_, conn);
+
+		connectionsMutex_.lock();
+		connectionTable_[handle] = conn;
+		conn->setIndex(connections_.size());
+		connections_.push_back(conn);
+		playerIDtoConnection_[playerID] = conn;
+		connectedUDP_[key] = handle;
+		connectionsMutex_.unlock();
+
+		LOG_INFO(LOG_UDP, "Client %s:%d connected over UDP\n", inet_ntoa(join.address.sin_addr), ntohs(join.address.sin_port));
+		JoinGame(conn);
+	}
+	pendingJoinsSwapUDP_.clear();
+}
+
+uint32_t NetworkServer::AllocateHandle() {
+	//The ingress threads look connections up in the table, so it can only grow with them locked out
+	uint32_t handle;
+	connectionsMutex_.lock();
+	if (!freeHandles_.empty()) {
+		handle = freeHandles_.back();
+		freeHandles_.pop_back();
+	}
+	else {
+		handle = connectionTable_.size();
+		connectionTable_.push_back(nullptr);
+	}
+	connectionsMutex_.unlock();
+	return handle;
+}
+
+void NetworkServer::JoinGame(Connection* conn) {
+	conn->CreateJoinMessage(connections_);
+	for (auto client : connections_) {
+		if (client != conn) client->CreateNewPlayerMessage(conn->getPlayerID());
 	}
+	scene_->AddPlayer(conn->getPlayerID());
+}
+
+void NetworkServer::HandleConnectionEvent(Connection* conn, uint32_t events) {
+	if (conn->isClosing()) {
+		if (conn->getDroppedMessages() > 0) {
+			queueFullDisconnects_++;
+			LOG_WARNING(LOG_TCP, "Player %d disconnected, %u messages didn't fit its outgoing queue (%llu clients so far)\n",
+				conn->getPlayerID(), conn->getDroppedMessages(), (unsigned long long)queueFullDisconnects_);
+		}
+		else {
+			LOG_INFO(conn->isUDPOnly() ? LOG_UDP : LOG_TCP, "Player %d disconnected.\n", conn->getPlayerID());
+		}
+		CloseConnection(conn);
+		return;
+	}
+	if (conn->isUDPOnly()) {
+		//Copied, as an ingress thread can move the client to a new address
+		sockaddr_in addr;
+		conn->getAddressUDP(addr);
+		if (conn->SendReliable(time_, &addr) == -1) {
+			CloseConnection(conn);
+		}
+		return;
+	}
+
+	if (events & REACTOR_READ) {
+		//Reading messages from client, until there's nothing left in the socket
+		int result;
+		while ((result = conn->Read()) == 1) {}
+		if (result == -1) events |= REACTOR_CLOSE;
+	}
+	if (events & REACTOR_CLOSE) {
+		LOG_INFO(LOG_TCP, "Client closed connection.\n");
+		CloseConnection(conn);
+		return;
+	}
+	if (events & REACTOR_WRITE) {
+		conn->setWriteable(true);
+	}
+	if (conn->isWriteable()) {
+#ifdef __linux__
+		int result = ringTCP_ ? conn->SendMessages(ringTCP_) : conn->SendMessages();
+#else
+		int result = conn->SendMessages();
+#endif
+		if (result == -1) {
+			LOG_WARNING(LOG_TCP, "Sending to client failed.\n");
+			CleanupSocket(conn);
+		}
+		else if (result == 0) {
+			reactorTCP_->WantWrite(conn->getSocketTCP(), conn->getHandle());
+		}
+	}
+}
+
+void NetworkServer::CloseConnection(Connection* conn) {
+	for (auto client : connections_) {
+		if (client != conn) client->CreatePlayerQuitMessage(conn->getPlayerID());
+	}
+	scene_->RemovePlayer(conn->getPlayerID());
+	CleanupSocket(conn);
+}
+
+void NetworkServer::QueueSend(uint32_t handle) {
+	sendQueueMutex_.lock();
+	sendQueue_.push_back(handle);
+	sendQueueMutex_.unlock();
+
+	reactorTCP_->Wake();
+}
+
+void NetworkServer::FlushQueuedSends() {
+	sendQueueMutex_.lock();
+	sendQueue_.swap(sendQueueSwap_);
+	sendQueueMutex_.unlock();
+
+	for (uint32_t handle : sendQueueSwap_) {
+		if (handle < connectionTable_.size() && connectionTable_[handle]) {
+			HandleConnectionEvent(connectionTable_[handle], 0);
+		}
+	}
+	sendQueueSwap_.clear();
 }
 
 void NetworkServer::ConnectionLoopUDP() {
 	int previousTime = time_;
 	int deltaTime = 0;
 
-	while (true) {
-		DWORD returnVal = WSAWaitForMultipleEvents(1, &eventUDP_, false, server_tick_, false);
-
-		if (returnVal != WSA_WAIT_FAILED) {
+	while (!stopping_) {
+		int count = reactorUDP_->Wait(eventsUDP_, MAX_REACTOR_EVENTS, server_tick_);
+		if (count == -1) {
+			die("UDP reactor wait failed!");
+		}
 
-			if (WSAEnumNetworkEvents(socketUDP_, eventUDP_, &networkEventsUDP_) == SOCKET_ERROR) {
-				die("Retrieving UDP event information failed");
-			}
-			if (networkEventsUDP_.lNetworkEvents & FD_READ) {
-				ReadUDP();
-			}
-			if (networkEventsUDP_.lNetworkEvents & FD_WRITE) {
+		for (int i = 0; i < count; i++) {
+			if (eventsUDP_[i].events & REACTOR_WRITE) {
 				writeableUDP_ = true;
 			}
-			deltaTime += time_ - previousTime;
-			previousTime = time_;
-
-			if (deltaTime >= server_tick_ && writeableUDP_) {
-				deltaTime = 0;
-				SendUDP();
-			}
 		}
-		else if (returnVal == WSA_WAIT_FAILED) {
-			die("UDP WSAWaitForMultipleEvents failed!");
+		deltaTime += time_ - previousTime;
+		previousTime = time_;
+
+		if (deltaTime >= server_tick_ && writeableUDP_) {
+			deltaTime = 0;
+			SendUDP();
 		}
 	}
 }
@@ -284,91 +578,617 @@ void NetworkServer::UpdateTime() {
 	//printf("time: %d\n", time_);
 }
 
-bool NetworkServer::ReadUDP()
-{
-	//Reading message from client
-	sockaddr_in fromAddr;
-	int fromAddrSize = sizeof(fromAddr);
-	int count = recvfrom(socketUDP_, readBufferUDP_, sizeof(readBufferUDP_), 0, (sockaddr*)&fromAddr, &fromAddrSize);
-	if (count == SOCKET_ERROR) {
-		printf("Receive failed\n");
-		if (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENETRESET || WSAGetLastError() == WSAEMSGSIZE) {
-			return true;
+void NetworkServer::IngressLoopUDP(UDPWorker* worker) {
+	while (!stopping_) {
+		int count = worker->reactor->Wait(worker->events, MAX_REACTOR_EVENTS, -1);
+		if (count == -1) {
+			die("UDP reactor wait failed!");
 		}
-		else {
-			printf("UDP socket closed or broken\n");
-			return false;
+
+		for (int i = 0; i < count; i++) {
+			if (worker->events[i].events & REACTOR_READ) {
+				//Edge-triggered, so drain every datagram that has arrived
+				while (ReadUDP(*worker)) {}
+			}
 		}
 	}
-	//printf("UDP Received %d bytes\n", count);
+}
 
-	try {
-		int playerID = addressUDPtoID_.at(fromAddr);
+bool NetworkServer::ReadUDP(UDPWorker& worker) //true - the ring was filled so there may be more waiting, false - drained
+{
+	//Reading a burst of messages from clients
+	int count = worker.batch->Receive();
+	if (count == -1) {
+		LOG_ERROR(LOG_UDP, "UDP socket closed or broken\n");
+		return false;
+	}
 
-		// Get length of message
-		uint16_t msgLength = (uint16_t)readBufferUDP_[0];
-		if (count == msgLength) {
-			//printf("\nReceived UDP message: '");
-			//fwrite(readBufferUDP_, 1, msgLength, stdout);
-			//printf("'\n");
+	//Shared with the other ingress threads and the tick thread, only the TCP thread adding or removing connections waits
+	connectionsMutex_.lock_shared();
+	for (int i = 0; i < count; i++) {
+		HandleDatagram(worker, worker.batch->GetAddress(i), worker.batch->GetData(i), worker.batch->GetLength(i));
+	}
+	FlushInputs(worker);
+	connectionsMutex_.unlock_shared();
+
+	return count == DATAGRAM_RING_SIZE;
+}
 
-			HandleMessage(playerID, msgLength, readBufferUDP_);
+void NetworkServer::HandleDatagram(UDPWorker& worker, const sockaddr_in& fromAddr, const char* buffer, int count) {
+	//printf("UDP Received %d bytes\n", count);
+
+	//Anything that's going to be dropped is, before it's decoded and without logging, just counted.
+	//Otherwise a flood would cost as much to throw away as real traffic does to handle.
+	IngressCounters& counters = worker.counters;
+	Count(counters.received);
+	if (count < (int)HeaderSizeUDP || count != ReadFrameLength(buffer)) {
+		Count(counters.malformed);
+		return;
+	}
+
+	MessageType type = (MessageType)(buffer[HeaderLenFieldSize]);
+	if (type == MessageType::CONNECTREQUEST || type == MessageType::CONNECTRESPONSE) {
+		//No token yet, so it's down to where it came from
+		if (!worker.connectLimiter.Take(fromAddr, time_, RATE_LIMIT_CONNECT, RATE_BURST_CONNECT)) {
+			Count(counters.connectLimited);
+			return;
 		}
-		else {
-			printf("UDP datagram wrong length - discarding.\n");
+		HandleConnectUDP(worker, fromAddr, buffer, count);
+		return;
+	}
+
+	if (type != MessageType::INPUTUPDATE && type != MessageType::TIMEREQUEST && type != MessageType::PING && type != MessageType::SNAPSHOTACK &&
+		type != MessageType::RELIABLE && type != MessageType::RELIABLEACK && type != MessageType::DISCONNECT) {
+		Count(counters.malformed);
+		return;
+	}
+
+	uint16_t handle;
+	uint64_t token;
+	memcpy(&handle, buffer + HeaderSize, HeaderHandleFieldSize);
+	memcpy(&token, buffer + HeaderSize + HeaderHandleFieldSize, HeaderTokenFieldSize);
+	Connection* conn = FindConnectionUDP(handle, token);
+	if (!conn) {
+		Count(counters.unknownToken);
+		return;
+	}
+	if (!AllowDatagramUDP(worker, conn, type)) return;
+
+	//The token says who this is, but anyone who's seen a datagram can send it again from somewhere else. So only a new
+	//input moves a client whose address changed (e.g. a NAT rebinding), anything else from elsewhere is dropped.
+	bool moved = !conn->isAddressUDP(fromAddr);
+	if (moved && type != MessageType::INPUTUPDATE) {
+		Count(counters.movesRejected);
+		return;
+	}
+	if (!moved) conn->setLastReceive(time_);
+
+	//printf("\nReceived UDP message: '");
+	//fwrite(buffer, 1, msgLength, stdout);
+	//printf("'\n");
+
+	HandleMessageUDP(worker, conn, (uint16_t)count, buffer, fromAddr, moved);
+}
+
+void NetworkServer::HandleConnectUDP(UDPWorker& worker, const sockaddr_in& fromAddr, const char* buffer, int count) {
+	//Called with connectionsMutex_ shared. Anyone can send these, so nothing is kept until a cookie checks out.
+	MessageType type = (MessageType)(buffer[HeaderLenFieldSize]);
+	std::error_code ec;
+	if (type == MessageType::CONNECTREQUEST) {
+		if (count < CONNECT_REQUEST_SIZE) {
+			LOG_DEBUG(LOG_UDP, "UDP connect request too small - discarding.\n");
+			return;
 		}
+		ConnectRequestMessage request = msgpack::unpack<ConnectRequestMessage>((uint8_t*)&buffer[HeaderSizeUDP], count - HeaderSizeUDP, ec);
+		if (ec) return;
+
+		ConnectChallengeMessage msg;
+		MessageType msgType = MessageType::CONNECTCHALLENGE;
+		msg.nonce = request.nonce;
+		msg.time = time_;
+		msg.cookie.resize(COOKIE_SIZE);
+		CreateCookie(fromAddr, msg.nonce, msg.time, msg.cookie.data());
+		std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+		uint16_t msgLen = msgData.size() + HeaderSize;
+
+		char reply[DATAGRAM_BUFFER_SIZE];
+		memcpy(reply, &msgLen, HeaderLenFieldSize);
+		memcpy(reply + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+		memcpy(reply + HeaderSize, (const char*)msgData.data(), msgData.size());
+		WriteUDP(worker.socket, reply, (sockaddr_in*)&fromAddr, msgLen);
+		return;
+	}
+
+	ConnectChallengeMessage response = msgpack::unpack<ConnectChallengeMessage>((uint8_t*)&buffer[HeaderSizeUDP], count - HeaderSizeUDP, ec);
+	//Unsigned, so a time from the future is as stale as an old one
+	if (ec || response.cookie.size() != COOKIE_SIZE || time_ - response.time > COOKIE_LIFETIME) {
+		LOG_DEBUG(LOG_UDP, "UDP connect response malformed or expired - discarding.\n");
+		return;
+	}
+	uint8_t cookie[COOKIE_SIZE];
+	CreateCookie(fromAddr, response.nonce, response.time, cookie);
+	if (!ConstantTimeEqual(cookie, response.cookie.data(), COOKIE_SIZE)) {
+		LOG_DEBUG(LOG_UDP, "UDP connect response with a bad cookie - discarding.\n");
+		return;
 	}
-	catch (const std::out_of_range& err) {
-		printf("UDP unknown source - discarding.\n");
+
+	//The accept was lost, so send it again
+	uint64_t key = (uint64_t)fromAddr.sin_addr.s_addr << 16 | fromAddr.sin_port;
+	auto existing = connectedUDP_.find(key);
+	if (existing != connectedUDP_.end() && connectionTable_[existing->second]->getConnectNonce() == response.nonce) {
+		SendServerAcceptUDP(worker.socket, connectionTable_[existing->second]);
+		return;
 	}
 
+	pendingJoinsMutex_.lock();
+	bool queued = pendingJoinsUDP_.size() < MAX_PENDING_JOINS;
+	if (queued) pendingJoinsUDP_.push_back({ fromAddr, response.nonce });
+	pendingJoinsMutex_.unlock();
+	if (queued) reactorTCP_->Wake();
+}
+
+void NetworkServer::CreateCookie(const sockaddr_in& address, uint64_t nonce, uint32_t time, uint8_t cookie[COOKIE_SIZE]) {
+	uint8_t data[sizeof(address.sin_addr.s_addr) + sizeof(address.sin_port) + sizeof(nonce) + sizeof(time)];
+	uint8_t* write = data;
+	memcpy(write, &address.sin_addr.s_addr, sizeof(address.sin_addr.s_addr));
+	write += sizeof(address.sin_addr.s_addr);
+	memcpy(write, &address.sin_port, sizeof(address.sin_port));
+	write += sizeof(address.sin_port);
+	memcpy(write, &nonce, sizeof(nonce));
+	write += sizeof(nonce);
+	memcpy(write, &time, sizeof(time));
+
+	uint8_t mac[SHA256_SIZE];
+	HmacSha256(cookieKey_, sizeof(cookieKey_), data, sizeof(data), mac);
+	memcpy(cookie, mac, COOKIE_SIZE);
+}
+
+void NetworkServer::SendServerAcceptUDP(SOCKET sock, Connection* conn) {
+	ServerAcceptMessage msg;
+	MessageType msgType = MessageType::SERVERACCEPT;
+	msg.handleUDP = (uint16_t)conn->getHandle();
+	msg.tokenUDP = conn->getTokenUDP();
+	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+	uint16_t msgLen = msgData.size() + HeaderSize;
+
+	char buffer[DATAGRAM_BUFFER_SIZE];
+	memcpy(buffer, &msgLen, HeaderLenFieldSize);
+	memcpy(buffer + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	memcpy(buffer + HeaderSize, (const char*)msgData.data(), msgData.size());
+	sockaddr_in address;
+	if (conn->getAddressUDP(address)) WriteUDP(sock, buffer, &address, msgLen);
+}
+
+bool NetworkServer::AllowDatagramUDP(UDPWorker& worker, Connection* conn, MessageType type) {
+	//The connection's own lock, as a client that moves address can land on another ingress thread
+	IngressLimits& limits = conn->getIngressLimits();
+	std::lock_guard<std::mutex> lock(limits.mutex);
+	if (!limits.datagrams.Take(time_, RATE_LIMIT_CONNECTION, RATE_BURST_CONNECTION)) {
+		Count(worker.counters.connectionLimited);
+		limits.dropped++;
+		return false;
+	}
+	if (type == MessageType::TIMEREQUEST && !limits.timeRequests.Take(time_, RATE_LIMIT_TIME_REQUESTS, RATE_BURST_TIME_REQUESTS)) {
+		Count(worker.counters.timeRequestLimited);
+		limits.dropped++;
+		return false;
+	}
 	return true;
 }
 
-bool NetworkServer::WriteUDP(sockaddr_in* address, uint16_t& length)
+Connection* NetworkServer::FindConnectionUDP(uint16_t handle, uint64_t token) {
+	//Called with connectionsMutex_ shared. The handle is straight into the table, then the token has to match.
+	if (handle >= connectionTable_.size()) return nullptr;
+	Connection* conn = connectionTable_[handle];
+	if (!conn || conn->getPlayerID() < 0 || conn->getTokenUDP() != token) return nullptr;
+	return conn;
+}
+
+uint64_t NetworkServer::CreateTokenUDP() {
+	//Each call is 32 bits from the OS, as unpredictable as the cookie key
+	uint64_t token = tokenRandom_();
+	return token << 32 | tokenRandom_();
+}
+
+void NetworkServer::HandleMessageUDP(UDPWorker& worker, Connection* conn, uint16_t msgLength, const char* buffer, const sockaddr_in& fromAddr, bool moved) {
+	//Called with connectionsMutex_ shared, so the connection can't go away underneath us
+	MessageType type = (MessageType)(buffer[HeaderLenFieldSize]);
+	//A body that doesn't unpack is counted as malformed and dropped, like a bad header
+	std::error_code ec;
+	switch (type)
+	{
+	case MessageType::TIMEREQUEST:
+	{
+		TimeRequestMessage msg = msgpack::unpack<TimeRequestMessage>((uint8_t*)&buffer[HeaderSizeUDP], msgLength - HeaderSizeUDP, ec);
+		if (ec) {
+			Count(worker.counters.malformed);
+			break;
+		}
+		msg.serverReceiveTime = std::chrono::duration_cast<std::chrono::microseconds>(ServerClock::now() - timeStart_).count();
+		SendTimeReplyMessage(worker, conn, msg);
+	}
+	break;
+	case MessageType::INPUTUPDATE:
+	{
+		InputUpdateMessage msg = msgpack::unpack<InputUpdateMessage>((uint8_t*)&buffer[HeaderSizeUDP], msgLength - HeaderSizeUDP, ec);
+		//ApplyPlayerInput reads both velocity axes, so one that unpacks with any other number can't be played out
+		if (ec || msg.velocity.size() != 2) {
+			Count(worker.counters.malformed);
+			break;
+		}
+		//A replayed input from somewhere new is dropped, a new one brings the client along with it
+		int where = conn->InputAddressUDP(fromAddr, msg.sequence);
+		if (where == -1) {
+			Count(worker.counters.movesRejected);
+			break;
+		}
+		if (where == 1) {
+			LOG_INFO(LOG_UDP, "Player %d UDP address is now %s:%d\n", conn->getPlayerID(), inet_ntoa(fromAddr.sin_addr), ntohs(fromAddr.sin_port));
+			conn->setLastReceive(time_);
+		}
+		//printf("ltime: %d, mtime: %d, x: %f\n", time_, msg.time, msg.input[(int)PlayerInputs::VELOCITY_X]);
+
+		//printf("vel: %f,%f rot: %f, jump: %d\n", msg.velocity[0], msg.velocity[1], msg.rotation, msg.jump);
+
+		//Every input is passed on, the scene's jitter buffer puts them back in order and drops any too late to use
+		worker.inputs.emplace_back(conn->getPlayerID(), msg);
+	}
+	break;
+	case MessageType::PING:
+		LOG_DEBUG(LOG_UDP, "Client ping\n");
+		break;
+	case MessageType::RELIABLE:
+	{
+		if (!conn->isUDPOnly()) break;
+		ReliableMessage msg = msgpack::unpack<ReliableMessage>((uint8_t*)&buffer[HeaderSizeUDP], msgLength - HeaderSizeUDP, ec);
+		if (ec) {
+			Count(worker.counters.malformed);
+			break;
+		}
+
+		//Acknowledged every time, even repeats, as it's the ack that was lost
+		ReliableAckMessage ack;
+		MessageType msgType = MessageType::RELIABLEACK;
+		ack.sequence = conn->ReceiveReliable(msg);
+		std::vector<uint8_t> msgData = msgpack::pack(ack); //Serialize the message struct
+		uint16_t msgLen = msgData.size() + HeaderSize;
+
+		char reply[DATAGRAM_BUFFER_SIZE];
+		memcpy(reply, &msgLen, HeaderLenFieldSize);
+		memcpy(reply + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+		memcpy(reply + HeaderSize, (const char*)msgData.data(), msgData.size());
+		sockaddr_in address;
+		if (conn->getAddressUDP(address)) WriteUDP(worker.socket, reply, &address, msgLen);
+	}
+	break;
+	case MessageType::RELIABLEACK:
+	{
+		if (!conn->isUDPOnly()) break;
+		ReliableAckMessage msg = msgpack::unpack<ReliableAckMessage>((uint8_t*)&buffer[HeaderSizeUDP], msgLength - HeaderSizeUDP, ec);
+		if (ec) {
+			Count(worker.counters.malformed);
+			break;
+		}
+		conn->AcknowledgeReliable(msg.sequence);
+		QueueSend(conn->getHandle()); //The window may have room for more now
+	}
+	break;
+	case MessageType::DISCONNECT:
+		if (!conn->isUDPOnly()) break; //TCP clients are gone when their socket closes
+		conn->setClosing();
+		QueueSend(conn->getHandle());
+		break;
+	case MessageType::SNAPSHOTACK:
+	{
+		SnapshotAckMessage msg = msgpack::unpack<SnapshotAckMessage>((uint8_t*)&buffer[HeaderSizeUDP], msgLength - HeaderSizeUDP, ec);
+		if (ec) {
+			Count(worker.counters.malformed);
+			break;
+		}
+		//Acks can arrive out of order too, and can't be for snapshots not sent yet.
+		//Only this client's ingress thread writes it, the snapshot thread just reads it.
+		if (msg.sequence > conn->getAckedSnapshot() && msg.sequence <= conn->getSnapshotSequence()) {
+			conn->setAckedSnapshot(msg.sequence);
+		}
+	}
+	break;
+	default:
+		break;
+	}
+}
+
+void NetworkServer::FlushInputs(UDPWorker& worker) {
+	if (worker.inputs.empty()) return;
+	//Stamped now rather than with time_, which only moves on once a frame
+	uint32_t arrival = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(ServerClock::now() - timeStart_).count();
+	scene_->SetInputs(worker.inputs, arrival);
+	worker.inputs.clear();
+}
+
+bool NetworkServer::SendDatagram(sockaddr_in* address, const char* buffer, uint16_t length) {
+	return WriteUDP(socketUDP_, buffer, address, length);
+}
+
+bool NetworkServer::WriteUDP(SOCKET sock, const char* buffer, sockaddr_in* address, uint16_t length)
 {
 	if (address) {
-		int count = sendto(socketUDP_, writeBufferUDP_, length, 0, (const sockaddr*)address, sizeof(sockaddr));
+		int count = sendto(sock, buffer, length, 0, (const sockaddr*)address, sizeof(sockaddr));
 		if (count == SOCKET_ERROR) {
 			if (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENOBUFS) {
-				writeableUDP_ = false;
-				return false;
+				return false; //Lossy anyway, the client will ask again
 			}
 			else {
 				die("UDP error writing"); //TODO: restart udp listening
 			}
 		}
 		//printf("Sent UDP message to the client: '");
-		//fwrite(writeBufferUDP_, 1, length, stdout);
+		//fwrite(buffer, 1, length, stdout);
 		//printf("'\n\n");
 		return true;
 	}
+	return false;
 }
 
-void NetworkServer::SendTimeReplyMessage(sockaddr_in* address, TimeRequestMessage& msg) {
+void NetworkServer::SendTimeReplyMessage(UDPWorker& worker, Connection* conn, TimeRequestMessage& msg) {
+	//Replies are built on the worker's stack, as several workers can be replying at once
+	char buffer[DATAGRAM_BUFFER_SIZE];
 	MessageType msgType = MessageType::TIMEREQUEST;
-	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+	memcpy(buffer + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
 
-	msg.serverTime = time_;
+	//Microseconds, as close to sending as it can be, so the client can take out how long the request was held here
+	msg.serverTime = std::chrono::duration_cast<std::chrono::microseconds>(ServerClock::now() - timeStart_).count();
 	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
 	uint16_t msgLen = msgData.size() + HeaderSize;
-	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferUDP_ + HeaderSize, (const char*)msgData.data(), msgData.size());
+	memcpy(buffer, &msgLen, HeaderLenFieldSize);
+	memcpy(buffer + HeaderSize, (const char*)msgData.data(), msgData.size());
 
-	if (writeableUDP_) WriteUDP(address, msgLen);
+	//Reply from the socket the request came in on, so the client sees the same source
+	sockaddr_in address;
+	if (conn->getAddressUDP(address)) WriteUDP(worker.socket, buffer, &address, msgLen);
 	//printf("reply time: %d\n", msg.serverTime);
 }
 
 bool NetworkServer::SendUDP() {
-	uint16_t msgLength = CreatePlayersUpdateMessage();
 	//printf("sending update, %d\n", time_);
-	for (auto conn : connections_) {
-		if (writeableUDP_) WriteUDP(conn->getAddressUDP(), msgLength);
-		else return false;
+	// Queue every client's snapshot and send them all together
+	size_t count = CreateSnapshotsUDP();
+	for (size_t i = 0; i < count; i++) {
+		batchUDP_->Queue(snapshotAddressesUDP_[i], &snapshotsUDP_[i * SNAPSHOT_MTU], snapshotLengthsUDP_[i]);
+	}
+
+	int result = batchUDP_->Flush();
+	if (result == 0) {
+		writeableUDP_ = false;
+		reactorUDP_->WantWrite(socketUDP_, 0);
+	}
+	else if (result == -1) {
+		die("UDP error writing"); //TODO: restart udp listening
+	}
+	return result == 1;
+}
+
+#ifdef __linux__
+
+bool NetworkServer::StartIoUring() {
+	if (!IoUring::SupportsMultishotReceive()) {
+		LOG_WARNING(LOG_UDP, "io_uring multishot receives unsupported (needs Linux 6.0)\n");
+		return false;
+	}
+
+	ringTCP_ = new IoUring();
+	ringUDP_ = new IoUring();
+	if (!ringTCP_->Init(2 * MAX_LINKED_SENDS) || !ringUDP_->Init(256)) {
+		delete ringTCP_;
+		delete ringUDP_;
+		ringTCP_ = ringUDP_ = nullptr;
+		return false;
+	}
+
+	//Each buffer holds the recvmsg header, then the sender's address, then the datagram itself
+	unsigned int bufferSize = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + DATAGRAM_BUFFER_SIZE;
+	receiveBuffersUDP_ = new char[(size_t)bufferSize * URING_UDP_BUFFERS];
+	if (!ringUDP_->RegisterBufferRing(0, receiveBuffersUDP_, URING_UDP_BUFFERS, bufferSize)) {
+		LOG_WARNING(LOG_UDP, "io_uring provided buffers unsupported\n");
+		delete ringTCP_;
+		delete ringUDP_;
+		delete[] receiveBuffersUDP_;
+		ringTCP_ = ringUDP_ = nullptr;
+		receiveBuffersUDP_ = nullptr;
+		return false;
+	}
+
+	stopEventUDP_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stopEventUDP_ == -1) {
+		die("eventfd failed");
 	}
 	return true;
 }
 
+void NetworkServer::ConnectionLoopUDPUring() {
+	int previousTime = time_;
+	int deltaTime = 0;
+
+	ArmReceiveUDP();
+	ArmTickUDP();
+	ArmStopUDP();
+
+	while (!stopping_) {
+		//Submit whatever is queued and sleep until something completes
+		int submitted = ringUDP_->Submit(1);
+		if (submitted < 0) {
+			die("UDP io_uring submit failed!");
+		}
+
+		connectionsMutex_.lock_shared();
+		while (io_uring_cqe* cqe = ringUDP_->PeekCqe()) {
+			switch (cqe->user_data) {
+			case URING_TAG_RECEIVE:
+				HandleReceiveUDP(cqe);
+				break;
+			case URING_TAG_TICK:
+				ArmTickUDP();
+				break;
+			case URING_TAG_SNAPSHOT:
+				pendingSendsUDP_--;
+				break;
+			case URING_TAG_STOP:
+				break; //Only there to end the wait, stopping_ is already set
+			}
+			ringUDP_->SeenCqe();
+		}
+		//Couldn't be armed while the queues were full, now there's room
+		if (rearmReceiveUDP_) ArmReceiveUDP();
+		if (rearmTickUDP_) ArmTickUDP();
+		if (rearmStopUDP_) ArmStopUDP();
+		FlushInputs(*workersUDP_[0]);
+		connectionsMutex_.unlock_shared();
+
+		deltaTime += time_ - previousTime;
+		previousTime = time_;
+
+		//A snapshot still in flight means the socket is backed up, so skip this tick's rather than pile on
+		if (deltaTime >= server_tick_ && pendingSendsUDP_ == 0) {
+			deltaTime = 0;
+			SendUDPUring();
+		}
+	}
+
+	CancelUring();
+}
+
+void NetworkServer::CancelUring() {
+	//Closing the ring lets go of the socket in the background, so a new server could find the port still taken.
+	//Cancel everything in flight and wait for it to finish instead.
+	io_uring_sqe* sqe = ringUDP_->GetSqe();
+	if (!sqe) {
+		ringUDP_->Submit();
+		sqe = ringUDP_->GetSqe();
+	}
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+	sqe->user_data = URING_TAG_CANCEL;
+
+	bool cancelled = false;
+	while (!cancelled || receivingUDP_ || pendingSendsUDP_ > 0) {
+		if (ringUDP_->Submit(1) < 0) return;
+		while (io_uring_cqe* cqe = ringUDP_->PeekCqe()) {
+			switch (cqe->user_data) {
+			case URING_TAG_RECEIVE:
+				if (cqe->flags & IORING_CQE_F_BUFFER) ringUDP_->RecycleBuffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+				if (!(cqe->flags & IORING_CQE_F_MORE)) receivingUDP_ = false;
+				break;
+			case URING_TAG_SNAPSHOT:
+				pendingSendsUDP_--;
+				break;
+			case URING_TAG_CANCEL:
+				cancelled = true;
+				break;
+			}
+			ringUDP_->SeenCqe();
+		}
+	}
+}
+
+void NetworkServer::ArmReceiveUDP() {
+	//Multishot: one request keeps producing a completion per datagram until it runs out of buffers
+	memset(&receiveMsgUDP_, 0, sizeof(receiveMsgUDP_));
+	receiveMsgUDP_.msg_namelen = sizeof(sockaddr_in);
+
+	io_uring_sqe* sqe = ringUDP_->GetSqe();
+	rearmReceiveUDP_ = sqe == nullptr;
+	if (!sqe) return;
+	receivingUDP_ = true;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = socketUDP_;
+	sqe->addr = (uint64_t)(uintptr_t)&receiveMsgUDP_;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = URING_TAG_RECEIVE;
+}
+
+void NetworkServer::ArmTickUDP() {
+	tickTimeoutUDP_.tv_sec = server_tick_ / 1000;
+	tickTimeoutUDP_.tv_nsec = (server_tick_ % 1000) * 1000000LL;
+
+	io_uring_sqe* sqe = ringUDP_->GetSqe();
+	rearmTickUDP_ = sqe == nullptr;
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&tickTimeoutUDP_;
+	sqe->len = 1;
+	sqe->user_data = URING_TAG_TICK;
+}
+
+void NetworkServer::ArmStopUDP() {
+	io_uring_sqe* sqe = ringUDP_->GetSqe();
+	rearmStopUDP_ = sqe == nullptr;
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = stopEventUDP_;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_TAG_STOP;
+}
+
+void NetworkServer::HandleReceiveUDP(io_uring_cqe* cqe) {
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		uint16_t bufferID = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (cqe->res >= 0) {
+			io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)ringUDP_->GetBuffer(bufferID);
+			const sockaddr_in* fromAddr = (const sockaddr_in*)(out + 1);
+			const char* payload = (const char*)(fromAddr + 1);
+			//Truncated datagrams were too big for the buffer, so can't be valid messages
+			int length = (out->flags & MSG_TRUNC) ? 0 : out->payloadlen;
+			HandleDatagram(*workersUDP_[0], *fromAddr, payload, length);
+		}
+		ringUDP_->RecycleBuffer(bufferID);
+	}
+	else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+		LOG_WARNING(LOG_UDP, "UDP io_uring receive failed with error %d\n", -cqe->res);
+	}
+
+	//The kernel ends the multishot receive on errors or when it ran out of buffers, so start it again
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		receivingUDP_ = false;
+		ArmReceiveUDP();
+	}
+}
+
+void NetworkServer::SendUDPUring() {
+	size_t count = CreateSnapshotsUDP();
+
+	//Headers must stay put until the sends complete, so they're only built once the snapshots are final
+	snapshotIovsUDP_.resize(count);
+	snapshotMsgsUDP_.assign(count, msghdr());
+	for (size_t i = 0; i < count; i++) {
+		snapshotIovsUDP_[i].iov_base = &snapshotsUDP_[i * SNAPSHOT_MTU];
+		snapshotIovsUDP_[i].iov_len = snapshotLengthsUDP_[i];
+
+		msghdr& msg = snapshotMsgsUDP_[i];
+		msg.msg_name = &snapshotAddressesUDP_[i];
+		msg.msg_namelen = sizeof(sockaddr_in);
+		msg.msg_iov = &snapshotIovsUDP_[i];
+		msg.msg_iovlen = 1;
+
+		io_uring_sqe* sqe = ringUDP_->GetSqe();
+		if (!sqe) break; //Still full after submitting, the rest of this tick's snapshots are dropped like any lost datagram
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = socketUDP_;
+		sqe->addr = (uint64_t)(uintptr_t)&msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_DONTWAIT;
+		sqe->user_data = URING_TAG_SNAPSHOT;
+		pendingSendsUDP_++;
+	}
+	//Everything queued goes to the kernel together on the loop's next submit
+}
+
+#endif
+
 uint16_t NetworkServer::CreatePingMessage() {
 
 	MessageType msgType = MessageType::PING;
@@ -380,72 +1200,359 @@ uint16_t NetworkServer::CreatePingMessage() {
 	return msgLen;
 }
 
-uint16_t NetworkServer::CreatePlayersUpdateMessage()
+size_t NetworkServer::CreateSnapshotsUDP() {
+	//Whatever the simulation published last, read without holding it up
+	const WorldSnapshot& world = scene_->GetWorldSnapshot();
+
+	interestGrid_.Clear();
+	for (size_t row = 0; row < world.Size(); row++) {
+		interestGrid_.Insert(world.ids[row], world.positionX[row], world.positionZ[row]);
+	}
+
+	//Shared, so the ingress threads carry on while the snapshots are built
+	connectionsMutex_.lock_shared();
+	UpdateIngressStats();
+	snapshotLengthsUDP_.clear();
+	snapshotAddressesUDP_.clear();
+	for (auto conn : connections_) {
+		sockaddr_in address;
+		if (!conn->getAddressUDP(address)) continue;
+
+		//UDP only clients have no socket to say they've gone, and their reliable messages need resending
+		if (conn->isUDPOnly()) {
+			if (time_ - conn->getLastReceive() > CONNECTION_TIMEOUT_UDP) {
+				LOG_INFO(LOG_UDP, "Player %d timed out\n", conn->getPlayerID());
+				conn->setClosing();
+				QueueSend(conn->getHandle());
+				continue;
+			}
+			if (conn->ReliablePending()) QueueSend(conn->getHandle());
+		}
+
+		UpdateInterest(conn, world);
+		CreatePlayersUpdateMessages(conn, address, world);
+	}
+	connectionsMutex_.unlock_shared();
+
+	return snapshotLengthsUDP_.size();
+}
+
+void NetworkServer::UpdateInterest(Connection* conn, const WorldSnapshot& world) {
+	std::vector<int>& interest = conn->Interest();
+	int self = world.Find(conn->getPlayerID());
+	if (self < 0) {
+		interest.clear(); //Not in the game yet, so nothing to see
+		interestFoundUDP_.clear();
+		return;
+	}
+
+	interestFoundUDP_.clear();
+	interestGrid_.Query(world.positionX[self], world.positionZ[self], INTEREST_LEAVE_RADIUS, interestFoundUDP_);
+
+	//Players come into view inside the radius, but only leave once past the leave radius
+	float radiusSq = INTEREST_RADIUS * INTEREST_RADIUS;
+	size_t kept = 0;
+	for (InterestEntry& entry : interestFoundUDP_) {
+		if (entry.distanceSq <= radiusSq || std::binary_search(interest.begin(), interest.end(), entry.id)) {
+			interestFoundUDP_[kept++] = entry;
+		}
+	}
+	interestFoundUDP_.resize(kept);
+
+	//Too many to fit, keep the nearest (their own player is at distance 0)
+	if (kept > SNAPSHOT_MAX_PLAYERS) {
+		std::nth_element(interestFoundUDP_.begin(), interestFoundUDP_.begin() + SNAPSHOT_MAX_PLAYERS, interestFoundUDP_.end(),
+			[](const InterestEntry& a, const InterestEntry& b) { return a.distanceSq < b.distanceSq; });
+		interestFoundUDP_.resize(SNAPSHOT_MAX_PLAYERS);
+	}
+
+	std::sort(interestFoundUDP_.begin(), interestFoundUDP_.end(), [](const InterestEntry& a, const InterestEntry& b) { return a.id < b.id; });
+	interest.clear();
+	for (InterestEntry& entry : interestFoundUDP_) {
+		interest.push_back(entry.id);
+	}
+}
+
+void NetworkServer::CreatePlayersUpdateMessages(Connection* conn, const sockaddr_in& address, const WorldSnapshot& world)
 {
+	SnapshotState state;
+	for (int id : conn->Interest()) {
+		PlayerValues& player = state[id];
+		player.position.resize(3);
+		player.velocity.resize(3);
+		world.GetPlayerValues(world.Find(id), player);
+		QuantizePlayerValues(player);
+	}
+
 	PlayersUpdateMessage msg;
 	msg.time = time_;
-	msg.playerValues = *scene_->GetPlayerValues();
+	msg.sequence = conn->NextSnapshotSequence();
+	int self = world.Find(conn->getPlayerID());
+	msg.inputSequence = self >= 0 ? world.inputSequence[self] : 0;
+
+	//Only send what's changed since the newest snapshot the client has, if it's recent enough that we still have it too.
+	//Otherwise (e.g. the acks are being lost) send the lot.
+	const SnapshotState* baseline = nullptr;
+	uint32_t acked = conn->getAckedSnapshot();
+	if (acked != 0 && msg.sequence - acked < SNAPSHOT_HISTORY) baseline = conn->Snapshots().Find(acked);
+	msg.baseline = baseline ? acked : 0;
+	DiffSnapshot(baseline, state, snapshotChangesUDP_, snapshotRemovedUDP_);
+	PrioritiseChanges(conn, baseline, state);
+
+	//Split it into datagrams of whole players and removals, so each can be used by the client without the rest.
+	//Players go in highest priority first until the client's bandwidth for this tick runs out, removals always go.
+	//Always at least one, so the client still hears about a snapshot with nothing in it.
+	const size_t mtuBits = (SNAPSHOT_MTU - SNAPSHOT_FRAGMENT_OVERHEAD) * 8;
+	const size_t budgetBits = conn->getBandwidthUDP() / TICKRATE;
+	size_t spentBits = 0;
+	size_t changesEnd = 0, removedEnd = 0;
+	snapshotFragmentsUDP_.clear();
+	auto fitsBudget = [&](size_t bits) {
+		return changesEnd < snapshotChangesUDP_.size() &&
+			spentBits + bits + SnapshotChangeBits(snapshotChangesUDP_[changesEnd].fields) <= budgetBits;
+	};
+	do {
+		size_t bits = SNAPSHOT_COUNT_BITS;
+		while (removedEnd < snapshotRemovedUDP_.size() && bits + SNAPSHOT_REMOVED_SIZE * 8 <= mtuBits) {
+			bits += SNAPSHOT_REMOVED_SIZE * 8;
+			removedEnd++;
+		}
+		while (fitsBudget(bits + SNAPSHOT_FRAGMENT_OVERHEAD * 8) && bits + SnapshotChangeBits(snapshotChangesUDP_[changesEnd].fields) <= mtuBits) {
+			bits += SnapshotChangeBits(snapshotChangesUDP_[changesEnd].fields);
+			changesEnd++;
+		}
+		snapshotFragmentsUDP_.push_back({ changesEnd, removedEnd });
+		spentBits += bits + SNAPSHOT_FRAGMENT_OVERHEAD * 8;
+	} while (removedEnd < snapshotRemovedUDP_.size() || fitsBudget(SNAPSHOT_FRAGMENT_OVERHEAD * 8 + SNAPSHOT_COUNT_BITS));
+
+	if (snapshotFragmentsUDP_.size() > SNAPSHOT_MAX_FRAGMENTS) {
+		LOG_WARNING(LOG_UDP, "Snapshot for player %d needs %d datagrams - not sent\n", conn->getPlayerID(), (int)snapshotFragmentsUDP_.size());
+		return;
+	}
+
+	size_t first = snapshotLengthsUDP_.size();
+	size_t bytes = 0;
 	MessageType msgType = MessageType::PLAYERSUPDATE;
-	std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
-	uint16_t msgLen = msgData.size() + HeaderSize;
-	memcpy(writeBufferUDP_ + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
-	memcpy(writeBufferUDP_, &msgLen, HeaderLenFieldSize);
-	memcpy(writeBufferUDP_ + HeaderSize, (const char*)msgData.data(), msgData.size());
+	msg.fragmentCount = (uint8_t)snapshotFragmentsUDP_.size();
+	size_t changesStart = 0, removedStart = 0;
+	for (size_t i = 0; i < snapshotFragmentsUDP_.size(); i++) {
+		changesEnd = snapshotFragmentsUDP_[i].first;
+		removedEnd = snapshotFragmentsUDP_[i].second;
+		msg.fragment = (uint8_t)i;
+		WriteSnapshotChanges(snapshotChangesUDP_.data() + changesStart, changesEnd - changesStart, msg);
+		msg.removed.assign(snapshotRemovedUDP_.begin() + removedStart, snapshotRemovedUDP_.begin() + removedEnd);
+		changesStart = changesEnd;
+		removedStart = removedEnd;
+
+		std::vector<uint8_t> msgData = msgpack::pack(msg); //Serialize the message struct
+		if (msgData.size() + HeaderSize > SNAPSHOT_MTU) {
+			LOG_WARNING(LOG_UDP, "Snapshot datagram for player %d too big - not sent\n", conn->getPlayerID());
+			snapshotLengthsUDP_.resize(first);
+			snapshotAddressesUDP_.resize(first);
+			return;
+		}
 
-	return msgLen;
+		//Buffers are only pointed at once every snapshot is built, so growing here is fine
+		size_t index = snapshotLengthsUDP_.size();
+		if (snapshotsUDP_.size() < (index + 1) * SNAPSHOT_MTU) snapshotsUDP_.resize((index + 1) * SNAPSHOT_MTU);
+		char* buffer = &snapshotsUDP_[index * SNAPSHOT_MTU];
+
+		uint16_t msgLen = msgData.size() + HeaderSize;
+		memcpy(buffer + HeaderLenFieldSize, &msgType, HeaderTypeFieldSize);
+		memcpy(buffer, &msgLen, HeaderLenFieldSize);
+		memcpy(buffer + HeaderSize, (const char*)msgData.data(), msgData.size());
+
+		snapshotLengthsUDP_.push_back(msgLen);
+		snapshotAddressesUDP_.push_back(address);
+		bytes += msgLen;
+	}
+
+	//The ones sent start building up priority again
+	std::unordered_map<int, EntityPriority>& priorities = conn->Priorities();
+	for (size_t i = 0; i < changesEnd; i++) {
+		EntityPriority& entity = priorities[snapshotChangesUDP_[i].id];
+		entity.priority = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			entity.sentVelocity[axis] = snapshotChangesUDP_[i].values->velocity[axis];
+		}
+		entity.sentTime = time_;
+	}
+	conn->getSnapshotStats().deferred = snapshotChangesUDP_.size() - changesEnd;
+	UpdateSnapshotStats(conn, state, bytes);
+
+	//Remember what the client will have once it gets this, which for players left out is still the baseline
+	if (changesEnd == snapshotChangesUDP_.size()) {
+		conn->Snapshots().Store(msg.sequence, state);
+		return;
+	}
+	SnapshotState sent;
+	if (baseline) sent = *baseline;
+	for (int id : snapshotRemovedUDP_) {
+		sent.erase(id);
+	}
+	for (size_t i = 0; i < changesEnd; i++) {
+		sent[snapshotChangesUDP_[i].id] = *snapshotChangesUDP_[i].values;
+	}
+	conn->Snapshots().Store(msg.sequence, sent);
 }
 
-void NetworkServer::HandleMessage(int playerID, uint16_t msgLength, const char* buffer) {
-	MessageType type = (MessageType)(buffer[HeaderLenFieldSize]);
-	switch (type)
-	{
-	case MessageType::TIMEREQUEST:
-	{
-		TimeRequestMessage msg = msgpack::unpack<TimeRequestMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
-		SendTimeReplyMessage(playerIDtoConnection_[playerID]->getAddressUDP(), msg);
+void NetworkServer::PrioritiseChanges(Connection* conn, const SnapshotState* baseline, const SnapshotState& state) {
+	std::unordered_map<int, EntityPriority>& priorities = conn->Priorities();
+
+	//Forget players that have left the snapshot
+	for (auto it = priorities.begin(); it != priorities.end();) {
+		if (!state.count(it->first)) it = priorities.erase(it);
+		else ++it;
 	}
-	break;
-	case MessageType::INPUTUPDATE:
-	{
-		Connection* conn = playerIDtoConnection_[playerID];
-		InputUpdateMessage msg = msgpack::unpack<InputUpdateMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
-		//printf("ltime: %d, mtime: %d, x: %f\n", time_, msg.time, msg.input[(int)PlayerInputs::VELOCITY_X]);
 
-		//printf("vel: %f,%f rot: %f, jump: %d\n", msg.velocity[0], msg.velocity[1], msg.rotation, msg.jump);
+	//The client already has the current values of unchanged players
+	size_t change = 0;
+	for (auto& player : state) {
+		if (change < snapshotChangesUDP_.size() && snapshotChangesUDP_[change].id == player.first) {
+			change++;
+			continue;
+		}
+		EntityPriority& entity = priorities[player.first];
+		entity.priority = 0;
+		entity.sentTime = time_;
+	}
 
-		//As UDP packets can arrive out of order, only want most up to date inputs
-		if (msg.time > *conn->LastUpdateTime()) {
-			*conn->LastUpdateTime() = msg.time;
-			scene_->SetInput(playerID, msg);
+	//Nearer players, and players that have sped up, turned or stopped, build up faster. Both lists are sorted by ID.
+	size_t found = 0;
+	for (SnapshotChange& changed : snapshotChangesUDP_) {
+		while (found < interestFoundUDP_.size() && interestFoundUDP_[found].id < changed.id) found++;
+		float distance = found < interestFoundUDP_.size() && interestFoundUDP_[found].id == changed.id ? std::sqrt(interestFoundUDP_[found].distanceSq) : INTEREST_LEAVE_RADIUS;
+		float nearness = std::max(0.0f, 1.0f - distance / INTEREST_LEAVE_RADIUS);
+
+		EntityPriority& entity = priorities[changed.id];
+		float velocityChange = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float difference = changed.values->velocity[axis] - entity.sentVelocity[axis];
+			velocityChange += difference * difference;
 		}
+
+		entity.priority += PRIORITY_BASE * (1.0f + PRIORITY_DISTANCE_WEIGHT * nearness) + PRIORITY_VELOCITY_WEIGHT * std::sqrt(velocityChange);
+		if (!baseline || !baseline->count(changed.id)) entity.priority += PRIORITY_NEW;
+		if (changed.id == conn->getPlayerID()) entity.priority += PRIORITY_OWN;
 	}
-		break;
-	case MessageType::PING:
-		printf("Client ping\n");
-		break;
+
+	std::stable_sort(snapshotChangesUDP_.begin(), snapshotChangesUDP_.end(), [&priorities](const SnapshotChange& a, const SnapshotChange& b) {
+		return priorities[a.id].priority > priorities[b.id].priority;
+	});
+}
+
+void NetworkServer::UpdateIngressStats() {
+	//Called with connectionsMutex_ shared
+	if (time_ - ingressStatsStart_ < INGRESS_STATS_INTERVAL) return;
+	ingressStatsStart_ = time_;
+
+	IngressStats stats = GetIngressStats();
+	const IngressStats& logged = ingressStatsLogged_;
+	if (stats.Dropped() != logged.Dropped()) {
+		LOG_WARNING(LOG_UDP, "UDP ingress dropped %llu of %llu datagrams: %llu malformed, %llu unknown token, %llu over connect rate, %llu over connection rate, %llu over time request rate, %llu from a new address without a new input\n",
+			(unsigned long long)(stats.Dropped() - logged.Dropped()), (unsigned long long)(stats.received - logged.received),
+			(unsigned long long)(stats.malformed - logged.malformed), (unsigned long long)(stats.unknownToken - logged.unknownToken),
+			(unsigned long long)(stats.connectLimited - logged.connectLimited), (unsigned long long)(stats.connectionLimited - logged.connectionLimited),
+			(unsigned long long)(stats.timeRequestLimited - logged.timeRequestLimited), (unsigned long long)(stats.movesRejected - logged.movesRejected));
+
+		//And who's responsible, for those with connections
+		for (auto conn : connections_) {
+			IngressLimits& limits = conn->getIngressLimits();
+			limits.mutex.lock();
+			uint64_t dropped = limits.dropped - limits.droppedLogged;
+			limits.droppedLogged = limits.dropped;
+			limits.mutex.unlock();
+			if (dropped == 0) continue;
+			LOG_WARNING(LOG_UDP, "Player %d over its UDP rate limits, %llu datagrams dropped\n", conn->getPlayerID(), (unsigned long long)dropped);
+		}
+	}
+	ingressStatsLogged_ = stats;
+}
+
+void NetworkServer::UpdateSendStats() {
+	if (time_ - sendStatsStart_ < SEND_STATS_INTERVAL) return;
+	sendStatsStart_ = time_;
+
+	//Only this thread adds or removes connections, so no need to lock them
+	ConnectionStats stats = sendStatsClosed_;
+	for (auto conn : connections_) {
+		stats.Add(conn->getStats());
+	}
+	const ConnectionStats& logged = sendStatsLogged_;
+	uint64_t batches = stats.batchesFlushed - logged.batchesFlushed;
+	if (batches > 0) {
+		LOG_INFO(LOG_TCP, "Sent %llu messages (%llu bytes) to clients in %llu batches, %.2f messages and %.2f send calls a batch, %llu sends cut short\n",
+			(unsigned long long)(stats.messagesSent - logged.messagesSent), (unsigned long long)(stats.bytesSent - logged.bytesSent),
+			(unsigned long long)batches, (double)(stats.messagesSent - logged.messagesSent) / batches,
+			(double)(stats.sendCalls - logged.sendCalls) / batches, (unsigned long long)(stats.partialWrites - logged.partialWrites));
+	}
+	sendStatsLogged_ = stats;
+}
+
+IngressStats NetworkServer::GetIngressStats() {
+	//Each worker's counters are only written by its own thread, so just add them up
+	IngressStats stats;
+	for (UDPWorker* worker : workersUDP_) {
+		IngressCounters& counters = worker->counters;
+		stats.received += counters.received.load(std::memory_order_relaxed);
+		stats.malformed += counters.malformed.load(std::memory_order_relaxed);
+		stats.unknownToken += counters.unknownToken.load(std::memory_order_relaxed);
+		stats.connectLimited += counters.connectLimited.load(std::memory_order_relaxed);
+		stats.connectionLimited += counters.connectionLimited.load(std::memory_order_relaxed);
+		stats.timeRequestLimited += counters.timeRequestLimited.load(std::memory_order_relaxed);
+		stats.movesRejected += counters.movesRejected.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+void NetworkServer::UpdateSnapshotStats(Connection* conn, const SnapshotState& state, size_t bytes) {
+	SnapshotStats& stats = conn->getSnapshotStats();
+	std::unordered_map<int, EntityPriority>& priorities = conn->Priorities();
+
+	if (stats.intervalStart == 0) stats.intervalStart = time_;
+	stats.intervalBytes += bytes;
+	for (auto& player : state) {
+		stats.intervalStaleness += time_ - priorities[player.first].sentTime;
+		stats.intervalPlayers++;
+	}
+
+	uint32_t elapsed = time_ - stats.intervalStart;
+	if (elapsed < SNAPSHOT_STATS_INTERVAL) return;
+	stats.bitrate = (uint32_t)(stats.intervalBytes * 8 * 1000 / elapsed);
+	stats.meanStaleness = stats.intervalPlayers ? (float)(stats.intervalStaleness / stats.intervalPlayers) : 0.0f;
+	stats.intervalStart = time_;
+	stats.intervalBytes = 0;
+	stats.intervalStaleness = 0;
+	stats.intervalPlayers = 0;
+	LOG_INFO(LOG_UDP, "Player %d snapshots: %u of %u bits/s, mean staleness %.0fms, %u players deferred\n",
+		conn->getPlayerID(), stats.bitrate, conn->getBandwidthUDP(), stats.meanStaleness, stats.deferred);
+}
+
+void NetworkServer::HandleMessage(int playerID, uint16_t msgLength, const char* buffer) {
+	MessageType type = (MessageType)(buffer[HeaderLenFieldSize]);
+	switch (type)
+	{
 	case MessageType::CLIENTINFO: 
 	{
-		printf("recieved client info\n");
+		LOG_INFO(LOG_TCP, "recieved client info\n");
 		ClientInfoMessage msg = msgpack::unpack<ClientInfoMessage>((uint8_t*)&buffer[HeaderSize], msgLength - HeaderSize);
 
-		Connection* newClient = playerIDtoConnection_[playerID];
+		//Clients joining over UDP gave their address in the handshake, and are already in the game
+		auto found = playerIDtoConnection_.find(playerID);
+		if (found == playerIDtoConnection_.end() || found->second->isUDPOnly()) break;
+		Connection* newClient = found->second;
 
 		//Build socket address structure
 		sockaddr_in addr;
-		int addrLen = sizeof(addr);
+		socklen_t addrLen = sizeof(addr);
 		getpeername(newClient->getSocketTCP(), (sockaddr*)&addr, &addrLen);
 		addr.sin_port = msg.portUDP; 
 
-		printf("Client UDP port: %d\n\n", addr.sin_port);
-
-		addressUDPtoID_[addr] = playerID;
+		LOG_INFO(LOG_UDP, "Client UDP port: %d\n", addr.sin_port);
 
 		newClient->setAddressUDP(addr);
-		newClient->CreateJoinMessage(connections_);
-		for (auto client : connections_) {
-			if (client != newClient) client->CreateNewPlayerMessage(playerID);
-		}
-		scene_->AddPlayer(playerID);
+
+		JoinGame(newClient);
 	}
 		break;
 	case MessageType::CHAT:
@@ -469,6 +1576,7 @@ void NetworkServer::HandleMessage(int playerID, uint16_t msgLength, const char*
 // ---------- StartWinSock() and die() taken from lab 4 -------------
 
 void NetworkServer::StartWinSock() {
+#ifdef _WIN32
 	// We want version 2.2.
 	WSADATA w;
 	int error = WSAStartup(0x0202, &w);
@@ -481,9 +1589,11 @@ void NetworkServer::StartWinSock() {
 		WSACleanup();
 		die("Wrong WinSock version");
 	}
+#endif
 }
 
 void NetworkServer::die(const char* message) {
+	Log::Flush(); //Get everything logged so far out before the error
 	fprintf(stderr, "\nError: %s (WSAGetLastError() = %d)", message, WSAGetLastError());
 	WSACleanup();
 #ifdef _DEBUG
@@ -494,26 +1604,27 @@ void NetworkServer::die(const char* message) {
 #endif
 }
 
-void NetworkServer::CleanupSocket(int index) {
-	addressUDPtoID_.erase(addressUDPtoID_.find(*connections_[index - 1]->getAddressUDP()));
-	connections_.erase(connections_.begin() + index - 1);
-	WSACloseEvent(eventsTCP_[index]);
-	eventsTCP_.erase(eventsTCP_.begin() + index);
-}
+void NetworkServer::CleanupSocket(Connection* conn) {
+	if (!conn->isUDPOnly()) reactorTCP_->Remove(conn->getSocketTCP(), conn->getHandle());
 
-bool operator==(const sockaddr_in& left, const sockaddr_in& right)
-{
-	return (left.sin_port == right.sin_port)
-		&& (memcmp(&left.sin_addr, &right.sin_addr, sizeof(left.sin_addr)) == 0);
-}
+	connectionsMutex_.lock();
+	if (conn->isUDPOnly()) {
+		auto udpIt = connectedUDP_.find(conn->getConnectKey());
+		if (udpIt != connectedUDP_.end() && udpIt->second == conn->getHandle()) connectedUDP_.erase(udpIt);
+	}
+	auto idIt = playerIDtoConnection_.find(conn->getPlayerID());
+	if (idIt != playerIDtoConnection_.end() && idIt->second == conn) playerIDtoConnection_.erase(idIt);
 
-bool operator<(const sockaddr_in& left, const sockaddr_in& right)
-{
-	int c = memcmp(&left.sin_addr, &right.sin_addr, sizeof(left.sin_addr));
-	if (c < 0)
-		return true;
-	else if (c == 0)
-		return left.sin_port < right.sin_port;
-	else
-		return false;
-}
\ No newline at end of file
+	// Swap the last connection into this one's place so nothing else has to move
+	size_t index = conn->getIndex();
+	connections_[index] = connections_.back();
+	connections_[index]->setIndex(index);
+	connections_.pop_back();
+
+	connectionTable_[conn->getHandle()] = nullptr;
+	closedHandles_.push_back(conn->getHandle());
+	connectionsMutex_.unlock();
+	sendStatsClosed_.Add(conn->getStats());
+
+	delete conn;
+}
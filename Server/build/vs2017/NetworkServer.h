@@ -1,15 +1,24 @@
 #pragma once
-#define NOMINMAX
-#include <WinSock2.h>
+#include "Sockets.h"
 #include <iostream>
 #include "Messages.h"
 #include "Connection.h"
+#include "Reactor.h"
+#include "DatagramBatch.h"
+#include "InterestGrid.h"
+#include "WorldSnapshot.h"
+#include "RateLimiter.h"
+#ifdef __linux__
+#include "IoUring.h"
+#endif
 #include <thread>
 #include <queue>
 #include <mutex>
+#include <shared_mutex>
 #include <utility>
 #include <unordered_map>
-#include <map>
+#include <random>
+#include <atomic>
 
 // The TCP port number on the server to connect to
 #define SERVERPORT_TCP 5555
@@ -19,12 +28,140 @@
 
 #define TICKRATE 8
 
+// Most players in the game at once, anyone connecting past this is told the game is full
+#define MAX_PLAYERS 2048
+
+// Players further than this from a client's player are left out of its snapshots
+#define INTEREST_RADIUS 15.0f
+// Once in a snapshot, a player stays in until it's this far away, so players on the edge don't flicker in and out
+#define INTEREST_LEAVE_RADIUS (INTEREST_RADIUS * 1.25f)
+// Most players in one snapshot, the nearest are picked. Each takes up to 20 bytes, split over datagrams of SNAPSHOT_MTU,
+// and the lot must fit in SNAPSHOT_MAX_FRAGMENTS of them.
+#define SNAPSHOT_MAX_PLAYERS 1024
+
+// Bits per second of snapshots each client is sent by default, changed with BANDWIDTH_ENV_VAR.
+// Players that don't fit in a tick build up priority and go in a later one.
+#define CLIENT_BANDWIDTH 512000
+// How much a changed player's priority grows each tick it isn't sent
+#define PRIORITY_BASE 1.0f             // For waiting another tick
+#define PRIORITY_DISTANCE_WEIGHT 2.0f  // Up to this much more for the nearest, down to nothing at INTEREST_LEAVE_RADIUS
+#define PRIORITY_VELOCITY_WEIGHT 0.5f  // Per m/s its velocity has changed since the client was last sent it
+#define PRIORITY_NEW 1000.0f           // Not in the client's baseline yet, so it can't see it at all
+#define PRIORITY_OWN 1000000.0f        // Their own player, which the client checks its prediction against, always goes
+// How often each client's snapshot bitrate and staleness are worked out and logged, in ms
+#define SNAPSHOT_STATS_INTERVAL 5000
+
+// Biggest connection handle a datagram's Handle field can hold. The handle leads straight to the connection, and the
+// datagram's 64 bit token has to match the connection's, random from the OS so no other sender can guess it.
+#define MAX_HANDLE_UDP 0xFFFF
+
+// Clients can also join over UDP alone. A CONNECTREQUEST is answered with a cookie, an HMAC of the client's address,
+// its nonce and the time, which it has to send back in a CONNECTRESPONSE. Nothing is allocated until then.
+// Requests smaller than this are ignored, so a spoofed request can't get back more than it sent.
+#define CONNECT_REQUEST_SIZE 64
+// Bytes of HMAC kept in a cookie
+#define COOKIE_SIZE 16
+// ms a cookie is good for
+#define COOKIE_LIFETIME 5000
+// Valid responses waiting for the TCP thread to set up their connections, any more are dropped and the client tries again
+#define MAX_PENDING_JOINS 256
+// ms without hearing from a UDP only client before it's taken to have gone
+#define CONNECTION_TIMEOUT_UDP 10000
+
+// Datagrams a second each connection may send, and how many it can save up for a burst. Anything over is dropped
+// before it's decoded. A client sends an input a frame (at most one every 2ms) and acks each snapshot, so only a
+// misbehaving one gets near this.
+#define RATE_LIMIT_CONNECTION 600
+#define RATE_BURST_CONNECTION 300
+// Time requests a second each connection may send, as every one is answered. Clients send a burst of 8 a tenth of a
+// second apart when they join, then one a second.
+#define RATE_LIMIT_TIME_REQUESTS 20
+#define RATE_BURST_TIME_REQUESTS 10
+// Connect requests and responses a second from one IP address. A client resends every 250ms, so this leaves room
+// for a few joining at once from behind the same NAT.
+#define RATE_LIMIT_CONNECT 16
+#define RATE_BURST_CONNECT 32
+// How often the UDP ingress drop counts are logged, in ms. Nothing is logged for an interval with no drops.
+#define INGRESS_STATS_INTERVAL 5000
+// How often the batching of messages to clients is logged, in ms. Nothing is logged for an interval with nothing sent.
+#define SEND_STATS_INTERVAL 5000
+
+// Number of UDP ingress threads, each with its own SO_REUSEPORT socket on SERVERPORT_UDP.
+// The kernel hashes each client onto one socket, so a client's datagrams are always read by the same thread.
+// Platforms without SO_REUSEPORT load balancing get a single ingress thread.
+#define UDP_INGRESS_WORKERS 4
+
+// Maximum number of events handled per reactor wait
+#define MAX_REACTOR_EVENTS 256
+
+// Reactor handle for the TCP listen socket. Connection handles are indices into connectionTable_.
+#define LISTEN_HANDLE (REACTOR_WAKE_HANDLE - 1)
+
+// Number of io_uring provided buffers for UDP receives, must be a power of two
+#define URING_UDP_BUFFERS 256
+
+// Environment variable choosing the networking backend at startup ("io_uring" or "readiness")
+#define BACKEND_ENV_VAR "SERVER_NETWORK_BACKEND"
+
+// Environment variable setting each client's snapshot bandwidth in bits per second
+#define BANDWIDTH_ENV_VAR "SERVER_CLIENT_BANDWIDTH"
+
 typedef std::chrono::high_resolution_clock ServerClock;
 
 class SceneApp;
 
 enum class ReadingWriting { READING, WRITING, NONE };
 
+// READINESS waits on the reactors then does the socket calls itself.
+// IO_URING (Linux only) hands the socket calls to the kernel through io_uring.
+enum class NetworkBackend { READINESS, IO_URING };
+
+// Datagrams the UDP ingress threads threw away unhandled, since the server started
+struct IngressStats {
+	uint64_t received = 0;
+	uint64_t malformed = 0;          // Wrong length, not a type clients send over UDP, or a body that won't unpack or is missing values
+	uint64_t unknownToken = 0;       // No connection has the token
+	uint64_t connectLimited = 0;     // Connect requests and responses over their address's rate
+	uint64_t connectionLimited = 0;  // Over their connection's datagram rate
+	uint64_t timeRequestLimited = 0; // Time requests over their connection's rate
+	uint64_t movesRejected = 0;      // From somewhere other than the client's address, and not a new input to move it there
+
+	uint64_t Dropped() const { return malformed + unknownToken + connectLimited + connectionLimited + timeRequestLimited + movesRejected; }
+};
+
+// One ingress thread's share of IngressStats. Only that thread writes them, the totals are read from any thread.
+struct IngressCounters {
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> malformed{ 0 };
+	std::atomic<uint64_t> unknownToken{ 0 };
+	std::atomic<uint64_t> connectLimited{ 0 };
+	std::atomic<uint64_t> connectionLimited{ 0 };
+	std::atomic<uint64_t> timeRequestLimited{ 0 };
+	std::atomic<uint64_t> movesRejected{ 0 };
+};
+
+// A thread reading client datagrams from its own socket.
+struct UDPWorker {
+	SOCKET socket = INVALID_SOCKET;
+	Reactor* reactor = nullptr;
+	DatagramBatch* batch = nullptr;
+	ReactorEvent events[MAX_REACTOR_EVENTS];
+	std::thread* thread = nullptr;
+	//Inputs decoded from the current burst of datagrams, handed to the scene together under one lock
+	std::vector<std::pair<int, InputUpdateMessage>> inputs;
+	//Rate limits for connect handshakes reaching this socket. The kernel picks the socket by address and port, so a
+	//sender changing port can be spread over every worker, and get up to UDP_INGRESS_WORKERS times the rate.
+	SourceRateLimiter connectLimiter;
+	IngressCounters counters;
+};
+
+// A client whose connect cookie came back valid, waiting for the TCP thread to give it a connection
+struct PendingJoinUDP {
+	sockaddr_in address;
+	uint64_t nonce;
+};
+
+
 class NetworkServer {
 public:
 	NetworkServer() {};
@@ -32,54 +169,188 @@ public:
 
 	void StartWinSock();
 	void StartConnection(SceneApp* scene);
+	// Stop every network thread and wait for them to finish. Call before the scene goes, as they use it.
+	void Stop();
 	void ConnectionLoopTCP();
 	void ConnectionLoopUDP();
 	void UpdateTime();
 	uint32_t GetTime() { return time_; }
 	//void CreateChatMessage(const char* chatMsg, int playerID);
 	void HandleMessage(int playerID, uint16_t length, const char* buffer);
+	// Ask the TCP thread to flush a connection's outgoing messages. Safe to call from any thread.
+	void QueueSend(uint32_t handle);
+	// Send a datagram that's already built, from any thread. Lost datagrams are for the caller to resend.
+	bool SendDatagram(sockaddr_in* address, const char* buffer, uint16_t length);
+	// Drop counts so far, safe to call from any thread
+	IngressStats GetIngressStats();
+	// Clients closed for not keeping up with their reliable messages, safe to call from any thread
+	uint64_t GetQueueFullDisconnects() { return queueFullDisconnects_; }
 private:
 	void DisplayLocalIP();
 	void StartListeningTCP();
 	void StartListeningUDP();
+	SOCKET CreateSocketUDP(bool reusePort);
 	void RestartListeningTCP();
 	void RestartListeningUDP();
 	void die(const char* message);
-	void CleanupSocket(int index);
-	bool ReadUDP();
-	bool WriteUDP(sockaddr_in* address, uint16_t& length);
-	void SendTimeReplyMessage(sockaddr_in* address, TimeRequestMessage& msg);
+	void AcceptConnections();
+	// Set up connections for the UDP joins the ingress threads have validated
+	void AcceptConnectionsUDP();
+	// Give out a connection handle, reusing an old one if possible
+	uint32_t AllocateHandle();
+	void JoinGame(Connection* conn);
+	void HandleConnectionEvent(Connection* conn, uint32_t events);
+	// Tell everyone else the player has gone, then clean up
+	void CloseConnection(Connection* conn);
+	void FlushQueuedSends();
+	void CleanupSocket(Connection* conn);
+	void IngressLoopUDP(UDPWorker* worker);
+	bool ReadUDP(UDPWorker& worker);
+	void HandleDatagram(UDPWorker& worker, const sockaddr_in& fromAddr, const char* buffer, int count);
+	Connection* FindConnectionUDP(uint16_t handle, uint64_t token);
+	// A new connection's secret token, only called by the TCP thread
+	uint64_t CreateTokenUDP();
+	void HandleConnectUDP(UDPWorker& worker, const sockaddr_in& fromAddr, const char* buffer, int count);
+	// Take a token for a datagram of type from conn, false if it's over a limit and should be dropped
+	bool AllowDatagramUDP(UDPWorker& worker, Connection* conn, MessageType type);
+	// The first COOKIE_SIZE bytes of the HMAC of where a client is, its nonce and when
+	void CreateCookie(const sockaddr_in& address, uint64_t nonce, uint32_t time, uint8_t cookie[COOKIE_SIZE]);
+	void SendServerAcceptUDP(SOCKET sock, Connection* conn);
+	// moved: from somewhere other than the client's address, which only a new input can move it to
+	void HandleMessageUDP(UDPWorker& worker, Connection* conn, uint16_t length, const char* buffer, const sockaddr_in& fromAddr, bool moved);
+	void FlushInputs(UDPWorker& worker);
+	bool WriteUDP(SOCKET sock, const char* buffer, sockaddr_in* address, uint16_t length);
+	void SendTimeReplyMessage(UDPWorker& worker, Connection* conn, TimeRequestMessage& msg);
 	bool SendUDP();
 	uint16_t CreatePingMessage();
-	uint16_t CreatePlayersUpdateMessage();
+	// Build every client's snapshot datagrams into snapshotsUDP_, returns how many
+	size_t CreateSnapshotsUDP();
+	void UpdateInterest(Connection* conn, const WorldSnapshot& world);
+	// Add a client's snapshot to snapshotsUDP_, as many datagrams as it takes
+	void CreatePlayersUpdateMessages(Connection* conn, const sockaddr_in& address, const WorldSnapshot& world);
+	// Raise the priority of each changed player, and order snapshotChangesUDP_ by it
+	void PrioritiseChanges(Connection* conn, const SnapshotState* baseline, const SnapshotState& state);
+	void UpdateSnapshotStats(Connection* conn, const SnapshotState& state, size_t bytes);
+	// Log what the ingress threads have dropped, once an interval, if anything
+	void UpdateIngressStats();
+	// Log how well messages to clients were batched, once an interval, if anything was sent. Only on the TCP thread.
+	void UpdateSendStats();
+#ifdef __linux__
+	bool StartIoUring();
+	void ConnectionLoopUDPUring();
+	void ArmReceiveUDP();
+	void ArmTickUDP();
+	void ArmStopUDP();
+	// Cancel whatever the UDP ring has in flight and wait for it, once the loop has stopped
+	void CancelUring();
+	void HandleReceiveUDP(io_uring_cqe* cqe);
+	void SendUDPUring();
+#endif
 
-	uint32_t time_;
+	// Milliseconds since timeStart_, moved on by the scene and read by every network thread.
+	// Starts at 0, as the loops measure their ticks from it before the scene's first update.
+	std::atomic<uint32_t> time_{ 0 };
 	ServerClock::time_point timeStart_ = ServerClock::now();
 
 	SceneApp* scene_;
 
-	std::thread* connectionThreadTCP_;
-	std::thread* connectionThreadUDP_;
+	std::thread* connectionThreadTCP_ = nullptr;
+	std::thread* connectionThreadUDP_ = nullptr;
+	//Checked by every network loop each time round, Stop() sets it then wakes them
+	std::atomic<bool> stopping_{ false };
+	//Counted by the TCP thread as it closes them
+	std::atomic<uint64_t> queueFullDisconnects_{ 0 };
 
-	//Structure to hold the result from WSAEnumNetworkEvents
-	WSANETWORKEVENTS networkEventsTCP_;
-	WSANETWORKEVENTS networkEventsUDP_;
+	//Readiness notifiers for each loop, and the events they return
+	Reactor* reactorTCP_ = nullptr;
+	Reactor* reactorUDP_ = nullptr;
+	ReactorEvent eventsTCP_[MAX_REACTOR_EVENTS];
+	ReactorEvent eventsUDP_[MAX_REACTOR_EVENTS];
 
-	SOCKET ListenSocket_;
+	SOCKET ListenSocket_ = INVALID_SOCKET;
 	std::vector<Connection*> connections_;
 	std::unordered_map<int, Connection*> playerIDtoConnection_;
+	//Connections indexed by handle, with unused handles kept for reuse
+	std::vector<Connection*> connectionTable_;
+	std::vector<uint32_t> freeHandles_;
+	//Handles closed during the current batch of events, only reused once the batch is done
+	std::vector<uint32_t> closedHandles_;
+	//UDP only connections by address, as ip << 16 | port
+	std::unordered_map<uint64_t, uint32_t> connectedUDP_;
+	//Guards the containers above. The ingress and tick threads only read them, so share it, and only the TCP thread
+	//modifies them, taking it exclusively. It doesn't cover the connections themselves, which lock their own state.
+	std::shared_mutex connectionsMutex_;
 
+	//Connections with new messages waiting to be sent
+	std::vector<uint32_t> sendQueue_;
+	std::vector<uint32_t> sendQueueSwap_;
+	std::mutex sendQueueMutex_;
+
+	//Ingress threads reading client datagrams. Snapshots go out through the first worker's socket.
+	std::vector<UDPWorker*> workersUDP_;
 	SOCKET socketUDP_;
-	//std::vector<sockaddr_in> addressesUDP_;
-	std::map<sockaddr_in, int> addressUDPtoID_;
+	DatagramBatch* batchUDP_ = nullptr;
+	//The OS's secure random numbers, for connection tokens. Only used by the TCP thread.
+	std::random_device tokenRandom_;
+
+	//Key connect cookies are signed with, made fresh each run
+	uint8_t cookieKey_[32];
+	//UDP joins with valid cookies, from the ingress threads to the TCP thread
+	std::vector<PendingJoinUDP> pendingJoinsUDP_;
+	std::vector<PendingJoinUDP> pendingJoinsSwapUDP_;
+	std::mutex pendingJoinsMutex_;
 
-	//WSAEVENT ListenEvent_;
-	std::vector<WSAEVENT> eventsTCP_ = std::vector<WSAEVENT>(1);
-	WSAEVENT eventUDP_;
+	//Ingress drop counts when they were last logged, only used by the tick thread
+	IngressStats ingressStatsLogged_;
+	uint32_t ingressStatsStart_ = 0;
+	//Totals for connections that have closed, and everything as it was when last logged. Only used by the TCP thread.
+	ConnectionStats sendStatsClosed_;
+	ConnectionStats sendStatsLogged_;
+	uint32_t sendStatsStart_ = 0;
 
-	char readBufferUDP_[500];
+	//Message being built by the tick thread
 	char writeBufferUDP_[500];
+
+	//Every snapshot datagram for this tick, SNAPSHOT_MTU apart, with where they're going
+	std::vector<char> snapshotsUDP_;
+	std::vector<uint16_t> snapshotLengthsUDP_;
+	std::vector<sockaddr_in> snapshotAddressesUDP_;
+	//What changed in the snapshot being built, and where each of its datagrams ends in them
+	std::vector<SnapshotChange> snapshotChangesUDP_;
+	std::vector<int> snapshotRemovedUDP_;
+	std::vector<std::pair<size_t, size_t>> snapshotFragmentsUDP_;
+	//Snapshot bandwidth each new client gets
+	uint32_t clientBandwidthUDP_ = CLIENT_BANDWIDTH;
+	//Players by position, for picking what goes in each snapshot
+	InterestGrid interestGrid_{ INTEREST_RADIUS };
+	//The players in the snapshot being built and how far away they are, sorted by ID
+	std::vector<InterestEntry> interestFoundUDP_;
 	bool writeableUDP_ = false;
 
 	int server_tick_ = 1000 / TICKRATE;
+
+	NetworkBackend backend_ = NetworkBackend::READINESS;
+#ifdef __linux__
+	//One ring per thread, as a ring must only be used from one thread
+	IoUring* ringTCP_ = nullptr;
+	IoUring* ringUDP_ = nullptr;
+
+	//Provided buffers the multishot receive fills, and the template header it receives with
+	char* receiveBuffersUDP_ = nullptr;
+	msghdr receiveMsgUDP_;
+	__kernel_timespec tickTimeoutUDP_;
+	//Written by Stop() to end the ring's wait, as nothing else can be submitted to it from another thread
+	int stopEventUDP_ = -1;
+	//Set when there was no submission entry free to arm with, so the loop tries again
+	bool rearmReceiveUDP_ = false;
+	bool rearmTickUDP_ = false;
+	bool rearmStopUDP_ = false;
+	//The multishot receive is in the ring, from arming it until the completion without IORING_CQE_F_MORE
+	bool receivingUDP_ = false;
+
+	//Snapshots being sent through the ring are left untouched until every send of them has completed
+	std::vector<iovec> snapshotIovsUDP_;
+	std::vector<msghdr> snapshotMsgsUDP_;
+	int pendingSendsUDP_ = 0;
+#endif
 };
\ No newline at end of file
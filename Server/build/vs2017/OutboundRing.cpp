@@ -0,0 +1,71 @@
+#include "OutboundRing.h"
+#include <cstring>
+
+OutboundRing::OutboundRing() {
+	for (size_t i = 0; i < OUTBOUND_RING_SLOTS; i++) {
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+		slots_[i].large = nullptr;
+	}
+	enqueuePos_.store(0, std::memory_order_relaxed);
+	dequeuePos_ = 0;
+}
+
+OutboundRing::~OutboundRing() {
+	for (size_t i = 0; i < OUTBOUND_RING_SLOTS; i++) {
+		delete[] slots_[i].large;
+	}
+}
+
+bool OutboundRing::Push(const char* head, uint16_t headLength, const char* body, uint16_t bodyLength) {
+	size_t length = (size_t)headLength + bodyLength;
+	if (length > UINT16_MAX) return false;
+	// Allocated before claiming a slot, so other producers aren't held up behind it
+	char* large = length > OUTBOUND_SLOT_SIZE ? new char[length] : nullptr;
+
+	// Claim a slot. It's free when its sequence matches the position, and still holds an unsent
+	// message from the last time round when its sequence is behind.
+	size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &slots_[pos & (OUTBOUND_RING_SLOTS - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		}
+		else if (diff < 0) {
+			delete[] large;
+			return false; // Full
+		}
+		else {
+			pos = enqueuePos_.load(std::memory_order_relaxed); // Another producer got there first
+		}
+	}
+
+	char* data = large ? large : slot->data;
+	memcpy(data, head, headLength);
+	if (bodyLength > 0) memcpy(data + headLength, body, bodyLength);
+	slot->large = large;
+	slot->length = (uint16_t)length;
+
+	// Publish it to the consumer
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+const char* OutboundRing::Peek(size_t i, uint16_t& length) {
+	size_t pos = dequeuePos_ + i;
+	if (i >= OUTBOUND_RING_SLOTS) return nullptr;
+	Slot& slot = slots_[pos & (OUTBOUND_RING_SLOTS - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != pos + 1) return nullptr;
+	length = slot.length;
+	return slot.large ? slot.large : slot.data;
+}
+
+void OutboundRing::Pop() {
+	Slot& slot = slots_[dequeuePos_ & (OUTBOUND_RING_SLOTS - 1)];
+	delete[] slot.large;
+	slot.large = nullptr;
+	slot.sequence.store(dequeuePos_ + OUTBOUND_RING_SLOTS, std::memory_order_release);
+	dequeuePos_++;
+}
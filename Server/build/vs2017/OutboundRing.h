@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Number of messages a connection can have waiting to be sent, must be a power of two
+#define OUTBOUND_RING_SLOTS 64
+
+// Largest message a slot holds itself. Bigger ones (up to 65535 bytes) are copied to the heap, which only the
+// occasional large message such as a JOINGAME listing every player should need.
+#define OUTBOUND_SLOT_SIZE 512
+
+// Bounded queue of outgoing messages, copied into preallocated slots.
+// Any number of threads may Push() without locking; only the network thread may Peek() and Pop().
+// Each slot carries a sequence number saying whose turn it is: producers claim a slot by bumping the
+// enqueue position, fill it in, then publish it by advancing the slot's sequence for the consumer.
+class OutboundRing {
+public:
+	OutboundRing();
+	~OutboundRing();
+
+	// Copy head followed by body into the next free slot.
+	// Returns false, leaving the ring untouched, if the ring is full or the message is over 65535 bytes.
+	bool Push(const char* head, uint16_t headLength, const char* body = nullptr, uint16_t bodyLength = 0);
+
+	// The i'th oldest message waiting, or nullptr if fewer than i + 1 are ready.
+	// Stays valid until it is popped.
+	const char* Peek(size_t i, uint16_t& length);
+
+	// Release the oldest message's slot back to the producers.
+	void Pop();
+
+	bool Empty() { uint16_t length; return Peek(0, length) == nullptr; }
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		uint16_t length;
+		char* large; // Heap copy of a message too big for data, freed when it's popped
+		char data[OUTBOUND_SLOT_SIZE];
+	};
+
+	Slot slots_[OUTBOUND_RING_SLOTS];
+
+	// Kept on separate cache lines so producers and the consumer don't contend
+	alignas(64) std::atomic<size_t> enqueuePos_;
+	alignas(64) size_t dequeuePos_;
+};
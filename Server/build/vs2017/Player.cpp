@@ -1,10 +1,11 @@
 #include "Player.h"
+#include "SlotMap.h"
 
 void Player::Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int ID)
 {
 	playerID = ID;
-	set_mesh(builder->CreateBoxMesh(gef::Vector4(0.5f, 0.75f, 0.5f)));
-	InitPhysx(physx::PxVec3(0.5f, 0.75f, 0.5f), physx::PxVec3(ID, 1.25f, 2), scene, physics, true);
+	if (builder) set_mesh(builder->CreateBoxMesh(gef::Vector4(PLAYER_HALF_WIDTH, PLAYER_HALF_HEIGHT, PLAYER_HALF_WIDTH)));
+	InitPhysx(physx::PxVec3(PLAYER_HALF_WIDTH, PLAYER_HALF_HEIGHT, PLAYER_HALF_WIDTH), physx::PxVec3((float)(SlotMapIndex(ID) % 5), 1.25f, 2), scene, physics, true);
 	GetPxBody()->setRigidDynamicLockFlags(physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_X | physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_Z | physx::PxRigidDynamicLockFlag::eLOCK_ANGULAR_Y);
 }
 
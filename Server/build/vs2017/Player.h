@@ -3,6 +3,10 @@
 #include "primitive_builder.h"
 #include <PxPhysicsAPI.h>
 
+// Every player is a box this size
+#define PLAYER_HALF_WIDTH 0.5f
+#define PLAYER_HALF_HEIGHT 0.75f
+
 class Player : public GameObject {
 public:
 	void Init(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int ID);
@@ -18,9 +22,13 @@ public:
 	physx::PxVec3 getForwardVec();
 	physx::PxVec3 getRightVec();
 	physx::PxRigidDynamic* GetPxBody() override;
+	// Sequence of the last input applied, sent back to the client so it knows which of its predictions to check
+	void setLastInput(uint32_t sequence) { lastInput = sequence; }
+	uint32_t getLastInput() { return lastInput; }
 
 protected:
 	int playerID;
+	uint32_t lastInput = 0;
 	physx::PxVec3 velocity = physx::PxVec3(0, 0, 0);
 	physx::PxVec3 forwardVec = physx::PxVec3(0, 0, -1);
 	physx::PxVec3 rightVec = physx::PxVec3(1, 0, 0);
@@ -0,0 +1,27 @@
+#pragma once
+#include "Messages.h"
+#include <PxPhysicsAPI.h>
+
+// Shared by the client and server, keep both copies the same.
+
+#define PLAYER_SPEED 3.0f
+#define PLAYER_JUMP_IMPULSE 7.0f
+
+// Set a player going with one simulation step's input, before the step. The server does this for each input it plays
+// out, and the client for its own player when it predicts and again when it replays inputs the server hasn't used yet,
+// so both have to run exactly this. P is either side's Player.
+template<class P>
+void ApplyPlayerInput(P& player, const InputUpdateMessage& input) {
+	physx::PxRigidDynamic* body = player.GetPxBody();
+	if (input.jump) {
+		body->addForce(physx::PxVec3(0, PLAYER_JUMP_IMPULSE, 0), physx::PxForceMode::eIMPULSE);
+	}
+
+	player.setRotation(input.rotation);
+
+	physx::PxVec3 velocity(input.velocity[0], 0, input.velocity[1]);
+	velocity.normalize();
+	velocity = velocity * PLAYER_SPEED;
+	velocity.y = body->getLinearVelocity().y;
+	player.setVelocity(velocity);
+}
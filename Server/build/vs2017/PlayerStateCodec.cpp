@@ -0,0 +1,81 @@
+#include "PlayerStateCodec.h"
+#include <cmath>
+
+#define TWO_PI 6.28318530718f
+
+// One code is left unused, so the middle of a symmetric range is exactly zero and still players stay still
+static uint32_t Steps(const QuantizedRange& range) {
+	return (uint32_t)(((uint64_t)1 << range.bits) - 2);
+}
+
+uint32_t QuantizeFloat(float value, const QuantizedRange& range) {
+	if (!(value >= range.min)) value = range.min; // Catches NaN too
+	if (value > range.max) value = range.max;
+	return (uint32_t)std::lround((double)(value - range.min) / (range.max - range.min) * Steps(range));
+}
+
+float DequantizeFloat(uint32_t value, const QuantizedRange& range) {
+	return (float)(range.min + (double)value * (range.max - range.min) / Steps(range));
+}
+
+uint32_t QuantizeAngle(float radians) {
+	if (!std::isfinite(radians)) return 0;
+	double turns = radians / TWO_PI;
+	turns -= std::floor(turns);
+	uint32_t steps = 1u << PlayerStateSchema::rotationBits;
+	return (uint32_t)std::lround(turns * steps) & (steps - 1);
+}
+
+float DequantizeAngle(uint32_t value) {
+	return (float)((double)value * TWO_PI / (1u << PlayerStateSchema::rotationBits));
+}
+
+void QuantizePlayerValues(PlayerValues& values) {
+	using namespace PlayerStateSchema;
+	values.position[0] = DequantizeFloat(QuantizeFloat(values.position[0], positionXZ), positionXZ);
+	values.position[1] = DequantizeFloat(QuantizeFloat(values.position[1], positionY), positionY);
+	values.position[2] = DequantizeFloat(QuantizeFloat(values.position[2], positionXZ), positionXZ);
+	for (float& v : values.velocity) {
+		v = DequantizeFloat(QuantizeFloat(v, velocity), velocity);
+	}
+	values.rotation = DequantizeAngle(QuantizeAngle(values.rotation));
+}
+
+void WritePlayerFields(BitWriter& writer, const PlayerValues& values, uint8_t fields) {
+	using namespace PlayerStateSchema;
+	if (fields & STATE_POSITION) {
+		writer.WriteBits(QuantizeFloat(values.position[0], positionXZ), positionXZ.bits);
+		writer.WriteBits(QuantizeFloat(values.position[1], positionY), positionY.bits);
+		writer.WriteBits(QuantizeFloat(values.position[2], positionXZ), positionXZ.bits);
+	}
+	if (fields & STATE_VELOCITY) {
+		for (int i = 0; i < 3; i++) {
+			writer.WriteBits(QuantizeFloat(values.velocity[i], velocity), velocity.bits);
+		}
+	}
+	if (fields & STATE_ROTATION) {
+		writer.WriteBits(QuantizeAngle(values.rotation), rotationBits);
+	}
+}
+
+bool ReadPlayerFields(BitReader& reader, PlayerValues& values, uint8_t fields) {
+	using namespace PlayerStateSchema;
+	uint32_t q[3];
+	if (fields & STATE_POSITION) {
+		if (!reader.ReadBits(positionXZ.bits, q[0]) || !reader.ReadBits(positionY.bits, q[1]) || !reader.ReadBits(positionXZ.bits, q[2])) return false;
+		values.position[0] = DequantizeFloat(q[0], positionXZ);
+		values.position[1] = DequantizeFloat(q[1], positionY);
+		values.position[2] = DequantizeFloat(q[2], positionXZ);
+	}
+	if (fields & STATE_VELOCITY) {
+		for (int i = 0; i < 3; i++) {
+			if (!reader.ReadBits(velocity.bits, q[i])) return false;
+			values.velocity[i] = DequantizeFloat(q[i], velocity);
+		}
+	}
+	if (fields & STATE_ROTATION) {
+		if (!reader.ReadBits(rotationBits, q[0])) return false;
+		values.rotation = DequantizeAngle(q[0]);
+	}
+	return true;
+}
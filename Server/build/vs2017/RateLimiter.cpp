@@ -0,0 +1,43 @@
+#include "RateLimiter.h"
+#include <random>
+
+bool TokenBucket::Take(uint32_t now, uint32_t rate, uint32_t burst) {
+	uint64_t full = (uint64_t)burst * 1000;
+	if (!started_) {
+		tokens_ = full;
+		lastRefill_ = now;
+		started_ = true;
+	}
+
+	//Ingress threads can see the clock a little behind each other, so it mustn't go backwards here
+	int32_t elapsed = (int32_t)(now - lastRefill_);
+	if (elapsed > 0) {
+		tokens_ += (uint64_t)elapsed * rate;
+		if (tokens_ > full) tokens_ = full;
+		lastRefill_ = now;
+	}
+
+	if (tokens_ < 1000) return false;
+	tokens_ -= 1000;
+	return true;
+}
+
+SourceRateLimiter::SourceRateLimiter() {
+	std::random_device random;
+	//Odd, so multiplying by it loses nothing
+	hashKey_ = ((uint64_t)random() << 32 | random()) | 1;
+}
+
+bool SourceRateLimiter::Take(const sockaddr_in& address, uint32_t now, uint32_t rate, uint32_t burst) {
+	uint32_t ip = address.sin_addr.s_addr;
+	//Multiplicative hashing, taking the top bits
+	size_t index = (size_t)(((uint64_t)ip * hashKey_) >> 32) & (SOURCE_RATE_BUCKETS - 1);
+
+	Slot& slot = slots_[index];
+	if (!slot.used || slot.address != ip) {
+		slot.address = ip;
+		slot.used = true;
+		slot.bucket = TokenBucket();
+	}
+	return slot.bucket.Take(now, rate, burst);
+}
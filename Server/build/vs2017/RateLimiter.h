@@ -0,0 +1,43 @@
+#pragma once
+#include "Sockets.h"
+#include <cstdint>
+
+// Buckets in a SourceRateLimiter, must be a power of two
+#define SOURCE_RATE_BUCKETS 4096
+
+// Lets through up to rate datagrams a second on average, with bursts of up to burst.
+// Starts full, refills continuously and each datagram takes one token. Counted in thousandths of a token, so a
+// millisecond's refill is exact at any whole rate. Not thread safe.
+class TokenBucket {
+public:
+	// Take a token at server time now (ms). False if there wasn't one, so the datagram should be dropped.
+	bool Take(uint32_t now, uint32_t rate, uint32_t burst);
+
+private:
+	uint64_t tokens_ = 0;
+	uint32_t lastRefill_ = 0;
+	bool started_ = false;
+};
+
+// Token buckets for senders that don't have a connection yet, by IP address (a client can pick any port).
+// Addresses hash into a fixed table and a new address takes its slot over, so nothing is allocated per sender and
+// a flood from many spoofed addresses only keeps knocking each other out rather than filling a legitimate client's
+// bucket. It's a steady sender from one address, which would otherwise keep the server busy, that gets limited.
+// The hash is keyed at random so senders can't pick addresses that land on someone else's slot. Not thread safe.
+class SourceRateLimiter {
+public:
+	SourceRateLimiter();
+
+	// Take a token from address's bucket at server time now (ms). False if it's over its rate.
+	bool Take(const sockaddr_in& address, uint32_t now, uint32_t rate, uint32_t burst);
+
+private:
+	struct Slot {
+		uint32_t address = 0;
+		bool used = false;
+		TokenBucket bucket;
+	};
+
+	Slot slots_[SOURCE_RATE_BUCKETS];
+	uint64_t hashKey_;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include "Sockets.h"
+#include <cstdint>
+
+// Readiness flags reported by (and requested from) a Reactor.
+enum ReactorFlags : uint32_t {
+	REACTOR_READ = 1 << 0,
+	REACTOR_WRITE = 1 << 1,
+	REACTOR_CLOSE = 1 << 2, // Peer hung up or the socket errored
+	REACTOR_WAKE = 1 << 3   // Wake() was called from another thread
+};
+
+// Handle reported alongside REACTOR_WAKE. Callers must not register sockets with it.
+#define REACTOR_WAKE_HANDLE UINT64_MAX
+
+struct ReactorEvent {
+	uint64_t handle;
+	uint32_t events;
+};
+
+// Edge-triggered socket readiness notifier.
+// Each socket is registered with a caller-chosen handle which is handed back with every event,
+// so dispatch is a direct lookup rather than a scan over all sockets.
+// Edge-triggered means REACTOR_READ/REACTOR_WRITE are only reported when the socket becomes ready,
+// so callers must read (or accept) until the call would block, and call WantWrite() after a send would block.
+// Add, Remove, WantWrite and Wait belong to the thread running the loop; only Wake may be called from elsewhere.
+class Reactor {
+public:
+	virtual ~Reactor() {}
+
+	// Start watching sock. interest is a combination of REACTOR_READ and REACTOR_WRITE.
+	virtual bool Add(SOCKET sock, uint64_t handle, uint32_t interest) = 0;
+
+	// Stop watching sock. Must be called before the socket is closed.
+	virtual void Remove(SOCKET sock, uint64_t handle) = 0;
+
+	// Call after a send on sock returned WSAEWOULDBLOCK so REACTOR_WRITE is reported once it drains.
+	virtual void WantWrite(SOCKET sock, uint64_t handle) = 0;
+
+	// Block for up to timeoutMs (-1 waits forever) and fill in at most maxEvents events.
+	// Returns the number of events, 0 on timeout, or -1 on failure.
+	virtual int Wait(ReactorEvent* events, int maxEvents, int timeoutMs) = 0;
+
+	// Interrupt a Wait() in progress on another thread. Safe to call from any thread.
+	virtual void Wake() = 0;
+
+	// Create the reactor for this platform: epoll on Linux, WSAPoll on Windows.
+	static Reactor* Create();
+};
@@ -0,0 +1,101 @@
+#ifdef __linux__
+#include "Reactor.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <vector>
+
+// epoll backend. Sockets are registered once with EPOLLET and never modified,
+// the handle travels in epoll_event::data so no lookup table is needed here.
+class ReactorEpoll : public Reactor {
+public:
+	ReactorEpoll();
+	~ReactorEpoll();
+
+	bool Add(SOCKET sock, uint64_t handle, uint32_t interest) override;
+	void Remove(SOCKET sock, uint64_t handle) override;
+	void WantWrite(SOCKET, uint64_t) override {} // Edge-triggered EPOLLOUT fires again by itself
+	int Wait(ReactorEvent* events, int maxEvents, int timeoutMs) override;
+	void Wake() override;
+
+	bool IsValid() { return epollFD_ != -1 && wakeFD_ != -1; }
+
+private:
+	int epollFD_ = -1;
+	int wakeFD_ = -1;
+	std::vector<epoll_event> epollEvents_;
+};
+
+ReactorEpoll::ReactorEpoll() {
+	epollFD_ = epoll_create1(EPOLL_CLOEXEC);
+	wakeFD_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epollFD_ == -1 || wakeFD_ == -1) return;
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u64 = REACTOR_WAKE_HANDLE;
+	if (epoll_ctl(epollFD_, EPOLL_CTL_ADD, wakeFD_, &ev) == -1) {
+		close(wakeFD_);
+		wakeFD_ = -1;
+	}
+}
+
+ReactorEpoll::~ReactorEpoll() {
+	if (wakeFD_ != -1) close(wakeFD_);
+	if (epollFD_ != -1) close(epollFD_);
+}
+
+bool ReactorEpoll::Add(SOCKET sock, uint64_t handle, uint32_t interest) {
+	epoll_event ev = {};
+	ev.events = EPOLLET | EPOLLRDHUP;
+	if (interest & REACTOR_READ) ev.events |= EPOLLIN;
+	if (interest & REACTOR_WRITE) ev.events |= EPOLLOUT;
+	ev.data.u64 = handle;
+	return epoll_ctl(epollFD_, EPOLL_CTL_ADD, sock, &ev) == 0;
+}
+
+void ReactorEpoll::Remove(SOCKET sock, uint64_t) {
+	epoll_ctl(epollFD_, EPOLL_CTL_DEL, sock, nullptr);
+}
+
+int ReactorEpoll::Wait(ReactorEvent* events, int maxEvents, int timeoutMs) {
+	if ((int)epollEvents_.size() < maxEvents) epollEvents_.resize(maxEvents);
+
+	int count = epoll_wait(epollFD_, epollEvents_.data(), maxEvents, timeoutMs);
+	if (count == -1) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const epoll_event& ev = epollEvents_[i];
+		events[i].handle = ev.data.u64;
+		events[i].events = 0;
+
+		if (ev.data.u64 == REACTOR_WAKE_HANDLE) {
+			// Reset the counter so the next Wake() produces a fresh edge
+			uint64_t value;
+			while (read(wakeFD_, &value, sizeof(value)) > 0) {}
+			events[i].events = REACTOR_WAKE;
+			continue;
+		}
+		if (ev.events & EPOLLIN) events[i].events |= REACTOR_READ;
+		if (ev.events & EPOLLOUT) events[i].events |= REACTOR_WRITE;
+		if (ev.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) events[i].events |= REACTOR_CLOSE;
+	}
+	return count;
+}
+
+void ReactorEpoll::Wake() {
+	uint64_t one = 1;
+	ssize_t written = write(wakeFD_, &one, sizeof(one));
+	(void)written; // Counter saturation only means a wake is already pending
+}
+
+Reactor* Reactor::Create() {
+	ReactorEpoll* reactor = new ReactorEpoll();
+	if (!reactor->IsValid()) {
+		delete reactor;
+		return nullptr;
+	}
+	return reactor;
+}
+#endif
@@ -0,0 +1,140 @@
+#ifdef _WIN32
+#include "Reactor.h"
+#include <vector>
+#include <unordered_map>
+
+// WSAPoll backend. Unlike WSAWaitForMultipleEvents it has no 64 handle limit.
+// WSAPoll is level-triggered, so write interest is only armed until it has been reported once
+// (and again after WantWrite()), which gives callers the same edge-triggered contract as epoll.
+class ReactorWinSock : public Reactor {
+public:
+	ReactorWinSock();
+	~ReactorWinSock();
+
+	bool Add(SOCKET sock, uint64_t handle, uint32_t interest) override;
+	void Remove(SOCKET sock, uint64_t handle) override;
+	void WantWrite(SOCKET sock, uint64_t handle) override;
+	int Wait(ReactorEvent* events, int maxEvents, int timeoutMs) override;
+	void Wake() override;
+
+	bool IsValid() { return wakeSocket_ != INVALID_SOCKET; }
+
+private:
+	// pollFDs_[i] belongs to handles_[i]; index 0 is always the wake socket.
+	std::vector<WSAPOLLFD> pollFDs_;
+	std::vector<uint64_t> handles_;
+	std::unordered_map<uint64_t, size_t> handleToIndex_;
+
+	// Loopback UDP socket connected to itself, Wake() sends it a byte to break out of WSAPoll.
+	SOCKET wakeSocket_ = INVALID_SOCKET;
+};
+
+ReactorWinSock::ReactorWinSock() {
+	wakeSocket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (wakeSocket_ == INVALID_SOCKET) return;
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	int addrLen = sizeof(addr);
+	if (bind(wakeSocket_, (SOCKADDR*)&addr, sizeof(addr)) != 0
+		|| getsockname(wakeSocket_, (sockaddr*)&addr, &addrLen) != 0
+		|| connect(wakeSocket_, (SOCKADDR*)&addr, sizeof(addr)) != 0
+		|| !SetNonBlocking(wakeSocket_)) {
+		closesocket(wakeSocket_);
+		wakeSocket_ = INVALID_SOCKET;
+		return;
+	}
+
+	WSAPOLLFD wakeFD = {};
+	wakeFD.fd = wakeSocket_;
+	wakeFD.events = POLLRDNORM;
+	pollFDs_.push_back(wakeFD);
+	handles_.push_back(REACTOR_WAKE_HANDLE);
+}
+
+ReactorWinSock::~ReactorWinSock() {
+	if (wakeSocket_ != INVALID_SOCKET) closesocket(wakeSocket_);
+}
+
+bool ReactorWinSock::Add(SOCKET sock, uint64_t handle, uint32_t interest) {
+	WSAPOLLFD fd = {};
+	fd.fd = sock;
+	if (interest & REACTOR_READ) fd.events |= POLLRDNORM;
+	if (interest & REACTOR_WRITE) fd.events |= POLLWRNORM;
+
+	handleToIndex_[handle] = pollFDs_.size();
+	pollFDs_.push_back(fd);
+	handles_.push_back(handle);
+	return true;
+}
+
+void ReactorWinSock::Remove(SOCKET sock, uint64_t handle) {
+	auto it = handleToIndex_.find(handle);
+	if (it == handleToIndex_.end()) return;
+
+	// Swap the last entry into the hole so removal stays O(1)
+	size_t index = it->second;
+	size_t last = pollFDs_.size() - 1;
+	if (index != last) {
+		pollFDs_[index] = pollFDs_[last];
+		handles_[index] = handles_[last];
+		handleToIndex_[handles_[index]] = index;
+	}
+	pollFDs_.pop_back();
+	handles_.pop_back();
+	handleToIndex_.erase(it);
+}
+
+void ReactorWinSock::WantWrite(SOCKET sock, uint64_t handle) {
+	auto it = handleToIndex_.find(handle);
+	if (it != handleToIndex_.end()) pollFDs_[it->second].events |= POLLWRNORM;
+}
+
+int ReactorWinSock::Wait(ReactorEvent* events, int maxEvents, int timeoutMs) {
+	int ready = WSAPoll(pollFDs_.data(), (ULONG)pollFDs_.size(), timeoutMs);
+	if (ready == SOCKET_ERROR) return -1;
+
+	int count = 0;
+	for (size_t i = 0; i < pollFDs_.size() && ready > 0 && count < maxEvents; i++) {
+		WSAPOLLFD& fd = pollFDs_[i];
+		if (fd.revents == 0) continue;
+		ready--;
+
+		events[count].handle = handles_[i];
+		events[count].events = 0;
+
+		if (i == 0) {
+			char drain[64];
+			while (recv(wakeSocket_, drain, sizeof(drain), 0) > 0) {}
+			events[count].events = REACTOR_WAKE;
+		}
+		else {
+			if (fd.revents & POLLRDNORM) events[count].events |= REACTOR_READ;
+			if (fd.revents & POLLWRNORM) {
+				events[count].events |= REACTOR_WRITE;
+				fd.events &= ~POLLWRNORM; // Disarm until the next WantWrite()
+			}
+			if (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) events[count].events |= REACTOR_CLOSE;
+		}
+		fd.revents = 0;
+		count++;
+	}
+	return count;
+}
+
+void ReactorWinSock::Wake() {
+	char byte = 0;
+	send(wakeSocket_, &byte, 1, 0);
+}
+
+Reactor* Reactor::Create() {
+	ReactorWinSock* reactor = new ReactorWinSock();
+	if (!reactor->IsValid()) {
+		delete reactor;
+		return nullptr;
+	}
+	return reactor;
+}
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+#include "Messages.h"
+#include "PlayerStateCodec.h"
+#include <cstdint>
+#include <map>
+
+// Shared by the client and server, keep both copies the same.
+
+// Snapshots each side remembers. The server only deltas against one of the client's last this many,
+// so the client always still has the baseline it needs.
+#define SNAPSHOT_HISTORY 32
+
+// Bits for the number of players in a snapshot's players data
+#define SNAPSHOT_COUNT_BITS 16
+
+// Largest snapshot datagram. A tick's snapshot is split over as many as it needs.
+#define SNAPSHOT_MTU 1200
+
+// Most datagrams one snapshot can be split over
+#define SNAPSHOT_MAX_FRAGMENTS 64
+
+// Bytes of a snapshot datagram that aren't players or removals: the message header and the other fields
+#define SNAPSHOT_FRAGMENT_OVERHEAD 40
+
+// Bytes each removed ID can take
+#define SNAPSHOT_REMOVED_SIZE 5
+
+typedef std::map<int, PlayerValues> SnapshotState;
+
+// The last SNAPSHOT_HISTORY snapshots, by sequence number
+class SnapshotHistory {
+public:
+	void Store(uint32_t sequence, const SnapshotState& state);
+	// The snapshot with this sequence, or nullptr if it's been overwritten or was never stored
+	const SnapshotState* Find(uint32_t sequence);
+
+private:
+	struct Entry {
+		uint32_t sequence = 0;
+		SnapshotState state;
+	};
+	Entry entries_[SNAPSHOT_HISTORY];
+};
+
+// One player that changed since the baseline, and which of its fields did
+struct SnapshotChange {
+	int id;
+	uint8_t fields;
+	const PlayerValues* values;
+};
+
+// Work out which players changed from baseline to state, and which in the baseline are gone.
+// With no baseline every player has changed, making a complete snapshot.
+// state should already be quantized with QuantizePlayerValues, so small changes the schema can't show aren't sent.
+void DiffSnapshot(const SnapshotState* baseline, const SnapshotState& state, std::vector<SnapshotChange>& changes, std::vector<int>& removed);
+
+// Bits a change takes in a snapshot's players data
+size_t SnapshotChangeBits(uint8_t fields);
+
+// Fill in msg's players data from count changes.
+// It's a count, then for each player its ID, which fields follow (PlayerStateField) and those fields.
+void WriteSnapshotChanges(const SnapshotChange* changes, size_t count, PlayersUpdateMessage& msg);
+
+// Apply one snapshot datagram on top of state, which must start as the baseline it was made against.
+// Each datagram holds whole players, so it can be applied without the rest of its snapshot.
+// Returns false, leaving state untouched, if the datagram doesn't fit state. updated is filled with the players it changed.
+bool ApplySnapshotDelta(const PlayersUpdateMessage& msg, SnapshotState& state, std::vector<int>* updated = nullptr);
+
+// What became of a snapshot datagram given to SnapshotAssembler
+enum class SnapshotFragmentResult {
+	APPLIED,          // Its players are in State(), the rest of the snapshot isn't yet
+	COMPLETE,         // It was the last one missing, and the whole snapshot is now in history
+	DISCARDED,        // From an older snapshot, a repeat, or part of one that can't be used
+	BAD_FRAGMENT,     // Fragment numbers that don't make sense
+	UNKNOWN_BASELINE, // The first seen of a snapshot made against a baseline no longer (or never) in history
+	MISFIT            // Doesn't fit its baseline, so the rest of that snapshot is discarded too
+};
+
+// Puts snapshots back together from their datagrams, which can arrive out of order, twice or not at all.
+// Only the newest snapshot seen is assembled, anything left of an older one is dropped.
+class SnapshotAssembler {
+public:
+	// Apply one datagram, storing its snapshot in history once every datagram of it is in
+	SnapshotFragmentResult Add(const PlayersUpdateMessage& msg, SnapshotHistory& history);
+	// The snapshot being assembled: its baseline, with every datagram so far applied
+	const SnapshotState& State() { return state_; }
+	// The players the last datagram applied changed
+	const std::vector<int>& Updated() { return updated_; }
+
+private:
+	uint32_t sequence_ = 0;
+	uint8_t fragmentCount_ = 0;
+	uint64_t received_ = 0; // A bit per datagram
+	bool valid_ = false;
+	SnapshotState state_;
+	std::vector<int> updated_;
+};
@@ -0,0 +1,48 @@
+#pragma once
+// Thin portability layer so the networking code can be built against WinSock or BSD sockets.
+// On Linux the WinSock names used throughout the server are mapped onto their POSIX equivalents.
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+typedef int SOCKET;
+typedef sockaddr SOCKADDR;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAENOBUFS ENOBUFS
+#define WSAENETRESET ENETRESET
+#define WSAEMSGSIZE EMSGSIZE
+#define WSAECONNABORTED ECONNABORTED
+#define WSAECONNRESET ECONNRESET
+#define WSAEINTR EINTR
+
+inline int WSAGetLastError() { return errno; }
+inline int closesocket(SOCKET sock) { return close(sock); }
+inline void WSACleanup() {}
+#endif
+
+// Put a socket into non-blocking mode. Returns false on failure.
+inline bool SetNonBlocking(SOCKET sock) {
+#ifdef _WIN32
+	u_long mode = 1;
+	return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags == -1) return false;
+	return fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
@@ -0,0 +1,72 @@
+#include "TickScheduler.h"
+#include "Log.h"
+#include <algorithm>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+TickScheduler::TickScheduler(float tickSeconds) {
+	tickLength_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(tickSeconds));
+	nextTick_ = Clock::now();
+}
+
+void TickScheduler::WaitForNextTick() {
+	Clock::time_point now = Clock::now();
+	if (now < nextTick_) {
+		std::this_thread::sleep_until(nextTick_);
+	}
+	else if (now - nextTick_ > tickLength_ * TICK_MAX_CATCHUP) {
+		// Stalled for too long (e.g. a debugger), running every missed tick at once would only stall the clients
+		LOG_WARNING(LOG_GENERAL, "Server fell %d ms behind - skipping ticks\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - nextTick_).count());
+		nextTick_ = now;
+	}
+	nextTick_ += tickLength_;
+}
+
+double ProcessCpuSeconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) / 1e7; // 100ns units
+#else
+	timespec time;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
+
+TickStats::TickStats() {
+	intervalStart_ = std::chrono::steady_clock::now();
+	intervalCpu_ = ProcessCpuSeconds();
+}
+
+void TickStats::Record(double workSeconds) {
+	work_.push_back((float)workSeconds);
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - intervalStart_).count();
+	if (elapsed < TICK_STATS_INTERVAL) return;
+
+	double cpu = ProcessCpuSeconds();
+	size_t ticks = work_.size();
+	double total = 0;
+	for (float work : work_) {
+		total += work;
+	}
+	std::sort(work_.begin(), work_.end());
+	LOG_INFO(LOG_GENERAL, "%.1f ticks/s, tick work mean %.3fms p99 %.3fms max %.3fms, process CPU %.3fms per tick (%.1f%% of a core)\n",
+		ticks / elapsed, total / ticks * 1000, work_[ticks * 99 / 100] * 1000.0, work_.back() * 1000.0,
+		(cpu - intervalCpu_) / ticks * 1000, (cpu - intervalCpu_) / elapsed * 100);
+
+	work_.clear();
+	intervalStart_ = now;
+	intervalCpu_ = cpu;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Most ticks a late scheduler runs back to back to catch up, before giving up on them and starting afresh
+#define TICK_MAX_CATCHUP 5
+
+// How often TickStats logs, in seconds
+#define TICK_STATS_INTERVAL 10
+
+// Fixed rate loop for the headless server, which has no render loop to drive it.
+// Ticks are due at exact multiples of the tick length from the start, so the rate doesn't drift with how long each one takes.
+class TickScheduler {
+public:
+	TickScheduler(float tickSeconds);
+
+	// Sleep until the next tick is due. Returns straight away if it's already late.
+	void WaitForNextTick();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration tickLength_;
+	Clock::time_point nextTick_;
+};
+
+// CPU time the whole process (every thread) has used, in seconds
+double ProcessCpuSeconds();
+
+// What each tick costs, logged every TICK_STATS_INTERVAL so the headless and windowed servers can be compared
+class TickStats {
+public:
+	TickStats();
+
+	// Call once a tick, with how long the tick's own work took
+	void Record(double workSeconds);
+
+private:
+	std::chrono::steady_clock::time_point intervalStart_;
+	double intervalCpu_;
+	std::vector<float> work_;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest of a stream of values from one writer thread to one reader thread without locks.
+// The writer fills its back buffer and publishes it, the reader takes whichever was published last.
+// Neither ever waits for the other, and each buffer's storage is reused, so nothing is allocated once they've grown.
+template<class T>
+class TripleBuffer {
+public:
+	// Buffer for the writer to fill. Keeps whatever was in it from three publishes ago.
+	T& Back() { return buffers_[back_]; }
+
+	// Make the back buffer the latest, and take the old latest as the new back buffer
+	void Publish() {
+		uint8_t middle = middle_.exchange(back_ | NEW_BIT, std::memory_order_acq_rel);
+		back_ = middle & INDEX_MASK;
+	}
+
+	// The latest published value, or the one returned last time if nothing newer has been published.
+	// It stays untouched by the writer until the next call.
+	const T& Latest() {
+		if (middle_.load(std::memory_order_relaxed) & NEW_BIT) {
+			uint8_t middle = middle_.exchange(front_, std::memory_order_acq_rel);
+			front_ = middle & INDEX_MASK;
+		}
+		return buffers_[front_];
+	}
+
+private:
+	static const uint8_t INDEX_MASK = 3;
+	static const uint8_t NEW_BIT = 4; // Set on middle_ when it's been published and not yet read
+
+	T buffers_[3];
+	uint8_t back_ = 0;                    // Writer's only
+	std::atomic<uint8_t> middle_{ 1 };    // Swapped between the two
+	uint8_t front_ = 2;                   // Reader's only
+};
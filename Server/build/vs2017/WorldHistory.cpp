@@ -0,0 +1,194 @@
+#include "WorldHistory.h"
+#include <algorithm>
+#include <cmath>
+
+#define WORLD_HISTORY_PI 3.14159265f
+
+WorldHistory::WorldHistory(float halfWidth, float halfHeight, float halfDepth) {
+	halfExtents_[0] = halfWidth;
+	halfExtents_[1] = halfHeight;
+	halfExtents_[2] = halfDepth;
+}
+
+void WorldHistory::Record(uint32_t time, const WorldSnapshot& world) {
+	//Overwrites the oldest, whose arrays are already big enough so nothing's allocated
+	newest_ = (newest_ + 1) % WORLD_HISTORY_STEPS;
+	frames_[newest_] = world;
+	times_[newest_] = time;
+	if (count_ < WORLD_HISTORY_STEPS) count_++;
+}
+
+bool WorldHistory::Bracket(uint32_t time, const WorldSnapshot*& before, const WorldSnapshot*& after, float& t) const {
+	if (count_ == 0) return false;
+	t = 0;
+	if ((int32_t)(time - NewestTime()) >= 0) {
+		before = after = &frames_[newest_];
+		return true;
+	}
+	if ((int32_t)(time - OldestTime()) <= 0) {
+		before = after = &frames_[Index(count_ - 1)];
+		return true;
+	}
+
+	//Times go down going back, find the newest step at or before time. The newest is after it and the oldest before.
+	size_t newer = 0, older = count_ - 1;
+	while (older - newer > 1) {
+		size_t middle = (newer + older) / 2;
+		if ((int32_t)(time - times_[Index(middle)]) >= 0) older = middle;
+		else newer = middle;
+	}
+	uint32_t beforeTime = times_[Index(older)];
+	uint32_t afterTime = times_[Index(newer)];
+	before = &frames_[Index(older)];
+	after = &frames_[Index(newer)];
+	t = (float)(time - beforeTime) / (float)(afterTime - beforeTime);
+	return true;
+}
+
+int WorldHistory::Interpolate(const WorldSnapshot& before, const WorldSnapshot& after, float t, size_t row, float position[3]) const {
+	position[0] = before.positionX[row];
+	position[1] = before.positionY[row];
+	position[2] = before.positionZ[row];
+	if (t == 0) return -1;
+
+	//Rows are in slot order, so unless someone joined or left in between it's the same row
+	int id = before.ids[row];
+	int afterRow = row < after.Size() && after.ids[row] == id ? (int)row : after.Find(id);
+	if (afterRow < 0) return -1;
+	position[0] += (after.positionX[afterRow] - position[0]) * t;
+	position[1] += (after.positionY[afterRow] - position[1]) * t;
+	position[2] += (after.positionZ[afterRow] - position[2]) * t;
+	return afterRow;
+}
+
+float WorldHistory::InterpolateRotation(const WorldSnapshot& before, const WorldSnapshot& after, float t, size_t row, int afterRow) const {
+	float rotation = before.rotation[row];
+	if (afterRow < 0) return rotation;
+
+	//The short way round
+	float turn = fmodf(after.rotation[afterRow] - rotation, 2 * WORLD_HISTORY_PI);
+	if (turn > WORLD_HISTORY_PI) turn -= 2 * WORLD_HISTORY_PI;
+	else if (turn < -WORLD_HISTORY_PI) turn += 2 * WORLD_HISTORY_PI;
+	return rotation + turn * t;
+}
+
+bool WorldHistory::Rewind(uint32_t time, WorldSnapshot& world) const {
+	const WorldSnapshot* before;
+	const WorldSnapshot* after;
+	float t;
+	if (!Bracket(time, before, after, t)) return false;
+
+	world.Clear();
+	world.step = before->step;
+	float position[3];
+	for (size_t row = 0; row < before->Size(); row++) {
+		int afterRow = Interpolate(*before, *after, t, row, position);
+		world.Add(before->ids[row], position[0], position[1], position[2],
+			before->velocityX[row], before->velocityY[row], before->velocityZ[row], InterpolateRotation(*before, *after, t, row, afterRow),
+			before->inputSequence[row]);
+	}
+	//Joined in between, so only in the later step
+	for (size_t row = 0; row < after->Size() && before != after; row++) {
+		if (before->Find(after->ids[row]) >= 0) continue;
+		world.Add(after->ids[row], after->positionX[row], after->positionY[row], after->positionZ[row],
+			after->velocityX[row], after->velocityY[row], after->velocityZ[row], after->rotation[row], after->inputSequence[row]);
+	}
+	return true;
+}
+
+bool WorldHistory::PlayerAt(int id, uint32_t time, float position[3], float& rotation) const {
+	const WorldSnapshot* before;
+	const WorldSnapshot* after;
+	float t;
+	if (!Bracket(time, before, after, t)) return false;
+
+	int row = before->Find(id);
+	if (row < 0) {
+		//Joined in between
+		before = after;
+		t = 0;
+		row = before->Find(id);
+		if (row < 0) return false;
+	}
+	int afterRow = Interpolate(*before, *after, t, row, position);
+	rotation = InterpolateRotation(*before, *after, t, row, afterRow);
+	return true;
+}
+
+void WorldHistory::FindNear(uint32_t time, const float point[3], float radius, std::vector<int>& ids) const {
+	ids.clear();
+	const WorldSnapshot* before;
+	const WorldSnapshot* after;
+	float t;
+	if (!Bracket(time, before, after, t)) return;
+
+	float radiusSquared = radius * radius;
+	float position[3];
+	for (size_t row = 0; row < before->Size(); row++) {
+		Interpolate(*before, *after, t, row, position);
+		float dx = position[0] - point[0];
+		float dy = position[1] - point[1];
+		float dz = position[2] - point[2];
+		if (dx * dx + dy * dy + dz * dz <= radiusSquared) ids.push_back(before->ids[row]);
+	}
+}
+
+int WorldHistory::Raycast(uint32_t time, const float origin[3], const float direction[3], float maxDistance, int ignoreID, float* distance) const {
+	const WorldSnapshot* before;
+	const WorldSnapshot* after;
+	float t;
+	if (!Bracket(time, before, after, t)) return -1;
+
+	float boundingSquared = halfExtents_[0] * halfExtents_[0] + halfExtents_[1] * halfExtents_[1] + halfExtents_[2] * halfExtents_[2];
+	int hitID = -1;
+	float nearest = maxDistance;
+	float position[3];
+	for (size_t row = 0; row < before->Size(); row++) {
+		if (before->ids[row] == ignoreID) continue;
+		int afterRow = Interpolate(*before, *after, t, row, position);
+
+		//Most are nowhere near, so throw out any whose bounding sphere the ray misses before doing the box
+		float toCentre[3] = { position[0] - origin[0], position[1] - origin[1], position[2] - origin[2] };
+		float along = toCentre[0] * direction[0] + toCentre[1] * direction[1] + toCentre[2] * direction[2];
+		float centreSquared = toCentre[0] * toCentre[0] + toCentre[1] * toCentre[1] + toCentre[2] * toCentre[2];
+		if (centreSquared - along * along > boundingSquared) continue;
+
+		//Into the box's own space, where it's axis aligned about the origin
+		float rotation = InterpolateRotation(*before, *after, t, row, afterRow);
+		float c = cosf(rotation);
+		float s = sinf(rotation);
+		float localOrigin[3] = {
+			-(toCentre[0] * c - toCentre[2] * s),
+			-toCentre[1],
+			-(toCentre[0] * s + toCentre[2] * c) };
+		float localDirection[3] = {
+			direction[0] * c - direction[2] * s,
+			direction[1],
+			direction[0] * s + direction[2] * c };
+
+		//Slab test
+		float enter = 0;
+		float leave = nearest;
+		bool miss = false;
+		for (int axis = 0; axis < 3 && !miss; axis++) {
+			if (fabsf(localDirection[axis]) < 1e-6f) {
+				miss = fabsf(localOrigin[axis]) > halfExtents_[axis];
+				continue;
+			}
+			float inverse = 1.0f / localDirection[axis];
+			float slabEnter = (-halfExtents_[axis] - localOrigin[axis]) * inverse;
+			float slabLeave = (halfExtents_[axis] - localOrigin[axis]) * inverse;
+			if (slabEnter > slabLeave) std::swap(slabEnter, slabLeave);
+			enter = std::max(enter, slabEnter);
+			leave = std::min(leave, slabLeave);
+			miss = enter > leave;
+		}
+		if (miss) continue;
+
+		nearest = enter;
+		hitID = before->ids[row];
+	}
+
+	if (hitID >= 0 && distance) *distance = nearest;
+	return hitID;
+}
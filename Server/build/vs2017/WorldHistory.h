@@ -0,0 +1,59 @@
+#pragma once
+#include "WorldSnapshot.h"
+#include <cstdint>
+#include <vector>
+
+// Simulation steps kept, a bit over a second at 60Hz. Anyone further behind than that is judged against the oldest.
+#define WORLD_HISTORY_STEPS 64
+
+// The world as it was over the last WORLD_HISTORY_STEPS simulation steps, so a player's action can be judged against
+// what they saw (the server's state from around half their round trip ago) rather than the server's present.
+// Each step is a WorldSnapshot, and queries interpolate between the two steps either side of the time asked for.
+// Every player is a box of the same size, rotated only about y, so bounds are its half extents and each row's rotation.
+// Recorded and queried by the simulation thread only.
+class WorldHistory {
+public:
+	WorldHistory(float halfWidth, float halfHeight, float halfDepth);
+
+	// Keep a copy of the world as it was at server time (ms). Times must go up.
+	void Record(uint32_t time, const WorldSnapshot& world);
+
+	bool Empty() const { return count_ == 0; }
+	// Range of times that can be rewound to exactly. Only valid if not Empty().
+	uint32_t OldestTime() const { return times_[Index(count_ - 1)]; }
+	uint32_t NewestTime() const { return times_[newest_]; }
+
+	// Everyone at server time. Times outside the history are clamped to it. Players only in one of the two
+	// steps either side (they joined or left between them) are taken as they were in that one. False if there's no history.
+	bool Rewind(uint32_t time, WorldSnapshot& world) const;
+
+	// One player's position and rotation at time, false if they weren't in the game then
+	bool PlayerAt(int id, uint32_t time, float position[3], float& rotation) const;
+
+	// FindNear and Raycast go through the players in the step before time, so anyone who joined after it isn't there yet.
+
+	// Players whose centre was within radius of point at time
+	void FindNear(uint32_t time, const float point[3], float radius, std::vector<int>& ids) const;
+
+	// First player whose box the ray (direction normalised) went through at time, within maxDistance, or -1 if none.
+	// ignoreID is skipped, normally whoever fired it. distance is set to how far along the ray the hit was.
+	int Raycast(uint32_t time, const float origin[3], const float direction[3], float maxDistance, int ignoreID, float* distance = nullptr) const;
+
+private:
+	// Frame i steps back from the newest
+	size_t Index(size_t i) const { return (newest_ + WORLD_HISTORY_STEPS - i) % WORLD_HISTORY_STEPS; }
+	// The frames either side of time and how far it is from before to after (0-1). They're the same frame at either end.
+	bool Bracket(uint32_t time, const WorldSnapshot*& before, const WorldSnapshot*& after, float& t) const;
+	// Position of row in before, interpolated towards the same player in after if they're there.
+	// Returns their row in after, or -1 if they're not there or it wasn't needed.
+	int Interpolate(const WorldSnapshot& before, const WorldSnapshot& after, float t, size_t row, float position[3]) const;
+	// Kept apart from the position, as proximity checks don't need it
+	float InterpolateRotation(const WorldSnapshot& before, const WorldSnapshot& after, float t, size_t row, int afterRow) const;
+
+	float halfExtents_[3];
+
+	WorldSnapshot frames_[WORLD_HISTORY_STEPS];
+	uint32_t times_[WORLD_HISTORY_STEPS];
+	size_t newest_ = WORLD_HISTORY_STEPS - 1;
+	size_t count_ = 0;
+};
@@ -0,0 +1,50 @@
+#include "WorldSnapshot.h"
+#include "SlotMap.h"
+
+void WorldSnapshot::Clear() {
+	for (int id : ids) {
+		rows[SlotMapIndex(id)] = -1;
+	}
+	ids.clear();
+	positionX.clear();
+	positionY.clear();
+	positionZ.clear();
+	velocityX.clear();
+	velocityY.clear();
+	velocityZ.clear();
+	rotation.clear();
+	inputSequence.clear();
+}
+
+void WorldSnapshot::Add(int id, float px, float py, float pz, float vx, float vy, float vz, float rot, uint32_t input) {
+	uint32_t slot = SlotMapIndex(id);
+	if (rows.size() <= slot) rows.resize(slot + 1, -1);
+	rows[slot] = (int)ids.size();
+
+	ids.push_back(id);
+	positionX.push_back(px);
+	positionY.push_back(py);
+	positionZ.push_back(pz);
+	velocityX.push_back(vx);
+	velocityY.push_back(vy);
+	velocityZ.push_back(vz);
+	rotation.push_back(rot);
+	inputSequence.push_back(input);
+}
+
+int WorldSnapshot::Find(int id) const {
+	uint32_t slot = SlotMapIndex(id);
+	if (id < 0 || slot >= rows.size()) return -1;
+	int row = rows[slot];
+	return row >= 0 && ids[row] == id ? row : -1;
+}
+
+void WorldSnapshot::GetPlayerValues(size_t row, PlayerValues& values) const {
+	values.position[0] = positionX[row];
+	values.position[1] = positionY[row];
+	values.position[2] = positionZ[row];
+	values.velocity[0] = velocityX[row];
+	values.velocity[1] = velocityY[row];
+	values.velocity[2] = velocityZ[row];
+	values.rotation = rotation[row];
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "Messages.h"
+#include <cstdint>
+#include <vector>
+
+// Every player's state at the end of one simulation step, as a structure of arrays.
+// Built by the simulation thread and published through a TripleBuffer, then read by the network thread
+// while the simulation carries on. Clear() keeps the arrays' storage, so rebuilding it doesn't allocate.
+struct WorldSnapshot {
+	uint32_t step = 0;
+	std::vector<int> ids;
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> velocityX, velocityY, velocityZ;
+	std::vector<float> rotation;
+	std::vector<uint32_t> inputSequence; // Last of the player's inputs applied
+	// Row of each slot map index, -1 if that slot has no player in this snapshot
+	std::vector<int> rows;
+
+	void Clear();
+	void Add(int id, float px, float py, float pz, float vx, float vy, float vz, float rot, uint32_t input);
+	size_t Size() const { return ids.size(); }
+	// Row holding this player ID, or -1 if it isn't in the snapshot
+	int Find(int id) const;
+	// Copy a row out in message form. values must already have 3 entries for position and velocity.
+	void GetPlayerValues(size_t row, PlayerValues& values) const;
+};
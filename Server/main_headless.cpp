@@ -0,0 +1,21 @@
+#include "scene_app.h"
+#include <csignal>
+
+// Dedicated server, built with CMakeLists.txt. Runs until interrupted.
+
+static SceneApp* runningApp = nullptr;
+
+static void HandleSignal(int) {
+	if (runningApp) runningApp->Stop();
+}
+
+int main() {
+	SceneApp myApp;
+	runningApp = &myApp;
+	std::signal(SIGINT, HandleSignal);
+	std::signal(SIGTERM, HandleSignal);
+
+	myApp.Run();
+
+	return 0;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include "scene_app.h"
+#include "Log.h"
+#include "PlayerMovement.h"
+#ifndef SERVER_HEADLESS
 #include <system/platform.h>
 #include <platform/d3d11/system/platform_d3d11.h>
 #include <graphics/sprite_renderer.h>
@@ -8,8 +11,31 @@
 #include <graphics/renderer_3d.h>
 #include <maths/math_utils.h>
 #include <input/input_manager.h>
+#endif
 #include <iostream>
 
+// Taken during static initialisation, so startup time covers everything before the server is ready
+static const ServerClock::time_point processStart = ServerClock::now();
+
+#ifdef SERVER_HEADLESS
+SceneApp::SceneApp() :
+	primitive_builder_(NULL)
+{
+}
+
+void SceneApp::Run()
+{
+	Init();
+
+	TickScheduler scheduler(stepSize_);
+	while (running_) {
+		scheduler.WaitForNextTick();
+		if (!Update(stepSize_)) break;
+	}
+
+	CleanUp();
+}
+#else
 SceneApp::SceneApp(gef::Platform& platform) :
 	Application(platform),
 	sprite_renderer_(NULL),
@@ -18,9 +44,11 @@ SceneApp::SceneApp(gef::Platform& platform) :
 	font_(NULL)
 {
 }
+#endif
 
 void SceneApp::Init()
 {
+#ifndef SERVER_HEADLESS
 	input_ = gef::InputManager::Create(platform_);
 
 	sprite_renderer_ = gef::SpriteRenderer::Create(platform_);
@@ -30,21 +58,25 @@ void SceneApp::Init()
 
 	// initialise primitive builder to make create some 3D geometry easier
 	primitive_builder_ = new PrimitiveBuilder(platform_);
+#endif
 
 	//Initialise PhysX
 	initPhysics();
 
 	network_.StartConnection(this);
 
-	ground_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(30.f, 0.5f, 30.f)));
+	if (primitive_builder_) ground_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(30.f, 0.5f, 30.f)));
 	ground_.InitPhysx(physx::PxVec3(30.f, 0.5f, 30.f), physx::PxVec3(0, 0, 0), gScene, gPhysics);
 
-	block_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(0.5, 0.5, 0.5)));
+	if (primitive_builder_) block_.set_mesh(primitive_builder_->CreateBoxMesh(gef::Vector4(0.5, 0.5, 0.5)));
 	block_.InitPhysx(physx::PxVec3(0.5, 0.5, 0.5), physx::PxVec3(2, 1, 0), gScene, gPhysics);
 
-
+#ifndef SERVER_HEADLESS
 	InitFont();
 	SetupLights();
+#endif
+
+	LOG_INFO(LOG_GENERAL, "Started in %d ms\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(ServerClock::now() - processStart).count());
 }
 
 void SceneApp::initPhysics()
@@ -64,17 +96,64 @@ void SceneApp::initPhysics()
 	
 }
 
-void SceneApp::updatePhysics(float dt)
+bool SceneApp::updatePhysics(float dt)
 {
 	accumulator_ += dt;
 	if (accumulator_ < stepSize_)
-		return;
+		return false;
 
 	accumulator_ -= stepSize_;
 
+	applyInputs();
 	gScene->simulate(stepSize_);
 	gScene->fetchResults(true);
-	return;
+	step_++;
+	return true;
+}
+
+void SceneApp::applyInputs()
+{
+	uint32_t now = network_.GetTime();
+	inputMutex_.lock();
+	for (auto it = playerInputs_.begin(); it != playerInputs_.end();) {
+		std::unique_ptr<Player>* player = players_.Get(it->first);
+		if (!player) {
+			it = playerInputs_.erase(it); // Left, an input can still turn up after RemovePlayer
+			continue;
+		}
+		auto& entry = *it++;
+		InputJitterBuffer& buffer = entry.second;
+		const InputUpdateMessage* input = buffer.Consume(now);
+
+		if (buffer.UpdateStats(now)) {
+			const InputBufferStats& stats = buffer.Stats();
+			LOG_INFO(LOG_GAME, "Player %d inputs: mean depth %.1f, delay %ums, %u underruns, %u late, %u overflowed, %u skipped\n",
+				entry.first, stats.meanDepth, stats.targetDelay, stats.underruns, stats.late, stats.overflowed, stats.skipped);
+		}
+
+		if (!input || !*player) continue; // Nothing yet, or not joined yet
+
+		ApplyPlayerInput(**player, *input);
+		(*player)->setLastInput(input->sequence);
+	}
+	inputMutex_.unlock();
+}
+
+void SceneApp::publishWorldSnapshot()
+{
+	// Filled from the simulation thread with players_ already locked, then swapped in for the network thread to take
+	WorldSnapshot& world = worldSnapshots_.Back();
+	world.Clear();
+	world.step = step_;
+	for (auto& player : players_) {
+		if (player) {
+			physx::PxVec3 position = player->getPosition();
+			physx::PxVec3 velocity = player->GetPxBody()->getLinearVelocity();
+			world.Add(player->getID(), position.x, position.y, position.z, velocity.x, velocity.y, velocity.z, player->getRotation(), player->getLastInput());
+		}
+	}
+	worldHistory_.Record(network_.GetTime(), world);
+	worldSnapshots_.Publish();
 }
 
 void SceneApp::AddPlayer(int playerID) {
@@ -86,62 +165,59 @@ void SceneApp::AddPlayer(int playerID) {
 void SceneApp::RemovePlayer(int playerID) {
 	if (playerID > -1) {
 		playersMutex_.lock();
-		players_[playerID].reset();
+		players_.Remove(playerID);
 		playersMutex_.unlock();
 	}
 }
 
 int SceneApp::GetAvailableID()
 {
-	for (int i = 0; i < 5; i++) {
-		if (!players_[i]) return i;
-	}
-	return -1;
+	// Reserve the slot now so the ID can be sent back straight away
+	playersMutex_.lock();
+	int playerID = players_.Size() < MAX_PLAYERS ? players_.Insert(nullptr) : -1;
+	playersMutex_.unlock();
+	return playerID;
 }
 
-void SceneApp::SetInput(int playerID, InputUpdateMessage& input) {
+void SceneApp::SetInputs(std::vector<std::pair<int, InputUpdateMessage>>& inputs, uint32_t arrival) {
 	inputMutex_.lock();
-	// Keep jump input until processed in simulation
-	if (!playerInputs_[playerID]) playerInputs_[playerID] = std::make_unique<InputUpdateMessage>();
-	if (playerInputs_[playerID]->jump == true) input.jump = true;
-	*playerInputs_[playerID].get() = input;
-	inputMutex_.unlock();
-}
-
-std::map<int, PlayerValues>* SceneApp::GetPlayerValues()
-{
-	playerValues_.clear();
-	playersMutex_.lock();
-	for (auto& player : players_) {
-		if (player) {
-			physx::PxVec3 velocity = player->GetPxBody()->getLinearVelocity();
-			playerValues_[player->getID()].velocity.push_back(velocity.x);
-			playerValues_[player->getID()].velocity.push_back(velocity.y);
-			playerValues_[player->getID()].velocity.push_back(velocity.z);
-			
-			physx::PxVec3 position = player->getPosition();
-			playerValues_[player->getID()].position.push_back(position.x);
-			playerValues_[player->getID()].position.push_back(position.y);
-			playerValues_[player->getID()].position.push_back(position.z);
-
-			playerValues_[player->getID()].rotation = player->getRotation();
-		}
+	for (auto& entry : inputs) {
+		playerInputs_[entry.first].Push(entry.second, arrival);
 	}
-	playersMutex_.unlock();
-	
-	return &playerValues_;
+	inputMutex_.unlock();
 }
 
 Player* SceneApp::addPlayer(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int playerID) {
-	players_[playerID] = std::make_unique<Player>();
+	std::unique_ptr<Player>* slot = players_.Get(playerID);
+	if (!slot) return nullptr; // Left before joining
+	*slot = std::make_unique<Player>();
 	//physxMutex_.lock();
-	players_[playerID]->Init(primitive_builder_, gScene, gPhysics, playerID);
+	(*slot)->Init(primitive_builder_, gScene, gPhysics, playerID);
 	//physxMutex_.unlock();
-	return players_[playerID].get();
+	return slot->get();
 }
 
 void SceneApp::CleanUp()
 {
+	//The network threads use the scene, so they go first
+	network_.Stop();
+
+	//Bodies, then PhysX itself, in the reverse of the order they were made
+	for (std::unique_ptr<Player>& player : players_) {
+		player.reset();
+	}
+	ground_.ReleasePhysx();
+	block_.ReleasePhysx();
+	if (gScene) gScene->release();
+	if (gDispatcher) gDispatcher->release();
+	if (gPhysics) gPhysics->release();
+	if (gFoundation) gFoundation->release();
+	gScene = NULL;
+	gDispatcher = NULL;
+	gPhysics = NULL;
+	gFoundation = NULL;
+
+#ifndef SERVER_HEADLESS
 	CleanUpFont();
 
 	delete primitive_builder_;
@@ -156,58 +232,46 @@ void SceneApp::CleanUp()
 	ImGui_ImplDX11_Shutdown();
 	ImGui_ImplWin32_Shutdown();
 	ImGui::DestroyContext();
+#endif
 }
 
 bool SceneApp::Update(float frame_time)
 {
+	ServerClock::time_point tickStart = ServerClock::now();
 	network_.UpdateTime();
 
+#ifndef SERVER_HEADLESS
 	input_->Update();
 	gef::Keyboard* keyInput = input_->keyboard();
 	if (keyInput->IsKeyPressed(gef::Keyboard::KC_ESCAPE)) {
 		return false;
 	}
+#endif
 
 	fps_ = 1.0f / frame_time;
 
-	inputMutex_.lock();
 	playersMutex_.lock();
-	for (int i = 0; i < 5; i++) {
-		if (playerInputs_[i]) {
-			if (playerInputs_[i]->jump) {
-				players_[i]->GetPxBody()->addForce(physx::PxVec3(0, 7, 0), physx::PxForceMode::eIMPULSE);
-			}
 
-			players_[i]->setRotation(playerInputs_[i]->rotation);
-
-			physx::PxVec3 newVelocity(playerInputs_[i]->velocity[0], 0, playerInputs_[i]->velocity[1]);
-				
-			newVelocity.normalize();
-			newVelocity = newVelocity * 3;
-			newVelocity.y = players_[i]->GetPxBody()->getLinearVelocity().y;                                                                                  
-			players_[i]->setVelocity(newVelocity);
-		
-			playerInputs_[i].reset();
-		}
-	}
-	inputMutex_.unlock();
-
-	updatePhysics(frame_time);
+	bool stepped = updatePhysics(frame_time);
 
 	for (auto &player : players_) {
 		if (player) {
 			player->UpdatePhysx();
 			physx::PxVec3 currentPos = player->getPosition();
-			printf("time: %d, x: %f, y: %f\n", network_.GetTime(), currentPos.x, currentPos.y);
+			LOG_DEBUG(LOG_GAME, "time: %d, x: %f, y: %f\n", network_.GetTime(), currentPos.x, currentPos.y);
 		}
 	}
 
+	if (stepped) publishWorldSnapshot();
+
 	playersMutex_.unlock();
 
+	tickStats_.Record(std::chrono::duration<double>(ServerClock::now() - tickStart).count());
 
 	return true;
 }
 
+#ifndef SERVER_HEADLESS
 void SceneApp::Render()
 {
 
@@ -248,9 +312,10 @@ void SceneApp::Render()
 }
 
 void SceneApp::renderPlayers() {
-	for(int i = 0; i < 5; i++) {
-		if (players_[i]) {
-			switch (i)
+	for (size_t i = 0; i < players_.Size(); i++) {
+		Player* player = players_.ValueAt(i).get();
+		if (player) {
+			switch (SlotMapIndex(players_.IDAt(i)) % 5)
 			{
 			case 0:
 				renderer_3d_->set_override_material(&primitive_builder_->red_material());
@@ -270,7 +335,7 @@ void SceneApp::renderPlayers() {
 			default:
 				break;
 			}
-			renderer_3d_->DrawMesh(*players_[i].get());
+			renderer_3d_->DrawMesh(*player);
 		}
 	}
 }
@@ -311,3 +376,4 @@ void SceneApp::SetupLights()
 	default_point_light.set_position(gef::Vector4(-500.0f, 400.0f, 700.0f));
 	default_shader_data.AddPointLight(default_point_light);
 }
+#endif
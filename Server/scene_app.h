@@ -4,19 +4,31 @@
 #define NOMINMAX
 
 #pragma once
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include "NetworkServer.h"
+#ifndef SERVER_HEADLESS
 #include <system/application.h>
+#endif
 #include <maths/vector2.h>
 #include "primitive_builder.h"
 #include <graphics/mesh_instance.h>
 #include "GameObject.h"
 #include "Player.h"
 #include "Messages.h"
+#include "SlotMap.h"
+#include "TripleBuffer.h"
+#include "WorldSnapshot.h"
+#include "WorldHistory.h"
+#include "TickScheduler.h"
+#include "InputJitterBuffer.h"
 #include <input/keyboard.h>
 #include <PxPhysicsAPI.h>
 #include <string>
 #include <mutex>
+#include <unordered_map>
+#include <atomic>
 
 // FRAMEWORK FORWARD DECLARATIONS
 namespace gef
@@ -28,46 +40,80 @@ namespace gef
 	class Renderer3D;
 }
 
+// With SERVER_HEADLESS defined (the CMake dedicated server build) there's no window or rendering,
+// and Run() steps the simulation from a fixed rate TickScheduler instead of gef's render loop.
+#ifdef SERVER_HEADLESS
+class SceneApp
+{
+public:
+	SceneApp();
+	// Init, then tick until Stop() is called (from any thread or a signal handler), then CleanUp
+	void Run();
+	void Stop() { running_ = false; }
+#else
 class SceneApp : public gef::Application
 {
 public:
 	SceneApp(gef::Platform& platform);
+	void Render();
+#endif
 	void Init();
 	void CleanUp();
 	bool Update(float frame_time);
-	void Render();
 	void AddPlayer(int playerID);
 	void RemovePlayer(int playerID);
 	int GetAvailableID();
-	void SetInput(int playerID, InputUpdateMessage& input);
-	std::map<int, PlayerValues>* GetPlayerValues();
+	// Hand over a batch of (playerID, input) pairs read at server time arrival, taking the input lock once for the lot.
+	void SetInputs(std::vector<std::pair<int, InputUpdateMessage>>& inputs, uint32_t arrival);
+	// Latest state published by the simulation. Only for the network thread that sends snapshots,
+	// the result stays valid until it calls this again.
+	const WorldSnapshot& GetWorldSnapshot() { return worldSnapshots_.Latest(); }
 private:
+#ifndef SERVER_HEADLESS
 	void InitFont();
 	void CleanUpFont();
 	void DrawHUD();
 	void SetupLights();
+	void renderPlayers();
+#endif
 	void initPhysics();
-	void updatePhysics(float dt);
+	// Returns true if the world was stepped
+	bool updatePhysics(float dt);
+	// Set each player going with its input for the coming step. Called with players_ locked.
+	void applyInputs();
+	void publishWorldSnapshot();
 	Player* addPlayer(PrimitiveBuilder* builder, physx::PxScene* scene, physx::PxPhysics* physics, int playerID);
-	void renderPlayers();
 
 	NetworkServer network_;
 
+#ifdef SERVER_HEADLESS
+	std::atomic<bool> running_{ true };
+#else
 	gef::InputManager* input_;
     
 	gef::SpriteRenderer* sprite_renderer_;
 	gef::Font* font_;
 	gef::Renderer3D* renderer_3d_;
+#endif
 
+	// Null in the headless server, which has nothing to draw so gives objects no meshes
 	PrimitiveBuilder* primitive_builder_;
 
-	std::unique_ptr<Player> players_[5];
+	// A player's ID is its slot map ID. The slot is reserved (holding nullptr) when the connection
+	// is accepted, and the player is created once it joins the game.
+	SlotMap<std::unique_ptr<Player>> players_;
 	std::mutex playersMutex_;
 
-	std::unique_ptr<InputUpdateMessage> playerInputs_[5];
+	// Inputs waiting for each player ID, one is used each simulation step
+	std::unordered_map<int, InputJitterBuffer> playerInputs_;
 	std::mutex inputMutex_;
 
-	std::map<int, PlayerValues> playerValues_;
+	// Player state after each step, for the network thread
+	TripleBuffer<WorldSnapshot> worldSnapshots_;
+	uint32_t step_ = 0;
+
+	// The last second of steps, for judging a player's actions against where everyone was when they made them
+	WorldHistory worldHistory_{ PLAYER_HALF_WIDTH, PLAYER_HALF_HEIGHT, PLAYER_HALF_WIDTH };
 
 	GameObject ground_;
 	GameObject block_;
@@ -82,6 +128,7 @@ private:
 	float stepSize_ = 1.0f / 60.0f;
 
 	float fps_;
+	TickStats tickStats_;
 };
 
 #endif // _SCENE_APP_H
@@ -0,0 +1,138 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// A connected client that sends inputs and time requests as fast as it can, next to HONEST_CLIENTS sending an input a
+// frame, while a stand in simulation steps every frame. The flood is cut down to the connection's rate before it's
+// decoded, so no more than that reaches the scene and far fewer time requests are answered. Reports the simulation's
+// step time before and during the flood, and how much of the flood was dropped.
+
+#define HONEST_CLIENTS 8
+#define FRAME_MS 16
+#define STEP_WORK 200000 // Enough to take a good part of a millisecond
+#define QUIET_SECONDS 1.0
+#define FLOOD_SECONDS 2.0
+
+struct StepStats {
+	uint64_t steps = 0;
+	double total = 0;
+	double worst = 0;
+};
+
+// Steps at FRAME_MS, keeping the server's clock going as the real scene does, for seconds
+static StepStats Simulate(NetworkServer* server, std::vector<TestClientUDP>& honest, double seconds) {
+	StepStats stats;
+	volatile double sink = 0;
+	double end = Test::Now() + seconds;
+	while (Test::Now() < end) {
+		double start = Test::Now();
+		server->UpdateTime();
+		for (TestClientUDP& client : honest) client.SendInput();
+		double work = 0;
+		for (int i = 0; i < STEP_WORK; i++) work += i * 0.5;
+		sink = sink + work;
+		double step = Test::Now() - start;
+		stats.steps++;
+		stats.total += step;
+		stats.worst = std::max(stats.worst, step);
+		double wait = FRAME_MS / 1000.0 - step;
+		if (wait > 0) std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+	}
+	return stats;
+}
+
+static void Run(const char* backend) {
+	SetTestBackend(backend);
+	SceneApp scene;
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	std::vector<TestClientUDP> honest(HONEST_CLIENTS);
+	TestClientUDP flooder;
+	int joined = 0;
+	for (int i = 0; i < HONEST_CLIENTS; i++) {
+		if (honest[i].Open(i + 1) && honest[i].Connect(2.0)) joined++;
+	}
+	CHECK(joined == HONEST_CLIENTS);
+	CHECK(flooder.Open(HONEST_CLIENTS + 1) && flooder.Connect(2.0));
+	done = true;
+	clock.join(); //The simulation keeps the clock from here on
+
+	StepStats quiet = Simulate(server, honest, QUIET_SECONDS);
+
+	IngressStats before = server->GetIngressStats();
+	uint64_t inputsBefore = scene.InputsReceived();
+	std::atomic<bool> flooding{ true };
+	std::atomic<uint64_t> sent{ 0 }, replies{ 0 };
+	std::thread flood([&]() {
+		TimeRequestMessage request = { 0, 0, 0 };
+		char buffer[TEST_RECEIVE_SIZE];
+		uint64_t count = 0, answered = 0;
+		while (flooding) {
+			for (int i = 0; i < 32; i++) {
+				if (flooder.SendInput()) count++;
+				if (flooder.Send(MessageType::TIMEREQUEST, request)) count++;
+			}
+			int received;
+			while ((received = recvfrom(flooder.sock, buffer, sizeof(buffer), 0, NULL, NULL)) > 0) {
+				if (received >= (int)(HeaderSize) && (MessageType)buffer[HeaderLenFieldSize] == MessageType::TIMEREQUEST) answered++;
+			}
+		}
+		sent = count;
+		replies = answered;
+	});
+	double floodStart = Test::Now();
+	StepStats flooded = Simulate(server, honest, FLOOD_SECONDS);
+	flooding = false;
+	flood.join();
+	double elapsed = Test::Now() - floodStart;
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	IngressStats stats = server->GetIngressStats();
+	uint64_t received = stats.received - before.received;
+	uint64_t limited = stats.connectionLimited - before.connectionLimited + stats.timeRequestLimited - before.timeRequestLimited;
+	uint64_t inputs = scene.InputsReceived() - inputsBefore;
+	//The flooder gets its burst and its rate, the honest clients an input a frame, and nothing else reaches the scene
+	uint64_t honestInputs = (uint64_t)(HONEST_CLIENTS * (elapsed * 1000 / FRAME_MS + 2));
+	uint64_t flooderAllowed = RATE_BURST_CONNECTION + (uint64_t)(RATE_LIMIT_CONNECTION * (elapsed + 0.5));
+	CHECK(limited > 0);
+	CHECK(inputs <= honestInputs + flooderAllowed);
+	CHECK(replies <= RATE_BURST_TIME_REQUESTS + (uint64_t)(RATE_LIMIT_TIME_REQUESTS * (elapsed + 0.5)));
+	CHECK(stats.malformed == before.malformed && stats.unknownToken == before.unknownToken);
+	//Flat on average. Any one step can still be held up by the flooding thread when there's only one core to share.
+	CHECK(flooded.total / flooded.steps < 2 * quiet.total / quiet.steps + 0.0005);
+
+	printf("%-9s flood of %.0f datagrams/s, %.0f/s read by the server, %.1f%% dropped over the rate, %llu inputs reached the scene, "
+		"%llu time requests answered\n", backend, sent / elapsed, received / elapsed, received ? 100.0 * limited / received : 0.0,
+		(unsigned long long)inputs, (unsigned long long)replies);
+	printf("%-9s simulation step %.3fms mean, %.3fms worst before; %.3fms mean, %.3fms worst during the flood\n", backend,
+		quiet.total / quiet.steps * 1000, quiet.worst * 1000, flooded.total / flooded.steps * 1000, flooded.worst * 1000);
+
+	delete server;
+	flooder.Close();
+	for (TestClientUDP& client : honest) client.Close();
+}
+
+int main() {
+	StartTestSockets();
+	Log::SetCategories(0);
+
+	Run("readiness");
+#ifdef __linux__
+	Run("io_uring");
+#endif
+	return TEST_RESULT();
+}
@@ -0,0 +1,88 @@
+#include "Test.h"
+#include "ClockSync.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// A server clock way off ours and running fast or slow against it, sampled the way the client does over a network
+// with uneven, jittery delays each way. What ServerTime hands out must only ever go up, be within a bounded error of
+// the server's real time once synced, and close in on it as the drift is learned.
+
+#define FRAME_US 16667
+#define RUN_SECONDS 300
+#define SETTLE_SECONDS 30 // Past the burst and enough windows for a drift fit
+#define BASE_DELAY_US 20000
+#define JITTER_US 15000.0 // Mean of the extra queueing each way
+#define ASYMMETRY_US 4000 // The way back is this much slower at best, which no sample can see
+
+struct Result {
+	int64_t worstSynced = 0;
+	int64_t worstSettled = 0;
+	int64_t meanSettled = 0;
+	bool increasing = true;
+	double drift = 0;
+};
+
+static Result Run(int64_t serverOffset, double drift, uint32_t seed) {
+	std::mt19937 random(seed);
+	std::exponential_distribution<double> jitter(1.0 / JITTER_US);
+	auto server = [&](int64_t local) { return serverOffset + local + (int64_t)llround(local * drift); };
+
+	ClockSync clock;
+	Result result;
+	CHECK(!clock.Synced());
+	CHECK(clock.ServerTime(1234) == 1234); //Our own time until there's a sample
+
+	int64_t local = 1000000, last = INT64_MIN, nextRequest = local, settledTotal = 0, settledCount = 0;
+	int requests = 0;
+	int64_t end = local + RUN_SECONDS * 1000000LL;
+	for (; local < end; local += FRAME_US) {
+		//Requests go out between frames, and come back before the next one
+		if (local >= nextRequest) {
+			int64_t clientSend = local;
+			int64_t serverReceive = server(clientSend + BASE_DELAY_US + (int64_t)jitter(random));
+			int64_t serverSend = serverReceive + 200;
+			//The reply coming back, by our clock, ignoring the tiny bit the drift changes the delays by
+			int64_t clientReceive = clientSend + (serverSend - server(clientSend)) + ASYMMETRY_US + BASE_DELAY_US + (int64_t)jitter(random);
+			clock.AddSample(clientSend, serverReceive, serverSend, clientReceive);
+			nextRequest = local + (requests++ < CLOCK_SYNC_BURST ? CLOCK_SYNC_BURST_INTERVAL : CLOCK_SYNC_INTERVAL) * 1000LL;
+		}
+		if (!clock.Synced()) continue;
+
+		int64_t estimate = clock.ServerTime(local);
+		if (estimate < last) result.increasing = false;
+		last = estimate;
+		int64_t error = std::llabs(estimate - server(local));
+		result.worstSynced = std::max(result.worstSynced, error);
+		if (local - 1000000 > SETTLE_SECONDS * 1000000LL) {
+			result.worstSettled = std::max(result.worstSettled, error);
+			settledTotal += error;
+			settledCount++;
+		}
+	}
+	result.meanSettled = settledCount ? settledTotal / settledCount : 0;
+	result.drift = clock.Drift();
+	return result;
+}
+
+static void Check(const char* name, int64_t serverOffset, double drift) {
+	Result result = Run(serverOffset, drift, (uint32_t)(serverOffset + drift * 1e6));
+	CHECK(result.increasing);
+	//The first sample alone is off by no more than half its round trip, and they only get better from there
+	CHECK(result.worstSynced < BASE_DELAY_US + 10 * (int64_t)JITTER_US);
+	//Settled, what's left is the asymmetry, which is out of sight of any sync over the network, and the jitter the best
+	//sample in the window still had, which is eased out at no more than CLOCK_SYNC_MAX_SLEW
+	CHECK(result.worstSettled < ASYMMETRY_US / 2 + (int64_t)JITTER_US);
+	CHECK(result.meanSettled < ASYMMETRY_US / 2 + 3000);
+	CHECK(std::fabs(result.drift - drift) < 30e-6);
+	printf("%-18s %.0fppm: %.1fms worst once synced, %.2fms worst and %.2fms mean settled, drift learned %.1fppm\n",
+		name, drift * 1e6, result.worstSynced / 1000.0, result.worstSettled / 1000.0, result.meanSettled / 1000.0, result.drift * 1e6);
+}
+
+int main() {
+	Check("In step", 0, 0);
+	Check("Ahead, fast", 5000000000LL, 200e-6);
+	Check("Behind, slow", -750000000LL, -300e-6);
+	Check("Ahead, very fast", 123456789LL, 800e-6);
+	return TEST_RESULT();
+}
@@ -0,0 +1,211 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "Hmac.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Floods an in-process server with UDP connect requests, first as fast as one address can send them, then from
+// FLOOD_SOURCES addresses at once along with responses carrying forged cookies, while LEGIT_CLIENTS join. The one
+// address is held to its rate, no challenge is bigger than the request it answers, forged cookies never get a
+// connection, and the real clients all still get in. Reports how fast the server gets through the flood and answers
+// it, how long joining takes meanwhile, and what signing a cookie costs.
+
+#define STEADY_SECONDS 1.0
+#define FLOOD_SECONDS 2.0
+#define FLOOD_SOURCES 256
+#define FLOOD_FIRST_HOST 1000 // 127.0.3.232 on, well clear of the real clients' addresses
+#define STEADY_HOST 2000
+#define LEGIT_CLIENTS 16
+#define COOKIE_SIGNS 200000
+
+struct FloodSource {
+	TestClientUDP client;
+	uint64_t challenges = 0;
+	size_t biggestChallenge = 0;
+
+	// Read whatever the server's sent back
+	void Drain() {
+		char buffer[TEST_RECEIVE_SIZE];
+		int count;
+		while ((count = recvfrom(client.sock, buffer, sizeof(buffer), 0, NULL, NULL)) > 0) {
+			if (count < (int)(HeaderSize) || (MessageType)buffer[HeaderLenFieldSize] != MessageType::CONNECTCHALLENGE) continue;
+			challenges++;
+			biggestChallenge = std::max(biggestChallenge, (size_t)count);
+		}
+	}
+};
+
+static ConnectRequestMessage Request(uint64_t nonce) {
+	ConnectRequestMessage request;
+	request.nonce = nonce;
+	request.padding.resize(CONNECT_REQUEST_SIZE);
+	return request;
+}
+
+static size_t RequestSize() {
+	ConnectRequestMessage request = Request(0);
+	return HeaderSizeUDP + msgpack::pack(request).size();
+}
+
+// A single address sending nothing but connect requests, as fast as it can
+static void RunSteady(NetworkServer* server) {
+	FloodSource source;
+	CHECK(source.client.Open(STEADY_HOST));
+	ConnectRequestMessage request = Request(1);
+	IngressStats before = server->GetIngressStats();
+	uint64_t sent = 0;
+	double start = Test::Now(), end = start + STEADY_SECONDS;
+	while (Test::Now() < end) {
+		for (int i = 0; i < 64; i++) {
+			if (source.client.Send(MessageType::CONNECTREQUEST, request)) sent++;
+		}
+		source.Drain();
+	}
+	double elapsed = Test::Now() - start;
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	source.Drain();
+	IngressStats stats = server->GetIngressStats();
+	source.client.Close();
+
+	//What it could save up, and what it earned while sending, with a little over for the server's clock being coarse
+	CHECK(source.challenges > 0);
+	CHECK(source.challenges <= RATE_BURST_CONNECT + (uint64_t)(RATE_LIMIT_CONNECT * (elapsed + 0.5)));
+	CHECK(stats.connectLimited - before.connectLimited > 0);
+	printf("  one address: %.0f requests/s sent, %.0f/s read by the server, %llu answered, %llu limited\n", sent / elapsed,
+		(stats.received - before.received) / elapsed, (unsigned long long)source.challenges,
+		(unsigned long long)(stats.connectLimited - before.connectLimited));
+}
+
+// Requests and forged responses from many addresses, none of them over its own rate for long, with real clients joining
+static void RunFlood(NetworkServer* server, SceneApp& scene) {
+	std::vector<FloodSource> sources(FLOOD_SOURCES);
+	int opened = 0;
+	for (int i = 0; i < FLOOD_SOURCES; i++) {
+		if (sources[i].client.Open(FLOOD_FIRST_HOST + i)) opened++;
+	}
+	CHECK(opened == FLOOD_SOURCES);
+
+	IngressStats before = server->GetIngressStats();
+	std::atomic<bool> flooding{ true };
+	std::atomic<uint64_t> sent{ 0 };
+	std::thread flood([&]() {
+		std::mt19937_64 random(3);
+		ConnectRequestMessage request = Request(0);
+		ConnectChallengeMessage forged;
+		forged.cookie.resize(COOKIE_SIZE);
+		uint64_t count = 0;
+		while (flooding) {
+			for (FloodSource& source : sources) {
+				request.nonce = random();
+				if (source.client.Send(MessageType::CONNECTREQUEST, request)) count++;
+				//A response with a made up cookie, for a time that's still in date
+				forged.nonce = random();
+				forged.time = server->GetTime();
+				for (uint8_t& byte : forged.cookie) byte = (uint8_t)random();
+				if (source.client.Send(MessageType::CONNECTRESPONSE, forged)) count++;
+				source.Drain();
+			}
+		}
+		sent = count;
+	});
+
+	//Real clients joining meanwhile, each from its own address
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::vector<TestClientUDP> clients(LEGIT_CLIENTS);
+	int joined = 0;
+	double worstJoin = 0, totalJoin = 0;
+	double start = Test::Now();
+	for (int i = 0; i < LEGIT_CLIENTS; i++) {
+		double joinStart = Test::Now();
+		if (clients[i].Open(i + 1) && clients[i].Connect(FLOOD_SECONDS)) joined++;
+		double joinTime = Test::Now() - joinStart;
+		worstJoin = std::max(worstJoin, joinTime);
+		totalJoin += joinTime;
+	}
+	double remaining = start + FLOOD_SECONDS - Test::Now();
+	if (remaining > 0) std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+	flooding = false;
+	flood.join();
+	double elapsed = Test::Now() - start;
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	IngressStats stats = server->GetIngressStats();
+	uint64_t challenges = 0;
+	size_t biggestChallenge = 0;
+	for (FloodSource& source : sources) {
+		source.Drain();
+		challenges += source.challenges;
+		biggestChallenge = std::max(biggestChallenge, source.biggestChallenge);
+		source.client.Close();
+	}
+
+	CHECK(joined == LEGIT_CLIENTS);
+	//Forged cookies got nobody in, the real clients are all there are
+	CHECK(scene.Players() == (size_t)joined);
+	CHECK(challenges > 0);
+	//No amplification, a spoofed request gets back no more than it sent
+	CHECK(biggestChallenge <= RequestSize());
+	uint64_t received = stats.received - before.received;
+	printf("  %d addresses: %.0f datagrams/s sent, %.0f/s read by the server, %.0f challenges/s, %.1f%% limited; "
+		"%d joined meanwhile in %.0fms on average, %.0fms at worst\n", FLOOD_SOURCES, sent / elapsed, received / elapsed,
+		challenges / elapsed, received ? 100.0 * (stats.connectLimited - before.connectLimited) / received : 0.0, joined,
+		totalJoin / LEGIT_CLIENTS * 1000, worstJoin * 1000);
+	for (TestClientUDP& client : clients) client.Close();
+}
+
+static void Run(const char* backend) {
+	SetTestBackend(backend);
+	SceneApp scene;
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	printf("%s\n", backend);
+	RunSteady(server);
+	RunFlood(server, scene);
+
+	delete server;
+	done = true;
+	clock.join();
+}
+
+// What the server spends on each challenge, signing the address, port, nonce and time as CreateCookie does
+static void BenchmarkCookies() {
+	uint8_t key[32] = { 1, 2, 3 };
+	uint8_t data[4 + 2 + 8 + 4] = {};
+	uint8_t out[SHA256_SIZE];
+	uint64_t checksum = 0;
+	double start = Test::Now();
+	for (int i = 0; i < COOKIE_SIGNS; i++) {
+		memcpy(data + 6, &i, sizeof(i));
+		HmacSha256(key, sizeof(key), data, sizeof(data), out);
+		checksum += out[0];
+	}
+	double elapsed = Test::Now() - start;
+	printf("Signing a cookie: %.2fus, %.0fk a second on one thread (checksum %llu)\n", elapsed / COOKIE_SIGNS * 1e6,
+		COOKIE_SIGNS / elapsed / 1000, (unsigned long long)checksum);
+}
+
+int main() {
+	StartTestSockets();
+	Log::SetCategories(0);
+
+	BenchmarkCookies();
+	Run("readiness");
+#ifdef __linux__
+	Run("io_uring");
+#endif
+	return TEST_RESULT();
+}
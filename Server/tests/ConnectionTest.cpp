@@ -0,0 +1,186 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "Connection.h"
+#include "Log.h"
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A connection whose outgoing queue fills up turns the next message away, and rather than carry on with the client
+// missing a reliable message, is marked to be closed by the network thread with the drop counted. A send cut short by
+// a full socket buffer is picked up later from where it stopped, so the client gets every byte once and in order, and
+// the stats say what happened. A client's datagrams sent again from another address, with the right handle and token,
+// don't move the client there, only an input newer than any it's sent does, and a wrong token gets nowhere at all.
+
+// Out of range of the server's table, so the sends it's asked to flush are ignored and the test has the queue to itself
+#define TEST_HANDLE 0x40000000u
+#define SHORT_WRITE_MESSAGES 8
+#define SHORT_WRITE_BODY 3000 // Bigger than an outbound slot, and several fill the socket buffer
+
+static void TestQueueFull(NetworkServer* server) {
+	int sockets[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	Connection* conn = new Connection(sockets[0], TEST_HANDLE, 1, server);
+
+	MessageType type = MessageType::CHAT;
+	std::vector<uint8_t> body(100, 'c');
+	uint16_t length = (uint16_t)(body.size() + HeaderSize);
+	for (int i = 0; i < OUTBOUND_RING_SLOTS; i++) CHECK(conn->AddMessage(length, type, body));
+	CHECK(!conn->isClosing());
+	CHECK(conn->getDroppedMessages() == 0);
+
+	//The one that doesn't fit closes the connection, and any more after it are counted too
+	CHECK(!conn->AddMessage(length, type, body));
+	CHECK(conn->isClosing());
+	CHECK(!conn->AddMessage(length, type, body));
+	CHECK(conn->getDroppedMessages() == 2);
+
+	delete conn;
+	closesocket(sockets[1]);
+}
+
+// Read whatever's arrived on sock onto the end of received
+static void Drain(SOCKET sock, std::vector<char>& received) {
+	char buffer[4096];
+	int count;
+	while ((count = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+		received.insert(received.end(), buffer, buffer + count);
+	}
+}
+
+static void TestShortWrite(NetworkServer* server) {
+	int sockets[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	//As small a send buffer as the kernel allows, so one gathered write can't take the whole queue
+	int size = 1;
+	setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof(size));
+	CHECK(SetNonBlocking(sockets[0]) && SetNonBlocking(sockets[1]));
+	Connection* conn = new Connection(sockets[0], TEST_HANDLE, 1, server);
+
+	//Each message filled with its own byte, so anything repeated, skipped or out of order shows
+	std::vector<char> expected;
+	MessageType type = MessageType::CHAT;
+	for (int i = 0; i < SHORT_WRITE_MESSAGES; i++) {
+		std::vector<uint8_t> body(SHORT_WRITE_BODY, (uint8_t)('a' + i));
+		uint16_t length = (uint16_t)(body.size() + HeaderSize);
+		CHECK(conn->AddMessage(length, type, body));
+		expected.insert(expected.end(), (const char*)&length, (const char*)&length + HeaderLenFieldSize);
+		expected.push_back((char)type);
+		expected.insert(expected.end(), body.begin(), body.end());
+	}
+
+	//The first write fills the buffer and stops partway through a message
+	CHECK(conn->Write() == 0);
+	const ConnectionStats& stats = conn->getStats();
+	CHECK(stats.sendCalls == 1);
+	CHECK(stats.partialWrites == 1);
+	CHECK(stats.bytesSent > 0 && stats.bytesSent < expected.size());
+	CHECK(stats.messagesSent < SHORT_WRITE_MESSAGES);
+	CHECK(stats.bytesSent / (SHORT_WRITE_BODY + HeaderSize) == stats.messagesSent); //Only whole messages popped
+
+	//The client reads, and the rest goes a bufferful at a time
+	std::vector<char> received;
+	int result = 0, writes = 1;
+	while (result == 0 && writes < 1000) {
+		Drain(sockets[1], received);
+		result = conn->Write();
+		writes++;
+	}
+	Drain(sockets[1], received);
+	CHECK(result == 1);
+	CHECK(received == expected);
+	CHECK(stats.sendCalls == (uint64_t)writes);
+	CHECK(stats.messagesSent == SHORT_WRITE_MESSAGES);
+	CHECK(stats.bytesSent == expected.size());
+	CHECK(stats.partialWrites >= 1 && stats.partialWrites < (uint64_t)writes);
+
+	//Nothing queued is nothing to do
+	CHECK(conn->Write() == 1);
+	CHECK(stats.sendCalls == (uint64_t)writes);
+	printf("%d messages of %d bytes in %d writes, %llu cut short\n", SHORT_WRITE_MESSAGES, SHORT_WRITE_BODY + (int)(HeaderSize),
+		writes, (unsigned long long)stats.partialWrites);
+
+	delete conn;
+	closesocket(sockets[1]);
+}
+
+// Wait for the server to have counted count or more of what counter reads, or a second
+template<class F>
+static bool WaitFor(F counter, uint64_t count) {
+	double end = Test::Now() + 1.0;
+	while (counter() < count) {
+		if (Test::Now() > end) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	return true;
+}
+
+static void TestMoveAddress(NetworkServer* server, SceneApp& scene) {
+	TestClientUDP client, other;
+	CHECK(client.Open(1) && client.Connect(2.0));
+	CHECK(other.Open(2));
+	for (int i = 0; i < 5; i++) client.SendInput();
+	CHECK(WaitFor([&]() { return scene.InputsReceived(); }, 5));
+
+	//Someone else with everything the client's sent so far, replaying it from their own address
+	other.handle = client.handle;
+	other.token = client.token;
+	other.sequence = 2;
+	IngressStats before = server->GetIngressStats();
+	uint64_t inputsBefore = scene.InputsReceived();
+	TimeRequestMessage request = { 0, 0, 0 };
+	other.SendInput();
+	other.Send(MessageType::TIMEREQUEST, request);
+	CHECK(WaitFor([&]() { return server->GetIngressStats().movesRejected; }, before.movesRejected + 2));
+	std::vector<char> body;
+	CHECK(!other.Receive(MessageType::TIMEREQUEST, body, 0.1));
+	//Still answered where it was
+	client.Send(MessageType::TIMEREQUEST, request);
+	CHECK(client.Receive(MessageType::TIMEREQUEST, body, 1.0));
+
+	//A token one bit out is no one's
+	other.token ^= 1;
+	other.Send(MessageType::TIMEREQUEST, request);
+	CHECK(WaitFor([&]() { return server->GetIngressStats().unknownToken; }, before.unknownToken + 1));
+	other.token ^= 1;
+	CHECK(scene.InputsReceived() == inputsBefore);
+
+	//The client's own next input from its new address moves it, then only the new address is listened to
+	std::swap(client.sock, other.sock);
+	client.SendInput();
+	CHECK(WaitFor([&]() { return scene.InputsReceived(); }, inputsBefore + 1));
+	client.Send(MessageType::TIMEREQUEST, request);
+	CHECK(client.Receive(MessageType::TIMEREQUEST, body, 1.0));
+	IngressStats after = server->GetIngressStats();
+	CHECK(after.movesRejected == before.movesRejected + 2);
+	client.Close();
+	other.Close();
+}
+
+int main() {
+	StartTestSockets();
+	Log::SetCategories(0);
+
+	SceneApp scene;
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+	//The scene keeps the server's clock going in the real thing
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	TestQueueFull(server);
+	TestShortWrite(server);
+	TestMoveAddress(server, scene);
+
+	delete server;
+	done = true;
+	clock.join();
+	return TEST_RESULT();
+}
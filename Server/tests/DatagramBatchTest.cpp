@@ -0,0 +1,120 @@
+#include "Test.h"
+#include "TestSockets.h"
+#include "DatagramBatch.h"
+#include <cstring>
+#include <vector>
+
+// Loopback checks that batched sends and receives keep every datagram intact, and how many system calls they take.
+// Then a quick comparison of a tick's snapshot fan-out sent one datagram at a time against sent as a batch.
+
+#define CLIENTS 256
+#define SNAPSHOT_SIZE 300
+
+static SOCKET Bind(sockaddr_in& address) {
+	SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(sock, (sockaddr*)&address, sizeof(address));
+	socklen_t length = sizeof(address);
+	getsockname(sock, (sockaddr*)&address, &length);
+	int bufferSize = 4 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+	SetNonBlocking(sock);
+	return sock;
+}
+
+static int ReceiveAll(DatagramBatch& batch, std::vector<std::vector<char>>& received) {
+	int calls = 0;
+	while (true) {
+		int count = batch.Receive();
+		calls++;
+		if (count <= 0) return calls;
+		for (int i = 0; i < count; i++) {
+			received.emplace_back(batch.GetData(i), batch.GetData(i) + batch.GetLength(i));
+		}
+	}
+}
+
+static void TestRoundTrip() {
+	sockaddr_in fromAddress, toAddress;
+	SOCKET from = Bind(fromAddress);
+	SOCKET to = Bind(toAddress);
+	DatagramBatch sender(from);
+	DatagramBatch receiver(to);
+
+	//A run of equal sizes (merged into GSO sends where the kernel allows), then mixed sizes
+	std::vector<std::vector<char>> sent;
+	for (int i = 0; i < 100; i++) {
+		size_t length = i < 70 ? 200 : 1 + i * 4;
+		sent.emplace_back(length, (char)i);
+	}
+	for (auto& datagram : sent) sender.Queue(toAddress, datagram.data(), (uint16_t)datagram.size());
+	CHECK(sender.Flush() == 1);
+	CHECK(sender.GetStats().packetsSent == sent.size());
+#ifdef __linux__
+	CHECK(sender.GetStats().sendCalls <= 2); //One sendmmsg, or one more if GSO had to be turned off
+#endif
+
+	std::vector<std::vector<char>> received;
+	ReceiveAll(receiver, received);
+	CHECK(received.size() == sent.size());
+	for (size_t i = 0; i < received.size() && i < sent.size(); i++) {
+		CHECK(received[i] == sent[i]);
+	}
+#ifdef __linux__
+	//Ring sized bursts, plus the call that finds nothing left
+	CHECK(receiver.GetStats().receiveCalls <= (sent.size() + DATAGRAM_RING_SIZE - 1) / DATAGRAM_RING_SIZE + 1);
+#endif
+
+	//Too big for a ring slot is reported as length 0, not cut short
+	std::vector<char> big(DATAGRAM_BUFFER_SIZE + 100, 'x');
+	sender.Queue(toAddress, big.data(), (uint16_t)big.size());
+	CHECK(sender.Flush() == 1);
+	received.clear();
+	ReceiveAll(receiver, received);
+	CHECK(received.size() == 1 && received[0].empty());
+
+	closesocket(from);
+	closesocket(to);
+}
+
+static void BenchmarkFanOut() {
+	sockaddr_in fromAddress;
+	SOCKET from = Bind(fromAddress);
+	std::vector<SOCKET> clients(CLIENTS);
+	std::vector<sockaddr_in> addresses(CLIENTS);
+	for (int i = 0; i < CLIENTS; i++) clients[i] = Bind(addresses[i]);
+	std::vector<char> snapshot(SNAPSHOT_SIZE, 's');
+	char drain[DATAGRAM_BUFFER_SIZE];
+
+	const int ticks = 200;
+	double single = 0, batched = 0;
+	DatagramBatch batch(from);
+	for (int tick = 0; tick < ticks; tick++) {
+		double start = Test::Now();
+		for (int i = 0; i < CLIENTS; i++) {
+			sendto(from, snapshot.data(), SNAPSHOT_SIZE, 0, (const sockaddr*)&addresses[i], sizeof(sockaddr_in));
+		}
+		single += Test::Now() - start;
+		for (SOCKET client : clients) while (recv(client, drain, sizeof(drain), 0) > 0) {}
+
+		start = Test::Now();
+		for (int i = 0; i < CLIENTS; i++) batch.Queue(addresses[i], snapshot.data(), SNAPSHOT_SIZE);
+		CHECK(batch.Flush() == 1);
+		batched += Test::Now() - start;
+		for (SOCKET client : clients) while (recv(client, drain, sizeof(drain), 0) > 0) {}
+	}
+	printf("Fan-out of %d snapshots a tick: one sendto each %.1fus a tick, batched %.1fus a tick in %.1f calls\n",
+		CLIENTS, single * 1e6 / ticks, batched * 1e6 / ticks, (double)batch.GetStats().sendCalls / ticks);
+
+	closesocket(from);
+	for (SOCKET client : clients) closesocket(client);
+}
+
+int main() {
+	StartTestSockets();
+	TestRoundTrip();
+	BenchmarkFanOut();
+	return TEST_RESULT();
+}
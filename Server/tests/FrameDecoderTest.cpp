@@ -0,0 +1,146 @@
+#include "Test.h"
+#include "FrameDecoder.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+// A stream of frames cut up at random, down to single bytes, comes back out as the same frames, the buffer stops
+// growing at the biggest frame, and bad lengths are caught. Then how fast small frames decode from full reads.
+
+#define STREAM_FRAMES 5000
+#define BENCHMARK_BYTES (64 * 1024 * 1024)
+#define BENCHMARK_FRAME_SIZE 24
+
+static std::vector<char> Frame(size_t length, std::mt19937& random) {
+	std::vector<char> frame(length);
+	uint16_t length16 = (uint16_t)length;
+	memcpy(frame.data(), &length16, sizeof(length16));
+	for (size_t i = sizeof(length16); i < length; i++) frame[i] = (char)random();
+	return frame;
+}
+
+// Feed stream in pieces of at most maxPiece bytes (or as much as there's room for) and collect the frames
+static int Decode(FrameDecoder& decoder, const std::vector<char>& stream, size_t maxPiece, std::mt19937& random,
+	std::vector<std::vector<char>>& frames, size_t& largestSpace) {
+	size_t pos = 0;
+	while (pos < stream.size()) {
+		size_t space;
+		char* write = decoder.GetWriteSpace(space);
+		if (space > largestSpace) largestSpace = space;
+		size_t piece = 1 + random() % maxPiece;
+		if (piece > space) piece = space;
+		if (piece > stream.size() - pos) piece = stream.size() - pos;
+		memcpy(write, stream.data() + pos, piece);
+		decoder.CommitWrite(piece);
+		pos += piece;
+
+		const char* frame;
+		uint16_t length;
+		int result;
+		while ((result = decoder.NextFrame(frame, length)) == 1) {
+			frames.emplace_back(frame, frame + length);
+		}
+		if (result == -1) return -1;
+	}
+	return 0;
+}
+
+static void TestSplitStream() {
+	std::mt19937 random(7);
+	std::vector<std::vector<char>> sent;
+	std::vector<char> stream;
+	for (int i = 0; i < STREAM_FRAMES; i++) {
+		//Mostly small, like real traffic, with the odd big one and both extremes
+		size_t length = i == 0 ? 3 : i == 1 ? FRAME_MAX_SIZE : random() % 16 == 0 ? 3 + random() % (FRAME_MAX_SIZE - 2) : 3 + random() % 200;
+		sent.push_back(Frame(length, random));
+		stream.insert(stream.end(), sent.back().begin(), sent.back().end());
+	}
+
+	for (size_t maxPiece : { (size_t)1, (size_t)7, (size_t)1500, (size_t)FRAME_MAX_SIZE * 2 }) {
+		FrameDecoder decoder;
+		std::vector<std::vector<char>> received;
+		size_t largestSpace = 0;
+		CHECK(Decode(decoder, stream, maxPiece, random, received, largestSpace) == 0);
+		CHECK(received == sent);
+		//Never more than a whole frame and a read's worth of room
+		CHECK(largestSpace <= FRAME_MAX_SIZE + 2 * FRAME_READ_CHUNK);
+	}
+}
+
+static void TestMalformed() {
+	std::mt19937 random(1);
+	for (uint16_t badLength : { (uint16_t)0, (uint16_t)1, (uint16_t)2 }) {
+		FrameDecoder decoder;
+		std::vector<char> stream = Frame(10, random);
+		std::vector<char> bad(4, 0);
+		memcpy(bad.data(), &badLength, sizeof(badLength));
+		stream.insert(stream.end(), bad.begin(), bad.end());
+
+		std::vector<std::vector<char>> received;
+		size_t largestSpace = 0;
+		CHECK(Decode(decoder, stream, stream.size(), random, received, largestSpace) == -1);
+		CHECK(received.size() == 1); //The good frame before it still came out
+	}
+
+	//A length alone isn't a frame yet
+	FrameDecoder decoder;
+	size_t space;
+	char* write = decoder.GetWriteSpace(space);
+	uint16_t length = 100;
+	memcpy(write, &length, sizeof(length));
+	decoder.CommitWrite(1);
+	const char* frame;
+	CHECK(decoder.NextFrame(frame, length) == 0);
+	decoder.CommitWrite(1);
+	CHECK(decoder.NextFrame(frame, length) == 0);
+
+	//And after a reset the half frame is forgotten
+	decoder.Reset();
+	std::vector<char> good = Frame(5, random);
+	write = decoder.GetWriteSpace(space);
+	memcpy(write, good.data(), good.size());
+	decoder.CommitWrite(good.size());
+	CHECK(decoder.NextFrame(frame, length) == 1 && length == good.size() && memcmp(frame, good.data(), length) == 0);
+}
+
+static void BenchmarkSmallFrames() {
+	std::mt19937 random(3);
+	std::vector<char> frame = Frame(BENCHMARK_FRAME_SIZE, random);
+	//One recv's worth, cut partway through a frame so every read leaves a piece behind
+	std::vector<char> chunk;
+	while (chunk.size() < FRAME_READ_CHUNK) chunk.insert(chunk.end(), frame.begin(), frame.end());
+	chunk.resize(FRAME_READ_CHUNK);
+
+	FrameDecoder decoder;
+	size_t frames = 0, bytes = 0;
+	uint64_t checksum = 0;
+	double start = Test::Now();
+	while (bytes < BENCHMARK_BYTES) {
+		size_t space;
+		char* write = decoder.GetWriteSpace(space);
+		//The stream continues from wherever the last chunk stopped, so keep it lined up with frame boundaries
+		size_t offset = bytes % BENCHMARK_FRAME_SIZE;
+		size_t piece = FRAME_READ_CHUNK - BENCHMARK_FRAME_SIZE;
+		memcpy(write, chunk.data() + offset, piece);
+		decoder.CommitWrite(piece);
+		bytes += piece;
+
+		const char* next;
+		uint16_t length;
+		while (decoder.NextFrame(next, length) == 1) {
+			checksum += (uint8_t)next[length - 1];
+			frames++;
+		}
+	}
+	double elapsed = Test::Now() - start;
+	CHECK(frames == bytes / BENCHMARK_FRAME_SIZE);
+	printf("%d byte frames: %.1fM frames/s, %.0f MB/s (checksum %llu)\n", BENCHMARK_FRAME_SIZE, frames / elapsed / 1e6,
+		bytes / elapsed / (1024 * 1024), (unsigned long long)checksum);
+}
+
+int main() {
+	TestSplitStream();
+	TestMalformed();
+	BenchmarkSmallFrames();
+	return TEST_RESULT();
+}
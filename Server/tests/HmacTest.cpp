@@ -0,0 +1,96 @@
+#include "Test.h"
+#include "Hmac.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+// SHA-256 against the FIPS 180-4 examples and lengths either side of where the padding spills into another block,
+// HMAC-SHA-256 against every RFC 4231 test case, and ConstantTimeEqual telling apart buffers that differ anywhere.
+
+static std::string Hex(const uint8_t* bytes, size_t length) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	for (size_t i = 0; i < length; i++) {
+		hex += digits[bytes[i] >> 4];
+		hex += digits[bytes[i] & 15];
+	}
+	return hex;
+}
+
+static std::string Sha256Hex(const std::string& data) {
+	uint8_t out[SHA256_SIZE];
+	Sha256((const uint8_t*)data.data(), data.size(), out);
+	return Hex(out, SHA256_SIZE);
+}
+
+static std::string HmacHex(const std::vector<uint8_t>& key, const std::string& data) {
+	uint8_t out[SHA256_SIZE];
+	HmacSha256(key.data(), key.size(), (const uint8_t*)data.data(), data.size(), out);
+	return Hex(out, SHA256_SIZE);
+}
+
+static void TestSha256() {
+	CHECK(Sha256Hex("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	CHECK(Sha256Hex("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	CHECK(Sha256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+	CHECK(Sha256Hex(std::string(1000000, 'a')) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+	//The length only just fits in the last block, doesn't, or the message fills blocks exactly
+	CHECK(Sha256Hex(std::string(55, 'a')) == "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318");
+	CHECK(Sha256Hex(std::string(56, 'a')) == "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a");
+	CHECK(Sha256Hex(std::string(63, 'a')) == "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34");
+	CHECK(Sha256Hex(std::string(64, 'a')) == "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb");
+	CHECK(Sha256Hex(std::string(65, 'a')) == "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0");
+	CHECK(Sha256Hex(std::string(119, 'a')) == "31eba51c313a5c08226adf18d4a359cfdfd8d2e816b13f4af952f7ea6584dcfb");
+}
+
+// RFC 4231 section 4
+static void TestHmacSha256() {
+	std::vector<uint8_t> key1(20, 0x0b);
+	CHECK(HmacHex(key1, "Hi There") == "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+	std::vector<uint8_t> key2 = { 'J', 'e', 'f', 'e' };
+	CHECK(HmacHex(key2, "what do ya want for nothing?") == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+	std::vector<uint8_t> key3(20, 0xaa);
+	CHECK(HmacHex(key3, std::string(50, '\xdd')) == "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe");
+
+	std::vector<uint8_t> key4;
+	for (uint8_t i = 1; i <= 25; i++) key4.push_back(i);
+	CHECK(HmacHex(key4, std::string(50, '\xcd')) == "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b");
+
+	//Truncated to 128 bits, as cookies are
+	std::vector<uint8_t> key5(20, 0x0c);
+	CHECK(HmacHex(key5, "Test With Truncation").substr(0, 32) == "a3b6167473100ee06e0c796c2955552b");
+
+	//Keys longer than a block are hashed first
+	std::vector<uint8_t> key6(131, 0xaa);
+	CHECK(HmacHex(key6, "Test Using Larger Than Block-Size Key - Hash Key First") ==
+		"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+	CHECK(HmacHex(key6, "This is a test using a larger than block-size key and a larger than block-size data. The key needs to be "
+		"hashed before being used by the HMAC algorithm.") == "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2");
+}
+
+static void TestConstantTimeEqual() {
+	uint8_t a[SHA256_SIZE], b[SHA256_SIZE];
+	for (int i = 0; i < SHA256_SIZE; i++) a[i] = b[i] = (uint8_t)(i * 7);
+	CHECK(ConstantTimeEqual(a, b, SHA256_SIZE));
+	CHECK(ConstantTimeEqual(a, b, 0));
+	bool all = true;
+	for (int i = 0; i < SHA256_SIZE; i++) {
+		for (int bit = 0; bit < 8; bit++) {
+			b[i] ^= 1 << bit;
+			if (ConstantTimeEqual(a, b, SHA256_SIZE)) all = false;
+			b[i] ^= 1 << bit;
+		}
+	}
+	CHECK(all);
+}
+
+int main() {
+	TestSha256();
+	TestHmacSha256();
+	TestConstantTimeEqual();
+	return TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Joins CLIENTS UDP only clients to an in-process server on the stub scene, then floods it with their inputs from
+// SENDERS threads while it builds and sends snapshots every tick. Reports how fast the ingress threads get through
+// them, and checks every input they let through reached the scene, bodies that don't unpack or are missing values were
+// dropped, and the server stops promptly afterwards.
+
+#define CLIENTS 256
+#define SENDERS 2
+#define FLOOD_SECONDS 1.0
+#define MALFORMED_BATCH 32
+
+static void Run(const char* backend) {
+	SetTestBackend(backend);
+	SceneApp scene;
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+
+	//The scene keeps the server's clock going in the real thing
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	std::vector<TestClientUDP> clients(CLIENTS);
+	double joinStart = Test::Now();
+	int joined = 0;
+	for (int i = 0; i < CLIENTS; i++) {
+		if (clients[i].Open(i + 1) && clients[i].Connect(2.0)) joined++;
+	}
+	double joinTime = Test::Now() - joinStart;
+	CHECK(joined == CLIENTS);
+	//Bodies that don't unpack are dropped as malformed, and never get to the scene. So are inputs that unpack, but
+	//without the two velocity axes the scene reads. A batch at a time, waiting for each to be read, as with one core
+	//a burst can fill the socket's receive buffer before the ingress threads get a look in.
+	IngressStats before = server->GetIngressStats();
+	IngressStats afterMalformed = before;
+	const uint8_t truncated[] = { 0xce, 0x01 }; //A uint32 cut off after its first byte
+	MessageType types[] = { MessageType::INPUTUPDATE, MessageType::TIMEREQUEST, MessageType::SNAPSHOTACK };
+	InputUpdateMessage missing{ 0, 1, {}, 0.0f, false };
+	for (int batch = 0; batch < CLIENTS; batch += MALFORMED_BATCH) {
+		for (int i = batch; i < batch + MALFORMED_BATCH && i < CLIENTS; i++) {
+			clients[i].SendBody(types[i % 3], truncated, sizeof(truncated));
+			missing.velocity.assign(i % 2 ? 3 : 1, 0.0f);
+			clients[i].Send(MessageType::INPUTUPDATE, missing);
+		}
+		uint64_t expected = 2 * std::min(batch + MALFORMED_BATCH, CLIENTS);
+		double waitEnd = Test::Now() + 1.0;
+		do {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			afterMalformed = server->GetIngressStats();
+		} while (afterMalformed.received - before.received < expected && Test::Now() < waitEnd);
+	}
+	CHECK(afterMalformed.malformed - before.malformed == 2 * CLIENTS);
+	CHECK(scene.InputsReceived() == 0);
+	before = afterMalformed;
+
+	std::atomic<uint64_t> sent{ 0 };
+	double end = Test::Now() + FLOOD_SECONDS;
+	std::vector<std::thread> senders;
+	for (int s = 0; s < SENDERS; s++) {
+		senders.emplace_back([&, s]() {
+			uint64_t count = 0;
+			while (Test::Now() < end) {
+				for (int i = s; i < CLIENTS; i += SENDERS) {
+					if (clients[i].SendInput()) count++;
+				}
+			}
+			sent += count;
+		});
+	}
+	for (std::thread& sender : senders) sender.join();
+	//Let the ingress threads catch up with what's still in the socket buffers
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+	IngressStats stats = server->GetIngressStats();
+	uint64_t received = stats.received - before.received;
+	uint64_t dropped = stats.Dropped() - before.Dropped();
+	CHECK(stats.malformed == before.malformed);
+	CHECK(stats.unknownToken == 0);
+	CHECK(received > 0);
+	//Inputs are all that was sent after joining, so everything not dropped should have been handed to the scene
+	CHECK(scene.InputsReceived() == received - dropped);
+
+	double stopStart = Test::Now();
+	delete server;
+	double stopTime = Test::Now() - stopStart;
+	CHECK(stopTime < 1.0);
+	done = true;
+	clock.join();
+	for (TestClientUDP& client : clients) client.Close();
+
+	printf("%-9s %d clients joined in %.0fms, %.0f inputs/s sent, %.0f/s read by the server, %.1f%% over rate limits, stopped in %.1fms\n",
+		backend, joined, joinTime * 1000, sent / FLOOD_SECONDS, received / FLOOD_SECONDS, received ? 100.0 * dropped / received : 0.0, stopTime * 1000);
+}
+
+int main() {
+	StartTestSockets();
+	//Just the results, not every connection coming and going
+	Log::SetCategories(0);
+
+	Run("readiness");
+#ifdef __linux__
+	Run("io_uring"); //Falls back to readiness where the kernel can't do it
+#endif
+	return TEST_RESULT();
+}
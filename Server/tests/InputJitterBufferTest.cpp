@@ -0,0 +1,221 @@
+#include "Test.h"
+#include "InputJitterBuffer.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// A client sending an input a frame over a link with a given latency each, and the simulation stepping at the same
+// rate. Every input sent is either used for a step of its own, in the order they were sent, or counted as late,
+// overflowed or skipped, whether they arrive evenly, out of order, one very late or in a burst after a stall. Steps
+// with nothing new hold the last input without its jump, and the delay goes up with the jitter and back down after.
+
+#define STEP_MS 16
+#define CLIENT_START 1000 // Client time of the first input, which the server clock matches
+#define LATENCY 40
+
+struct Sent {
+	uint32_t arrival;
+	InputUpdateMessage input;
+};
+
+struct Step {
+	uint32_t sequence;
+	bool jump;
+	bool fresh; // An input it hadn't used before
+	uint32_t delay; // The buffer's extra delay after it
+	uint32_t skipped; // Inputs skipped so far
+};
+
+// inputs inputs a step apart, the one with sequence i arriving latency(i) ms after it was sent
+template<class F>
+static std::vector<Sent> Send(uint32_t inputs, F latency) {
+	std::vector<Sent> sent(inputs);
+	for (uint32_t i = 0; i < inputs; i++) {
+		InputUpdateMessage& input = sent[i].input;
+		input.time = CLIENT_START + i * STEP_MS;
+		input.sequence = i;
+		input.velocity = { 0, 0, 0 };
+		input.rotation = 0;
+		input.jump = false;
+		sent[i].arrival = input.time + latency(i);
+	}
+	return sent;
+}
+
+// Push each input as the server clock reaches its arrival, and step every STEP_MS until they've all been and gone
+static std::vector<Step> Play(InputJitterBuffer& buffer, std::vector<Sent> sent) {
+	std::stable_sort(sent.begin(), sent.end(), [](const Sent& a, const Sent& b) { return a.arrival < b.arrival; });
+	std::vector<Step> steps;
+	uint32_t last = 0;
+	bool started = false;
+	size_t next = 0;
+	for (uint32_t now = CLIENT_START; next < sent.size() || buffer.Depth() > 0; now++) {
+		while (next < sent.size() && sent[next].arrival <= now) {
+			buffer.Push(sent[next].input, now);
+			next++;
+		}
+		if (now % STEP_MS != 0) continue;
+		const InputUpdateMessage* input = buffer.Consume(now);
+		if (!input) continue;
+		bool fresh = !started || input->sequence != last;
+		steps.push_back({ input->sequence, input->jump, fresh, buffer.ExtraDelay(), buffer.Stats().intervalSkipped });
+		last = input->sequence;
+		started = true;
+	}
+	return steps;
+}
+
+static std::vector<uint32_t> Used(const std::vector<Step>& steps) {
+	std::vector<uint32_t> used;
+	for (const Step& step : steps) {
+		if (step.fresh) used.push_back(step.sequence);
+	}
+	return used;
+}
+
+static bool Increasing(const std::vector<uint32_t>& used) {
+	for (size_t i = 1; i < used.size(); i++) {
+		if (used[i] <= used[i - 1]) return false;
+	}
+	return true;
+}
+
+// Everything sent is used once or counted as thrown away
+static uint32_t Accounted(InputJitterBuffer& buffer, const std::vector<Step>& steps) {
+	const InputBufferStats& stats = buffer.Stats();
+	return (uint32_t)Used(steps).size() + stats.intervalLate + stats.intervalOverflowed + stats.intervalSkipped;
+}
+
+static void TestSteady() {
+	InputJitterBuffer buffer;
+	std::vector<Sent> sent = Send(200, [](uint32_t) { return LATENCY; });
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+
+	CHECK(used.size() == sent.size());
+	CHECK(Increasing(used));
+	//One each, nothing held
+	CHECK(steps.size() == sent.size());
+	CHECK(buffer.ExtraDelay() == 0);
+	CHECK(buffer.Stats().intervalUnderruns == 0);
+	CHECK(buffer.Stats().intervalSkipped == 0);
+}
+
+static void TestReorder() {
+	//Every other input is held up long enough that the next one overtakes it
+	InputJitterBuffer buffer;
+	std::vector<Sent> sent = Send(400, [](uint32_t i) { return i % 2 ? LATENCY + STEP_MS + 4 : LATENCY; });
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+
+	CHECK(Increasing(used));
+	CHECK(Accounted(buffer, steps) == sent.size());
+	CHECK(buffer.ExtraDelay() >= STEP_MS);
+	//Only the first few, before the delay has grown to cover it, can come too late
+	CHECK(buffer.Stats().intervalLate < 10);
+	CHECK(buffer.Stats().intervalSkipped == 0);
+	CHECK(used.size() > 390);
+	size_t consecutive = 0;
+	for (size_t i = used.size() - 300; i < used.size(); i++) {
+		if (used[i] == used[i - 1] + 1) consecutive++;
+	}
+	CHECK(consecutive == 300);
+}
+
+static void TestLate() {
+	//One input with a jump turns up after the inputs sent after it have been used
+	InputJitterBuffer buffer;
+	std::vector<Sent> sent = Send(200, [](uint32_t i) { return i == 50 ? LATENCY + 500 : LATENCY; });
+	sent[50].input.jump = true;
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+
+	CHECK(std::find(used.begin(), used.end(), 50u) == used.end());
+	CHECK(buffer.Stats().intervalLate == 1);
+	CHECK(Increasing(used));
+	CHECK(Accounted(buffer, steps) == sent.size());
+	//Its jump still happens, once
+	int jumps = 0;
+	for (const Step& step : steps) jumps += step.jump;
+	CHECK(jumps == 1);
+}
+
+static void TestUnderrun() {
+	//The link stalls, and the inputs sent meanwhile all arrive together with the one after
+	InputJitterBuffer buffer;
+	const uint32_t first = 100, stalled = 5;
+	std::vector<Sent> sent = Send(300, [&](uint32_t i) {
+		return i >= first && i <= first + stalled ? LATENCY + (first + stalled - i) * STEP_MS : LATENCY;
+	});
+	sent[first - 1].input.jump = true;
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+
+	//The steps in the stall hold the input before, without jumping again
+	size_t held = 0;
+	for (size_t i = 1; i < steps.size(); i++) {
+		if (steps[i].sequence != first - 1 || steps[i].fresh) continue;
+		held++;
+		CHECK(!steps[i].jump);
+	}
+	CHECK(held > 0);
+	CHECK(buffer.Stats().intervalUnderruns >= 1);
+	//Then the backlog is worked through one a step, with none skipped
+	CHECK(used.size() == sent.size());
+	CHECK(Increasing(used));
+	CHECK(buffer.Stats().intervalSkipped == 0);
+}
+
+static void TestAdaptation() {
+	//Jittery for a while, then steady again
+	InputJitterBuffer buffer;
+	std::mt19937 random(7);
+	const uint32_t jittery = 300;
+	std::vector<Sent> sent = Send(1500, [&](uint32_t i) { return i < jittery ? LATENCY + random() % 30 : LATENCY; });
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+	CHECK(Increasing(used));
+	CHECK(Accounted(buffer, steps) == sent.size());
+
+	//The delay goes up with the jitter, then comes back down without throwing more away than it saves
+	size_t steady = 0;
+	while (steady < steps.size() && steps[steady].sequence < jittery) steady++;
+	CHECK(steady < steps.size());
+	if (steady == steps.size()) return;
+	uint32_t jitteryDelay = steps[steady].delay;
+	uint32_t skipped = buffer.Stats().intervalSkipped - steps[steady].skipped;
+	CHECK(jitteryDelay > STEP_MS);
+	CHECK(jitteryDelay <= INPUT_MAX_EXTRA_DELAY);
+	CHECK(buffer.ExtraDelay() < 2);
+	CHECK(skipped <= jitteryDelay / STEP_MS + 1);
+	printf("Delay %ums with 0-30ms of jitter, %ums once steady, %u late, %u skipped catching up\n", jitteryDelay,
+		buffer.ExtraDelay(), buffer.Stats().intervalLate, skipped);
+}
+
+static void TestFaster() {
+	//A client sending twice a step falls behind, and has the oldest skipped rather than building up without end
+	InputJitterBuffer buffer;
+	std::vector<Sent> sent(400);
+	for (uint32_t i = 0; i < sent.size(); i++) {
+		sent[i].input = { CLIENT_START + i * STEP_MS / 2, i, { 0, 0, 0 }, 0, false };
+		sent[i].arrival = sent[i].input.time + LATENCY;
+	}
+	std::vector<Step> steps = Play(buffer, sent);
+	std::vector<uint32_t> used = Used(steps);
+
+	CHECK(Increasing(used));
+	CHECK(buffer.Stats().intervalSkipped > 0);
+	CHECK(buffer.Stats().intervalOverflowed == 0);
+	CHECK(Accounted(buffer, steps) == sent.size());
+	CHECK(buffer.Depth() == 0);
+}
+
+int main() {
+	TestSteady();
+	TestReorder();
+	TestLate();
+	TestUnderrun();
+	TestAdaptation();
+	TestFaster();
+	return TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+#include "Test.h"
+#include "InterestGrid.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+// Queries find exactly who a brute force search over every player does, the grid stays the size of the cells in use
+// however far players wander, and positions out of an int's reach or NaN don't break it. Then how long a snapshot
+// tick's rebuild and queries take.
+
+#define CELL_SIZE 15.0f
+#define RADIUS (CELL_SIZE * 1.25f)
+#define PLAYERS 256
+#define WORLD_SIZE 400.0f
+#define WANDER_TICKS 20000
+#define BENCHMARK_TICKS 2000
+
+struct TestPlayer {
+	int id;
+	float x;
+	float z;
+};
+
+static bool SameAsBruteForce(InterestGrid& grid, const std::vector<TestPlayer>& players, float x, float z) {
+	std::vector<InterestEntry> found;
+	grid.Query(x, z, RADIUS, found);
+	std::vector<int> gridIDs, bruteIDs;
+	for (InterestEntry& entry : found) gridIDs.push_back(entry.id);
+	for (const TestPlayer& player : players) {
+		float dx = player.x - x, dz = player.z - z;
+		if (dx * dx + dz * dz <= RADIUS * RADIUS) bruteIDs.push_back(player.id);
+	}
+	std::sort(gridIDs.begin(), gridIDs.end());
+	std::sort(bruteIDs.begin(), bruteIDs.end());
+	return gridIDs == bruteIDs;
+}
+
+static void Build(InterestGrid& grid, const std::vector<TestPlayer>& players) {
+	grid.Clear();
+	for (const TestPlayer& player : players) grid.Insert(player.id, player.x, player.z);
+}
+
+static void TestQueries() {
+	std::mt19937 random(4);
+	std::uniform_real_distribution<float> position(-WORLD_SIZE / 2, WORLD_SIZE / 2);
+	std::vector<TestPlayer> players;
+	for (int i = 0; i < PLAYERS; i++) players.push_back({ i, position(random), position(random) });
+	//Right on cell edges as well
+	players.push_back({ PLAYERS, CELL_SIZE, -CELL_SIZE });
+	players.push_back({ PLAYERS + 1, 0.0f, 0.0f });
+
+	InterestGrid grid(CELL_SIZE);
+	Build(grid, players);
+	bool same = true;
+	for (const TestPlayer& player : players) {
+		if (!SameAsBruteForce(grid, players, player.x, player.z)) same = false;
+	}
+	for (int i = 0; i < 1000; i++) {
+		if (!SameAsBruteForce(grid, players, position(random), position(random))) same = false;
+	}
+	CHECK(same);
+}
+
+// Everyone walks off in their own direction for a long time, so almost every tick puts them in cells never used before
+static void TestWandering() {
+	std::mt19937 random(8);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<TestPlayer> players;
+	std::vector<float> velocityX, velocityZ;
+	for (int i = 0; i < PLAYERS; i++) {
+		players.push_back({ i, unit(random) * WORLD_SIZE, unit(random) * WORLD_SIZE });
+		velocityX.push_back(unit(random) * 5.0f);
+		velocityZ.push_back(unit(random) * 5.0f);
+	}
+
+	InterestGrid grid(CELL_SIZE);
+	size_t mostCells = 0;
+	bool same = true;
+	for (int tick = 0; tick < WANDER_TICKS; tick++) {
+		for (int i = 0; i < PLAYERS; i++) {
+			players[i].x += velocityX[i];
+			players[i].z += velocityZ[i];
+		}
+		Build(grid, players);
+		mostCells = std::max(mostCells, grid.CellCount());
+		if (tick % 1000 == 0 && !SameAsBruteForce(grid, players, players[0].x, players[0].z)) same = false;
+	}
+	CHECK(same);
+	//Those used by this build and the one before at most
+	CHECK(mostCells <= 2 * PLAYERS);
+	printf("%d players wandering for %d ticks: at most %zu cells held\n", PLAYERS, WANDER_TICKS, mostCells);
+}
+
+static void TestOutOfRange() {
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const float infinity = std::numeric_limits<float>::infinity();
+	std::vector<TestPlayer> players = {
+		{ 0, 0.0f, 0.0f },
+		{ 1, 5.0f, 5.0f },
+		{ 2, nan, 0.0f },
+		{ 3, 0.0f, nan },
+		{ 4, infinity, -infinity },
+		{ 5, 1e30f, 1e30f },
+		{ 6, -1e30f, 3e9f },
+		{ 7, 1e30f, 1e30f },
+	};
+	InterestGrid grid(CELL_SIZE);
+	Build(grid, players);
+
+	//The sane players still find each other and nothing else
+	std::vector<InterestEntry> found;
+	grid.Query(0.0f, 0.0f, RADIUS, found);
+	CHECK(found.size() == 2);
+
+	//Far out players share the edge cell, but are only found by a query near them
+	found.clear();
+	grid.Query(1e30f, 1e30f, RADIUS, found);
+	CHECK(found.size() == 2);
+
+	//NaN and infinite queries look in an edge cell and find nobody, as no distance to them is in range
+	found.clear();
+	grid.Query(nan, nan, RADIUS, found);
+	grid.Query(infinity, 0.0f, RADIUS, found);
+	grid.Query(-infinity, nan, RADIUS, found);
+	CHECK(found.empty());
+	Build(grid, players);
+	CHECK(grid.CellCount() <= players.size());
+}
+
+static void BenchmarkTick() {
+	std::mt19937 random(2);
+	std::uniform_real_distribution<float> position(-WORLD_SIZE / 2, WORLD_SIZE / 2);
+	std::vector<TestPlayer> players;
+	for (int i = 0; i < PLAYERS; i++) players.push_back({ i, position(random), position(random) });
+
+	//A rebuild and a query for everyone, as CreateSnapshotsUDP does
+	InterestGrid grid(CELL_SIZE);
+	std::vector<InterestEntry> found;
+	size_t totalFound = 0;
+	double start = Test::Now();
+	for (int tick = 0; tick < BENCHMARK_TICKS; tick++) {
+		for (TestPlayer& player : players) player.x += tick % 2 ? 0.1f : -0.1f;
+		Build(grid, players);
+		for (TestPlayer& player : players) {
+			found.clear();
+			grid.Query(player.x, player.z, RADIUS, found);
+			totalFound += found.size();
+		}
+	}
+	double elapsed = Test::Now() - start;
+	printf("%d players: %.1fus a tick to rebuild and query, %.1f found each\n", PLAYERS, elapsed / BENCHMARK_TICKS * 1e6,
+		(double)totalFound / BENCHMARK_TICKS / PLAYERS);
+}
+
+int main() {
+	TestQueries();
+	TestWandering();
+	TestOutOfRange();
+	BenchmarkTick();
+	return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+#include "Test.h"
+#include "InterpolationBuffer.h"
+#include <cmath>
+
+// Sampling goes through every sample exactly, follows steady movement and a jump's arc between them without cutting
+// the corner, and doesn't jump at a sample. Old and repeated samples are ignored, only the newest
+// INTERPOLATION_SAMPLES are kept, past the newest it's carried on only so far, rotation turns the short way round,
+// and all of that still holds when server time wraps round.
+
+#define SNAPSHOT_INTERVAL 125 // ms, the server's 8 a second
+#define GRAVITY 9.81f
+
+static PlayerValues Values(float x, float y, float z, float vx, float vy, float vz, float rotation) {
+	PlayerValues values;
+	values.position = { x, y, z };
+	values.velocity = { vx, vy, vz };
+	values.rotation = rotation;
+	return values;
+}
+
+// Running along x at 3m/s and jumping at 7m/s every second, from start (ms)
+static PlayerValues Jumping(uint32_t start, uint32_t time) {
+	float seconds = (time - start) / 1000.0f;
+	float air = std::fmod(seconds, 1.0f);
+	float y = air < 7.0f * 2 / GRAVITY ? 7.0f * air - GRAVITY * air * air / 2 : 0.0f;
+	float vy = air < 7.0f * 2 / GRAVITY ? 7.0f - GRAVITY * air : 0.0f;
+	return Values(3.0f * seconds, y, 1.0f, 3.0f, vy, 0.0f, 0.0f);
+}
+
+static void TestEmptyAndOne() {
+	InterpolationBuffer buffer;
+	physx::PxVec3 position;
+	float rotation;
+	CHECK(buffer.Empty());
+	CHECK(!buffer.Sample(1000, position, rotation));
+
+	buffer.Add(1000, Values(1, 2, 3, 4, 0, 0, 0.5f));
+	CHECK(!buffer.Empty());
+	CHECK(buffer.Sample(1000, position, rotation) && position == physx::PxVec3(1, 2, 3) && rotation == 0.5f);
+	CHECK(buffer.Sample(500, position, rotation) && position == physx::PxVec3(1, 2, 3)); //Before it, so it
+	//After it, carried on along its velocity, but only so far
+	CHECK(buffer.Sample(1050, position, rotation));
+	CHECK_NEAR(position.x, 1 + 4 * 0.05f, 1e-5);
+	CHECK(buffer.Sample(1000 + INTERPOLATION_MAX_EXTRAPOLATION * 4, position, rotation));
+	CHECK_NEAR(position.x, 1 + 4 * INTERPOLATION_MAX_EXTRAPOLATION / 1000.0f, 1e-5);
+
+	buffer.Clear();
+	CHECK(buffer.Empty());
+	CHECK(!buffer.Sample(1000, position, rotation));
+}
+
+static void TestOrderAndRing() {
+	InterpolationBuffer buffer;
+	physx::PxVec3 position;
+	float rotation;
+	buffer.Add(1000, Values(1, 0, 0, 0, 0, 0, 0));
+	buffer.Add(1000, Values(9, 0, 0, 0, 0, 0, 0)); //A repeat
+	buffer.Add(900, Values(9, 0, 0, 0, 0, 0, 0));  //Older
+	CHECK(buffer.Sample(1000, position, rotation) && position.x == 1.0f);
+
+	//Only the newest are kept, so before them is the oldest still there
+	InterpolationBuffer ring;
+	int added = INTERPOLATION_SAMPLES + 5;
+	for (int i = 0; i < added; i++) ring.Add(1000 + i * SNAPSHOT_INTERVAL, Values((float)i, 0, 0, 0, 0, 0, 0));
+	int oldest = added - INTERPOLATION_SAMPLES;
+	CHECK(ring.Sample(1000, position, rotation) && position.x == (float)oldest);
+	CHECK(ring.Sample(1000 + oldest * SNAPSHOT_INTERVAL, position, rotation) && position.x == (float)oldest);
+	bool exact = true;
+	for (int i = oldest; i < added; i++) {
+		if (!ring.Sample(1000 + i * SNAPSHOT_INTERVAL, position, rotation) || position.x != (float)i) exact = false;
+	}
+	CHECK(exact);
+}
+
+// Hermite through positions and velocities is exact for anything moving at most quadratically, so running and
+// jumping come out as they really were. Straight lines between the samples cut under the arc.
+static void TestCurve(uint32_t start) {
+	InterpolationBuffer buffer;
+	for (int i = 0; i < INTERPOLATION_SAMPLES; i++) {
+		uint32_t time = start + i * SNAPSHOT_INTERVAL;
+		buffer.Add(time, Jumping(start, time));
+	}
+
+	physx::PxVec3 position, previous;
+	float rotation, worst = 0, worstLinear = 0, biggestStep = 0;
+	uint32_t span = (INTERPOLATION_SAMPLES - 1) * SNAPSHOT_INTERVAL;
+	for (uint32_t ms = 0; ms <= span; ms++) {
+		uint32_t time = start + ms;
+		if (!buffer.Sample(time, position, rotation)) continue;
+		PlayerValues truth = Jumping(start, time);
+		//Only within one leg of the arc, where there's no landing between the samples to smooth over
+		uint32_t leg = ms / SNAPSHOT_INTERVAL;
+		PlayerValues before = Jumping(start, start + leg * SNAPSHOT_INTERVAL);
+		PlayerValues after = Jumping(start, start + (leg + 1) * SNAPSHOT_INTERVAL);
+		float airStart = std::fmod(leg * SNAPSHOT_INTERVAL / 1000.0f, 1.0f);
+		bool inAir = airStart + SNAPSHOT_INTERVAL / 1000.0f < 7.0f * 2 / GRAVITY;
+		if (inAir) {
+			float error = (position - physx::PxVec3(truth.position[0], truth.position[1], truth.position[2])).magnitude();
+			worst = std::fmax(worst, error);
+			float t = (ms % SNAPSHOT_INTERVAL) / (float)SNAPSHOT_INTERVAL;
+			float linear = before.position[1] + (after.position[1] - before.position[1]) * t;
+			worstLinear = std::fmax(worstLinear, std::fabs(linear - truth.position[1]));
+		}
+		if (ms > 0) biggestStep = std::fmax(biggestStep, (position - previous).magnitude());
+		previous = position;
+	}
+	CHECK(worst < 1e-3f);
+	CHECK(worstLinear > 0.01f);
+	//No more than a ms of running and jumping at a time, so no jump at the samples
+	CHECK(biggestStep < 0.02f);
+	printf("Start %u: %.5fm from the real arc at worst, straight lines %.4fm, %.4fm the most it moved in a ms\n", start,
+		worst, worstLinear, biggestStep);
+}
+
+static void TestRotation() {
+	InterpolationBuffer buffer;
+	physx::PxVec3 position;
+	float rotation;
+	buffer.Add(1000, Values(0, 0, 0, 0, 0, 0, 2 * physx::PxPi - 0.2f));
+	buffer.Add(1100, Values(0, 0, 0, 0, 0, 0, 0.2f));
+	buffer.Add(1200, Values(0, 0, 0, 0, 0, 0, 0.6f));
+	CHECK(buffer.Sample(1050, position, rotation));
+	CHECK_NEAR(std::fmod(rotation + 2 * physx::PxPi, 2 * physx::PxPi), 0.0, 1e-4);
+	CHECK(buffer.Sample(1150, position, rotation));
+	CHECK_NEAR(rotation, 0.4, 1e-5);
+	//Held at the newest's past it
+	CHECK(buffer.Sample(1300, position, rotation) && rotation == 0.6f);
+}
+
+int main() {
+	TestEmptyAndOne();
+	TestOrderAndRing();
+	TestCurve(1000);
+	TestCurve(0xFFFFFFFFu - 400); //Server time wrapping in the middle
+	TestRotation();
+	return TEST_RESULT();
+}
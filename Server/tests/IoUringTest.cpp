@@ -0,0 +1,83 @@
+#include "Test.h"
+#include "IoUring.h"
+#include "Sockets.h"
+#include <sys/utsname.h>
+#include <cstring>
+
+// The multishot support check against the running kernel, then a multishot receive through a provided buffer ring,
+// which is what the server's io_uring backend relies on.
+
+#define BUFFERS 8
+#define BUFFER_SIZE 256
+
+static bool KernelAtLeast(int major, int minor) {
+	utsname name;
+	if (uname(&name) != 0) return false;
+	int haveMajor = 0, haveMinor = 0;
+	sscanf(name.release, "%d.%d", &haveMajor, &haveMinor);
+	return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+}
+
+static void TestMultishotReceive() {
+	IoUring ring;
+	CHECK(ring.Init(8));
+	static char buffers[BUFFERS * BUFFER_SIZE];
+	CHECK(ring.RegisterBufferRing(0, buffers, BUFFERS, BUFFER_SIZE));
+
+	SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	bind(sock, (sockaddr*)&address, sizeof(address));
+	getsockname(sock, (sockaddr*)&address, &length);
+
+	msghdr msg = {};
+	msg.msg_namelen = sizeof(sockaddr_in);
+	io_uring_sqe* sqe = ring.GetSqe();
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)(uintptr_t)&msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = 1;
+	CHECK(ring.Submit() == 1);
+
+	//More datagrams than buffers, handing each back as it's used, all from the one armed receive
+	const int count = 3 * BUFFERS;
+	int received = 0;
+	for (int i = 0; i < count; i++) {
+		char data[4];
+		memcpy(data, &i, sizeof(i));
+		sendto(sock, data, sizeof(data), 0, (sockaddr*)&address, sizeof(address));
+		CHECK(ring.Submit(1) >= 0);
+		while (io_uring_cqe* cqe = ring.PeekCqe()) {
+			CHECK(cqe->res >= 0);
+			CHECK(cqe->flags & IORING_CQE_F_MORE);
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				uint16_t bufferID = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)ring.GetBuffer(bufferID);
+				const char* payload = ring.GetBuffer(bufferID) + sizeof(io_uring_recvmsg_out) + out->namelen;
+				int value;
+				memcpy(&value, payload, sizeof(value));
+				CHECK(out->payloadlen == sizeof(value) && value == received);
+				ring.RecycleBuffer(bufferID);
+				received++;
+			}
+			ring.SeenCqe();
+		}
+	}
+	CHECK(received == count);
+	closesocket(sock);
+}
+
+int main() {
+	bool supported = IoUring::SupportsMultishotReceive();
+	printf("Multishot receive %s on this kernel\n", supported ? "supported" : "unsupported");
+	//io_uring can also be switched off (or blocked in a container), so only support is checked against the version
+	CHECK(!supported || KernelAtLeast(6, 0));
+	if (supported) TestMultishotReceive();
+	return TEST_RESULT();
+}
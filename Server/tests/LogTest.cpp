@@ -0,0 +1,186 @@
+#include "Test.h"
+#include "Log.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records from each thread come out whole and in the order they were logged, with their level, category and a copy
+// of any string. A thread that logs faster than they can be printed has the rest dropped rather than being held up,
+// and the drops are reported after what did get through. Whatever's still waiting when the program exits is printed.
+
+#define ORDER_THREADS 4
+#define ORDER_RECORDS 500 // Each, under LOG_RING_RECORDS so none are dropped
+#define FLOOD_RECORDS 20000 // Far more than a ring and a blocked pipe can hold
+#define EXIT_RECORDS 300
+
+// Everything written to a pipe, read on another thread so the logger can't block on it
+class Capture {
+public:
+	Capture() {
+		CHECK(pipe(fds_) == 0);
+		out_ = fdopen(fds_[1], "w");
+	}
+
+	void Start() {
+		reader_ = std::thread([this]() {
+			char buffer[4096];
+			ssize_t count;
+			while ((count = read(fds_[0], buffer, sizeof(buffer))) > 0) text_.append(buffer, count);
+		});
+	}
+
+	// Close the write end and wait for the reader to get everything
+	std::string Finish() {
+		fclose(out_);
+		if (reader_.joinable()) reader_.join();
+		close(fds_[0]);
+		return text_;
+	}
+
+	FILE* Out() { return out_; }
+
+private:
+	int fds_[2];
+	FILE* out_;
+	std::thread reader_;
+	std::string text_;
+};
+
+static std::vector<std::string> Lines(const std::string& text) {
+	std::vector<std::string> lines;
+	size_t start = 0, end;
+	while ((end = text.find('\n', start)) != std::string::npos) {
+		lines.push_back(text.substr(start, end - start));
+		start = end + 1;
+	}
+	return lines;
+}
+
+// Numbers of the records logged by a thread as "<thread> record <n>", in the order they were printed
+static std::vector<int> Records(const std::vector<std::string>& lines, int thread) {
+	std::vector<int> records;
+	std::string prefix = std::to_string(thread) + " record ";
+	for (const std::string& line : lines) {
+		size_t at = line.find(prefix);
+		if (at != std::string::npos) records.push_back(atoi(line.c_str() + at + prefix.size()));
+	}
+	return records;
+}
+
+static uint64_t Dropped(const std::vector<std::string>& lines) {
+	uint64_t dropped = 0;
+	for (const std::string& line : lines) {
+		size_t at = line.find(" log records dropped");
+		if (at == std::string::npos) continue;
+		size_t start = line.rfind(' ', at - 1) + 1;
+		dropped += strtoull(line.c_str() + start, nullptr, 10);
+	}
+	return dropped;
+}
+
+// Run in a child process before this one's logged anything, so it starts with no printing thread of its own
+static void TestExit() {
+	int fds[2];
+	CHECK(pipe(fds) == 0);
+	pid_t child = fork();
+	if (child == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		for (int i = 0; i < EXIT_RECORDS; i++) LOG_INFO(LOG_GENERAL, "%d record %d\n", 0, i);
+		exit(0); //Straight away, with most of them still in the ring
+	}
+	close(fds[1]);
+	std::string text;
+	char buffer[4096];
+	ssize_t count;
+	while ((count = read(fds[0], buffer, sizeof(buffer))) > 0) text.append(buffer, count);
+	close(fds[0]);
+	int status = 0;
+	waitpid(child, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	std::vector<int> records = Records(Lines(text), 0);
+	bool all = records.size() == EXIT_RECORDS;
+	for (size_t i = 0; all && i < records.size(); i++) all = records[i] == (int)i;
+	CHECK(all);
+}
+
+static void TestOrder() {
+	Capture capture;
+	capture.Start();
+	Log::SetOutput(capture.Out());
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < ORDER_THREADS; t++) {
+		threads.emplace_back([t]() {
+			for (int i = 0; i < ORDER_RECORDS; i++) LOG_WARNING(LOG_TCP, "%d record %d\n", t, i);
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+	//Copied when logged, so it doesn't matter that it's gone by the time it's printed
+	{
+		std::string temporary = "gone " + std::string(200, 'x');
+		LOG_ERROR(LOG_UDP, "string %s\n", temporary.c_str());
+	}
+	Log::Flush();
+	Log::SetOutput(stdout);
+	std::vector<std::string> lines = Lines(capture.Finish());
+
+	bool inOrder = true;
+	for (int t = 0; t < ORDER_THREADS; t++) {
+		std::vector<int> records = Records(lines, t);
+		if (records.size() != ORDER_RECORDS) inOrder = false;
+		for (size_t i = 0; inOrder && i < records.size(); i++) inOrder = records[i] == (int)i;
+	}
+	CHECK(inOrder);
+	CHECK(Dropped(lines) == 0);
+	bool tagged = true, copied = false;
+	for (const std::string& line : lines) {
+		if (line.find(" record ") != std::string::npos) tagged = tagged && line.find(" WARN  TCP  ") != std::string::npos;
+		//Long strings cut to fit
+		if (line.find(" ERROR UDP  string gone " + std::string(LOG_STRING_SIZE - 6, 'x')) != std::string::npos &&
+			line.find(std::string(LOG_STRING_SIZE - 5, 'x')) == std::string::npos) copied = true;
+	}
+	CHECK(tagged);
+	CHECK(copied);
+}
+
+static void TestFull() {
+	//Nothing reads the pipe until the flood's over, so the printing thread blocks once it's full and the ring fills up
+	Capture capture;
+	Log::SetOutput(capture.Out());
+	double start = Test::Now();
+	std::thread flood([]() {
+		for (int i = 0; i < FLOOD_RECORDS; i++) LOG_INFO(LOG_GAME, "%d record %d\n", 1, i);
+	});
+	flood.join();
+	double elapsed = Test::Now() - start;
+	capture.Start();
+	Log::Flush();
+	Log::SetOutput(stdout);
+	std::vector<std::string> lines = Lines(capture.Finish());
+
+	//What got through is in order with gaps, and everything else is reported dropped
+	std::vector<int> records = Records(lines, 1);
+	bool increasing = true;
+	for (size_t i = 1; i < records.size(); i++) increasing = increasing && records[i] > records[i - 1];
+	uint64_t dropped = Dropped(lines);
+	CHECK(increasing);
+	CHECK(records.size() >= LOG_RING_RECORDS);
+	CHECK(dropped > 0);
+	CHECK(records.size() + dropped == FLOOD_RECORDS);
+	//Never waited on the printing thread
+	CHECK(elapsed < 1.0);
+	printf("%d records logged in %.2fms with the output blocked, %zu printed, %llu dropped\n", FLOOD_RECORDS, elapsed * 1000,
+		records.size(), (unsigned long long)dropped);
+}
+
+int main() {
+	TestExit();
+	TestOrder();
+	TestFull();
+	return TEST_RESULT();
+}
@@ -0,0 +1,162 @@
+#include "Test.h"
+#include "PredictionBuffer.h"
+#include "PlayerMovement.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Acknowledgements only move forward and only for inputs already sent, errors within PREDICTION_TOLERANCE don't
+// replay and bigger ones do, and inputs the server never gets to fall out of the ring without being replayed. Then a
+// client and server played out step by step, with the inputs and snapshots between them held up and reordered and the
+// server now and then shoving the player somewhere the client can't predict. The client has to replay once for each
+// shove and end up where the server has it.
+
+#define STEP_SIZE (1.0f / 60.0f)
+#define RUN_STEPS 3000
+#define SHOVE_EVERY 300
+#define INPUT_DELAY 3 // Steps for an input to reach the server and come out of its jitter buffer
+
+// One input's worth of movement, as ApplyPlayerInput sets it going, without the physics scene
+static physx::PxVec3 Move(const physx::PxVec3& position, const InputUpdateMessage& input) {
+	physx::PxVec3 velocity(input.velocity[0], 0, input.velocity[1]);
+	velocity.normalize();
+	return position + velocity * PLAYER_SPEED * STEP_SIZE;
+}
+
+static void Predict(PredictionBuffer& buffer, float x) {
+	InputUpdateMessage& input = buffer.Add();
+	input.velocity[0] = 1;
+	input.velocity[1] = 0;
+	buffer.SetPosition(input.sequence, physx::PxVec3(x, 0, 0));
+}
+
+static void TestAcknowledge() {
+	PredictionBuffer buffer;
+	CHECK(buffer.Latest() == 0 && buffer.Acknowledged() == 0);
+	CHECK(!buffer.Get(0));
+	CHECK(!buffer.Acknowledge(1, physx::PxVec3(0, 0, 0))); //Nothing sent yet
+	for (int i = 1; i <= 10; i++) Predict(buffer, (float)i);
+	CHECK(buffer.Latest() == 10);
+	CHECK(buffer.Get(7) && buffer.Get(7)->position.x == 7.0f);
+
+	CHECK(!buffer.Acknowledge(5, physx::PxVec3(5, 0, 0)));
+	CHECK(buffer.Acknowledged() == 5);
+	//Old, repeated and not yet sent are all ignored, even if they disagree
+	CHECK(!buffer.Acknowledge(5, physx::PxVec3(50, 0, 0)));
+	CHECK(!buffer.Acknowledge(3, physx::PxVec3(50, 0, 0)));
+	CHECK(!buffer.Acknowledge(11, physx::PxVec3(50, 0, 0)));
+	CHECK(buffer.Acknowledged() == 5);
+	CHECK(buffer.Replays() == 0);
+
+	//Just inside the tolerance is agreement, just outside needs a replay
+	CHECK(!buffer.Acknowledge(6, physx::PxVec3(6 + PREDICTION_TOLERANCE * 0.9f, 0, 0)));
+	CHECK(buffer.Acknowledge(7, physx::PxVec3(7, PREDICTION_TOLERANCE * 1.5f, 0)));
+	CHECK(buffer.Acknowledged() == 7);
+	CHECK(buffer.Replays() == 1);
+	CHECK_NEAR(buffer.MaxError(), PREDICTION_TOLERANCE * 1.5f, 1e-5);
+	CHECK(buffer.Acknowledge(10, physx::PxVec3(0, 0, 0)));
+	CHECK(buffer.Replays() == 2);
+}
+
+static void TestOverflow() {
+	PredictionBuffer buffer;
+	int sent = PREDICTION_BUFFER_SIZE + 20;
+	for (int i = 1; i <= sent; i++) Predict(buffer, (float)i);
+	//The oldest are forgotten as if they'd been acknowledged, so only what's left in the ring is ever replayed
+	CHECK(buffer.Acknowledged() == (uint32_t)(sent - PREDICTION_BUFFER_SIZE));
+	CHECK(!buffer.Get(buffer.Acknowledged()));
+	CHECK(!buffer.Get(1));
+	bool all = true;
+	for (uint32_t sequence = buffer.Acknowledged() + 1; sequence <= buffer.Latest(); sequence++) {
+		if (!buffer.Get(sequence) || buffer.Get(sequence)->position.x != (float)sequence) all = false;
+	}
+	CHECK(all);
+	CHECK(!buffer.Acknowledge(20, physx::PxVec3(0, 0, 0)));
+	buffer.SetPosition(1, physx::PxVec3(-1, 0, 0)); //Gone, so it mustn't land on whatever has its slot now
+	CHECK(buffer.Get(1 + PREDICTION_BUFFER_SIZE)->position.x == (float)(1 + PREDICTION_BUFFER_SIZE));
+	CHECK(!buffer.Acknowledge(buffer.Latest(), physx::PxVec3((float)buffer.Latest(), 0, 0)));
+}
+
+struct Snapshot {
+	int arrival;
+	uint32_t sequence;
+	physx::PxVec3 position;
+};
+
+// Snapshots take snapshotDelay steps to arrive, give or take jitter
+static void TestReplay(int snapshotDelay, int jitter) {
+	std::mt19937 random(snapshotDelay * 31 + jitter);
+	std::uniform_int_distribution<int> late(0, jitter);
+	PredictionBuffer buffer;
+	physx::PxVec3 client(0, 0, 0), server(0, 0, 0);
+	std::vector<InputUpdateMessage> sentInputs;
+	std::vector<Snapshot> inFlight;
+	uint32_t serverSequence = 0, newest = 0;
+	int shoves = 0, outOfOrder = 0;
+
+	for (int step = 1; step <= RUN_STEPS + INPUT_DELAY + snapshotDelay + jitter + 1; step++) {
+		//Snapshots that have arrived, in the order they arrived
+		std::stable_sort(inFlight.begin(), inFlight.end(), [](const Snapshot& a, const Snapshot& b) { return a.arrival < b.arrival; });
+		while (!inFlight.empty() && inFlight.front().arrival <= step) {
+			Snapshot snapshot = inFlight.front();
+			inFlight.erase(inFlight.begin());
+			if (snapshot.sequence < newest) outOfOrder++;
+			newest = std::max(newest, snapshot.sequence);
+			if (!buffer.Acknowledge(snapshot.sequence, snapshot.position)) continue;
+			//As reconcileMyPlayer does
+			client = snapshot.position;
+			for (uint32_t sequence = buffer.Acknowledged() + 1; sequence <= buffer.Latest(); sequence++) {
+				PredictedInput* predicted = buffer.Get(sequence);
+				if (!predicted) continue;
+				client = Move(client, predicted->input);
+				predicted->position = client;
+			}
+		}
+
+		//The client's step, turning now and then
+		if (step <= RUN_STEPS) {
+			InputUpdateMessage& input = buffer.Add();
+			float angle = (step / 45) * 0.7f;
+			input.velocity[0] = std::cos(angle);
+			input.velocity[1] = step % 200 < 20 ? 0 : std::sin(angle);
+			if (step % 500 < 30) input.velocity[0] = input.velocity[1] = 0; //Standing still
+			client = Move(client, input);
+			buffer.SetPosition(input.sequence, client);
+			sentInputs.push_back(input);
+		}
+
+		//The server's step, with whatever inputs have got there
+		bool stepped = false;
+		while (serverSequence < sentInputs.size() && (int)serverSequence + 1 + INPUT_DELAY <= step) {
+			server = Move(server, sentInputs[serverSequence]);
+			serverSequence++;
+			if (serverSequence % SHOVE_EVERY == 0) {
+				server += physx::PxVec3(0.5f, 0, -0.25f);
+				shoves++;
+			}
+			stepped = true;
+		}
+		if (stepped) inFlight.push_back({ step + snapshotDelay + late(random), serverSequence, server });
+	}
+
+	CHECK(inFlight.empty() && serverSequence == RUN_STEPS);
+	CHECK(buffer.Acknowledged() == RUN_STEPS);
+	//Once for each shove and no more, after which the prediction is back where the server has it
+	CHECK(buffer.Replays() == (uint32_t)shoves);
+	CHECK((client - server).magnitude() <= PREDICTION_TOLERANCE);
+	CHECK(buffer.MaxError() < 1.0f);
+	if (jitter) CHECK(outOfOrder > 0);
+	printf("Snapshots %d+%d steps late: %d shoves, %u replays, %d snapshots out of order, %.4fm off at the end\n",
+		snapshotDelay, jitter, shoves, buffer.Replays(), outOfOrder, (client - server).magnitude());
+}
+
+int main() {
+	TestAcknowledge();
+	TestOverflow();
+	TestReplay(1, 0);
+	TestReplay(6, 4);
+	TestReplay(30, 10);
+	TestReplay(PREDICTION_BUFFER_SIZE - INPUT_DELAY - 20, 15);
+	return TEST_RESULT();
+}
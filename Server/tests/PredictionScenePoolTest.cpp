@@ -0,0 +1,70 @@
+#include "Test.h"
+#include "PredictionScenePool.h"
+#include "Log.h"
+
+// Every scene can be leased once until it's given back, then there's none, and returning one that isn't out (twice,
+// or one from elsewhere) changes nothing. The pool never touches the scenes themselves outside Init and CleanUp, so
+// stand ins that are never dereferenced do here, without the PhysX SDK.
+
+static void TestLeases() {
+	char standIns[PREDICTION_SCENE_POOL_SIZE];
+	physx::PxScene* scenes[PREDICTION_SCENE_POOL_SIZE];
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) scenes[i] = reinterpret_cast<physx::PxScene*>(&standIns[i]);
+	PredictionScenePool pool;
+	pool.Init(scenes);
+	CHECK(pool.PeakLeased() == 0);
+
+	//Each one once
+	physx::PxScene* leased[PREDICTION_SCENE_POOL_SIZE];
+	bool distinct = true;
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) {
+		leased[i] = pool.Lease();
+		if (!leased[i]) distinct = false;
+		for (size_t j = 0; j < i; j++) {
+			if (leased[j] == leased[i]) distinct = false;
+		}
+	}
+	CHECK(distinct);
+	CHECK(!pool.Lease());
+	CHECK(pool.PeakLeased() == PREDICTION_SCENE_POOL_SIZE);
+
+	//Back and out again
+	pool.Return(leased[0]);
+	CHECK(pool.Lease() == leased[0]);
+	CHECK(!pool.Lease());
+
+	//Returning one twice, or one that was never the pool's, doesn't free anything else up
+	char elsewhere;
+	pool.Return(reinterpret_cast<physx::PxScene*>(&elsewhere));
+	pool.Return(nullptr);
+	CHECK(!pool.Lease());
+	pool.Return(leased[1]);
+	pool.Return(leased[1]);
+	CHECK(pool.Lease() == leased[1]);
+	CHECK(!pool.Lease());
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) pool.Return(leased[i]);
+	for (size_t i = 0; i < PREDICTION_SCENE_POOL_SIZE; i++) CHECK(pool.Lease());
+	CHECK(pool.PeakLeased() == PREDICTION_SCENE_POOL_SIZE);
+}
+
+static void TestMissing() {
+	//A scene that couldn't be made is never handed out
+	char standIn;
+	physx::PxScene* scenes[PREDICTION_SCENE_POOL_SIZE] = {};
+	scenes[PREDICTION_SCENE_POOL_SIZE - 1] = reinterpret_cast<physx::PxScene*>(&standIn);
+	PredictionScenePool pool;
+	pool.Init(scenes);
+	CHECK(pool.Lease() == scenes[PREDICTION_SCENE_POOL_SIZE - 1]);
+	CHECK(!pool.Lease());
+	CHECK(pool.PeakLeased() == 1);
+
+	PredictionScenePool empty;
+	CHECK(!empty.Lease()); //Before Init
+}
+
+int main() {
+	Log::SetCategories(0);
+	TestLeases();
+	TestMissing();
+	return TEST_RESULT();
+}
@@ -0,0 +1,114 @@
+#include "Test.h"
+#include "RateLimiter.h"
+#include <random>
+#include <vector>
+
+// A bucket lets through its burst straight away, then exactly its rate however the time is sliced, never saves up more
+// than its burst, and copes with the clock going back or wrapping. Per source, addresses are limited apart from each
+// other whatever port they use, and a slot taken over by another address starts afresh. Then how long a Take costs,
+// from one steady sender and from a flood of spoofed addresses.
+
+#define BENCHMARK_TAKES 10000000
+
+static sockaddr_in Address(uint32_t ip, uint16_t port) {
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(ip);
+	address.sin_port = htons(port);
+	return address;
+}
+
+static int TakeAll(TokenBucket& bucket, uint32_t now, uint32_t rate, uint32_t burst) {
+	int taken = 0;
+	while (bucket.Take(now, rate, burst)) taken++;
+	return taken;
+}
+
+static void TestBucket() {
+	//Starts full
+	TokenBucket bucket;
+	CHECK(TakeAll(bucket, 1000, 16, 32) == 32);
+	CHECK(!bucket.Take(1000, 16, 32));
+
+	//16 a second is a token every 62.5ms
+	CHECK(!bucket.Take(1062, 16, 32));
+	CHECK(bucket.Take(1063, 16, 32));
+	CHECK(!bucket.Take(1063, 16, 32));
+
+	//Never more than the burst, however long it's left
+	CHECK(TakeAll(bucket, 1000000, 16, 32) == 32);
+
+	//Exactly the rate, whether it's asked every ms or now and then
+	TokenBucket often, seldom;
+	int oftenTaken = 0, seldomTaken = 0;
+	for (uint32_t now = 0; now < 10000; now++) {
+		if (often.Take(now, 600, 300)) oftenTaken++;
+		if (now % 97 == 0) seldomTaken += TakeAll(seldom, now, 600, 300);
+	}
+	seldomTaken += TakeAll(seldom, 10000, 600, 300);
+	CHECK(oftenTaken == 300 + 600 * 10 - 1); //The last ms's token isn't in until 10000
+	CHECK(seldomTaken == 300 + 600 * 10);
+
+	//The clock going back a little (another ingress thread's a tick behind) doesn't refill or break it
+	TokenBucket behind;
+	CHECK(TakeAll(behind, 5000, 1000, 10) == 10);
+	CHECK(!behind.Take(4990, 1000, 10));
+	CHECK(!behind.Take(5000, 1000, 10));
+	CHECK(behind.Take(5001, 1000, 10));
+
+	//Or wrapping round
+	TokenBucket wrapping;
+	CHECK(TakeAll(wrapping, 0xFFFFFFF0u, 1000, 10) == 10);
+	CHECK(TakeAll(wrapping, 4, 1000, 10) == 10); //20ms later, capped at the burst
+	CHECK(TakeAll(wrapping, 9, 1000, 10) == 5);
+}
+
+static void TestSources() {
+	SourceRateLimiter limiter;
+	sockaddr_in a = Address(0x0A000001, 1000), b = Address(0x0A000002, 1000);
+	int taken = 0;
+	while (limiter.Take(a, 1000, 16, 32)) taken++;
+	CHECK(taken == 32);
+	//Another address has its own bucket, another port on the same one doesn't
+	CHECK(limiter.Take(b, 1000, 16, 32));
+	CHECK(!limiter.Take(Address(0x0A000001, 2000), 1000, 16, 32));
+	CHECK(limiter.Take(a, 1063, 16, 32));
+	CHECK(!limiter.Take(a, 1063, 16, 32));
+
+	//Enough other addresses that one lands on a's slot, after which a starts again with a full bucket
+	for (uint32_t ip = 0x0B000000; ip < 0x0B000000 + SOURCE_RATE_BUCKETS * 32; ip++) limiter.Take(Address(ip, 1), 1063, 16, 32);
+	taken = 0;
+	while (limiter.Take(a, 1063, 16, 32)) taken++;
+	CHECK(taken == 32);
+}
+
+static void Benchmark() {
+	//One address sending all the time, so always the same slot and nearly always over
+	SourceRateLimiter* limiter = new SourceRateLimiter();
+	sockaddr_in steady = Address(0x0A000001, 1000);
+	uint64_t allowed = 0;
+	double start = Test::Now();
+	for (int i = 0; i < BENCHMARK_TAKES; i++) allowed += limiter->Take(steady, i / 1000, 16, 32);
+	double steadyTime = Test::Now() - start;
+
+	//Every datagram from a different random address, so a slot miss and a fresh bucket nearly every time
+	std::mt19937 random(5);
+	std::vector<sockaddr_in> spoofed(1 << 16);
+	for (sockaddr_in& address : spoofed) address = Address(random(), (uint16_t)random());
+	uint64_t spoofedAllowed = 0;
+	start = Test::Now();
+	for (int i = 0; i < BENCHMARK_TAKES; i++) spoofedAllowed += limiter->Take(spoofed[i & (spoofed.size() - 1)], i / 1000, 16, 32);
+	double spoofedTime = Test::Now() - start;
+	delete limiter;
+
+	printf("One address: %.1fns a take, %llu of %d let through\n", steadyTime / BENCHMARK_TAKES * 1e9, (unsigned long long)allowed, BENCHMARK_TAKES);
+	printf("Spoofed addresses: %.1fns a take, %llu of %d let through\n", spoofedTime / BENCHMARK_TAKES * 1e9,
+		(unsigned long long)spoofedAllowed, BENCHMARK_TAKES);
+}
+
+int main() {
+	TestBucket();
+	TestSources();
+	Benchmark();
+	return TEST_RESULT();
+}
@@ -0,0 +1,139 @@
+#include "Test.h"
+#include "SlotMap.h"
+#include <random>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// Players joining and leaving at random for a long time: every ID looks up what it was given for until it's removed
+// and nothing after, IDs stay positive, the map doesn't grow past the most ever held at once, and dense iteration
+// sees exactly what's in it. Then filling every slot, and how fast churn and iteration run.
+
+#define CHURN_STEPS 2000000
+#define CHURN_LIVE 64
+#define BENCHMARK_STEPS 20000000
+
+static void CheckContents(SlotMap<int>& map, const std::unordered_map<int, int>& live) {
+	CHECK(map.Size() == live.size());
+	bool matched = true;
+	size_t seen = 0;
+	for (int value : map) {
+		auto it = live.find(map.IDAt(seen));
+		if (it == live.end() || it->second != value || map.ValueAt(seen) != value) matched = false;
+		seen++;
+	}
+	CHECK(matched);
+	CHECK(seen == live.size());
+}
+
+static void TestChurn() {
+	std::mt19937 random(9);
+	SlotMap<int> map;
+	std::unordered_map<int, int> live;
+	std::vector<int> liveIDs;
+	std::vector<int> removed; //Recently removed IDs, which must stay dead
+	size_t mostLive = 0;
+	bool idsGood = true, lookupsGood = true, staleGood = true;
+
+	for (int step = 0; step < CHURN_STEPS; step++) {
+		//Hover around CHURN_LIVE players
+		bool insert = liveIDs.empty() || (liveIDs.size() < CHURN_LIVE * 2 && random() % (CHURN_LIVE * 2) >= liveIDs.size());
+		if (insert) {
+			int id = map.Insert(step);
+			if (id < 0 || live.count(id)) idsGood = false;
+			live[id] = step;
+			liveIDs.push_back(id);
+			if (liveIDs.size() > mostLive) mostLive = liveIDs.size();
+		}
+		else {
+			size_t pick = random() % liveIDs.size();
+			int id = liveIDs[pick];
+			int* value = map.Get(id);
+			if (!value || *value != live[id]) lookupsGood = false;
+			if (!map.Remove(id)) lookupsGood = false;
+			live.erase(id);
+			liveIDs[pick] = liveIDs.back();
+			liveIDs.pop_back();
+			if (removed.size() < 4096) removed.push_back(id);
+			else removed[random() % removed.size()] = id;
+		}
+
+		if (step % 1024 == 0) {
+			for (int id : removed) {
+				//A removed ID finds nothing, unless its slot has been reused often enough for the generation to wrap round to it
+				if (!live.count(id) && (map.Get(id) != nullptr || map.Remove(id))) staleGood = false;
+			}
+		}
+		if (step % 100000 == 0) CheckContents(map, live);
+	}
+	CHECK(idsGood);
+	CHECK(lookupsGood);
+	CHECK(staleGood);
+	CheckContents(map, live);
+
+	//Slots are reused, so the map never held more than were ever in it at once
+	std::set<uint32_t> indices;
+	for (size_t i = 0; i < map.Size(); i++) indices.insert(SlotMapIndex((uint32_t)map.IDAt(i)));
+	CHECK(!indices.empty() && *indices.rbegin() < mostLive);
+
+	CHECK(map.Get(-1) == nullptr);
+	CHECK(!map.Remove(-1));
+	CHECK(map.Get((int)SLOTMAP_MAX_SLOTS - 1) == nullptr);
+}
+
+static void TestFull() {
+	SlotMap<int> map;
+	std::vector<int> ids;
+	for (uint32_t i = 0; i < SLOTMAP_MAX_SLOTS; i++) {
+		int id = map.Insert((int)i);
+		if (id < 0) break;
+		ids.push_back(id);
+	}
+	CHECK(ids.size() == SLOTMAP_MAX_SLOTS);
+	CHECK(map.Insert(0) == -1);
+
+	//One out lets one in, with a new ID for the same slot
+	CHECK(map.Remove(ids[1234]));
+	int id = map.Insert(-5);
+	CHECK(id >= 0 && id != ids[1234] && SlotMapIndex((uint32_t)id) == SlotMapIndex((uint32_t)ids[1234]));
+	CHECK(map.Get(ids[1234]) == nullptr);
+	CHECK(map.Get(id) && *map.Get(id) == -5);
+	CHECK(map.Insert(0) == -1);
+
+	//Reusing one slot over and over wraps its generation, never making the ID negative
+	bool positive = true;
+	for (uint32_t i = 0; i < (SLOTMAP_GENERATION_MASK + 1) * 2; i++) {
+		map.Remove(id);
+		id = map.Insert((int)i);
+		if (id < 0) positive = false;
+	}
+	CHECK(positive);
+}
+
+static void BenchmarkChurn() {
+	std::mt19937 random(5);
+	SlotMap<int> map;
+	std::vector<int> liveIDs;
+	for (int i = 0; i < CHURN_LIVE; i++) liveIDs.push_back(map.Insert(i));
+
+	//A leave and a join, then a lookup of everyone, as a tick with someone coming and going
+	double start = Test::Now();
+	uint64_t checksum = 0;
+	for (int step = 0; step < BENCHMARK_STEPS / CHURN_LIVE; step++) {
+		size_t pick = random() % liveIDs.size();
+		map.Remove(liveIDs[pick]);
+		liveIDs[pick] = map.Insert(step);
+		for (int id : liveIDs) checksum += *map.Get(id);
+		for (int value : map) checksum += value;
+	}
+	double elapsed = Test::Now() - start;
+	printf("%d players: %.1fM lookups/s with one leaving and joining each tick (checksum %llu)\n", CHURN_LIVE,
+		(double)BENCHMARK_STEPS / elapsed / 1e6, (unsigned long long)checksum);
+}
+
+int main() {
+	TestChurn();
+	TestFull();
+	BenchmarkChurn();
+	return TEST_RESULT();
+}
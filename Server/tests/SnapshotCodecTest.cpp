@@ -0,0 +1,345 @@
+#include "Test.h"
+#include "SnapshotDelta.h"
+#include <system_error> // msgpack.hpp doesn't include it itself
+#include "msgpack.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+// The snapshot encoding end to end: bit streams give back what went in, quantized fields come back within half a step
+// and clamp at the edges of their range, deltas rebuild the server's state, and the assembler copes with datagrams
+// repeated, reordered, against unknown baselines or with nonsense counts. Then how the encoding compares with msgpack.
+
+#define PLAYERS 1000
+#define BENCHMARK_SNAPSHOTS 2000
+
+static PlayerValues RandomPlayer(std::mt19937& random) {
+	std::uniform_real_distribution<float> xz(-60.0f, 60.0f), y(-30.0f, 30.0f), v(-30.0f, 30.0f), yaw(-10.0f, 10.0f);
+	PlayerValues values;
+	values.position = { xz(random), y(random), xz(random) };
+	values.velocity = { v(random), v(random), v(random) };
+	values.rotation = yaw(random);
+	return values;
+}
+
+static SnapshotState RandomState(std::mt19937& random, int players) {
+	SnapshotState state;
+	for (int i = 0; i < players; i++) {
+		PlayerValues values = RandomPlayer(random);
+		QuantizePlayerValues(values);
+		state[i * 3 + 1] = values;
+	}
+	return state;
+}
+
+static void TestBitStream() {
+	std::mt19937 random(1);
+	std::vector<std::pair<uint32_t, int>> written;
+	BitWriter writer;
+	for (int i = 0; i < 10000; i++) {
+		int bits = 1 + random() % 32;
+		uint32_t value = bits == 32 ? (uint32_t)random() : (uint32_t)random() & ((1u << bits) - 1);
+		writer.WriteBits(value, bits);
+		written.push_back({ value, bits });
+	}
+	std::vector<uint8_t> data = writer.Finish();
+
+	BitReader reader(data.data(), data.size());
+	bool same = true;
+	for (auto& entry : written) {
+		uint32_t value;
+		if (!reader.ReadBits(entry.second, value) || value != entry.first) same = false;
+	}
+	CHECK(same);
+	//Only the padding of the last byte is left, and reading past it fails
+	CHECK(reader.BitsLeft() < 8);
+	uint32_t value;
+	CHECK(!reader.ReadBits(8, value));
+
+	BitReader empty(nullptr, 0);
+	CHECK(empty.BitsLeft() == 0);
+	CHECK(!empty.ReadBits(1, value));
+}
+
+static void TestQuantize() {
+	using namespace PlayerStateSchema;
+	std::mt19937 random(2);
+	for (const QuantizedRange& range : { positionXZ, positionY, velocity }) {
+		float step = (range.max - range.min) / (((uint64_t)1 << range.bits) - 2);
+		std::uniform_real_distribution<float> inside(range.min, range.max);
+		double worst = 0;
+		for (int i = 0; i < 100000; i++) {
+			float value = inside(random);
+			worst = std::max(worst, (double)std::fabs(DequantizeFloat(QuantizeFloat(value, range), range) - value));
+		}
+		CHECK(worst <= step * 0.5 + 1e-6);
+
+		//Either end and the middle exactly, past the ends clamped, and NaN to the bottom
+		CHECK(DequantizeFloat(QuantizeFloat(range.min, range), range) == range.min);
+		CHECK_NEAR(DequantizeFloat(QuantizeFloat(range.max, range), range), range.max, 1e-5);
+		CHECK(DequantizeFloat(QuantizeFloat(0.0f, range), range) == 0.0f);
+		CHECK(QuantizeFloat(range.max * 10, range) == QuantizeFloat(range.max, range));
+		CHECK(QuantizeFloat(std::numeric_limits<float>::infinity(), range) == QuantizeFloat(range.max, range));
+		CHECK(QuantizeFloat(-std::numeric_limits<float>::infinity(), range) == 0);
+		CHECK(QuantizeFloat(std::numeric_limits<float>::quiet_NaN(), range) == 0);
+		CHECK(QuantizeFloat(range.max, range) < ((uint64_t)1 << range.bits));
+	}
+
+	//Angles wrap into one turn, either way round
+	const float turn = 6.28318530718f;
+	float angleStep = turn / (1u << rotationBits);
+	CHECK(QuantizeAngle(0.0f) == 0);
+	CHECK(QuantizeAngle(turn) == 0);
+	CHECK(QuantizeAngle(-turn * 3) == 0);
+	CHECK_NEAR(DequantizeAngle(QuantizeAngle(-turn / 4)), turn * 3 / 4, angleStep);
+	CHECK_NEAR(DequantizeAngle(QuantizeAngle(turn * 2.5f)), turn / 2, angleStep);
+	CHECK(QuantizeAngle(std::numeric_limits<float>::quiet_NaN()) == 0);
+	CHECK(QuantizeAngle(turn - angleStep / 4) == 0); //Rounds up to a whole turn, which is zero
+}
+
+static void TestDelta() {
+	std::mt19937 random(3);
+	SnapshotState server = RandomState(random, 200);
+
+	//A complete snapshot rebuilds the state exactly, as both sides quantize the same way
+	std::vector<SnapshotChange> changes;
+	std::vector<int> removed;
+	DiffSnapshot(nullptr, server, changes, removed);
+	CHECK(changes.size() == server.size() && removed.empty());
+	PlayersUpdateMessage msg = {};
+	WriteSnapshotChanges(changes.data(), changes.size(), msg);
+	SnapshotState client;
+	std::vector<int> updated;
+	CHECK(ApplySnapshotDelta(msg, client, &updated));
+	CHECK(client.size() == server.size() && updated.size() == server.size());
+	bool same = true;
+	for (auto& player : server) {
+		const PlayerValues& a = player.second;
+		const PlayerValues& b = client[player.first];
+		if (a.position != b.position || a.velocity != b.velocity || a.rotation != b.rotation) same = false;
+	}
+	CHECK(same);
+
+	//Then a delta with some moved, one gone and one new only sends those
+	SnapshotState baseline = server;
+	server[1].position[0] += 1.0f;
+	QuantizePlayerValues(server[1]);
+	server[4].rotation += 1.0f;
+	QuantizePlayerValues(server[4]);
+	server.erase(7);
+	PlayerValues newcomer = RandomPlayer(random);
+	QuantizePlayerValues(newcomer);
+	server[100000] = newcomer;
+	DiffSnapshot(&baseline, server, changes, removed);
+	CHECK(changes.size() == 3);
+	CHECK(removed.size() == 1 && removed[0] == 7);
+	msg = {};
+	WriteSnapshotChanges(changes.data(), changes.size(), msg);
+	msg.removed = removed;
+	CHECK(ApplySnapshotDelta(msg, client, &updated));
+	CHECK(updated.size() == 3);
+	CHECK(client.size() == server.size() && !client.count(7));
+	CHECK(client[1].position == server[1].position && client[4].rotation == server[4].rotation);
+	CHECK(client[100000].velocity == newcomer.velocity);
+
+	//Applying the same datagram again changes nothing
+	SnapshotState before = client;
+	CHECK(ApplySnapshotDelta(msg, client, &updated));
+	CHECK(client.size() == before.size() && client[1].position == before[1].position);
+
+	//A partial update for a player the client doesn't have can't be used, and leaves the state alone
+	SnapshotState missing = client;
+	missing.erase(1);
+	size_t size = missing.size();
+	CHECK(!ApplySnapshotDelta(msg, missing, &updated));
+	CHECK(missing.size() == size);
+}
+
+static void TestBadCounts() {
+	//Claims the most players a count can, with nothing after it. Turned away before any are decoded or allocated.
+	BitWriter writer;
+	writer.WriteBits((1u << SNAPSHOT_COUNT_BITS) - 1, SNAPSHOT_COUNT_BITS);
+	PlayersUpdateMessage msg = {};
+	msg.players = writer.Finish();
+	SnapshotState state;
+	CHECK(!ApplySnapshotDelta(msg, state));
+
+	//Room for exactly one player's ID and fields, but claiming two
+	BitWriter two;
+	two.WriteBits(2, SNAPSHOT_COUNT_BITS);
+	two.WriteBits(5, PlayerStateSchema::idBits);
+	two.WriteBits(0, PLAYER_STATE_FIELD_BITS);
+	msg.players = two.Finish();
+	CHECK(!ApplySnapshotDelta(msg, state));
+
+	//Cut off partway through a player
+	std::mt19937 random(4);
+	SnapshotState server = RandomState(random, 3);
+	std::vector<SnapshotChange> changes;
+	std::vector<int> removed;
+	DiffSnapshot(nullptr, server, changes, removed);
+	WriteSnapshotChanges(changes.data(), changes.size(), msg);
+	msg.players.resize(msg.players.size() - 2);
+	CHECK(!ApplySnapshotDelta(msg, state));
+	CHECK(state.empty());
+
+	//And no players at all is fine
+	BitWriter none;
+	none.WriteBits(0, SNAPSHOT_COUNT_BITS);
+	msg.players = none.Finish();
+	CHECK(ApplySnapshotDelta(msg, state));
+}
+
+// A snapshot of server split over fragments datagrams against baseline, a few players each
+static std::vector<PlayersUpdateMessage> Split(const SnapshotState* baselineState, uint32_t baseline, const SnapshotState& server,
+	uint32_t sequence, size_t fragments) {
+	std::vector<SnapshotChange> changes;
+	std::vector<int> removed;
+	DiffSnapshot(baselineState, server, changes, removed);
+	std::vector<PlayersUpdateMessage> messages(fragments);
+	size_t start = 0;
+	for (size_t i = 0; i < fragments; i++) {
+		size_t end = changes.size() * (i + 1) / fragments;
+		PlayersUpdateMessage& msg = messages[i];
+		msg = {};
+		msg.sequence = sequence;
+		msg.baseline = baseline;
+		msg.fragment = (uint8_t)i;
+		msg.fragmentCount = (uint8_t)fragments;
+		WriteSnapshotChanges(changes.data() + start, end - start, msg);
+		if (i == 0) msg.removed = removed;
+		start = end;
+	}
+	return messages;
+}
+
+static void TestAssembler() {
+	std::mt19937 random(5);
+	SnapshotState server = RandomState(random, 640);
+	SnapshotHistory history;
+	SnapshotAssembler assembler;
+
+	//All 64 datagrams, every one arriving twice and in any order. Only the last new one completes it.
+	std::vector<PlayersUpdateMessage> messages = Split(nullptr, 0, server, 1, SNAPSHOT_MAX_FRAGMENTS);
+	std::vector<size_t> order;
+	for (size_t i = 0; i < messages.size(); i++) order.insert(order.end(), { i, i });
+	std::shuffle(order.begin(), order.end(), random);
+	int applied = 0, complete = 0, discarded = 0;
+	for (size_t i : order) {
+		SnapshotFragmentResult result = assembler.Add(messages[i], history);
+		if (result == SnapshotFragmentResult::APPLIED) applied++;
+		else if (result == SnapshotFragmentResult::COMPLETE) complete++;
+		else if (result == SnapshotFragmentResult::DISCARDED) discarded++;
+	}
+	CHECK(applied == SNAPSHOT_MAX_FRAGMENTS - 1);
+	CHECK(complete == 1);
+	CHECK(discarded == SNAPSHOT_MAX_FRAGMENTS);
+	CHECK(history.Find(1) != nullptr && history.Find(1)->size() == server.size());
+
+	//One missing, so the snapshot never completes
+	SnapshotState next = server;
+	for (auto& player : next) player.second.rotation = DequantizeAngle(QuantizeAngle(player.second.rotation + 0.5f));
+	messages = Split(history.Find(1), 1, next, 2, 10);
+	for (size_t i = 0; i < messages.size(); i++) {
+		if (i == 3) continue;
+		CHECK(assembler.Add(messages[i], history) == SnapshotFragmentResult::APPLIED);
+	}
+	CHECK(history.Find(2) == nullptr);
+
+	//Against a baseline the client never had, or has lost
+	messages = Split(history.Find(1), 9, next, 3, 4);
+	CHECK(assembler.Add(messages[0], history) == SnapshotFragmentResult::UNKNOWN_BASELINE);
+	CHECK(assembler.Add(messages[1], history) == SnapshotFragmentResult::DISCARDED);
+	for (uint32_t sequence = 10; sequence < 10 + SNAPSHOT_HISTORY; sequence++) history.Store(sequence, server);
+	CHECK(history.Find(1) == nullptr);
+	messages = Split(&server, 1, next, 100, 2);
+	CHECK(assembler.Add(messages[0], history) == SnapshotFragmentResult::UNKNOWN_BASELINE);
+
+	//An older snapshot turning up late is ignored
+	messages = Split(&server, 10, next, 50, 1);
+	CHECK(assembler.Add(messages[0], history) == SnapshotFragmentResult::DISCARDED);
+
+	//Fragment numbers that make no sense, including a count that changes partway through a snapshot
+	messages = Split(&server, 10, next, 101, 3);
+	PlayersUpdateMessage bad = messages[0];
+	bad.fragmentCount = 0;
+	CHECK(assembler.Add(bad, history) == SnapshotFragmentResult::BAD_FRAGMENT);
+	bad.fragmentCount = SNAPSHOT_MAX_FRAGMENTS + 1;
+	CHECK(assembler.Add(bad, history) == SnapshotFragmentResult::BAD_FRAGMENT);
+	bad.fragmentCount = 3;
+	bad.fragment = 3;
+	CHECK(assembler.Add(bad, history) == SnapshotFragmentResult::BAD_FRAGMENT);
+	CHECK(assembler.Add(messages[0], history) == SnapshotFragmentResult::APPLIED);
+	bad = messages[1];
+	bad.fragmentCount = 2;
+	CHECK(assembler.Add(bad, history) == SnapshotFragmentResult::BAD_FRAGMENT);
+	CHECK(assembler.Add(messages[1], history) == SnapshotFragmentResult::APPLIED);
+
+	//A datagram that doesn't fit the baseline spoils the rest of its snapshot
+	bad = messages[2];
+	bad.players.resize(1);
+	CHECK(assembler.Add(bad, history) == SnapshotFragmentResult::MISFIT);
+	CHECK(assembler.Add(messages[2], history) == SnapshotFragmentResult::DISCARDED);
+	CHECK(history.Find(101) == nullptr);
+}
+
+// Players as they were sent before the bit packing, msgpack's floats by ID
+struct MsgpackSnapshot {
+	SnapshotState players;
+
+	template<class T>
+	void pack(T& pack) {
+		pack(players);
+	}
+};
+
+// Bytes and time per snapshot of PLAYERS, bit packed against msgpack
+static void BenchmarkEncoding() {
+	std::mt19937 random(6);
+	SnapshotState server = RandomState(random, PLAYERS);
+	MsgpackSnapshot values;
+	values.players = server;
+
+	std::vector<SnapshotChange> changes;
+	std::vector<int> removed;
+	PlayersUpdateMessage msg = {};
+	SnapshotState client;
+	size_t packedBytes = 0;
+	double start = Test::Now();
+	for (int i = 0; i < BENCHMARK_SNAPSHOTS; i++) {
+		DiffSnapshot(nullptr, server, changes, removed);
+		WriteSnapshotChanges(changes.data(), changes.size(), msg);
+		packedBytes = msg.players.size();
+		ApplySnapshotDelta(msg, client);
+	}
+	double packedTime = (Test::Now() - start) / BENCHMARK_SNAPSHOTS;
+
+	size_t msgpackBytes = 0;
+	uint64_t checksum = 0;
+	start = Test::Now();
+	for (int i = 0; i < BENCHMARK_SNAPSHOTS; i++) {
+		std::vector<uint8_t> data = msgpack::pack(values);
+		msgpackBytes = data.size();
+		MsgpackSnapshot decoded = msgpack::unpack<MsgpackSnapshot>(data);
+		checksum += decoded.players.size();
+	}
+	double msgpackTime = (Test::Now() - start) / BENCHMARK_SNAPSHOTS;
+	CHECK(packedBytes < msgpackBytes);
+
+	printf("%d players: bit packed %.1f bytes each, %.0fus to diff, encode and apply a snapshot\n", PLAYERS,
+		(double)packedBytes / PLAYERS, packedTime * 1e6);
+	printf("%d players: msgpack    %.1f bytes each, %.0fus to pack and unpack a snapshot (checksum %llu)\n", PLAYERS,
+		(double)msgpackBytes / PLAYERS, msgpackTime * 1e6, (unsigned long long)checksum);
+}
+
+int main() {
+	TestBitStream();
+	TestQuantize();
+	TestDelta();
+	TestBadCounts();
+	TestAssembler();
+	BenchmarkEncoding();
+	return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// A UDP only client on an in-process server, with BOTS bots packed close enough around it that it's sent as many
+// players as a snapshot can hold. Every datagram must fit in SNAPSHOT_MTU and be usable on its own, with just its
+// baseline, and every snapshot must go back together whole. Reports the datagrams and bytes a snapshot takes, full and
+// as a delta, and how fast the client side decodes them.
+
+#define BOTS 1200
+#define BOT_SPACING 0.5f
+#define RECEIVE_SECONDS 2.0
+#define BANDWIDTH "100000000" // Enough for whole snapshots every tick, so none are cut short by the budget
+
+static void Run(const char* backend) {
+	SetTestBackend(backend);
+	SetTestEnv(BANDWIDTH_ENV_VAR, BANDWIDTH);
+	SceneApp scene;
+	scene.AddBots(BOTS, BOT_SPACING);
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	TestClientUDP client;
+	CHECK(client.Open(1) && client.Connect(2.0));
+
+	SnapshotHistory history;
+	SnapshotAssembler assembler;
+	std::vector<char> body;
+	std::error_code ec;
+	size_t datagrams = 0, tooBig = 0, unusable = 0;
+	size_t fullSnapshots = 0, deltaSnapshots = 0, fullBytes = 0, deltaBytes = 0, fullDatagrams = 0, deltaDatagrams = 0;
+	size_t snapshotBytes = 0, snapshotDatagrams = 0, largestSnapshot = 0;
+	uint32_t sequence = 0;
+	std::vector<int> updated;
+	double decodeTime = 0;
+	size_t decodedPlayers = 0;
+
+	double end = Test::Now() + RECEIVE_SECONDS;
+	while (Test::Now() < end) {
+		if (!client.Receive(MessageType::PLAYERSUPDATE, body, 0.25)) continue;
+		datagrams++;
+		if (body.size() + HeaderSize > SNAPSHOT_MTU) tooBig++;
+		PlayersUpdateMessage msg = msgpack::unpack<PlayersUpdateMessage>((uint8_t*)body.data(), body.size(), ec);
+		if (ec) {
+			unusable++;
+			continue;
+		}
+
+		//Usable on its own, on top of just its baseline
+		SnapshotState alone;
+		if (msg.baseline != 0) {
+			const SnapshotState* baseline = history.Find(msg.baseline);
+			if (baseline) alone = *baseline;
+		}
+		double start = Test::Now();
+		if (!ApplySnapshotDelta(msg, alone, &updated)) unusable++;
+		decodeTime += Test::Now() - start;
+		decodedPlayers += updated.size();
+
+		if (msg.sequence != sequence) {
+			sequence = msg.sequence;
+			snapshotBytes = 0;
+			snapshotDatagrams = 0;
+		}
+		snapshotBytes += body.size() + HeaderSize;
+		snapshotDatagrams++;
+
+		if (assembler.Add(msg, history) != SnapshotFragmentResult::COMPLETE) continue;
+		largestSnapshot = std::max(largestSnapshot, assembler.State().size());
+		if (msg.baseline == 0) {
+			fullSnapshots++;
+			fullBytes += snapshotBytes;
+			fullDatagrams += snapshotDatagrams;
+		}
+		else {
+			deltaSnapshots++;
+			deltaBytes += snapshotBytes;
+			deltaDatagrams += snapshotDatagrams;
+		}
+		SnapshotAckMessage ack;
+		ack.sequence = msg.sequence;
+		client.Send(MessageType::SNAPSHOTACK, ack);
+	}
+
+	CHECK(datagrams > 0);
+	CHECK(tooBig == 0);
+	CHECK(unusable == 0);
+	CHECK(fullSnapshots > 0);
+	CHECK(deltaSnapshots > 0);
+	//As many as fit in a snapshot, which is fewer than there are bots
+	CHECK(largestSnapshot == SNAPSHOT_MAX_PLAYERS);
+	CHECK(fullDatagrams > fullSnapshots); //Split over several each
+
+	delete server;
+	done = true;
+	clock.join();
+	client.Close();
+
+	if (!fullSnapshots || !deltaSnapshots) return;
+	printf("%-9s %zu players a snapshot: full %.0f datagrams, %.0f bytes; delta %.0f datagrams, %.0f bytes; %zu snapshots, %.1fM players/s decoded\n",
+		backend, largestSnapshot, (double)fullDatagrams / fullSnapshots, (double)fullBytes / fullSnapshots,
+		(double)deltaDatagrams / deltaSnapshots, (double)deltaBytes / deltaSnapshots, fullSnapshots + deltaSnapshots,
+		decodeTime > 0 ? decodedPlayers / decodeTime / 1e6 : 0.0);
+}
+
+int main() {
+	StartTestSockets();
+	Log::SetCategories(0);
+
+	Run("readiness");
+#ifdef __linux__
+	Run("io_uring");
+#endif
+	return TEST_RESULT();
+}
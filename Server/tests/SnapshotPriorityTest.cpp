@@ -0,0 +1,141 @@
+#include "Test.h"
+#include "TestClientUDP.h"
+#include "scene_app.h"
+#include "SnapshotDelta.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A UDP only client on an in-process server, with BOTS bots around it that all turn every snapshot and too little
+// bandwidth to send them all each tick. No snapshot may come to more bytes than the client's share of a tick, and
+// however far away a bot is, and so however slowly it builds up priority, it must be sent again within STARVATION_TICKS.
+// Reports how many players go a tick, and the longest any bot waited.
+
+#define BOTS 150
+#define BOT_SPACING 1.0f // Close enough that they're all in the client's interest
+#define BANDWIDTH 16000  // Bits a second, a few dozen turning bots a tick
+#define MEASURE_TICKS 32 // Snapshots checked once the client has every bot
+#define TIMEOUT_SECONDS 30.0
+
+// What one bot that's only turned costs, and so the fewest a tick's budget must carry
+static size_t PlayersPerTick() {
+	size_t budgetBits = BANDWIDTH / TICKRATE;
+	return (budgetBits - SNAPSHOT_FRAGMENT_OVERHEAD * 8 - SNAPSHOT_COUNT_BITS) / SnapshotChangeBits(STATE_ROTATION);
+}
+
+// The longest a bot should wait. Each is sent once its priority reaches about what the others reach between their sends,
+// and the nearest build up (1 + PRIORITY_DISTANCE_WEIGHT) times as fast as the farthest, with a couple of ticks over.
+static uint32_t StarvationTicks() {
+	size_t players = BOTS + 1;
+	size_t perTick = PlayersPerTick();
+	return (uint32_t)(((size_t)(1 + PRIORITY_DISTANCE_WEIGHT) * players + perTick - 1) / perTick + 2);
+}
+
+int main() {
+	StartTestSockets();
+	Log::SetCategories(0);
+	SetTestEnv(BANDWIDTH_ENV_VAR, std::to_string(BANDWIDTH).c_str());
+
+	SceneApp scene;
+	scene.AddBots(BOTS, BOT_SPACING);
+	NetworkServer* server = new NetworkServer();
+	server->StartConnection(&scene);
+
+	std::atomic<bool> done{ false };
+	std::thread clock([&]() {
+		while (!done) {
+			server->UpdateTime();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	TestClientUDP client;
+	CHECK(client.Open(1) && client.Connect(2.0));
+
+	SnapshotHistory history;
+	SnapshotAssembler assembler;
+	std::vector<char> body;
+	std::error_code ec;
+	std::unordered_map<int, uint32_t> lastSent; //Sequence of the snapshot each player last came in
+	uint32_t sequence = 0, firstMeasured = 0, measured = 0, worstWait = 0;
+	size_t snapshotBytes = 0, snapshotFragments = 0, overBudget = 0, players = 0, unusable = 0;
+	size_t fewestPlayers = SIZE_MAX, mostPlayers = 0;
+	const size_t budgetBytes = BANDWIDTH / TICKRATE / 8;
+
+	//A snapshot's done when the next one starts
+	auto finishSnapshot = [&]() {
+		if (sequence == 0) return;
+		//The players field is padded out to a whole byte in each datagram
+		if (snapshotBytes > budgetBytes + snapshotFragments) overBudget++;
+		if (firstMeasured == 0) return;
+		fewestPlayers = std::min(fewestPlayers, players);
+		mostPlayers = std::max(mostPlayers, players);
+		measured++;
+	};
+
+	double end = Test::Now() + TIMEOUT_SECONDS;
+	while (measured < MEASURE_TICKS && Test::Now() < end) {
+		if (!client.Receive(MessageType::PLAYERSUPDATE, body, 0.5)) continue;
+		PlayersUpdateMessage msg = msgpack::unpack<PlayersUpdateMessage>((uint8_t*)body.data(), body.size(), ec);
+		if (ec) {
+			unusable++;
+			continue;
+		}
+		if (msg.sequence != sequence) {
+			finishSnapshot();
+			sequence = msg.sequence;
+			snapshotBytes = 0;
+			snapshotFragments = 0;
+			players = 0;
+		}
+		snapshotBytes += body.size() + HeaderSize;
+		snapshotFragments++;
+
+		SnapshotFragmentResult result = assembler.Add(msg, history);
+		if (result != SnapshotFragmentResult::APPLIED && result != SnapshotFragmentResult::COMPLETE) {
+			unusable++;
+			continue;
+		}
+		players += assembler.Updated().size();
+		for (int id : assembler.Updated()) {
+			auto last = lastSent.find(id);
+			if (firstMeasured != 0 && last != lastSent.end()) worstWait = std::max(worstWait, msg.sequence - last->second);
+			lastSent[id] = msg.sequence;
+		}
+		//Waits only count once every bot's been sent in full, which takes a while at this bandwidth
+		if (firstMeasured == 0 && lastSent.size() == BOTS + 1) firstMeasured = msg.sequence;
+		if (result != SnapshotFragmentResult::COMPLETE) continue;
+
+		SnapshotAckMessage ack;
+		ack.sequence = msg.sequence;
+		client.Send(MessageType::SNAPSHOTACK, ack);
+	}
+
+	//And no bot that never came again at all. The client's own player stands still, so it never has to.
+	uint32_t starved = 0;
+	for (auto& sent : lastSent) {
+		if (scene.IsBot(sent.first)) starved = std::max(starved, sequence - sent.second);
+	}
+
+	CHECK(unusable == 0);
+	CHECK(firstMeasured != 0);
+	CHECK(measured == MEASURE_TICKS);
+	CHECK(overBudget == 0);
+	//Too many for one tick, so some had to wait, but none for longer than they should
+	CHECK(mostPlayers < BOTS);
+	CHECK(worstWait > 1);
+	CHECK(worstWait <= StarvationTicks());
+	CHECK(starved <= StarvationTicks());
+
+	delete server;
+	done = true;
+	clock.join();
+	client.Close();
+
+	printf("%d bots at %d bits/s: %zu to %zu players a snapshot (budget for %zu turning), longest wait %u snapshots of %u allowed\n",
+		BOTS, BANDWIDTH, fewestPlayers, mostPlayers, PlayersPerTick(), worstWait, StarvationTicks());
+	return TEST_RESULT();
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+
+// Just enough for the test programs in this directory. Each is its own executable run by ctest: failed checks are
+// printed as they happen, and main returns TEST_RESULT() so any failure makes the program exit non zero.
+
+namespace Test {
+	inline int& Failures() { static int failures = 0; return failures; }
+
+	inline void Fail(const char* file, int line, const char* check) {
+		fprintf(stderr, "%s:%d: %s failed\n", file, line, check);
+		Failures()++;
+	}
+
+	// Seconds on a steady clock, for the benchmarks
+	inline double Now() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+#define CHECK(condition) do { if (!(condition)) Test::Fail(__FILE__, __LINE__, "CHECK(" #condition ")"); } while (0)
+#define CHECK_NEAR(a, b, tolerance) do { if (!(std::fabs((double)(a) - (double)(b)) <= (tolerance))) { \
+	Test::Fail(__FILE__, __LINE__, "CHECK_NEAR(" #a ", " #b ", " #tolerance ")"); \
+	fprintf(stderr, "    %g vs %g\n", (double)(a), (double)(b)); } } while (0)
+
+#define TEST_RESULT() (Test::Failures() == 0 ? (printf("All checks passed\n"), 0) : (printf("%d checks failed\n", Test::Failures()), 1))
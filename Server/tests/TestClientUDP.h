@@ -0,0 +1,134 @@
+#pragma once
+#include "Test.h"
+#include "TestSockets.h"
+#include "NetworkServer.h"
+#include "msgpack.hpp"
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Bigger than any datagram the server should send, so one that's too big still arrives whole
+#define TEST_RECEIVE_SIZE 4096
+
+// A UDP only client for driving an in-process NetworkServer over loopback, doing just what the real client does.
+// Each binds its own loopback address, 127.0.0.0 plus host, so the server sees every one as a separate IP.
+struct TestClientUDP {
+	SOCKET sock = INVALID_SOCKET;
+	uint16_t handle = 0;
+	uint64_t token = 0;
+	uint64_t nonce = 0;
+	uint32_t sequence = 0;
+
+	bool Open(uint32_t host) {
+		sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (sock == INVALID_SOCKET) return false;
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK - 1 + host);
+		nonce = host;
+		return bind(sock, (sockaddr*)&address, sizeof(address)) == 0 && SetNonBlocking(sock);
+	}
+
+	void Close() {
+		if (sock != INVALID_SOCKET) closesocket(sock);
+		sock = INVALID_SOCKET;
+	}
+
+	static sockaddr_in ServerAddress() {
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(SERVERPORT_UDP);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return address;
+	}
+
+	// Send msg with the client's header, as the client's messages go
+	template<class T>
+	bool Send(MessageType type, T& msg) {
+		std::vector<uint8_t> body = msgpack::pack(msg);
+		return SendBody(type, body.data(), body.size());
+	}
+
+	// Send whatever body bytes, packed or not
+	bool SendBody(MessageType type, const void* body, size_t bodyLength) {
+		char buffer[DATAGRAM_BUFFER_SIZE];
+		if (HeaderSizeUDP + bodyLength > sizeof(buffer)) return false;
+		uint16_t length = (uint16_t)(HeaderSizeUDP + bodyLength);
+		memcpy(buffer, &length, HeaderLenFieldSize);
+		memcpy(buffer + HeaderLenFieldSize, &type, HeaderTypeFieldSize);
+		memcpy(buffer + HeaderSize, &handle, HeaderHandleFieldSize);
+		memcpy(buffer + HeaderSize + HeaderHandleFieldSize, &token, HeaderTokenFieldSize);
+		memcpy(buffer + HeaderSizeUDP, body, bodyLength);
+		sockaddr_in server = ServerAddress();
+		return sendto(sock, buffer, length, 0, (const sockaddr*)&server, sizeof(server)) == length;
+	}
+
+	// Wait up to timeout seconds for a datagram of type from the server and put its body in body, skipping anything else
+	bool Receive(MessageType type, std::vector<char>& body, double timeout) {
+		double end = Test::Now() + timeout;
+		char buffer[TEST_RECEIVE_SIZE];
+		while (Test::Now() < end) {
+			int count = recvfrom(sock, buffer, sizeof(buffer), 0, NULL, NULL);
+			if (count < 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			if (count < (int)(HeaderSize) || (MessageType)buffer[HeaderLenFieldSize] != type) continue;
+			body.assign(buffer + HeaderSize, buffer + count);
+			return true;
+		}
+		return false;
+	}
+
+	// The connect handshake, starting again each time an answer doesn't come. False if it never finished.
+	bool Connect(double timeout) {
+		double end = Test::Now() + timeout;
+		ConnectRequestMessage request;
+		request.nonce = nonce;
+		request.padding.resize(CONNECT_REQUEST_SIZE);
+		std::vector<char> body;
+		std::error_code ec;
+		while (Test::Now() < end) {
+			handle = 0;
+			token = 0;
+			Send(MessageType::CONNECTREQUEST, request);
+			if (!Receive(MessageType::CONNECTCHALLENGE, body, 0.25)) continue;
+			ConnectChallengeMessage challenge = msgpack::unpack<ConnectChallengeMessage>((uint8_t*)body.data(), body.size(), ec);
+			if (ec) continue;
+
+			Send(MessageType::CONNECTRESPONSE, challenge);
+			if (!Receive(MessageType::SERVERACCEPT, body, 0.25)) continue;
+			ServerAcceptMessage accept = msgpack::unpack<ServerAcceptMessage>((uint8_t*)body.data(), body.size(), ec);
+			if (ec) continue;
+			handle = accept.handleUDP;
+			token = accept.tokenUDP;
+			return true;
+		}
+		return false;
+	}
+
+	bool SendInput() {
+		InputUpdateMessage msg;
+		msg.time = 0;
+		msg.sequence = ++sequence;
+		msg.velocity = { 0.0f, 0.0f };
+		msg.rotation = 0;
+		msg.jump = false;
+		return Send(MessageType::INPUTUPDATE, msg);
+	}
+};
+
+// Set an environment variable the next NetworkServer started reads
+inline void SetTestEnv(const char* name, const char* value) {
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
+// Switch the network backend for the next NetworkServer started
+inline void SetTestBackend(const char* backend) {
+	SetTestEnv(BACKEND_ENV_VAR, backend);
+}
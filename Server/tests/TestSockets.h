@@ -0,0 +1,10 @@
+#pragma once
+#include "Sockets.h"
+
+// Sockets need starting up on Windows before anything else touches them
+inline void StartTestSockets() {
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(0x202, &wsaData);
+#endif
+}
@@ -0,0 +1,187 @@
+#include "Test.h"
+#include "TripleBuffer.h"
+#include "WorldSnapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The reader always gets the newest whole snapshot published and never one the writer is still filling, with the
+// writer and reader on their own threads going as fast as they can. Then how long the simulation thread is held up
+// handing a world over, through the triple buffer and the way it used to be, building a map under the players lock.
+
+#define PLAYERS 256
+#define STEPS 200000
+#define BENCHMARK_SECONDS 1.0
+
+static void Fill(WorldSnapshot& world, uint32_t step) {
+	world.Clear();
+	world.step = step;
+	for (int i = 0; i < PLAYERS; i++) {
+		float v = (float)step;
+		world.Add(i + 1, v, v, v, v, v, v, v, step);
+	}
+}
+
+// Every row written in the same step as the snapshot says
+static bool Whole(const WorldSnapshot& world) {
+	if (world.Size() != PLAYERS) return false;
+	for (size_t row = 0; row < world.Size(); row++) {
+		if (world.positionX[row] != (float)world.step || world.rotation[row] != (float)world.step || world.inputSequence[row] != world.step) return false;
+	}
+	return true;
+}
+
+static void TestSingleThread() {
+	TripleBuffer<WorldSnapshot> buffer;
+	CHECK(buffer.Latest().Size() == 0); //Nothing published yet
+
+	Fill(buffer.Back(), 1);
+	buffer.Publish();
+	CHECK(buffer.Latest().step == 1);
+	CHECK(buffer.Latest().step == 1); //Still there until something newer is
+
+	//Only the last of several publishes is seen, and the writer never gets the reader's buffer
+	for (uint32_t step = 2; step <= 5; step++) {
+		Fill(buffer.Back(), step);
+		buffer.Publish();
+	}
+	const WorldSnapshot& latest = buffer.Latest();
+	CHECK(latest.step == 5 && Whole(latest));
+	for (int i = 0; i < 10; i++) {
+		CHECK(&buffer.Back() != &latest);
+		buffer.Publish();
+		CHECK(&buffer.Back() != &latest);
+	}
+}
+
+static void TestThreads() {
+	TripleBuffer<WorldSnapshot>* buffer = new TripleBuffer<WorldSnapshot>();
+	std::atomic<bool> finished{ false };
+	std::thread writer([&]() {
+		for (uint32_t step = 1; step <= STEPS; step++) {
+			Fill(buffer->Back(), step);
+			buffer->Publish();
+			if (step % 64 == 0) std::this_thread::yield(); //Mix the two up even on one core
+		}
+		finished = true;
+	});
+
+	uint32_t last = 0;
+	uint64_t reads = 0, newer = 0;
+	bool whole = true, ordered = true;
+	while (!finished) {
+		const WorldSnapshot& world = buffer->Latest();
+		reads++;
+		if (world.Size() == 0) continue;
+		if (!Whole(world)) whole = false;
+		if (world.step < last) ordered = false;
+		if (world.step > last) newer++;
+		last = world.step;
+	}
+	writer.join();
+
+	CHECK(whole);
+	CHECK(ordered);
+	CHECK(buffer->Latest().step == STEPS);
+	printf("%d steps published, %llu reads saw %llu new snapshots\n", STEPS, (unsigned long long)reads, (unsigned long long)newer);
+	delete buffer;
+}
+
+struct StallStats {
+	uint64_t steps = 0;
+	double total = 0;
+	double worst = 0;
+	// How long the network thread kept the simulation out each read, the most it can be held up by one.
+	// Unlike the waits themselves, this doesn't depend on how many cores there are for the threads to run on at once.
+	uint64_t reads = 0;
+	double held = 0;
+
+	void Add(double stall) {
+		steps++;
+		total += stall;
+		worst = std::max(worst, stall);
+	}
+};
+
+// The simulation thread's time publishing each step, while a network thread reads the latest as fast as it can
+static StallStats BenchmarkTripleBuffer() {
+	TripleBuffer<WorldSnapshot>* buffer = new TripleBuffer<WorldSnapshot>();
+	std::atomic<bool> done{ false };
+	uint64_t checksum = 0;
+	std::thread reader([&]() {
+		while (!done) {
+			const WorldSnapshot& world = buffer->Latest();
+			if (world.Size()) checksum += (uint64_t)world.positionX[0];
+		}
+	});
+
+	StallStats stats; //Reads never keep the simulation out, so held stays 0
+	double end = Test::Now() + BENCHMARK_SECONDS;
+	for (uint32_t step = 1; Test::Now() < end; step++) {
+		Fill(buffer->Back(), step);
+		double start = Test::Now();
+		buffer->Publish();
+		stats.Add(Test::Now() - start);
+	}
+	done = true;
+	reader.join();
+	delete buffer;
+	return stats;
+}
+
+// The same, with the network thread copying the players into a map under the lock the simulation steps under
+static StallStats BenchmarkLocked() {
+	std::mutex playersMutex;
+	WorldSnapshot world;
+	std::atomic<bool> done{ false };
+	uint64_t checksum = 0;
+	StallStats stats;
+	std::thread reader([&]() {
+		std::map<int, PlayerValues> players;
+		while (!done) {
+			players.clear();
+			playersMutex.lock();
+			double start = Test::Now();
+			for (size_t row = 0; row < world.Size(); row++) {
+				PlayerValues& values = players[world.ids[row]];
+				values.position.resize(3);
+				values.velocity.resize(3);
+				world.GetPlayerValues(row, values);
+			}
+			stats.held += Test::Now() - start;
+			stats.reads++;
+			playersMutex.unlock();
+			if (!players.empty()) checksum += (uint64_t)players.begin()->second.position[0];
+		}
+	});
+
+	double end = Test::Now() + BENCHMARK_SECONDS;
+	for (uint32_t step = 1; Test::Now() < end; step++) {
+		double start = Test::Now();
+		playersMutex.lock();
+		stats.Add(Test::Now() - start);
+		Fill(world, step);
+		playersMutex.unlock();
+	}
+	done = true;
+	reader.join();
+	return stats;
+}
+
+int main() {
+	TestSingleThread();
+	TestThreads();
+
+	StallStats triple = BenchmarkTripleBuffer();
+	StallStats locked = BenchmarkLocked();
+	CHECK(triple.steps > 0 && locked.steps > 0);
+	CHECK(locked.reads > 0);
+	printf("%d players, simulation thread per step: triple buffer %.2fus mean, %.1fus worst to publish, never kept out by reads\n",
+		PLAYERS, triple.total / triple.steps * 1e6, triple.worst * 1e6);
+	printf("%d players, simulation thread per step: lock and map %.2fus mean, %.1fus worst waiting, kept out %.1fus by each read\n",
+		PLAYERS, locked.total / locked.steps * 1e6, locked.worst * 1e6, locked.reads ? locked.held / locked.reads * 1e6 : 0.0);
+	return TEST_RESULT();
+}
@@ -0,0 +1,242 @@
+#include "Test.h"
+#include "WorldHistory.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Rewinding gives back where players were between recorded steps, clamps to the ends of the history once it's wrapped,
+// copes with players joining and leaving in between, and turns the short way round. FindNear and Raycast agree with
+// brute force over the rewound world and hit rotated boxes where they are. Then what each query costs against how
+// many players there are and how much history there is to search.
+
+#define STEP_MS 16
+#define HALF_WIDTH 0.5f
+#define HALF_HEIGHT 1.0f
+#define HALF_DEPTH 0.5f
+#define BENCHMARK_QUERIES 20000
+
+// Player id at x = id + time / 100, z = 0, turning a little each ms
+static void AddMoving(WorldSnapshot& world, int id, uint32_t time) {
+	world.Add(id, (float)id + time / 100.0f, 1.0f, 0.0f, 10.0f, 0, 0, time * 0.001f, time / STEP_MS);
+}
+
+static void TestInterpolation() {
+	WorldHistory history(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+	WorldSnapshot world;
+	float position[3], rotation;
+	CHECK(history.Empty());
+	CHECK(!history.Rewind(0, world));
+	CHECK(!history.PlayerAt(1, 0, position, rotation));
+
+	//Twice round the ring
+	uint32_t start = 1000;
+	int steps = WORLD_HISTORY_STEPS * 2 + 5;
+	for (int i = 0; i < steps; i++) {
+		uint32_t time = start + i * STEP_MS;
+		world.Clear();
+		world.step = i;
+		for (int id = 1; id <= 4; id++) AddMoving(world, id, time);
+		history.Record(time, world);
+	}
+	uint32_t newest = start + (steps - 1) * STEP_MS;
+	uint32_t oldest = newest - (WORLD_HISTORY_STEPS - 1) * STEP_MS;
+	CHECK(history.NewestTime() == newest);
+	CHECK(history.OldestTime() == oldest);
+
+	//Between steps, on them, and either side of the history clamped to its ends
+	bool exact = true;
+	for (uint32_t time = oldest; time <= newest; time += 5) {
+		if (!history.PlayerAt(3, time, position, rotation)) exact = false;
+		else if (std::fabs(position[0] - (3.0f + time / 100.0f)) > 1e-3f || std::fabs(rotation - time * 0.001f) > 1e-4f) exact = false;
+	}
+	CHECK(exact);
+	CHECK(history.PlayerAt(2, newest + 500, position, rotation));
+	CHECK_NEAR(position[0], 2.0f + newest / 100.0f, 1e-3);
+	CHECK(history.PlayerAt(2, oldest - 500, position, rotation));
+	CHECK_NEAR(position[0], 2.0f + oldest / 100.0f, 1e-3);
+	CHECK(history.PlayerAt(2, 0, position, rotation)); //From before the server started
+	CHECK_NEAR(position[0], 2.0f + oldest / 100.0f, 1e-3);
+	CHECK(!history.PlayerAt(99, newest, position, rotation));
+
+	//The whole world at once matches
+	uint32_t between = oldest + STEP_MS * 10 + 7;
+	CHECK(history.Rewind(between, world));
+	CHECK(world.Size() == 4);
+	bool same = true;
+	for (size_t row = 0; row < world.Size(); row++) {
+		if (std::fabs(world.positionX[row] - (world.ids[row] + between / 100.0f)) > 1e-3f) same = false;
+	}
+	CHECK(same);
+}
+
+static void TestJoinLeave() {
+	WorldHistory history(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+	WorldSnapshot world;
+	//1 is there throughout, 2 leaves after the first step and 3 joins in the second
+	world.Add(1, 0, 0, 0, 0, 0, 0, 0, 0);
+	world.Add(2, 5, 0, 0, 0, 0, 0, 0, 0);
+	history.Record(100, world);
+	world.Clear();
+	world.Add(1, 10, 0, 0, 0, 0, 0, 0, 0);
+	world.Add(3, 20, 0, 0, 0, 0, 0, 0, 0);
+	history.Record(200, world);
+
+	float position[3], rotation;
+	CHECK(history.PlayerAt(1, 150, position, rotation) && std::fabs(position[0] - 5.0f) < 1e-4f);
+	CHECK(history.PlayerAt(2, 150, position, rotation) && position[0] == 5.0f);
+	CHECK(history.PlayerAt(3, 150, position, rotation) && position[0] == 20.0f);
+	CHECK(!history.PlayerAt(2, 200, position, rotation)); //Gone by then
+	CHECK(!history.PlayerAt(3, 100, position, rotation)); //Not there yet
+
+	CHECK(history.Rewind(150, world));
+	CHECK(world.Size() == 3 && world.Find(1) >= 0 && world.Find(2) >= 0 && world.Find(3) >= 0);
+
+	//Turning from just short of a whole turn to just past it goes through 0, not back round the other way
+	WorldHistory turning(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+	const float pi = 3.14159265f;
+	world.Clear();
+	world.Add(1, 0, 0, 0, 0, 0, 0, 2 * pi - 0.2f, 0);
+	turning.Record(0, world);
+	world.Clear();
+	world.Add(1, 0, 0, 0, 0, 0, 0, 0.2f, 0);
+	turning.Record(10, world);
+	CHECK(turning.PlayerAt(1, 5, position, rotation));
+	CHECK_NEAR(std::fmod(rotation + 2 * pi, 2 * pi), 0.0, 1e-4);
+}
+
+static void TestQueries() {
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> spread(-20.0f, 20.0f);
+	WorldHistory history(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+	WorldSnapshot world;
+	for (int i = 0; i < 10; i++) {
+		world.Clear();
+		for (int id = 1; id <= 200; id++) {
+			std::mt19937 place(id); //Each player in the same place every step, then moving along x
+			float x = spread(place) + i, z = spread(place);
+			world.Add(id, x, 1.0f, z, 0, 0, 0, 0, 0);
+		}
+		history.Record(i * STEP_MS, world);
+	}
+
+	//FindNear agrees with brute force over the rewound world
+	bool agrees = true;
+	for (int q = 0; q < 200; q++) {
+		uint32_t time = random() % (10 * STEP_MS);
+		float point[3] = { spread(random), 1.0f, spread(random) };
+		std::vector<int> found, expected;
+		history.FindNear(time, point, 4.0f, found);
+		history.Rewind(time, world);
+		for (size_t row = 0; row < world.Size(); row++) {
+			float dx = world.positionX[row] - point[0], dy = world.positionY[row] - point[1], dz = world.positionZ[row] - point[2];
+			if (dx * dx + dy * dy + dz * dz <= 16.0f) expected.push_back(world.ids[row]);
+		}
+		std::sort(found.begin(), found.end());
+		std::sort(expected.begin(), expected.end());
+		if (found != expected) agrees = false;
+	}
+	CHECK(agrees);
+
+	//A ray fired where a player was hits them then, but not now they've moved on
+	float past[3], rotation;
+	history.PlayerAt(17, 0, past, rotation);
+	float origin[3] = { past[0], past[1], past[2] - 50.0f };
+	float direction[3] = { 0, 0, 1 };
+	float distance;
+	int hit = history.Raycast(0, origin, direction, 100.0f, -1, &distance);
+	CHECK(hit == 17 || (hit >= 0 && distance <= 50.0f - HALF_DEPTH + 1e-3f)); //Someone else might be in the way
+	if (hit == 17) CHECK_NEAR(distance, 50.0f - HALF_DEPTH, 1e-3);
+	CHECK(history.Raycast(9 * STEP_MS, origin, direction, 100.0f, -1) != 17);
+	CHECK(history.Raycast(0, origin, direction, 100.0f, 17) != 17);
+	hit = history.Raycast(0, origin, direction, 10.0f, -1, &distance);
+	CHECK(hit != 17 && (hit == -1 || distance <= 10.0f)); //Out of reach
+}
+
+static void TestRotatedBox() {
+	//Turned 45 degrees, a box's corners stick out past its half width
+	WorldHistory history(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+	WorldSnapshot world;
+	world.Add(1, 0, 0, 0, 0, 0, 0, 0, 0);
+	world.Add(2, 10, 0, 0, 0, 0, 0, 3.14159265f / 4, 0);
+	history.Record(0, world);
+
+	float direction[3] = { 0, 0, 1 };
+	float offset = HALF_WIDTH * 1.2f; //Past the edge, inside the corner
+	float origin1[3] = { offset, 0, -10 };
+	float origin2[3] = { 10 + offset, 0, -10 };
+	CHECK(history.Raycast(0, origin1, direction, 100.0f, -1) == -1);
+	CHECK(history.Raycast(0, origin2, direction, 100.0f, -1) == 2);
+	float origin3[3] = { 10 + HALF_WIDTH * 1.5f, 0, -10 };
+	CHECK(history.Raycast(0, origin3, direction, 100.0f, -1) == -1);
+
+	//Nearest of two in a line, and from inside a box it's that one at distance 0
+	float along[3] = { 1, 0, 0 };
+	float start[3] = { -10, 0, 0 };
+	float distance;
+	CHECK(history.Raycast(0, start, along, 100.0f, -1, &distance) == 1);
+	CHECK_NEAR(distance, 10.0f - HALF_WIDTH, 1e-4);
+	float inside[3] = { 0, 0, 0 };
+	CHECK(history.Raycast(0, inside, along, 100.0f, -1, &distance) == 1);
+	CHECK_NEAR(distance, 0.0, 1e-6);
+	CHECK(history.Raycast(0, inside, along, 100.0f, 1, &distance) == 2);
+}
+
+static void Benchmark() {
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> spread(-30.0f, 30.0f);
+	printf("%8s %8s %12s %12s %12s %12s\n", "players", "steps", "PlayerAt us", "Rewind us", "FindNear us", "Raycast us");
+	for (int players : { 16, 64, 256, 1024 }) {
+		for (int steps : { 8, WORLD_HISTORY_STEPS }) {
+			WorldHistory* history = new WorldHistory(HALF_WIDTH, HALF_HEIGHT, HALF_DEPTH);
+			WorldSnapshot world;
+			for (int i = 0; i < steps; i++) {
+				world.Clear();
+				for (int id = 1; id <= players; id++) world.Add(id, spread(random), 1.0f, spread(random), 0, 0, 0, spread(random), 0);
+				history->Record(i * STEP_MS, world);
+			}
+
+			std::vector<uint32_t> times(BENCHMARK_QUERIES);
+			for (uint32_t& time : times) time = random() % (steps * STEP_MS);
+			float position[3], rotation, point[3] = { 0, 1, 0 }, direction[3] = { 0.6f, 0, 0.8f };
+			std::vector<int> found;
+			uint64_t checksum = 0;
+
+			double start = Test::Now();
+			for (uint32_t time : times) checksum += history->PlayerAt(1 + time % players, time, position, rotation);
+			double playerAt = (Test::Now() - start) / BENCHMARK_QUERIES;
+
+			int rewinds = BENCHMARK_QUERIES / 10;
+			start = Test::Now();
+			for (int i = 0; i < rewinds; i++) {
+				history->Rewind(times[i], world);
+				checksum += world.Size();
+			}
+			double rewind = (Test::Now() - start) / rewinds;
+
+			start = Test::Now();
+			for (int i = 0; i < rewinds; i++) {
+				history->FindNear(times[i], point, 5.0f, found);
+				checksum += found.size();
+			}
+			double findNear = (Test::Now() - start) / rewinds;
+
+			start = Test::Now();
+			for (int i = 0; i < rewinds; i++) checksum += history->Raycast(times[i], point, direction, 50.0f, -1);
+			double raycast = (Test::Now() - start) / rewinds;
+
+			printf("%8d %8d %12.3f %12.2f %12.2f %12.2f (checksum %llu)\n", players, steps, playerAt * 1e6, rewind * 1e6,
+				findNear * 1e6, raycast * 1e6, (unsigned long long)checksum);
+			delete history;
+		}
+	}
+}
+
+int main() {
+	TestInterpolation();
+	TestJoinLeave();
+	TestQueries();
+	TestRotatedBox();
+	Benchmark();
+	return TEST_RESULT();
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "NetworkServer.h"
+#include "SlotMap.h"
+#include "TripleBuffer.h"
+#include "WorldSnapshot.h"
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+// Stands in for the real SceneApp (Server/scene_app.h) so the networking can be run in the tests without PhysX or gef.
+// Players stand still in a grid 2m apart, in the order they joined, and their inputs are only counted.
+// Bots can be added to fill the world, packed around the origin and turning a little every snapshot.
+class SceneApp {
+public:
+	void AddPlayer(int playerID) {
+		playersMutex_.lock();
+		if (uint8_t* player = players_.Get(playerID)) *player = JOINED;
+		playersMutex_.unlock();
+	}
+
+	void RemovePlayer(int playerID) {
+		playersMutex_.lock();
+		players_.Remove(playerID);
+		playersMutex_.unlock();
+	}
+
+	int GetAvailableID() {
+		playersMutex_.lock();
+		int playerID = players_.Size() < MAX_PLAYERS ? players_.Insert(CONNECTED) : -1;
+		playersMutex_.unlock();
+		return playerID;
+	}
+
+	void SetInputs(std::vector<std::pair<int, InputUpdateMessage>>& inputs, uint32_t) {
+		inputs_ += inputs.size();
+	}
+
+	const WorldSnapshot& GetWorldSnapshot() {
+		WorldSnapshot& world = worldSnapshots_.Back();
+		world.Clear();
+		playersMutex_.lock();
+		int joined = 0;
+		for (size_t i = 0; i < players_.Size(); i++) {
+			if (players_.ValueAt(i) != JOINED) continue;
+			world.Add(players_.IDAt(i), (float)(joined % 32) * 2.0f, 1.0f, (float)(joined / 32) * 2.0f, 0, 0, 0, 0, 0);
+			joined++;
+		}
+		float rotation = (float)(snapshots_++ % 60) * 0.1f;
+		for (Bot& bot : bots_) {
+			world.Add(bot.id, bot.x, 1.0f, bot.z, 0, 0, 0, rotation, 0);
+		}
+		playersMutex_.unlock();
+		worldSnapshots_.Publish();
+		return worldSnapshots_.Latest();
+	}
+
+	// Inputs the ingress threads have handed over so far
+	uint64_t InputsReceived() { return inputs_; }
+
+	// Players given an ID, joined yet or not, without the bots
+	size_t Players() {
+		playersMutex_.lock();
+		size_t players = players_.Size() - bots_.size();
+		playersMutex_.unlock();
+		return players;
+	}
+
+	bool IsBot(int id) {
+		playersMutex_.lock();
+		const uint8_t* player = players_.Get(id);
+		bool bot = player && *player == BOT;
+		playersMutex_.unlock();
+		return bot;
+	}
+
+	// Add count bots in a square grid spacing apart, centred on the origin
+	void AddBots(int count, float spacing) {
+		playersMutex_.lock();
+		int side = (int)std::ceil(std::sqrt((float)count));
+		for (int i = 0; i < count; i++) {
+			int id = players_.Insert(BOT);
+			if (id < 0) break;
+			bots_.push_back({ id, ((i % side) - side / 2) * spacing, ((i / side) - side / 2) * spacing });
+		}
+		playersMutex_.unlock();
+	}
+
+private:
+	// What each of players_ is. A plain byte, as SlotMap<bool> would be a std::vector<bool> of bits.
+	enum : uint8_t { CONNECTED, JOINED, BOT };
+
+	struct Bot {
+		int id;
+		float x;
+		float z;
+	};
+
+	SlotMap<uint8_t> players_;
+	std::vector<Bot> bots_;
+	uint32_t snapshots_ = 0;
+	std::mutex playersMutex_;
+	TripleBuffer<WorldSnapshot> worldSnapshots_;
+	std::atomic<uint64_t> inputs_{ 0 };
+};